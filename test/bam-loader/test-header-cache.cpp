@@ -0,0 +1,276 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+/**
+* the parsed-header cache of bam-load: a matching cache file is loaded, any other is a cache miss
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/out.h>
+#include <klib/rc.h>
+#include <klib/namelist.h>
+#include <kfs/directory.h>
+
+#include <sysalloc.h>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+extern "C" {
+#include "../../tools/bam-loader/bam.h"
+}
+
+using namespace std;
+
+TEST_SUITE(HeaderCacheTestSuite);
+
+static const char * const HEADER =
+    "@HD\tVN:1.4\tSO:coordinate\n"
+    "@SQ\tSN:chr1\tLN:100000\n"
+    "@SQ\tSN:chr2\tLN:5000\n"
+    "@RG\tID:grp1\tSM:x\n"
+    "@RG\tID:grp2\tSM:y\tLB:lib2\n";
+
+static const char * const CACHE_DIR = "test-header-cache.dir";
+
+// the head of a cache file starts with magic[8], formatVersion, headSize, refSeqSize, readGroupSize
+enum { OFS_MAGIC = 0, OFS_VERSION = 8, OFS_HEAD_SIZE = 12, OFS_REFSEQ_SIZE = 16, OFS_READGROUP_SIZE = 20 };
+
+class CacheFixture
+{
+public:
+    CacheFixture() : dir(NULL), name("test-header-cache.sam")
+    {
+        if (KDirectoryNativeDir(&dir) != 0)
+            throw logic_error("CacheFixture: KDirectoryNativeDir failed");
+        KDirectoryRemove(dir, true, "%s", CACHE_DIR);
+        {
+            ofstream out(name.c_str(), ios::binary);
+            out << HEADER << "r1\t99\tchr1\t100\t60\t10M\t=\t200\t110\tACGTACGTAC\tIIIIIIIIII\tRG:Z:grp1\n";
+        }
+        BAM_SetHeaderCacheDir(CACHE_DIR);
+    }
+    ~CacheFixture()
+    {
+        BAM_SetHeaderCacheDir(NULL);
+        KDirectoryRemove(dir, true, "%s", CACHE_DIR);
+        KDirectoryRemove(dir, true, "%s", name.c_str());
+        KDirectoryRelease(dir);
+    }
+    // the references and read groups of the file, as "name:length ... name/sample/library ..."
+    string Open()
+    {
+        BAM_File const * bam = NULL;
+        if (BAM_FileMake(&bam, NULL, NULL, "%s", name.c_str()) != 0)
+            throw logic_error("CacheFixture: BAM_FileMake failed");
+        ostringstream res;
+        uint32_t count = 0;
+        BAM_FileGetRefSeqCount(bam, &count);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            BAMRefSeq const * rs = NULL;
+            if (BAM_FileGetRefSeq(bam, i, &rs) != 0)
+                throw logic_error("CacheFixture: BAM_FileGetRefSeq failed");
+            res << rs->name << ":" << rs->length << " ";
+        }
+        BAM_FileGetReadGroupCount(bam, &count);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            BAMReadGroup const * rg = NULL;
+            if (BAM_FileGetReadGroup(bam, i, &rg) != 0)
+                throw logic_error("CacheFixture: BAM_FileGetReadGroup failed");
+            res << rg->name << "/" << (rg->sample ? rg->sample : "") << "/" << (rg->library ? rg->library : "") << " ";
+        }
+        BAM_FileRelease(bam);
+        return res.str();
+    }
+    // the one file in the cache directory
+    string CacheFile()
+    {
+        KNamelist * list = NULL;
+        uint32_t count = 0;
+        const char * entry = NULL;
+        if (KDirectoryList(dir, &list, NULL, NULL, "%s", CACHE_DIR) != 0)
+            throw logic_error("CacheFixture: no cache directory");
+        KNamelistCount(list, &count);
+        if (count != 1 || KNamelistGet(list, 0, &entry) != 0)
+        {
+            KNamelistRelease(list);
+            throw logic_error("CacheFixture: not one cache file");
+        }
+        string res = string(CACHE_DIR) + "/" + entry;
+        KNamelistRelease(list);
+        return res;
+    }
+    string Read(const string & path)
+    {
+        ifstream in(path.c_str(), ios::binary);
+        ostringstream res;
+        res << in.rdbuf();
+        return res.str();
+    }
+    void Write(const string & path, const string & content)
+    {
+        ofstream out(path.c_str(), ios::binary | ios::trunc);
+        out << content;
+    }
+    // renames chr2 in the parsed copy at the end of the cache file: visible only if the file is loaded
+    string Marked(const string & content)
+    {
+        string res = content;
+        size_t pos = res.rfind("chr2");
+        if (pos == string::npos)
+            throw logic_error("CacheFixture: chr2 is not in the cache file");
+        res[pos + 3] = 'Z';
+        return res;
+    }
+    // a cache miss does not see the mark, it parses the header and stores it again
+    void RequireMiss(const string & content)
+    {
+        string const path = CacheFile();
+        string const stored = Read(path);
+        Write(path, content);
+        REQUIRE_EQ(Open(), string(PARSED));
+        REQUIRE_EQ(Read(path), stored);
+    }
+
+    KDirectory * dir;
+    string name;
+    static const char * const PARSED;
+};
+
+const char * const CacheFixture::PARSED = "chr1:100000 chr2:5000 grp1/x/ grp2/y/lib2 ";
+
+static void Poke32(string & s, size_t ofs, uint32_t value)
+{
+    for (size_t i = 0; i < 4; ++i)
+        s[ofs + i] = (char)(value >> (8 * i));
+}
+
+static uint32_t Peek32(const string & s, size_t ofs)
+{
+    uint32_t res = 0;
+    for (size_t i = 0; i < 4; ++i)
+        res |= (uint32_t)(uint8_t)s[ofs + i] << (8 * i);
+    return res;
+}
+
+FIXTURE_TEST_CASE(Cache_StoredAndLoaded, CacheFixture)
+{
+    BAM_SetHeaderCacheDir(NULL);
+    REQUIRE_EQ(Open(), string(PARSED));
+    BAM_SetHeaderCacheDir(CACHE_DIR);
+    REQUIRE_EQ(Open(), string(PARSED));
+
+    string const path = CacheFile();
+    Write(path, Marked(Read(path)));
+    REQUIRE_EQ(Open(), string("chr1:100000 chrZ:5000 grp1/x/ grp2/y/lib2 "));
+}
+
+FIXTURE_TEST_CASE(Cache_MissOnOtherMagic, CacheFixture)
+{
+    Open();
+    string content = Marked(Read(CacheFile()));
+    content[OFS_MAGIC] ^= 1;
+    RequireMiss(content);
+}
+
+FIXTURE_TEST_CASE(Cache_MissOnOtherVersion, CacheFixture)
+{
+    Open();
+    string content = Marked(Read(CacheFile()));
+    Poke32(content, OFS_VERSION, Peek32(content, OFS_VERSION) + 1);
+    RequireMiss(content);
+    Poke32(content, OFS_VERSION, Peek32(content, OFS_VERSION) - 2);
+    RequireMiss(content);
+}
+
+FIXTURE_TEST_CASE(Cache_MissOnOtherStructSizes, CacheFixture)
+{
+    Open();
+    string const marked = Marked(Read(CacheFile()));
+    size_t const ofs[] = { OFS_HEAD_SIZE, OFS_REFSEQ_SIZE, OFS_READGROUP_SIZE };
+    for (size_t i = 0; i < sizeof ofs / sizeof ofs[0]; ++i)
+    {
+        string content = marked;
+        Poke32(content, ofs[i], Peek32(content, ofs[i]) + 8);
+        RequireMiss(content);
+    }
+}
+
+FIXTURE_TEST_CASE(Cache_MissOnOtherFileSize, CacheFixture)
+{
+    Open();
+    string const marked = Marked(Read(CacheFile()));
+    RequireMiss(marked.substr(0, marked.size() - 8));
+    RequireMiss(marked + string(8, '\0'));
+    RequireMiss(marked.substr(0, 16));
+    RequireMiss(string());
+}
+
+FIXTURE_TEST_CASE(Cache_MissOnOtherHeaderText, CacheFixture)
+{
+    Open();
+    string content = Marked(Read(CacheFile()));
+    size_t pos = content.find("SM:x");
+    REQUIRE_NE(pos, string::npos);
+    content[pos + 3] = 'q';
+    RequireMiss(content);
+}
+
+//////////////////////////////////////////// Main
+#include <kapp/args.h>
+
+extern "C"
+{
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+
+const char UsageDefaultName[] = "test-header-cache";
+
+rc_t CC UsageSummary (const char * progname)
+{
+    return KOutMsg ( "Usage:\n" "\t%s [options]\n\n", progname );
+}
+
+rc_t CC Usage( const Args* args )
+{
+    return 0;
+}
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    rc_t rc = HeaderCacheTestSuite(argc, argv);
+    return rc;
+}
+
+}
@@ -0,0 +1,281 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+/**
+* the spot-name index of bam-load: the Robin Hood table, its doubling and the chunks of names
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/out.h>
+#include <klib/rc.h>
+
+#include <sysalloc.h>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+extern "C" {
+#include "../../tools/bam-loader/name-index.h"
+}
+
+using namespace std;
+
+TEST_SUITE(NameIndexTestSuite);
+
+// the scratch files are removed right after they are opened
+static char const SCRATCH[] = "test-name-index";
+
+static string SpotName(uint64_t i)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "SRR000001.%llu", (unsigned long long)i);
+    return buf;
+}
+
+// a name that fills most of the 64K a name may have, unique by its number
+static string LongName(uint64_t i)
+{
+    string res = SpotName(i) + ":";
+    res.resize(60000, (char)('a' + i % 26));
+    return res;
+}
+
+class NameIndexFixture
+{
+public:
+    NameIndexFixture() : index(NULL)
+    {
+        Make(0.0);
+    }
+    ~NameIndexFixture()
+    {
+        NameIndexWhack(index);
+    }
+
+    void Make(double load_factor)
+    {
+        NameIndexWhack(index);
+        index = NULL;
+        if (NameIndexMake(&index, SCRATCH, load_factor) != 0)
+            throw logic_error("NameIndexFixture: NameIndexMake failed");
+    }
+
+    // the id of name, it is inserted with newId if it is not in the index
+    uint64_t Entry(string const &name, uint64_t newId, bool &wasInserted)
+    {
+        uint64_t id = newId;
+        if (NameIndexEntry(index, &id, &wasInserted, name.data(), name.size()) != 0)
+            throw logic_error("NameIndexFixture: NameIndexEntry failed");
+        return id;
+    }
+
+    NameIndexStats Stats() const
+    {
+        NameIndexStats stats;
+        NameIndexGetStats(index, &stats);
+        return stats;
+    }
+
+    NameIndex *index;
+};
+
+FIXTURE_TEST_CASE(NameIndex_Empty, NameIndexFixture)
+{
+    NameIndexStats const stats = Stats();
+    REQUIRE_EQ(stats.count, (uint64_t)0);
+    REQUIRE_EQ(stats.capacity, (uint64_t)1 << 16);
+    REQUIRE_EQ(stats.lookups, (uint64_t)0);
+    REQUIRE_EQ(stats.grown, 0u);
+
+    // a missing index has no stats
+    NameIndexStats none;
+    NameIndexGetStats(NULL, &none);
+    REQUIRE_EQ(none.count, (uint64_t)0);
+    REQUIRE_EQ(none.capacity, (uint64_t)0);
+}
+
+FIXTURE_TEST_CASE(NameIndex_InsertAndFind_AcrossDoublings, NameIndexFixture)
+{
+    // 64K slots filled to 3/4 before each doubling: 64K -> 128K -> 256K -> 512K
+    uint64_t const N = 300000;
+    bool wasInserted = false;
+    for (uint64_t i = 0; i < N; ++i) {
+        REQUIRE_EQ(Entry(SpotName(i), i + 1, wasInserted), i + 1);
+        REQUIRE(wasInserted);
+    }
+    NameIndexStats stats = Stats();
+    REQUIRE_EQ(stats.count, N);
+    REQUIRE_EQ(stats.capacity, (uint64_t)1 << 19);
+    REQUIRE_EQ(stats.grown, 3u);
+
+    // every name survived the moves into the bigger tables
+    for (uint64_t i = 0; i < N; ++i) {
+        REQUIRE_EQ(Entry(SpotName(i), 0, wasInserted), i + 1);
+        REQUIRE(!wasInserted);
+    }
+    // an unknown name is still not found
+    REQUIRE_EQ(Entry(SpotName(N), N + 1, wasInserted), N + 1);
+    REQUIRE(wasInserted);
+}
+
+FIXTURE_TEST_CASE(NameIndex_LoadFactor, NameIndexFixture)
+{
+    Make(0.5);
+    bool wasInserted = false;
+    for (uint64_t i = 0; i < ((uint64_t)1 << 15); ++i)
+        Entry(SpotName(i), i, wasInserted);
+    REQUIRE_EQ(Stats().grown, 0u);
+    // the table is doubled with the first name above half of it
+    Entry(SpotName((uint64_t)1 << 15), 0, wasInserted);
+    REQUIRE_EQ(Stats().grown, 1u);
+    REQUIRE_EQ(Stats().capacity, (uint64_t)1 << 17);
+}
+
+FIXTURE_TEST_CASE(NameIndex_Duplicate_KeepsFirstId, NameIndexFixture)
+{
+    bool wasInserted = false;
+    REQUIRE_EQ(Entry("spot1", 7, wasInserted), (uint64_t)7);
+    REQUIRE(wasInserted);
+    REQUIRE_EQ(Entry("spot1", 9, wasInserted), (uint64_t)7);
+    REQUIRE(!wasInserted);
+    // a prefix or an extension of a name is another name
+    REQUIRE_EQ(Entry("spot", 11, wasInserted), (uint64_t)11);
+    REQUIRE(wasInserted);
+    REQUIRE_EQ(Entry("spot10", 12, wasInserted), (uint64_t)12);
+    REQUIRE(wasInserted);
+    // so is the empty name
+    REQUIRE_EQ(Entry("", 13, wasInserted), (uint64_t)13);
+    REQUIRE(wasInserted);
+    REQUIRE_EQ(Entry("", 14, wasInserted), (uint64_t)13);
+    REQUIRE(!wasInserted);
+    REQUIRE_EQ(Stats().count, (uint64_t)4);
+}
+
+FIXTURE_TEST_CASE(NameIndex_LongNames_AcrossChunks, NameIndexFixture)
+{
+    // about 280 of them fit into a chunk of 16MB, names never straddle two chunks
+    uint64_t const N = 800;
+    bool wasInserted = false;
+    for (uint64_t i = 0; i < N; ++i) {
+        REQUIRE_EQ(Entry(LongName(i), i, wasInserted), i);
+        REQUIRE(wasInserted);
+    }
+    NameIndexStats const stats = Stats();
+    REQUIRE_EQ(stats.count, N);
+    // the names are in the third chunk by now
+    REQUIRE_GE(stats.bytes, stats.capacity * 16 + ((uint64_t)2 << 24));
+    for (uint64_t i = 0; i < N; ++i) {
+        REQUIRE_EQ(Entry(LongName(i), N + i, wasInserted), i);
+        REQUIRE(!wasInserted);
+    }
+    // the longest name there may be
+    string const longest(0xFFFF, 'x');
+    REQUIRE_EQ(Entry(longest, 1, wasInserted), (uint64_t)1);
+    REQUIRE(wasInserted);
+    REQUIRE_EQ(Entry(longest, 2, wasInserted), (uint64_t)1);
+    REQUIRE(!wasInserted);
+}
+
+FIXTURE_TEST_CASE(NameIndex_Stats, NameIndexFixture)
+{
+    bool wasInserted = false;
+    uint64_t i;
+    for (i = 0; i < 1000; ++i)
+        Entry(SpotName(i), i, wasInserted);
+    for (i = 0; i < 500; ++i)
+        Entry(SpotName(i), i, wasInserted);
+
+    NameIndexStats const stats = Stats();
+    REQUIRE_EQ(stats.count, (uint64_t)1000);
+    REQUIRE_EQ(stats.lookups, (uint64_t)1500);
+    REQUIRE_GE(stats.probes, stats.lookups);
+    REQUIRE_EQ(stats.grown, 0u);
+
+    // the slots of 16 bytes and the names, each one behind its length of 2 bytes, from offset 2 on
+    uint64_t names = 2;
+    for (i = 0; i < 1000; ++i)
+        names += SpotName(i).size() + 2;
+    REQUIRE_EQ(stats.bytes, stats.capacity * 16 + names);
+}
+
+FIXTURE_TEST_CASE(NameIndex_Errors, NameIndexFixture)
+{
+    bool wasInserted = true;
+    uint64_t id;
+
+    // ids are stored in 32 bits
+    id = (uint64_t)UINT32_MAX + 1;
+    REQUIRE_RC_FAIL(NameIndexEntry(index, &id, &wasInserted, "spot1", 5));
+    // names have a length of 16 bits
+    string const tooLong(0x10000, 'x');
+    id = 1;
+    REQUIRE_RC_FAIL(NameIndexEntry(index, &id, &wasInserted, tooLong.data(), tooLong.size()));
+    REQUIRE_EQ(Stats().count, (uint64_t)0);
+
+    // neither one was inserted
+    id = UINT32_MAX;
+    REQUIRE_RC(NameIndexEntry(index, &id, &wasInserted, "spot1", 5));
+    REQUIRE(wasInserted);
+    REQUIRE_EQ(id, (uint64_t)UINT32_MAX);
+    // a known name is found whatever the new id would have been
+    id = (uint64_t)UINT32_MAX + 1;
+    REQUIRE_RC(NameIndexEntry(index, &id, &wasInserted, "spot1", 5));
+    REQUIRE(!wasInserted);
+    REQUIRE_EQ(id, (uint64_t)UINT32_MAX);
+}
+
+//////////////////////////////////////////// Main
+#include <kapp/args.h>
+
+extern "C"
+{
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+
+const char UsageDefaultName[] = "test-name-index";
+
+rc_t CC UsageSummary (const char * progname)
+{
+    return KOutMsg ( "Usage:\n" "\t%s [options]\n\n", progname );
+}
+
+rc_t CC Usage( const Args* args )
+{
+    return 0;
+}
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    rc_t rc = NameIndexTestSuite(argc, argv);
+    return rc;
+}
+
+}
@@ -0,0 +1,218 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+/**
+* equivalence tests for the vectorized read kernels of bam-load
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/out.h>
+
+#include <sysalloc.h>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include "../../tools/bam-loader/read-kernels.h"
+}
+
+using namespace std;
+
+TEST_SUITE(ReadKernelsTestSuite);
+
+static unsigned const MaxLen = 300;
+static unsigned const Rounds = 20000;
+
+// lengths around the vector width and random ones
+static unsigned Length(unsigned round)
+{
+    return round < 64 ? round : rand() % MaxLen;
+}
+
+// output buffers are padded to catch writes past len
+class KernelFixture
+{
+public:
+    KernelFixture() : src(MaxLen), vec(MaxLen + 16), ref(MaxLen + 16)
+    {
+        srand(12345);
+    }
+    void Clear()
+    {
+        memset(&vec[0], 0xAA, vec.size());
+        memset(&ref[0], 0xAA, ref.size());
+    }
+    bool Same() const
+    {
+        return memcmp(&vec[0], &ref[0], vec.size()) == 0;
+    }
+    vector<uint8_t> src;
+    vector<uint8_t> vec;
+    vector<uint8_t> ref;
+};
+
+FIXTURE_TEST_CASE(CopyQuality_Equivalence, KernelFixture)
+{
+    for (unsigned round = 0; round != Rounds; ++round) {
+        unsigned const len = Length(round);
+        bool const reverse = (round & 1) != 0;
+
+        for (unsigned i = 0; i != len; ++i)
+            src[i] = rand();
+        Clear();
+        CopyQuality(&vec[0], &src[0], len, reverse);
+        CopyQualityScalar(&ref[0], &src[0], len, reverse);
+        REQUIRE(Same());
+    }
+}
+
+FIXTURE_TEST_CASE(CopyRead_Equivalence, KernelFixture)
+{
+    static char const bases[] = "ACGTNacgtn";
+
+    for (unsigned round = 0; round != Rounds; ++round) {
+        unsigned const len = Length(round);
+        bool const reverse = (round & 1) != 0;
+        unsigned const kind = (round >> 1) % 3;
+
+        for (unsigned i = 0; i != len; ++i) {
+            if (kind == 0)
+                src[i] = bases[rand() % 10];
+            else if (kind == 1)
+                src[i] = rand();
+            else // mostly plain bases, the odd IUPAC code or garbage
+                src[i] = rand() % 64 ? bases[rand() % 5] : rand();
+        }
+        Clear();
+        CopyRead((char *)&vec[0], (char const *)&src[0], len, reverse);
+        CopyReadScalar((char *)&ref[0], (char const *)&src[0], len, reverse);
+        REQUIRE(Same());
+    }
+}
+
+TEST_CASE(CopyRead_Complement)
+{
+    char const src[] = "ACGTNacgtnRYKMSWBDHV.0123ACGTACGTACGTACGT";
+    char const expect[] = "ACGTACGTACGTACGT3210.BDHVWSKMRYNACGTNACGT";
+    unsigned const len = sizeof(src) - 1;
+    char dst[sizeof(src)] = { 0 };
+
+    CopyRead(dst, src, len, true);
+    REQUIRE_EQ(string(dst, len), string(expect, len));
+}
+
+FIXTURE_TEST_CASE(OffsetQuality_Equivalence, KernelFixture)
+{
+    for (unsigned round = 0; round != Rounds; ++round) {
+        unsigned const len = Length(round);
+        uint8_t const offset = round < 64 ? 33 : rand();
+
+        for (unsigned i = 0; i != len; ++i)
+            src[i] = rand();
+        Clear();
+        OffsetQuality(&vec[0], &src[0], len, offset);
+        OffsetQualityScalar(&ref[0], &src[0], len, offset);
+        REQUIRE(Same());
+    }
+}
+
+FIXTURE_TEST_CASE(QuantizeQuality_Equivalence, KernelFixture)
+{
+    for (unsigned round = 0; round != Rounds; ++round) {
+        unsigned const len = Length(round);
+        unsigned const changes = 1 + rand() % (2 * QUALITY_BINS_MAX_RUNS);
+        uint8_t lookup[256];
+        uint8_t value = rand();
+        QualityBins bins;
+
+        // some tables have too many runs and use the lookup
+        for (unsigned i = 0; i != 256; ++i) {
+            if ((unsigned)(rand() % 256) < changes)
+                value = rand();
+            lookup[i] = value;
+        }
+        QualityBinsMake(&bins, lookup);
+        for (unsigned i = 0; i != len; ++i)
+            src[i] = rand();
+        Clear();
+        QuantizeQuality(&vec[0], &src[0], len, &bins);
+        QuantizeQualityScalar(&ref[0], &src[0], len, &bins);
+        REQUIRE(Same());
+    }
+}
+
+TEST_CASE(QualityBins_QualQuant1)
+{
+    uint8_t lookup[256];
+    QualityBins bins;
+
+    for (unsigned i = 0; i != 256; ++i)
+        lookup[i] = i < 10 ? 1 : i < 20 ? 10 : i < 30 ? 20 : 30;
+    QualityBinsMake(&bins, lookup);
+    REQUIRE_EQ(bins.runs, 4u);
+    REQUIRE_EQ((unsigned)bins.start[3], 30u);
+    REQUIRE_EQ((unsigned)bins.value[3], 30u);
+
+    uint8_t const src[] = { 0, 9, 10, 19, 20, 29, 30, 41, 255, 0, 1, 2, 3, 4, 5, 6, 7, 8 };
+    uint8_t const expect[] = { 1, 1, 10, 10, 20, 20, 30, 30, 30, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+    uint8_t dst[sizeof(src)];
+
+    QuantizeQuality(dst, src, sizeof(src), &bins);
+    REQUIRE_EQ(memcmp(dst, expect, sizeof(src)), 0);
+}
+
+//////////////////////////////////////////// Main
+#include <kapp/args.h>
+
+extern "C"
+{
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+
+const char UsageDefaultName[] = "test-read-kernels";
+
+rc_t CC UsageSummary (const char * progname)
+{
+    return KOutMsg ( "Usage:\n" "\t%s [options]\n\n", progname );
+}
+
+rc_t CC Usage( const Args* args )
+{
+    return 0;
+}
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    rc_t rc = ReadKernelsTestSuite(argc, argv);
+    return rc;
+}
+
+}
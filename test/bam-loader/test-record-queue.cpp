@@ -0,0 +1,296 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+/**
+* hand-over of the bam-load records from the reader threads to the main thread
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/out.h>
+#include <klib/rc.h>
+#include <atomic32.h>
+
+#include <sysalloc.h>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+extern "C" {
+#include "../../tools/bam-loader/record-queue.h"
+}
+
+using namespace std;
+
+TEST_SUITE(RecordQueueTestSuite);
+
+static rc_t const ReadError = RC(rcExe, rcFile, rcReading, rcData, rcCorrupt);
+static rc_t const PrepareError = RC(rcExe, rcData, rcProcessing, rcData, rcExcessive);
+static rc_t const ConsumerError = RC(rcExe, rcData, rcWriting, rcData, rcInvalid);
+
+static atomic32_t live; // records read but not released yet
+
+// an input of numbered records
+struct Source
+{
+    Source() : total(0), failAt(0), failPrepareAt(0), next(0), blocks(0), prepared(0), before(NULL), outOfOrder(false)
+    {
+        memset(&queue, 0, sizeof(queue));
+    }
+
+    RecordQueue queue;
+    unsigned total;         // records before the end, 0: endless
+    unsigned failAt;        // reading this record fails, 0: never
+    unsigned failPrepareAt; // preparing this block fails ( 1-based ), 0: never
+    unsigned next;
+    unsigned blocks;        // prepared by the reader
+    unsigned prepared;      // records prepared by the reader
+    Source *before;         // the input that has to be prepared first
+    bool outOfOrder;
+};
+
+static rc_t CC Read(void *data, void **rec)
+{
+    Source *const self = static_cast<Source *>(data);
+    if (self->failAt != 0 && self->next == self->failAt)
+        return ReadError;
+    if (self->total != 0 && self->next == self->total)
+        return RC(rcAlign, rcFile, rcReading, rcRow, rcNotFound);
+
+    unsigned *const r = static_cast<unsigned *>(malloc(sizeof(*r)));
+    *r = self->next++;
+    atomic32_inc(&live);
+    *rec = r;
+    return 0;
+}
+
+static rc_t CC Prepare(void *data, RecordBlock *block)
+{
+    Source *const self = static_cast<Source *>(data);
+    if (self->before != NULL && self->before->prepared != self->before->total)
+        self->outOfOrder = true;
+    if (++self->blocks == self->failPrepareAt)
+        return PrepareError;
+    self->prepared += block->count;
+    return 0;
+}
+
+static void CC Release(void *rec)
+{
+    atomic32_dec(&live);
+    free(rec);
+}
+
+class RecordQueueFixture
+{
+public:
+    RecordQueueFixture()
+    {
+        atomic32_set(&live, 0);
+        if (RecordTurnInit(&turn) != 0)
+            throw logic_error("RecordTurnInit failed");
+    }
+    ~RecordQueueFixture()
+    {
+        RecordTurnWhack(&turn);
+    }
+    void Start(Source &input, unsigned order)
+    {
+        RecordSource src;
+        src.read = Read;
+        src.prepare = Prepare;
+        src.release = Release;
+        src.data = &input;
+        if (RecordQueueStart(&input.queue, &turn, order, &src, "test") != 0)
+            throw logic_error("RecordQueueStart failed");
+    }
+    // takes the records until NULL or stop of them, returns how many there were in order
+    unsigned Consume(Source &input, rc_t &rc, unsigned stop = 0)
+    {
+        unsigned n = 0;
+        void *rec;
+        while ((stop == 0 || n < stop) && (rec = RecordQueueNext(&input.queue, &rc)) != NULL) {
+            if (*static_cast<unsigned *>(rec) != n)
+                throw logic_error("record out of order");
+            Release(rec);
+            ++n;
+        }
+        return n;
+    }
+
+    RecordTurn turn;
+};
+
+static bool IsEnd(rc_t rc)
+{
+    return (int)GetRCObject(rc) == rcData && (int)GetRCState(rc) == rcDone;
+}
+
+FIXTURE_TEST_CASE(AllRecordsInOrder, RecordQueueFixture)
+{
+    Source input;
+    input.total = 3 * RECORD_QUEUE_BLOCK_SIZE + 5;
+    Start(input, 0);
+
+    rc_t rc = 0;
+    REQUIRE_EQ(Consume(input, rc), input.total);
+    REQUIRE(IsEnd(rc));
+    REQUIRE_RC(RecordQueueWhack(&input.queue));
+    REQUIRE_EQ(atomic32_read(&live), 0);
+}
+
+FIXTURE_TEST_CASE(ReaderFailsPartway, RecordQueueFixture)
+{
+    Source input;
+    input.failAt = 2 * RECORD_QUEUE_BLOCK_SIZE + 100;
+    Start(input, 0);
+
+    rc_t rc = 0;
+    // the records read before the error are delivered, then the error
+    REQUIRE_EQ(Consume(input, rc), input.failAt);
+    REQUIRE_EQ(rc, ReadError);
+    // an error stays an error
+    REQUIRE(RecordQueueNext(&input.queue, &rc) == NULL);
+    REQUIRE_EQ(rc, ReadError);
+    RecordQueueWhack(&input.queue);
+    REQUIRE_EQ(atomic32_read(&live), 0);
+}
+
+FIXTURE_TEST_CASE(PrepareFailsPartway, RecordQueueFixture)
+{
+    Source input;
+    input.total = 4 * RECORD_QUEUE_BLOCK_SIZE;
+    input.failPrepareAt = 2;
+    Start(input, 0);
+
+    rc_t rc = 0;
+    REQUIRE_EQ(Consume(input, rc), RECORD_QUEUE_BLOCK_SIZE);
+    REQUIRE_EQ(rc, PrepareError);
+    RecordQueueWhack(&input.queue);
+    REQUIRE_EQ(atomic32_read(&live), 0);
+}
+
+FIXTURE_TEST_CASE(ConsumerErrorStopsReader, RecordQueueFixture)
+{
+    Source input; // endless: the reader has to be stopped
+    Start(input, 0);
+
+    rc_t rc = 0;
+    REQUIRE_EQ(Consume(input, rc, 100), 100u);
+    REQUIRE_RC(rc);
+
+    // the caller's error is neither handed a record nor overwritten
+    rc = ConsumerError;
+    REQUIRE(RecordQueueNext(&input.queue, &rc) == NULL);
+    REQUIRE_EQ(rc, ConsumerError);
+    REQUIRE(input.queue.done);
+    RecordQueueWhack(&input.queue);
+    REQUIRE_EQ(atomic32_read(&live), 0);
+}
+
+FIXTURE_TEST_CASE(AbandonedBeforeTheEnd, RecordQueueFixture)
+{
+    Source input;
+    input.total = 10 * RECORD_QUEUE_BLOCK_SIZE;
+    Start(input, 0);
+
+    rc_t rc = 0;
+    REQUIRE_EQ(Consume(input, rc, 3000), 3000u);
+    RecordQueueWhack(&input.queue);
+    REQUIRE_EQ(atomic32_read(&live), 0);
+}
+
+FIXTURE_TEST_CASE(InputsInOrder, RecordQueueFixture)
+{
+    Source first;
+    Source second;
+    first.total = 5 * RECORD_QUEUE_BLOCK_SIZE + 7;
+    second.total = 3 * RECORD_QUEUE_BLOCK_SIZE + 1;
+    second.before = &first;
+    Start(first, 0);
+    Start(second, 1);
+
+    rc_t rc = 0;
+    REQUIRE_EQ(Consume(first, rc), first.total);
+    REQUIRE(IsEnd(rc));
+    REQUIRE_RC(RecordQueueWhack(&first.queue));
+
+    rc = 0;
+    REQUIRE_EQ(Consume(second, rc), second.total);
+    REQUIRE(IsEnd(rc));
+    REQUIRE_RC(RecordQueueWhack(&second.queue));
+    REQUIRE(!second.outOfOrder);
+    REQUIRE_EQ(atomic32_read(&live), 0);
+}
+
+FIXTURE_TEST_CASE(FailedInputReleasesTheNext, RecordQueueFixture)
+{
+    Source first;
+    Source second;
+    first.failAt = 10;
+    second.total = 2 * RECORD_QUEUE_BLOCK_SIZE;
+    Start(first, 0);
+    Start(second, 1);
+
+    rc_t rc = 0;
+    REQUIRE_EQ(Consume(first, rc), 10u);
+    REQUIRE_EQ(rc, ReadError);
+    RecordQueueWhack(&first.queue);
+    // the load gives up: the second input has to stop although it is waiting for its turn
+    RecordQueueWhack(&second.queue);
+    REQUIRE_EQ(atomic32_read(&live), 0);
+}
+
+//////////////////////////////////////////// Main
+#include <kapp/args.h>
+
+extern "C"
+{
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+
+const char UsageDefaultName[] = "test-record-queue";
+
+rc_t CC UsageSummary (const char * progname)
+{
+    return KOutMsg ( "Usage:\n" "\t%s [options]\n\n", progname );
+}
+
+rc_t CC Usage( const Args* args )
+{
+    return 0;
+}
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    rc_t rc = RecordQueueTestSuite(argc, argv);
+    return rc;
+}
+
+}
@@ -0,0 +1,280 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+/**
+* the SAM-parser of bam-load: records it read the same as the earlier parser, malformed records it rejected
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/out.h>
+#include <klib/rc.h>
+#include <kfs/directory.h>
+
+#include <sysalloc.h>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "../../tools/bam-loader/bam.h"
+}
+
+using namespace std;
+
+TEST_SUITE(SamParserTestSuite);
+
+static const char * const HEADER =
+    "@HD\tVN:1.4\tSO:coordinate\n"
+    "@SQ\tSN:chr1\tLN:100000\n"
+    "@SQ\tSN:chr2\tLN:5000\n"
+    "@RG\tID:grp1\tSM:x\n";
+
+static const string GOOD_1 = "r1\t99\tchr1\t100\t60\t10M\t=\t200\t110\tACGTACGTAC\tIIIIIIIIII\tRG:Z:grp1\tNM:i:0";
+static const string GOOD_2 = "r3\t4\t*\t0\t0\t*\t*\t0\t0\tACGTN\t*";
+
+// writes the records behind the header into a file, reads them back with BAM_FileRead2
+// and formats each one as SAM again
+class SamFixture
+{
+public:
+    SamFixture() : dir(NULL), name("test-sam-parser.tmp"), rc(0)
+    {
+        if (KDirectoryNativeDir(&dir) != 0)
+            throw logic_error("SamFixture: KDirectoryNativeDir failed");
+    }
+    ~SamFixture()
+    {
+        KDirectoryRemove(dir, true, "%s", name.c_str());
+        KDirectoryRelease(dir);
+    }
+    // the formatted records, rc is 0 if the end of the file was reached, else the error that stopped the reading
+    vector<string> Parse(const string & records)
+    {
+        vector<string> res;
+        {
+            ofstream out(name.c_str(), ios::binary);
+            out << HEADER << records;
+        }
+        BAM_File const * bam = NULL;
+        rc = BAM_FileMake(&bam, NULL, NULL, "%s", name.c_str());
+        if (rc != 0)
+            throw logic_error("SamFixture: BAM_FileMake failed");
+        for ( ; ; )
+        {
+            BAM_Alignment const * rec = NULL;
+            rc = BAM_FileRead2(bam, &rec);
+            if (rc == 0)
+            {
+                char buf[4096];
+                size_t len = 0;
+                if (BAM_AlignmentFormatSAM(rec, &len, sizeof buf, buf) != 0)
+                    throw logic_error("SamFixture: BAM_AlignmentFormatSAM failed");
+                if (len > 0 && buf[len - 1] == '\n')
+                    --len;
+                res.push_back(string(buf, len));
+                BAM_AlignmentRelease(rec);
+            }
+            else if (GetRCObject(rc) == rcRow && GetRCState(rc) == rcEmpty)
+            {
+                // like bam-load, skip records without name and data
+                BAM_AlignmentRelease(rec);
+                res.push_back("<empty>");
+            }
+            else
+                break;
+        }
+        if (GetRCObject(rc) == rcRow && GetRCState(rc) == rcNotFound)
+            rc = 0;
+        BAM_FileRelease(bam);
+        return res;
+    }
+    // a malformed record between two good ones: the first one is read, then the reading stops
+    bool Rejects(const string & record)
+    {
+        vector<string> recs = Parse(GOOD_1 + "\n" + record + "\n" + GOOD_2 + "\n");
+        return rc != 0 && recs.size() == 1 && recs[0] == GOOD_1;
+    }
+
+    KDirectory * dir;
+    string name;
+    rc_t rc;
+};
+
+FIXTURE_TEST_CASE(SamParser_Representative, SamFixture)
+{
+    static const char * const records[] = {
+        "r1\t99\tchr1\t100\t60\t10M\t=\t200\t110\tACGTACGTAC\tIIIIIIIIII\tRG:Z:grp1\tNM:i:0",
+        "r1\t147\tchr1\t200\t60\t10M\t=\t100\t-110\tGTACGTACGT\t#########!\tRG:Z:grp1",
+        "r2:with:colons\t81\tchr1\t300\t30\t5M2I3M\tchr2\t50\t0\tACGTNACGTA\t*",
+        "r3\t4\t*\t0\t0\t*\t*\t0\t0\tACGTN\t*",
+        "r4\t256\tchr2\t1\t255\t3S5M1D2N4M1P1=1X2H\t*\t0\t0\t*\t*",
+        "r5\t0\tchr2\t10\t0\t14M\t*\t0\t0\tACGTRYKMSWBDHV\t~~~~~~~~~~~~~~",
+        "r6\t0\tchr2\t20\t7\t4M\t*\t0\t0\tA=CN\t5555\tXA:A:q\tXI:i:-2147483648\tXZ:Z:a b:c\tXH:H:1AE301\tZZ:Z:",
+        "r7\t1\tchr1\t1\t0\t2M\t*\t0\t0\tAC\t!!\tXs:i:0\tXt:i:255\tXu:i:256\tXv:i:-129\tXw:i:65536\tXx:i:-32769",
+        NULL };
+    string text;
+    for (size_t i = 0; records[i] != NULL; ++i)
+        text += string(records[i]) + "\n";
+    vector<string> recs = Parse(text);
+    REQUIRE_RC(rc);
+    REQUIRE_EQ(recs.size(), (size_t)8);
+    for (size_t i = 0; records[i] != NULL; ++i)
+        REQUIRE_EQ(recs[i], string(records[i]));
+}
+
+FIXTURE_TEST_CASE(SamParser_LongRead, SamFixture)
+{
+    string seq, qual;
+    for (int i = 0; i < 300; ++i)
+    {
+        seq += "ACGT"[i % 4];
+        qual += (char)(33 + i % 60);
+    }
+    string record = "r1\t16\tchr1\t99999\t1\t300M\t*\t0\t0\t" + seq + "\t" + qual;
+    vector<string> recs = Parse(record + "\n");
+    REQUIRE_RC(rc);
+    REQUIRE_EQ(recs.size(), (size_t)1);
+    REQUIRE_EQ(recs[0], record);
+}
+
+FIXTURE_TEST_CASE(SamParser_Normalized, SamFixture)
+{
+    // bases in upper case, floats without exponent, integer arrays as 'i'
+    vector<string> recs = Parse(
+        "r1\t0\tchr2\t10\t0\t4M\t*\t0\t0\tacgt\t*\tXF:f:-1.5e3\n"
+        "r2\t0\tchr2\t10\t0\t4M\t*\t0\t0\tACGT\t*\tXS:B:S,0,65535\tXf:B:f,1.5,-0.25\tXi:B:i,7\n");
+    REQUIRE_RC(rc);
+    REQUIRE_EQ(recs.size(), (size_t)2);
+    REQUIRE_EQ(recs[0], string("r1\t0\tchr2\t10\t0\t4M\t*\t0\t0\tACGT\t*\tXF:f:-1500"));
+    REQUIRE_EQ(recs[1], string("r2\t0\tchr2\t10\t0\t4M\t*\t0\t0\tACGT\t*\tXS:B:i,0,65535\tXf:B:f,1.5,-0.25\tXi:B:i,7"));
+}
+
+FIXTURE_TEST_CASE(SamParser_Arrays, SamFixture)
+{
+    // the earlier parser wrote the first value over the end of the field,
+    // it read arrays only if that value was 0 or the only one
+    vector<string> recs = Parse(
+        "r1\t0\tchr2\t10\t0\t4M\t*\t0\t0\tACGT\t*\tXB:B:c,-1,2,-128\tXS:B:S,1,2,65535\tXi:B:i,-7,7\tXf:B:f,0.5,3\n");
+    REQUIRE_RC(rc);
+    REQUIRE_EQ(recs.size(), (size_t)1);
+    REQUIRE_EQ(recs[0], string("r1\t0\tchr2\t10\t0\t4M\t*\t0\t0\tACGT\t*\tXB:B:i,-1,2,-128\tXS:B:i,1,2,65535\tXi:B:i,-7,7\tXf:B:f,0.5,3"));
+}
+
+FIXTURE_TEST_CASE(SamParser_EmptyRecord, SamFixture)
+{
+    vector<string> recs = Parse(GOOD_1 + "\n\t0\tchr1\t5\t0\t1M\t*\t0\t0\tA\t*\n" + GOOD_2 + "\n");
+    REQUIRE_RC(rc);
+    REQUIRE_EQ(recs.size(), (size_t)3);
+    REQUIRE_EQ(recs[1], string("<empty>"));
+    REQUIRE_EQ(recs[2], GOOD_2);
+}
+
+FIXTURE_TEST_CASE(SamParser_Malformed, SamFixture)
+{
+    static const char * const records[] = {
+        "b\t0\tchr1\tx5\t0\t1M\t*\t0\t0\tA\tI",             // POS not a number
+        "b\t0\tchr1\t5\t256\t1M\t*\t0\t0\tA\tI",            // MAPQ too big
+        "b\t0\tchr1\t5\t0\t1Y\t*\t0\t0\tA\tI",              // CIGAR operation
+        "b\t0\tchr1\t5\t0\tM\t*\t0\t0\tA\tI",               // CIGAR without length
+        "b\t0\tchr1\t5\t0\t1M2\t*\t0\t0\tA\tI",             // CIGAR without operation
+        "b\t0\tchr1\t5\t0\t2M\t*\t0\t0\tA!\tII",            // SEQ character
+        "b\t0\tchr1\t5\t0\t2M\t*\t0\t0\tAC\tI",             // QUAL length
+        "b\t0\tchr1\t5\t0\t2M\t*\t0\t0\tAC\tI\x1f",         // QUAL below '!'
+        "b\t0\tchr1\t5\t0\t1M\t*\t0\t0\tA",                 // too few fields
+        "b\t0\tchr9\t5\t0\t1M\t*\t0\t0\tA\tI",              // RNAME not in the header
+        "b\t0\tchr1\t5\t0\t1M\tchr9\t5\t0\tA\tI",           // RNEXT not in the header
+        "b\t0\tchr1\t5\t0\t1M\t*\t0\tt\tA\tI",              // TLEN not a number
+        "b\t0\tchr1\t5\t0\t1M\t*\t0\t0\tA\tI\tNM:i",        // tag without value
+        "b\t0\tchr1\t5\t0\t1M\t*\t0\t0\tA\tI\tNM:i:x1",     // integer tag not a number
+        "b\t0\tchr1\t5\t0\t1M\t*\t0\t0\tA\tI\tNM:q:1",      // tag type
+        "b\t0\tchr1\t5\t0\t1M\t*\t0\t0\tA\tI\tXB:B:q,1",    // array type
+        "b\t0\tchr1\t5\t0\t1M\t*\t0\t0\tA\tI\tXB:B:i,1,x",  // array value
+        "",                                                 // empty line
+        NULL };
+    for (size_t i = 0; records[i] != NULL; ++i)
+    {
+        if (!Rejects(records[i]))
+            FAIL((string("accepted: ") + records[i]).c_str());
+    }
+}
+
+FIXTURE_TEST_CASE(SamParser_PositionOverflow, SamFixture)
+{
+    // the earlier parser wrapped around to 1215752191
+    REQUIRE(Rejects("b\t0\tchr1\t99999999999\t0\t1M\t*\t0\t0\tA\tI"));
+}
+
+FIXTURE_TEST_CASE(SamParser_PlusSign, SamFixture)
+{
+    // rejected by the earlier parser
+    vector<string> recs = Parse("b\t+0\tchr1\t+5\t0\t1M\t*\t0\t+0\tA\tI\tNM:i:+3\n");
+    REQUIRE_RC(rc);
+    REQUIRE_EQ(recs.size(), (size_t)1);
+    REQUIRE_EQ(recs[0], string("b\t0\tchr1\t5\t0\t1M\t*\t0\t0\tA\tI\tNM:i:3"));
+}
+
+FIXTURE_TEST_CASE(SamParser_NoFinalNewline, SamFixture)
+{
+    // rejected by the earlier parser
+    vector<string> recs = Parse(GOOD_1 + "\n" + GOOD_2);
+    REQUIRE_RC(rc);
+    REQUIRE_EQ(recs.size(), (size_t)2);
+    REQUIRE_EQ(recs[1], GOOD_2);
+}
+
+//////////////////////////////////////////// Main
+#include <kapp/args.h>
+
+extern "C"
+{
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+
+const char UsageDefaultName[] = "test-sam-parser";
+
+rc_t CC UsageSummary (const char * progname)
+{
+    return KOutMsg ( "Usage:\n" "\t%s [options]\n\n", progname );
+}
+
+rc_t CC Usage( const Args* args )
+{
+    return 0;
+}
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    rc_t rc = SamParserTestSuite(argc, argv);
+    return rc;
+}
+
+}
@@ -0,0 +1,220 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+/**
+* the 4na pack/unpack-kernels of fastdump ( tools/fastdump/simd_4na.c ) against a plain
+* byte-at-a-time loop, for all simd-levels the cpu supports
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/out.h>
+#include <klib/rc.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "simd_4na.h"
+
+using namespace std;
+
+TEST_SUITE(Simd4naTestSuite);
+
+static const char x4na_to_ASCII[ 16 ] =
+{
+    'N', 'A', 'C', 'N', 'G', 'N', 'N', 'N', 'T', 'N', 'N', 'N', 'N', 'N', 'N', 'N'
+};
+
+/* the reference: the loops of pack_4na() / unpack_4na() before they used the kernels */
+static void ref_pack( const uint8_t * src, uint8_t * dst, size_t n_packed )
+{
+    for ( size_t i = 0; i < 2 * n_packed; ++i )
+    {
+        uint8_t base = ( src[ i ] & 0x0F );
+        if ( 0 == ( i & 0x01 ) )
+            dst[ i >> 1 ] = ( base << 4 );
+        else
+            dst[ i >> 1 ] |= base;
+    }
+}
+
+static void ref_unpack( const uint8_t * src, char * dst, size_t n_packed )
+{
+    for ( size_t i = 0; i < n_packed; ++i )
+    {
+        dst[ 2 * i ]     = x4na_to_ASCII[ ( src[ i ] >> 4 ) & 0x0F ];
+        dst[ 2 * i + 1 ] = x4na_to_ASCII[ src[ i ] & 0x0F ];
+    }
+}
+
+#define MAX_LEN 1024
+#define GUARD 0xAA
+
+class Kernel4naFixture
+{
+public:
+    Kernel4naFixture()
+    : bases( MAX_LEN ), packed( MAX_LEN ), ref_packed( MAX_LEN ), ascii( MAX_LEN ), ref_ascii( MAX_LEN )
+    {
+        static const uint8_t codes[] = { 1, 2, 4, 8, 15, 0, 1, 2, 4, 8, 1, 2, 4, 8, 3, 5 };
+        srand( 4711 );
+        for ( size_t i = 0; i < MAX_LEN; ++i )
+            bases[ i ] = codes[ rand() & 0x0F ];
+    }
+
+    /* "" if pack_4na_bytes() packs all lengths up to 300 bases from unaligned starts like the reference
+       and writes nothing behind them, else what differs */
+    string CheckPack( simd_level level )
+    {
+        for ( size_t l = 0; l <= 300; ++l )
+        {
+            for ( size_t offset = 0; offset < 4; ++offset )
+            {
+                size_t n_packed = l >> 1;
+                memset( &packed[ 0 ], GUARD, MAX_LEN );
+                pack_4na_bytes( level, &bases[ offset ], &packed[ 0 ], n_packed );
+                ref_pack( &bases[ offset ], &ref_packed[ 0 ], n_packed );
+                if ( memcmp( &packed[ 0 ], &ref_packed[ 0 ], n_packed ) != 0 )
+                    return Describe( "pack", level, l, offset );
+                if ( packed[ n_packed ] != GUARD )
+                    return Describe( "pack writes behind", level, l, offset );
+            }
+        }
+        return string();
+    }
+
+    /* "" if unpack_4na_bytes() unpacks all lengths up to 300 bases from unaligned starts like the
+       reference and writes nothing behind them, else what differs */
+    string CheckUnpack( simd_level level )
+    {
+        ref_pack( &bases[ 0 ], &ref_packed[ 0 ], MAX_LEN / 2 );
+        for ( size_t l = 0; l <= 300; ++l )
+        {
+            for ( size_t offset = 0; offset < 4; ++offset )
+            {
+                size_t n_packed = l >> 1;
+                memset( &ascii[ 0 ], GUARD, MAX_LEN );
+                unpack_4na_bytes( level, &ref_packed[ offset ], &ascii[ 0 ], n_packed );
+                ref_unpack( &ref_packed[ offset ], &ref_ascii[ 0 ], n_packed );
+                if ( memcmp( &ascii[ 0 ], &ref_ascii[ 0 ], 2 * n_packed ) != 0 )
+                    return Describe( "unpack", level, l, offset );
+                if ( ( uint8_t )ascii[ 2 * n_packed ] != GUARD )
+                    return Describe( "unpack writes behind", level, l, offset );
+            }
+        }
+        return string();
+    }
+
+    static string Describe( const char * what, simd_level level, size_t len, size_t offset )
+    {
+        char tmp[ 128 ];
+        snprintf( tmp, sizeof tmp, "%s( %s ) differs for length %u at offset %u",
+                  what, simd_level_name( level ), ( unsigned )len, ( unsigned )offset );
+        return string( tmp );
+    }
+
+    vector< uint8_t > bases;
+    vector< uint8_t > packed;
+    vector< uint8_t > ref_packed;
+    vector< char > ascii;
+    vector< char > ref_ascii;
+};
+
+FIXTURE_TEST_CASE( Pack_EqualsReference, Kernel4naFixture )
+{
+    for ( int level = simd_scalar; level <= ( int )get_simd_level(); ++level )
+        REQUIRE_EQ( CheckPack( ( simd_level )level ), string() );
+}
+
+FIXTURE_TEST_CASE( Unpack_EqualsReference, Kernel4naFixture )
+{
+    for ( int level = simd_scalar; level <= ( int )get_simd_level(); ++level )
+        REQUIRE_EQ( CheckUnpack( ( simd_level )level ), string() );
+}
+
+FIXTURE_TEST_CASE( Unpack_AllCodes, Kernel4naFixture )
+{
+    /* every packed byte, i.e. every pair of 4na-codes, enough of them for the widest kernel */
+    for ( size_t i = 0; i < 512; ++i )
+        ref_packed[ i ] = ( uint8_t )i;
+    ref_unpack( &ref_packed[ 0 ], &ref_ascii[ 0 ], 512 );
+    for ( int level = simd_scalar; level <= ( int )get_simd_level(); ++level )
+    {
+        memset( &ascii[ 0 ], GUARD, MAX_LEN );
+        unpack_4na_bytes( ( simd_level )level, &ref_packed[ 0 ], &ascii[ 0 ], 512 );
+        REQUIRE_EQ( memcmp( &ascii[ 0 ], &ref_ascii[ 0 ], 1024 ), 0 );
+    }
+}
+
+FIXTURE_TEST_CASE( Pack_UpperBitsAreIgnored, Kernel4naFixture )
+{
+    /* the reference masks the codes with 0x0F */
+    for ( size_t i = 0; i < MAX_LEN; ++i )
+        bases[ i ] = ( uint8_t )( rand() & 0xFF );
+    for ( int level = simd_scalar; level <= ( int )get_simd_level(); ++level )
+        REQUIRE_EQ( CheckPack( ( simd_level )level ), string() );
+}
+
+TEST_CASE( SimdLevel_HasName )
+{
+    for ( int level = simd_scalar; level <= ( int )get_simd_level(); ++level )
+        REQUIRE( simd_level_name( ( simd_level )level ) != NULL );
+    REQUIRE_EQ( get_simd_level(), get_simd_level() );
+}
+
+//////////////////////////////////////////// Main
+#include <kapp/args.h>
+
+extern "C"
+{
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+
+const char UsageDefaultName[] = "test-4na";
+
+rc_t CC UsageSummary (const char * progname)
+{
+    return KOutMsg ( "Usage:\n" "\t%s [options]\n\n", progname );
+}
+
+rc_t CC Usage( const Args* args )
+{
+    return 0;
+}
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    rc_t rc = Simd4naTestSuite(argc, argv);
+    return rc;
+}
+
+}
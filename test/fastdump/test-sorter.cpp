@@ -0,0 +1,232 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+/**
+* the slab-store and the sorter of fastdump: a sorter with a mem-limit saves its store into
+* a sub-file whenever the entries reach the limit, not on every record after the first save
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/out.h>
+#include <klib/rc.h>
+#include <kfs/directory.h>
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "helper.h"
+#include "slab_store.h"
+#include "sorter.h"
+#include "lookup_reader.h"
+
+using namespace std;
+
+TEST_SUITE(SorterTestSuite);
+
+#define LOOKUP_FILE "test-sorter.lookup"
+#define READ_LEN 150
+#define RECORDS 20000
+
+// the 4na-codes of A, C, G, T
+static const char x4na[ 4 ] = { 1, 2, 4, 8 };
+static const char ascii[ 4 ] = { 'A', 'C', 'G', 'T' };
+
+// the bases of a read depend on its spot, to check them after the sort
+static string Bases(int64_t spot, const char * alphabet)
+{
+    string res(READ_LEN, ' ');
+    for (size_t i = 0; i < READ_LEN; ++i)
+        res[i] = alphabet[(spot * 7 + i * 3 + i / 5) % 4];
+    return res;
+}
+
+static String ToString(const string & s)
+{
+    String res;
+    StringInit(&res, s.data(), s.size(), (uint32_t)s.size());
+    return res;
+}
+
+// the spots in a scrambled order, each one exactly once
+static int64_t Spot(uint32_t i)
+{
+    return (int64_t)((i * 7919u) % RECORDS) + 1;
+}
+
+TEST_CASE(SlabStore_BytesUsed_StartOverAfterClear)
+{
+    struct slab_store * store = NULL;
+    REQUIRE_RC(make_slab_store(&store, 64 * 1024, lft_4na));
+    REQUIRE_EQ(slab_store_bytes_used(store), (uint64_t)0);
+
+    string b = Bases(1, x4na);
+    String s = ToString(b);
+    for (uint32_t i = 0; i < 1000; ++i)
+        REQUIRE_RC(slab_store_add(store, make_key(Spot(i), 1), &s));
+    uint64_t used = slab_store_bytes_used(store);
+    uint64_t allocated = slab_store_bytes(store);
+    // 1000 entries of 2 + 75 packed bytes and a 16 byte key
+    REQUIRE_GE(used, (uint64_t)(1000 * (2 + READ_LEN / 2)));
+    REQUIRE_GE(allocated, used);
+
+    // a clear keeps the slabs, but nothing is in use any more
+    clear_slab_store(store);
+    REQUIRE_EQ(slab_store_count(store), (uint64_t)0);
+    REQUIRE_EQ(slab_store_bytes_used(store), (uint64_t)0);
+    REQUIRE_EQ(slab_store_bytes(store), allocated);
+
+    // the next batch reuses them
+    for (uint32_t i = 0; i < 1000; ++i)
+        REQUIRE_RC(slab_store_add(store, make_key(Spot(i), 1), &s));
+    REQUIRE_EQ(slab_store_bytes_used(store), used);
+    REQUIRE_EQ(slab_store_bytes(store), allocated);
+
+    release_slab_store(store);
+}
+
+class SorterFixture
+{
+public:
+    SorterFixture() : dir(NULL), sorter(NULL)
+    {
+        if (KDirectoryNativeDir(&dir) != 0)
+            throw logic_error("SorterFixture: KDirectoryNativeDir failed");
+    }
+    ~SorterFixture()
+    {
+        destroy_sorter(sorter);
+        KDirectoryRemove(dir, true, LOOKUP_FILE);
+        KDirectoryRelease(dir);
+    }
+
+    // sorts RECORDS reads of READ_LEN bases into LOOKUP_FILE
+    void Sort(size_t mem_limit)
+    {
+        sorter_params params;
+        memset(&params, 0, sizeof params);
+        params.dir = dir;
+        params.output_filename = LOOKUP_FILE;
+        params.buf_size = 64 * 1024;
+        params.mem_limit = mem_limit;
+        params.lookup_fmt = lft_4na;
+        if (make_sorter(&sorter, &params) != 0)
+            throw logic_error("SorterFixture: make_sorter failed");
+
+        for (uint32_t i = 0; i < RECORDS; ++i)
+        {
+            string b = Bases(Spot(i), x4na);
+            String s = ToString(b);
+            if (write_to_sorter(sorter, Spot(i), 1, &s) != 0)
+                throw logic_error("SorterFixture: write_to_sorter failed");
+        }
+        if (finish_sorter(sorter) != 0)
+            throw logic_error("SorterFixture: finish_sorter failed");
+    }
+
+    // reads LOOKUP_FILE back: every spot once, in ascending order, with its bases
+    void Check()
+    {
+        struct lookup_reader * reader = NULL;
+        SBuffer buf;
+        if (make_SBuffer(&buf, 4096) != 0)
+            throw logic_error("SorterFixture: make_SBuffer failed");
+        if (make_lookup_reader(dir, NULL, &reader, 64 * 1024, "%s", LOOKUP_FILE) != 0)
+            throw logic_error("SorterFixture: make_lookup_reader failed");
+
+        int64_t expected = 1;
+        int64_t spot;
+        uint32_t read;
+        while (get_bases_from_lookup_reader(reader, &spot, &read, &buf) == 0)
+        {
+            if (spot != expected || read != 1)
+                throw logic_error("SorterFixture: unexpected key");
+            if (string(buf.S.addr, buf.S.len) != Bases(spot, ascii))
+                throw logic_error("SorterFixture: unexpected bases");
+            ++expected;
+        }
+        release_lookup_reader(reader);
+        release_SBuffer(&buf);
+        if (expected != RECORDS + 1)
+            throw logic_error("SorterFixture: records missing");
+    }
+
+    KDirectory * dir;
+    struct sorter * sorter;
+};
+
+FIXTURE_TEST_CASE(Sorter_NoMemLimit_NoSubFiles, SorterFixture)
+{
+    Sort(0);
+    REQUIRE_EQ(sorter_sub_file_count(sorter), (uint32_t)0);
+    Check();
+}
+
+FIXTURE_TEST_CASE(Sorter_SmallMemLimit_OneSubFilePerLimit, SorterFixture)
+{
+    const size_t mem_limit = 256 * 1024;
+    Sort(mem_limit);
+
+    // each sub-file holds about mem_limit bytes of packed bases and keys, the last one the rest
+    const uint64_t total = (uint64_t)RECORDS * (2 + READ_LEN / 2 + 16);
+    const uint32_t expected = (uint32_t)(total / mem_limit) + 1;
+    REQUIRE_GE(sorter_sub_file_count(sorter), expected - 1);
+    REQUIRE_GE(expected + 1, sorter_sub_file_count(sorter));
+    Check();
+}
+
+//////////////////////////////////////////// Main
+#include <kapp/args.h>
+
+extern "C"
+{
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+
+const char UsageDefaultName[] = "test-sorter";
+
+rc_t CC UsageSummary (const char * progname)
+{
+    return KOutMsg ( "Usage:\n" "\t%s [options]\n\n", progname );
+}
+
+rc_t CC Usage( const Args* args )
+{
+    return 0;
+}
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    rc_t rc = SorterTestSuite(argc, argv);
+    return rc;
+}
+
+}
@@ -0,0 +1,207 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+/**
+* the telemetry of fastdump: scratch-space check, progress-lines, JSON-output
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/out.h>
+#include <klib/rc.h>
+#include <klib/time.h>
+#include <kfs/directory.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "telemetry.h"
+
+using namespace std;
+
+TEST_SUITE(TelemetryTestSuite);
+
+#define JSON_FILE "test-telemetry.json"
+
+class TelemetryFixture
+{
+public:
+    TelemetryFixture() : dir(NULL), t(NULL)
+    {
+        if (KDirectoryNativeDir(&dir) != 0)
+            throw logic_error("TelemetryFixture: KDirectoryNativeDir failed");
+    }
+    ~TelemetryFixture()
+    {
+        release_telemetry(t);
+        KDirectoryRemove(dir, true, JSON_FILE);
+        KDirectoryRelease(dir);
+    }
+
+    void Make(uint32_t progress_ms)
+    {
+        if (make_telemetry(&t, dir, JSON_FILE, 0, 1, progress_ms, false) != 0)
+            throw logic_error("TelemetryFixture: make_telemetry failed");
+    }
+
+    // the JSON-lines written so far
+    string Json() const
+    {
+        ifstream in(JSON_FILE);
+        stringstream s;
+        s << in.rdbuf();
+        return s.str();
+    }
+
+    static size_t Count(const string & s, const string & what)
+    {
+        size_t n = 0;
+        for (size_t pos = s.find(what); pos != string::npos; pos = s.find(what, pos + 1))
+            ++n;
+        return n;
+    }
+
+    // the value of "free" in the last scratch-line
+    static uint64_t FreeOf(const string & json)
+    {
+        size_t pos = json.rfind("\"free\":");
+        if (pos == string::npos)
+            throw logic_error("TelemetryFixture: no scratch-line");
+        return strtoull(json.c_str() + pos + 7, NULL, 10);
+    }
+
+    KDirectory * dir;
+    struct telemetry * t;
+};
+
+FIXTURE_TEST_CASE(ScratchSpaceFits, TelemetryFixture)
+{
+    Make(0);
+    REQUIRE(telemetry_check_space(t, dir, ".", 1));
+    REQUIRE_EQ(Count(Json(), "\"stage\":\"scratch\""), (size_t)1);
+}
+
+FIXTURE_TEST_CASE(ScratchSpaceShortage, TelemetryFixture)
+{
+    Make(0);
+    REQUIRE(telemetry_check_space(t, dir, ".", 1));
+    // a quota just above what the filesystem has left
+    uint64_t avail = FreeOf(Json());
+    REQUIRE(!telemetry_check_space(t, dir, ".", 2 * avail + 1));
+    REQUIRE(!telemetry_check_space(NULL, dir, ".", 2 * avail + 1));
+}
+
+FIXTURE_TEST_CASE(PathIsEscaped, TelemetryFixture)
+{
+    const char * path = "test-telemetry-\"quoted\\dir\"";
+    REQUIRE_RC(KDirectoryCreateDir(dir, 0775, kcmCreate, "%s", path));
+    Make(0);
+    bool fits = telemetry_check_space(t, dir, path, 1);
+    KDirectoryRemove(dir, true, "%s", path);
+    REQUIRE(fits);
+    string json = Json();
+    REQUIRE_NE(json.find("\"path\":\"test-telemetry-\\\"quoted\\\\dir\\\"\""), string::npos);
+}
+
+FIXTURE_TEST_CASE(ProgressIsReported, TelemetryFixture)
+{
+    Make(1);
+    telemetry_tick tick;
+    telemetry_tick_init(&tick, "sort", 3);
+    uint64_t records;
+    for (records = 1; records <= 4 * TELEMETRY_CHECK_RECORDS; ++records)
+    {
+        if (records % TELEMETRY_CHECK_RECORDS == 0)
+            KSleepMs(2);
+        telemetry_progress(t, &tick, records, 10 * records);
+    }
+    telemetry_stage(t, tick.stage, tick.thread_id, records - 1, 10 * (records - 1), tick.start);
+
+    string json = Json();
+    REQUIRE_GE(Count(json, "\"stage\":\"sort\",\"thread\":3,\"running\":true"), (size_t)3);
+    REQUIRE_EQ(Count(json, "\"stage\":\"sort\",\"thread\":3,\"running\":false"), (size_t)1);
+    REQUIRE_NE(json.find("\"running\":false,\"records\":16384,\"bytes\":163840"), string::npos);
+}
+
+FIXTURE_TEST_CASE(ProgressOnlyPerInterval, TelemetryFixture)
+{
+    Make(60000);
+    telemetry_tick tick;
+    telemetry_tick_init(&tick, "merge", 0);
+    for (uint64_t records = 1; records <= 4 * TELEMETRY_CHECK_RECORDS; ++records)
+        telemetry_progress(t, &tick, records, records);
+    REQUIRE_EQ(Count(Json(), "\"running\":true"), (size_t)0);
+}
+
+FIXTURE_TEST_CASE(NoProgressIfDisabled, TelemetryFixture)
+{
+    Make(0);
+    telemetry_tick tick;
+    telemetry_tick_init(&tick, "join", 1);
+    for (uint64_t records = 1; records <= 2 * TELEMETRY_CHECK_RECORDS; ++records)
+    {
+        if (records % TELEMETRY_CHECK_RECORDS == 0)
+            KSleepMs(2);
+        telemetry_progress(t, &tick, records, 0);
+    }
+    REQUIRE_EQ(Count(Json(), "\"running\":true"), (size_t)0);
+    // without a telemetry nothing happens
+    telemetry_progress(NULL, &tick, 3 * TELEMETRY_CHECK_RECORDS, 0);
+}
+
+//////////////////////////////////////////// Main
+#include <kapp/args.h>
+
+extern "C"
+{
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+
+const char UsageDefaultName[] = "test-telemetry";
+
+rc_t CC UsageSummary (const char * progname)
+{
+    return KOutMsg ( "Usage:\n" "\t%s [options]\n\n", progname );
+}
+
+rc_t CC Usage( const Args* args )
+{
+    return 0;
+}
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    rc_t rc = TelemetryTestSuite(argc, argv);
+    return rc;
+}
+
+}
@@ -0,0 +1,504 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+/**
+* SAM-lines encoded into BAM-records by sam-dump's BAM-output
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/out.h>
+#include <kfs/directory.h>
+#include <kfs/file.h>
+
+#include <sysalloc.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <zlib.h>
+
+extern "C" {
+#include "../../tools/sra-pileup/bam_rec.h"
+#include "../../tools/sra-pileup/bam_index.h"
+#include "../../tools/sra-pileup/bgzf_out.h"
+}
+
+using namespace std;
+
+TEST_SUITE(BamRecTestSuite);
+
+static const string Header( "@HD\tVN:1.4\tSO:coordinate\n@SQ\tSN:chr1\tLN:1000\n@SQ\tSN:chr2\tLN:50\n" );
+
+class RecFixture
+{
+public:
+    RecFixture()
+    {
+        bam_ref_dict_init(&refs);
+        out_buf_init(&buf, NULL, 0);
+        size_t start = 0;
+        while (start < Header.size()) {
+            size_t const nl = Header.find('\n', start);
+            if (bam_ref_dict_add_line(&refs, Header.data() + start, nl - start) != 0)
+                throw logic_error("bam_ref_dict_add_line failed");
+            start = nl + 1;
+        }
+        if (bam_ref_dict_seal(&refs) != 0)
+            throw logic_error("bam_ref_dict_seal failed");
+    }
+    ~RecFixture()
+    {
+        out_buf_release(&buf);
+        bam_ref_dict_release(&refs);
+    }
+    rc_t Encode(const string & line)
+    {
+        buf.len = 0;
+        return bam_rec_encode(&refs, line.data(), line.size(), &buf, &info);
+    }
+    const uint8_t * Bytes() const { return (const uint8_t *)buf.data; }
+    int32_t I32(size_t at) const
+    {
+        return (int32_t)(Bytes()[at] | Bytes()[at + 1] << 8 | Bytes()[at + 2] << 16 | (uint32_t)Bytes()[at + 3] << 24);
+    }
+    uint16_t U16(size_t at) const { return (uint16_t)(Bytes()[at] | Bytes()[at + 1] << 8); }
+    // the tag-section starts behind the fixed part, name, cigar, seq and qual
+    size_t Tags() const
+    {
+        return 36 + Bytes()[12] + 4 * U16(16) + (I32(20) + 1) / 2 + I32(20);
+    }
+
+    bam_ref_dict refs;
+    out_buf buf;
+    bam_rec_info info;
+};
+
+FIXTURE_TEST_CASE(BamRec_Header, RecFixture)
+{
+    REQUIRE_RC(bam_header_encode(&refs, Header.data(), Header.size(), &buf));
+    REQUIRE_EQ(memcmp(buf.data, "BAM\1", 4), 0);
+    REQUIRE_EQ(I32(4), (int32_t)Header.size());
+    size_t at = 8 + Header.size();
+    REQUIRE_EQ(I32(at), 2);
+    REQUIRE_EQ(I32(at + 4), 5);
+    REQUIRE_EQ(string(buf.data + at + 8), string("chr1"));
+    REQUIRE_EQ(I32(at + 13), 1000);
+    REQUIRE_EQ(string(buf.data + at + 21), string("chr2"));
+    REQUIRE_EQ(I32(at + 26), 50);
+    REQUIRE_EQ(buf.len, at + 30);
+}
+
+FIXTURE_TEST_CASE(BamRec_Find, RecFixture)
+{
+    REQUIRE_EQ(bam_ref_dict_find(&refs, "chr2", 4), 1);
+    REQUIRE_EQ(bam_ref_dict_find(&refs, "chr1", 4), 0);
+    REQUIRE_EQ(bam_ref_dict_find(&refs, "chr", 3), -1);
+    REQUIRE_EQ(bam_ref_dict_find(&refs, "chr3", 4), -1);
+}
+
+FIXTURE_TEST_CASE(BamRec_Aligned, RecFixture)
+{
+    REQUIRE_RC(Encode("q1\t99\tchr2\t11\t60\t3M1D2M\t=\t21\t15\tACGTN\tIIII#\tXA:A:x"));
+    REQUIRE_EQ(I32(0), (int32_t)buf.len - 4);
+    REQUIRE_EQ(I32(4), 1);                     // refID
+    REQUIRE_EQ(I32(8), 10);                    // 0-based pos
+    REQUIRE_EQ((int)Bytes()[12], 3);           // l_read_name
+    REQUIRE_EQ((int)Bytes()[13], 60);          // mapq
+    REQUIRE_EQ(U16(14), (uint16_t)bam_reg2bin(10, 16, 14, 5));
+    REQUIRE_EQ(U16(16), (uint16_t)3);          // n_cigar_op
+    REQUIRE_EQ(U16(18), (uint16_t)99);         // flag
+    REQUIRE_EQ(I32(20), 5);                    // l_seq
+    REQUIRE_EQ(I32(24), 1);                    // '=' is the own reference
+    REQUIRE_EQ(I32(28), 20);
+    REQUIRE_EQ(I32(32), 15);
+    REQUIRE_EQ(string(buf.data + 36), string("q1"));
+    REQUIRE_EQ(I32(39), 3 << 4 | 0);           // 3M
+    REQUIRE_EQ(I32(43), 1 << 4 | 2);           // 1D
+    REQUIRE_EQ(I32(47), 2 << 4 | 0);           // 2M
+    REQUIRE_EQ((int)Bytes()[51], 0x12);        // AC
+    REQUIRE_EQ((int)Bytes()[52], 0x48);        // GT
+    REQUIRE_EQ((int)Bytes()[53], 0xF0);        // N
+    REQUIRE_EQ((int)Bytes()[54], 40);          // 'I' - 33
+    REQUIRE_EQ((int)Bytes()[58], 2);           // '#' - 33
+    REQUIRE_EQ(memcmp(Bytes() + Tags(), "XAAx", 4), 0);
+    REQUIRE_EQ(Tags() + 4, buf.len);
+
+    REQUIRE_EQ(info.ref_id, 1);
+    REQUIRE_EQ(info.beg, (int64_t)10);
+    REQUIRE_EQ(info.end, (int64_t)16);
+    REQUIRE(info.mapped);
+}
+
+FIXTURE_TEST_CASE(BamRec_Unmapped, RecFixture)
+{
+    REQUIRE_RC(Encode("u1\t4\t*\t0\t0\t*\t*\t0\t0\tAC\t*"));
+    REQUIRE_EQ(I32(4), -1);
+    REQUIRE_EQ(I32(8), -1);
+    REQUIRE_EQ(U16(14), (uint16_t)4680);
+    REQUIRE_EQ(U16(16), (uint16_t)0);
+    REQUIRE_EQ(I32(24), -1);
+    REQUIRE_EQ(I32(28), -1);
+    REQUIRE_EQ((int)Bytes()[40], 0xFF);        // missing qualities
+    REQUIRE_EQ(Tags(), buf.len);
+    REQUIRE(!info.mapped);
+}
+
+FIXTURE_TEST_CASE(BamRec_IntTags, RecFixture)
+{
+    REQUIRE_RC(Encode("q\t0\tchr1\t1\t0\t1M\t*\t0\t0\tA\tI\tX1:i:-1\tX2:i:300\tX3:i:-40000\tX4:i:3000000000"));
+    const uint8_t * t = Bytes() + Tags();
+    REQUIRE_EQ(memcmp(t, "X1c\xff", 4), 0);
+    REQUIRE_EQ(memcmp(t + 4, "X2S\x2c\x01", 5), 0);
+    REQUIRE_EQ(memcmp(t + 9, "X3i\xc0\x63\xff\xff", 7), 0);
+    REQUIRE_EQ(memcmp(t + 16, "X4I\x00\x5e\xd0\xb2", 7), 0);
+    REQUIRE_EQ(Tags() + 23, buf.len);
+}
+
+FIXTURE_TEST_CASE(BamRec_ArrayTag, RecFixture)
+{
+    REQUIRE_RC(Encode("q\t0\tchr1\t1\t0\t1M\t*\t0\t0\tA\tI\tXB:B:s,1,-2"));
+    const uint8_t * t = Bytes() + Tags();
+    REQUIRE_EQ(memcmp(t, "XBBs\x02\x00\x00\x00\x01\x00\xfe\xff", 12), 0);
+    REQUIRE_EQ(Tags() + 12, buf.len);
+}
+
+FIXTURE_TEST_CASE(BamRec_UnknownReference, RecFixture)
+{
+    REQUIRE_RC_FAIL(Encode("q\t0\tchrX\t1\t0\t1M\t*\t0\t0\tA\tI"));
+}
+
+// the records sam-dump builds from the row-fields are the ones the SAM-line gives
+FIXTURE_TEST_CASE(BamRec_Builder, RecFixture)
+{
+    REQUIRE_RC(Encode("q1\t99\tchr2\t11\t60\t3M1D2M\t=\t21\t15\tACGTN\tIIII#\tRG:Z:g1\tNM:i:1\tXS:A:+\tMD:Z:3^A2"));
+    string const text(buf.data, buf.len);
+
+    bam_rec_fields f;
+    memset(&f, 0, sizeof f);
+    f.qname = "q1"; f.qname_len = 2;
+    f.flag = 99;
+    f.ref_id = 1;
+    f.pos = 10;
+    f.mapq = 60;
+    f.cigar = "3M1D2M"; f.cigar_len = 6;
+    f.next_ref_id = 1;
+    f.pnext = 20;
+    f.tlen = 15;
+    f.seq = "ACGTN"; f.seq_len = 5;
+    f.qual = "IIII#"; f.qual_len = 5;
+
+    buf.len = 0;
+    REQUIRE_RC(bam_rec_begin(&buf, &f));
+    REQUIRE_RC(bam_tag_Z(&buf, "RG", "g1", 2));
+    REQUIRE_RC(bam_tag_i(&buf, "NM", 1));
+    REQUIRE_RC(bam_tag_A(&buf, "XS", '+'));
+    REQUIRE_RC(bam_tags_text(&buf, "\tMD:Z:3^A2", 10));
+    bam_rec_info built;
+    REQUIRE_RC(bam_rec_end(&buf, 0, &built));
+    REQUIRE_EQ(string(buf.data, buf.len), text);
+    REQUIRE_EQ(built.ref_id, info.ref_id);
+    REQUIRE_EQ(built.beg, info.beg);
+    REQUIRE_EQ(built.end, info.end);
+    REQUIRE(built.mapped);
+
+    // missing qualities and an unplaced record
+    f.qual = NULL; f.qual_len = 0;
+    f.flag = 4; f.ref_id = -1; f.pos = -1; f.next_ref_id = -1; f.pnext = -1; f.tlen = 0;
+    f.cigar = "*"; f.cigar_len = 1;
+    buf.len = 0;
+    REQUIRE_RC(bam_rec_begin(&buf, &f));
+    REQUIRE_RC(bam_rec_end(&buf, 0, &built));
+    string const unplaced(buf.data, buf.len);
+    REQUIRE_RC(Encode("q1\t4\t*\t0\t60\t*\t*\t0\t0\tACGTN\t*"));
+    REQUIRE_EQ(string(buf.data, buf.len), unplaced);
+    REQUIRE(!built.mapped);
+}
+
+FIXTURE_TEST_CASE(BamRec_Reg2Bin, RecFixture)
+{
+    REQUIRE_EQ(bam_reg2bin(0, 1, 14, 5), 4681u);
+    REQUIRE_EQ(bam_reg2bin(16383, 16385, 14, 5), 585u);
+    REQUIRE_EQ(bam_reg2bin(0, 1 << 29, 14, 5), 0u);
+    REQUIRE_EQ(bam_reg2bin(1 << 26, (1 << 26) + 1, 14, 5), 4681u + 4096u);
+}
+
+/////////////////////////////////////////// BGZF-blocks and the BAI-index, written to a file and read back
+
+static uint32_t Le32(const string & s, size_t at)
+{
+    return (uint8_t)s[at] | (uint8_t)s[at + 1] << 8 | (uint8_t)s[at + 2] << 16 | (uint32_t)(uint8_t)s[at + 3] << 24;
+}
+
+static uint64_t Le64(const string & s, size_t at)
+{
+    return Le32(s, at) | (uint64_t)Le32(s, at + 4) << 32;
+}
+
+class FileFixture
+{
+public:
+    FileFixture() : dir(NULL), file(NULL), name("test-bam-rec.tmp")
+    {
+        if (KDirectoryNativeDir(&dir) != 0)
+            throw logic_error("FileFixture: KDirectoryNativeDir failed");
+    }
+    ~FileFixture()
+    {
+        KFileRelease(file);
+        KDirectoryRemove(dir, true, "%s", name.c_str());
+        KDirectoryRelease(dir);
+    }
+    KFile * Create()
+    {
+        KFileRelease(file);
+        file = NULL;
+        if (KDirectoryCreateFile(dir, &file, false, 0664, kcmInit, "%s", name.c_str()) != 0)
+            throw logic_error("FileFixture: KDirectoryCreateFile failed");
+        return file;
+    }
+    string Content()
+    {
+        KFileRelease(file);
+        file = NULL;
+        ifstream in(name.c_str(), ios::binary);
+        return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+    // the blocks of a BGZF-file inflated, false if a block is malformed
+    bool Inflate(const string & bgzf, string & data, size_t & blocks, size_t & last_block)
+    {
+        size_t at = 0;
+        data.clear();
+        blocks = 0;
+        while (at < bgzf.size())
+        {
+            if (bgzf.size() - at < 18 ||
+                memcmp(bgzf.data() + at, "\x1f\x8b\x08\x04", 4) != 0 ||
+                bgzf[at + 10] != 6 || bgzf[at + 12] != 'B' || bgzf[at + 13] != 'C')
+                return false;
+            size_t const bsize = ((uint8_t)bgzf[at + 16] | (uint8_t)bgzf[at + 17] << 8) + 1;
+            if (bsize > bgzf.size() - at || bsize < 26)
+                return false;
+            uint32_t const isize = Le32(bgzf, at + bsize - 4);
+            vector<char> out(isize + 1);
+            z_stream zs;
+            memset(&zs, 0, sizeof zs);
+            if (inflateInit2(&zs, -15) != Z_OK)
+                return false;
+            zs.next_in = (Bytef *)bgzf.data() + at + 18;
+            zs.avail_in = (uInt)(bsize - 26);
+            zs.next_out = (Bytef *)&out[0];
+            zs.avail_out = (uInt)out.size();
+            int const zrc = inflate(&zs, Z_FINISH);
+            inflateEnd(&zs);
+            if (zrc != Z_STREAM_END || zs.total_out != isize)
+                return false;
+            if (crc32(crc32(0, NULL, 0), (const Bytef *)&out[0], isize) != Le32(bgzf, at + bsize - 8))
+                return false;
+            data.append(&out[0], isize);
+            last_block = at;
+            at += bsize;
+            ++blocks;
+        }
+        return true;
+    }
+
+    KDirectory * dir;
+    KFile * file;
+    string name;
+};
+
+static const string EofMarker("\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0\x42\x43\x02\0\x1b\0\x03\0\0\0\0\0\0\0\0\0", 28);
+
+FIXTURE_TEST_CASE(Bgzf_Blocks, FileFixture)
+{
+    string data;
+    for (size_t i = 0; data.size() < 2 * BGZF_BLOCK_DATA + 100; ++i)
+        data += (char)('A' + (i * 7 + i / 13) % 26);
+
+    bgzf_out * bgzf;
+    REQUIRE_RC(bgzf_out_make(&bgzf, Create(), 0, 0));
+    REQUIRE_RC(bgzf_out_write(bgzf, data.data(), 100));
+    uint64_t const mid = bgzf_out_tell(bgzf);
+    REQUIRE_RC(bgzf_out_write(bgzf, data.data() + 100, data.size() - 100));
+    REQUIRE_RC(bgzf_out_finish(bgzf));
+    REQUIRE_EQ(bgzf_out_voffset(bgzf, mid), (uint64_t)100);
+    uint64_t const end = bgzf_out_pos(bgzf);
+    bgzf_out_release(bgzf);
+
+    string const content = Content();
+    REQUIRE_EQ((uint64_t)content.size(), end);
+    string inflated;
+    size_t blocks, last;
+    REQUIRE(Inflate(content, inflated, blocks, last));
+    REQUIRE_EQ(inflated, data);
+    REQUIRE_EQ(blocks, (size_t)4);                  // three full or partial blocks and the EOF-marker
+    REQUIRE_EQ(content.size() - last, (size_t)28);
+    REQUIRE_EQ(content.substr(last), EofMarker);
+}
+
+FIXTURE_TEST_CASE(Bgzf_Empty, FileFixture)
+{
+    bgzf_out * bgzf;
+    REQUIRE_RC(bgzf_out_make(&bgzf, Create(), 0, 0));
+    REQUIRE_RC(bgzf_out_finish(bgzf));
+    bgzf_out_release(bgzf);
+    REQUIRE_EQ(Content(), EofMarker);
+}
+
+// the chunks of one bin of a reference in a BAI-file, the pseudo-bin counts and the unplaced records
+struct BaiRef
+{
+    vector< pair<uint64_t, uint64_t> > chunks;
+    uint64_t mapped, unmapped;
+    uint32_t intervals;
+};
+
+static bool ParseBai(const string & bai, uint32_t bin, vector<BaiRef> & refs, uint64_t & no_coor)
+{
+    if (bai.size() < 8 || bai.compare(0, 4, "BAI\1", 4) != 0)
+        return false;
+    size_t at = 8;
+    for (uint32_t r = Le32(bai, 4); r > 0; --r)
+    {
+        BaiRef ref;
+        ref.mapped = ref.unmapped = 0;
+        uint32_t const bins = Le32(bai, at);
+        at += 4;
+        for (uint32_t b = 0; b < bins; ++b)
+        {
+            uint32_t const id = Le32(bai, at);
+            uint32_t const chunks = Le32(bai, at + 4);
+            at += 8;
+            for (uint32_t c = 0; c < chunks; ++c, at += 16)
+            {
+                if (id == bin)
+                    ref.chunks.push_back(make_pair(Le64(bai, at), Le64(bai, at + 8)));
+                else if (id == 37450 && c == 1)
+                {
+                    ref.mapped = Le64(bai, at);
+                    ref.unmapped = Le64(bai, at + 8);
+                }
+            }
+        }
+        ref.intervals = Le32(bai, at);
+        at += 4 + 8 * (size_t)ref.intervals;
+        refs.push_back(ref);
+    }
+    if (at + 8 != bai.size())
+        return false;
+    no_coor = Le64(bai, at);
+    return true;
+}
+
+FIXTURE_TEST_CASE(Bai_RoundTrip, FileFixture)
+{
+    uint64_t const len[2] = { 100000, 50 };
+    bam_index * index;
+    REQUIRE_RC(bam_index_make(&index, bik_bai, 2, len));
+
+    bgzf_out * bam;
+    REQUIRE_RC(bgzf_out_make(&bam, Create(), 0, 0));
+    char const record[40] = { 0 };
+    struct { int32_t ref_id; int64_t beg, end; bool mapped; } const recs[] =
+    {
+        { 0, 10, 20, true },
+        { 0, 17000, 17100, true },      // the second window
+        { 1, 5, 10, true },
+        { 0, 15, 16, false },           // a half-aligned mate printed at the end, ref 0 is done
+        { 1, 7, 8, false },             // the same on the current reference
+        { -1, -1, -1, false }           // unplaced
+    };
+    vector<uint64_t> beg, end;
+    for (size_t i = 0; i < sizeof recs / sizeof recs[0]; ++i)
+    {
+        beg.push_back(bgzf_out_tell(bam));
+        REQUIRE_RC(bgzf_out_write(bam, record, sizeof record));
+        end.push_back(bgzf_out_tell(bam));
+        REQUIRE_RC(bam_index_push(index, recs[i].ref_id, recs[i].beg, recs[i].end, recs[i].mapped, beg.back(), end.back()));
+    }
+    REQUIRE(bam_index_sorted(index));
+    REQUIRE_RC(bgzf_out_finish(bam));
+    KFileRelease(file);
+    file = NULL;
+    name = "test-bam-rec.tmp.bai";
+    REQUIRE_RC(bam_index_write(index, Create(), bam));
+
+    vector<BaiRef> refs;
+    uint64_t no_coor = 0;
+    REQUIRE(ParseBai(Content(), 4681, refs, no_coor));     // the bin of the first 16k window
+    REQUIRE_EQ(refs.size(), (size_t)2);
+    REQUIRE_EQ(no_coor, (uint64_t)1);
+
+    // all records are in one BGZF-block, chunks in a block merge: the late mate extends the chunk of ref 0
+    REQUIRE_EQ(refs[0].chunks.size(), (size_t)1);
+    REQUIRE_EQ(refs[0].chunks[0].first, bgzf_out_voffset(bam, beg[0]));
+    REQUIRE_EQ(refs[0].chunks[0].second, bgzf_out_voffset(bam, end[3]));
+    REQUIRE_EQ(refs[0].mapped, (uint64_t)2);
+    REQUIRE_EQ(refs[0].unmapped, (uint64_t)1);
+    REQUIRE_EQ(refs[0].intervals, (uint32_t)2);
+
+    REQUIRE_EQ(refs[1].chunks.size(), (size_t)1);
+    REQUIRE_EQ(refs[1].chunks[0].second, bgzf_out_voffset(bam, end[4]));
+    REQUIRE_EQ(refs[1].mapped, (uint64_t)1);
+    REQUIRE_EQ(refs[1].unmapped, (uint64_t)1);
+
+    bgzf_out_release(bam);
+    bam_index_release(index);
+    KDirectoryRemove(dir, true, "test-bam-rec.tmp");
+}
+
+//////////////////////////////////////////// Main
+#include <kapp/args.h>
+
+extern "C"
+{
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+
+const char UsageDefaultName[] = "test-bam-rec";
+
+rc_t CC UsageSummary (const char * progname)
+{
+    return KOutMsg ( "Usage:\n" "\t%s [options]\n\n", progname );
+}
+
+rc_t CC Usage( const Args* args )
+{
+    return 0;
+}
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    rc_t rc = BamRecTestSuite(argc, argv);
+    return rc;
+}
+
+}
@@ -0,0 +1,256 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+/**
+* sam-dump's mate-cache: LRU-eviction of same-ref entries, spilling of unaligned entries
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/out.h>
+#include <klib/rc.h>
+
+#include <sysalloc.h>
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+extern "C" {
+#include "../../tools/sra-pileup/matecache.h"
+}
+
+using namespace std;
+
+TEST_SUITE(MateCacheTestSuite);
+
+class MateCacheFixture
+{
+public:
+    MateCacheFixture() : mc(NULL)
+    {
+        srand(12345);
+    }
+    ~MateCacheFixture()
+    {
+        release_matecache(mc);
+    }
+    void Make(uint64_t mem_limit, uint32_t row_gap)
+    {
+        if (make_matecache(&mc, 1, mem_limit, row_gap) != 0)
+            throw logic_error("make_matecache failed");
+    }
+    bool HasSameRef(int64_t key) const
+    {
+        INSDC_coord_zero pos;
+        uint32_t flags;
+        INSDC_coord_len tlen;
+        return matecache_lookup_same_ref(mc, 0, key, &pos, &flags, &tlen) == 0;
+    }
+
+    matecache * mc;
+};
+
+static rc_t CC collect(int64_t seq_id, int64_t al_id, void * data)
+{
+    vector<int64_t> * keys = static_cast<vector<int64_t> *>(data);
+    if (seq_id != al_id * 3)
+        return RC(rcApp, rcNoTarg, rcVisiting, rcData, rcInvalid);
+    keys->push_back(al_id);
+    return 0;
+}
+
+FIXTURE_TEST_CASE(SameRef_InsertLookupRemove, MateCacheFixture)
+{
+    Make(1 << 20, 0);
+    REQUIRE_RC(matecache_insert_same_ref(mc, 0, 17, 1000, 0x63, (INSDC_coord_len)-250));
+
+    INSDC_coord_zero pos = 0;
+    uint32_t flags = 0;
+    INSDC_coord_len tlen = 0;
+    REQUIRE_RC(matecache_lookup_same_ref(mc, 0, 17, &pos, &flags, &tlen));
+    REQUIRE_EQ(pos, (INSDC_coord_zero)1000);
+    REQUIRE_EQ(flags, (uint32_t)0x63);
+    REQUIRE_EQ(tlen, (INSDC_coord_len)-250);
+
+    REQUIRE_RC(matecache_remove_same_ref(mc, 0, 17));
+    rc_t rc = matecache_lookup_same_ref(mc, 0, 17, &pos, &flags, &tlen);
+    REQUIRE_EQ(GetRCState(rc), rcNotFound);
+    REQUIRE_EQ(mc->per_file[0].stat_same_ref.count, (uint64_t)0);
+}
+
+FIXTURE_TEST_CASE(SameRef_RowGapEvicts, MateCacheFixture)
+{
+    Make(1 << 20, 100);
+    REQUIRE_RC(matecache_insert_same_ref(mc, 0, 1, 10, 0, 0));
+    REQUIRE_RC(matecache_insert_same_ref(mc, 0, 50, 20, 0, 0));
+    REQUIRE_RC(matecache_insert_same_ref(mc, 0, 120, 30, 0, 0));
+    REQUIRE(!HasSameRef(1));
+    REQUIRE(HasSameRef(50));
+    REQUIRE(HasSameRef(120));
+    REQUIRE_EQ(mc->per_file[0].stat_same_ref.evictions, (uint64_t)1);
+}
+
+FIXTURE_TEST_CASE(SameRef_FullPoolEvictsLeastRecentlyUsed, MateCacheFixture)
+{
+    /* a tiny limit gives the smallest pool */
+    Make(0, 0);
+    const uint32_t capacity = mc->per_file[0].same_ref.capacity;
+    const int64_t n = capacity + 1000;
+    for (int64_t key = 1; key <= n; ++key)
+        REQUIRE_RC(matecache_insert_same_ref(mc, 0, key, (INSDC_coord_zero)key, 0, 0));
+
+    REQUIRE_EQ(mc->per_file[0].stat_same_ref.evictions, (uint64_t)1000);
+    REQUIRE_EQ(mc->per_file[0].stat_same_ref.count, (uint64_t)capacity);
+    for (int64_t key = 1; key <= n; ++key)
+        REQUIRE_EQ(HasSameRef(key), key > 1000);
+
+    /* removed nodes are used again before anything is evicted */
+    REQUIRE_RC(matecache_remove_same_ref(mc, 0, n));
+    REQUIRE_RC(matecache_insert_same_ref(mc, 0, n + 1, 0, 0, 0));
+    REQUIRE(HasSameRef(1001));
+    REQUIRE_EQ(mc->per_file[0].stat_same_ref.evictions, (uint64_t)1000);
+}
+
+FIXTURE_TEST_CASE(SameRef_HitBecomesMostRecentlyUsed, MateCacheFixture)
+{
+    Make(0, 0);
+    const int64_t capacity = mc->per_file[0].same_ref.capacity;
+    for (int64_t key = 1; key <= capacity; ++key)
+        REQUIRE_RC(matecache_insert_same_ref(mc, 0, key, (INSDC_coord_zero)key, 0, 0));
+
+    /* the oldest entry is looked up, the next oldest is given up instead */
+    REQUIRE(HasSameRef(1));
+    REQUIRE_RC(matecache_insert_same_ref(mc, 0, capacity + 1, 0, 0, 0));
+    REQUIRE(HasSameRef(1));
+    REQUIRE(!HasSameRef(2));
+    REQUIRE(HasSameRef(capacity + 1));
+}
+
+FIXTURE_TEST_CASE(SameRef_Clear, MateCacheFixture)
+{
+    Make(1 << 20, 0);
+    for (int64_t key = 1; key <= 10000; ++key)
+        REQUIRE_RC(matecache_insert_same_ref(mc, 0, key, 0, 0, 0));
+    REQUIRE_RC(matecache_clear_same_ref(mc));
+    REQUIRE(!HasSameRef(5000));
+    REQUIRE_RC(matecache_insert_same_ref(mc, 0, 5000, 0, 0, 0));
+    REQUIRE(HasSameRef(5000));
+    REQUIRE_EQ(mc->per_file[0].stat_same_ref.count, (uint64_t)1);
+}
+
+FIXTURE_TEST_CASE(Unaligned_SpillKeepsEverything, MateCacheFixture)
+{
+    /* nothing fits into memory: every table goes into a spill-file */
+    Make(0, 0);
+    vector<int64_t> keys;
+    for (int i = 0; i < 100000; ++i)
+        keys.push_back(1 + (((int64_t)rand() << 16) ^ rand()) % 100000000);
+
+    for (size_t i = 0; i < keys.size(); ++i)
+        REQUIRE_RC(matecache_insert_unaligned(mc, 0, keys[i], (INSDC_coord_zero)i, 7, keys[i] * 3));
+    REQUIRE(mc->spills > 0);
+
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    REQUIRE_EQ(mc->per_file[0].stat_unaligned.count, (uint64_t)keys.size());
+
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        INSDC_coord_zero pos;
+        uint32_t ref_idx = 0;
+        int64_t seq_id = 0;
+        REQUIRE_RC(matecache_lookup_unaligned(mc, 0, keys[i], &pos, &ref_idx, &seq_id));
+        REQUIRE_EQ(ref_idx, (uint32_t)7);
+        REQUIRE_EQ(seq_id, keys[i] * 3);
+    }
+
+    /* visited in the order of the alignment-ids, lookups still work afterwards */
+    vector<int64_t> visited;
+    REQUIRE_RC(foreach_unaligned_entry(mc, 0, collect, &visited));
+    REQUIRE(visited == keys);
+
+    INSDC_coord_zero pos;
+    uint32_t ref_idx;
+    int64_t seq_id;
+    REQUIRE_RC(matecache_lookup_unaligned(mc, 0, keys[keys.size() / 2], &pos, &ref_idx, &seq_id));
+    REQUIRE_EQ(seq_id, keys[keys.size() / 2] * 3);
+    rc_t rc = matecache_lookup_unaligned(mc, 0, 100000001, &pos, &ref_idx, &seq_id);
+    REQUIRE_EQ(GetRCState(rc), rcNotFound);
+
+    /* and inserts turn it back into a hash-table */
+    REQUIRE_RC(matecache_insert_unaligned(mc, 0, 100000001, 1, 2, 300000003));
+    REQUIRE_RC(matecache_lookup_unaligned(mc, 0, 100000001, &pos, &ref_idx, &seq_id));
+    REQUIRE_RC(matecache_lookup_unaligned(mc, 0, keys[0], &pos, &ref_idx, &seq_id));
+    REQUIRE_EQ(seq_id, keys[0] * 3);
+}
+
+FIXTURE_TEST_CASE(Unaligned_Merge, MateCacheFixture)
+{
+    Make(1 << 20, 0);
+    matecache * other;
+    REQUIRE_RC(make_matecache(&other, 1, 1 << 20, 0));
+    for (int64_t key = 1; key <= 1000; ++key)
+        REQUIRE_RC(matecache_insert_unaligned(key % 2 ? mc : other, 0, key, 0, 0, key * 3));
+    REQUIRE_RC(matecache_merge_unaligned(mc, other));
+    release_matecache(other);
+
+    vector<int64_t> visited;
+    REQUIRE_RC(foreach_unaligned_entry(mc, 0, collect, &visited));
+    REQUIRE_EQ(visited.size(), (size_t)1000);
+    for (size_t i = 0; i < visited.size(); ++i)
+        REQUIRE_EQ(visited[i], (int64_t)i + 1);
+}
+
+//////////////////////////////////////////// Main
+#include <kapp/args.h>
+
+extern "C"
+{
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+
+const char UsageDefaultName[] = "test-matecache";
+
+rc_t CC UsageSummary (const char * progname)
+{
+    return KOutMsg ( "Usage:\n" "\t%s [options]\n\n", progname );
+}
+
+rc_t CC Usage( const Args* args )
+{
+    return 0;
+}
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    rc_t rc = MateCacheTestSuite(argc, argv);
+    return rc;
+}
+
+}
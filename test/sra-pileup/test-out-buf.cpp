@@ -0,0 +1,213 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+/**
+* the output-buffer of sam-dump and sra-pileup: number formatting, growth, flushing
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/out.h>
+#include <klib/rc.h>
+
+#include <sysalloc.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "../../tools/sra-pileup/out_buf.h"
+}
+
+using namespace std;
+
+TEST_SUITE(OutBufTestSuite);
+
+static string fmt(uint64_t value)
+{
+    char buf[32];
+    return string(buf, fmt_u64(buf, value));
+}
+
+static string fmt_signed(int64_t value)
+{
+    char buf[32];
+    return string(buf, fmt_i64(buf, value));
+}
+
+static string printed(uint64_t value)
+{
+    char buf[32];
+    snprintf(buf, sizeof buf, "%llu", (unsigned long long)value);
+    return buf;
+}
+
+TEST_CASE(Fmt_Limits)
+{
+    REQUIRE_EQ(fmt(0), string("0"));
+    REQUIRE_EQ(fmt(UINT64_MAX), string("18446744073709551615"));
+    REQUIRE_EQ(fmt_signed(0), string("0"));
+    REQUIRE_EQ(fmt_signed(-1), string("-1"));
+    REQUIRE_EQ(fmt_signed(INT64_MAX), string("9223372036854775807"));
+    REQUIRE_EQ(fmt_signed(INT64_MIN), string("-9223372036854775808"));
+}
+
+TEST_CASE(Fmt_DigitCountAtPowersOf10)
+{
+    /* the number of digits changes here, the count has to be exact on both sides */
+    uint64_t p = 1;
+    for (int i = 0; i < 20; ++i)
+    {
+        REQUIRE_EQ(fmt(p), printed(p));
+        REQUIRE_EQ(fmt(p - 1), printed(p - 1));
+        REQUIRE_EQ(fmt(p + 1), printed(p + 1));
+        if (i < 19)
+            p *= 10;
+    }
+    /* and at the bit-lengths the count is estimated from */
+    for (int bits = 1; bits < 64; ++bits)
+    {
+        uint64_t b = (uint64_t)1 << bits;
+        REQUIRE_EQ(fmt(b), printed(b));
+        REQUIRE_EQ(fmt(b - 1), printed(b - 1));
+    }
+}
+
+TEST_CASE(Reserve_MovesFromTheFixedBufferToTheHeap)
+{
+    char fixed[16];
+    out_buf buf;
+    out_buf_init(&buf, fixed, sizeof fixed);
+
+    REQUIRE_RC(out_buf_str(&buf, "0123456789"));
+    REQUIRE(buf.data == fixed);
+    REQUIRE_RC(out_buf_u64(&buf, UINT64_MAX));     /* 20 more bytes do not fit */
+    REQUIRE(buf.data != fixed);
+    REQUIRE_GE(buf.size, buf.len);
+    REQUIRE_EQ(string(buf.data, buf.len), string("012345678918446744073709551615"));
+
+    /* growing on the heap keeps the data too */
+    string expected(buf.data, buf.len);
+    for (int i = 0; i < 1000; ++i)
+    {
+        REQUIRE_RC(out_buf_i64(&buf, -i));
+        REQUIRE_RC(out_buf_char(&buf, '\t'));
+        expected += fmt_signed(-i) + "\t";
+    }
+    REQUIRE_EQ(string(buf.data, buf.len), expected);
+
+    char * dst;
+    REQUIRE_RC(out_buf_reserve(&buf, 100000, &dst));
+    REQUIRE(dst == buf.data + buf.len);
+    memset(dst, 'x', 100000);
+    out_buf_commit(&buf, 100000);
+    REQUIRE_EQ(buf.len, expected.size() + 100000);
+    REQUIRE_EQ(string(buf.data, expected.size()), expected);
+
+    out_buf_release(&buf);
+    REQUIRE(buf.data == NULL);
+}
+
+TEST_CASE(Reserve_WithoutFixedBuffer)
+{
+    out_buf buf;
+    out_buf_init(&buf, NULL, 100);
+    REQUIRE_EQ(buf.size, (size_t)0);
+    REQUIRE_RC(out_buf_char(&buf, 'A'));
+    REQUIRE_RC(out_buf_mem(&buf, "BC", 2));
+    REQUIRE_EQ(string(buf.data, buf.len), string("ABC"));
+    out_buf_release(&buf);
+}
+
+/* collects what out_buf_flush() hands to the KOut-handler, one string per call */
+static rc_t CC capture(void * data, const char * buffer, size_t bytes, size_t * num_writ)
+{
+    static_cast<vector<string> *>(data)->push_back(string(buffer, bytes));
+    *num_writ = bytes;
+    return 0;
+}
+
+TEST_CASE(Flush_WritesInOrderAndEmpties)
+{
+    KWrtHandler saved = *KOutHandlerGet();
+    vector<string> written;
+    REQUIRE_RC(KOutHandlerSet(capture, &written));
+
+    char fixed[8];
+    out_buf buf;
+    out_buf_init(&buf, fixed, sizeof fixed);
+
+    REQUIRE_RC(out_buf_flush(&buf));                /* nothing to write */
+    REQUIRE_RC(out_buf_str(&buf, "line1\t"));
+    REQUIRE_RC(out_buf_u64(&buf, 1));
+    REQUIRE_RC(out_buf_char(&buf, '\n'));
+    REQUIRE_RC(out_buf_flush(&buf));
+    REQUIRE_EQ(buf.len, (size_t)0);
+    REQUIRE_RC(out_buf_str(&buf, "line2\t"));
+    REQUIRE_RC(out_buf_i64(&buf, -2));
+    REQUIRE_RC(out_buf_char(&buf, '\n'));
+    REQUIRE_RC(out_buf_flush(&buf));
+    REQUIRE_RC(out_buf_flush(&buf));                /* nothing again */
+
+    KOutHandlerSet(saved.writer, saved.data);
+    out_buf_release(&buf);
+
+    REQUIRE_EQ(written.size(), (size_t)2);
+    REQUIRE_EQ(written[0], string("line1\t1\n"));
+    REQUIRE_EQ(written[1], string("line2\t-2\n"));
+}
+
+//////////////////////////////////////////// Main
+#include <kapp/args.h>
+
+extern "C"
+{
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+
+const char UsageDefaultName[] = "test-out-buf";
+
+rc_t CC UsageSummary (const char * progname)
+{
+    return KOutMsg ( "Usage:\n" "\t%s [options]\n\n", progname );
+}
+
+rc_t CC Usage( const Args* args )
+{
+    return 0;
+}
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    rc_t rc = OutBufTestSuite(argc, argv);
+    return rc;
+}
+
+}
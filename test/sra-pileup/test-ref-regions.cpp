@@ -0,0 +1,325 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+/**
+* sra-pileup's reference-regions: the parsers of -r and --regions-file, the merging of the regions
+* and the skiplist of the gaps between merged regions
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/out.h>
+#include <klib/rc.h>
+#include <klib/container.h>
+
+#include <sysalloc.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "../../tools/sra-pileup/ref_regions.h"
+}
+
+using namespace std;
+
+TEST_SUITE(RefRegionsTestSuite);
+
+class RegionsFixture
+{
+public:
+    RegionsFixture() : skl(NULL)
+    {
+        BSTreeInit(&regions);
+    }
+    ~RegionsFixture()
+    {
+        skiplist_release(skl);
+        free_ref_regions(&regions);
+    }
+    /* the regions given with -r, merged with the given --merge-dist */
+    void Make(const char * const * defs, uint64_t merge_dist)
+    {
+        for (size_t i = 0; defs[i] != NULL; ++i)
+        {
+            if (parse_and_add_region(&regions, defs[i]) != 0)
+                throw logic_error("parse_and_add_region failed");
+        }
+        check_ref_regions(&regions, merge_dist);
+        skl = skiplist_make(&regions);
+    }
+    /* what a walk over the whole reference answers for each position */
+    vector<bool> Sequential(const char * ref, uint64_t len)
+    {
+        vector<bool> res(len + 1, false);
+        skiplist_enter_ref(skl, ref);
+        for (uint64_t pos = 1; pos <= len; ++pos)
+            res[pos] = skiplist_is_skip_position(skl, pos);
+        return res;
+    }
+    /* what the workers of --threads answer, each shard entering the reference on its own */
+    vector<bool> Sharded(const char * ref, uint64_t len, uint64_t shard_size, bool reverse)
+    {
+        vector<bool> res(len + 1, false);
+        uint64_t count = (len + shard_size - 1) / shard_size;
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            uint64_t shard = reverse ? count - 1 - i : i;
+            uint64_t start = shard * shard_size + 1;
+            uint64_t end = start + shard_size - 1;
+            if (end > len)
+                end = len;
+            skiplist_enter_ref(skl, ref);
+            for (uint64_t pos = start; pos <= end; ++pos)
+                res[pos] = skiplist_is_skip_position(skl, pos);
+        }
+        return res;
+    }
+
+    /* the regions of a reference after check_ref_regions(), as "start-end,start-end..." */
+    string Ranges(const char * ref)
+    {
+        string res;
+        const struct reference_region * node;
+        for (node = get_first_ref_node(&regions); node != NULL; node = get_next_ref_node(node))
+        {
+            if (string(get_ref_node_name(node)) != ref)
+                continue;
+            for (uint32_t i = 0; i < get_ref_node_range_count(node); ++i)
+            {
+                const struct reference_range * r = get_ref_range(node, i);
+                char tmp[64];
+                sprintf(tmp, "%s%lu-%lu", res.empty() ? "" : ",",
+                        (unsigned long)get_ref_range_start(r), (unsigned long)get_ref_range_end(r));
+                res += tmp;
+            }
+        }
+        return res;
+    }
+    rc_t FromFile(const char * content)
+    {
+        FILE * f = fopen(FILE_NAME, "w");
+        if (f == NULL)
+            throw logic_error("cannot create the region-file");
+        fputs(content, f);
+        fclose(f);
+        rc_t rc = add_regions_from_file(&regions, FILE_NAME);
+        remove(FILE_NAME);
+        if (rc == 0)
+            check_ref_regions(&regions, 0);
+        return rc;
+    }
+
+    static const char * FILE_NAME;
+    BSTree regions;
+    struct skiplist * skl;
+};
+
+const char * RegionsFixture::FILE_NAME = "test-ref-regions.bed";
+
+FIXTURE_TEST_CASE(Regions_NameFromTo, RegionsFixture)
+{
+    const char * defs[] = { "chr1:100-200", "chr2:300", "chr3", NULL };
+    Make(defs, 0);
+    /* 1-based and inclusive as given, a missing end is 0 */
+    REQUIRE_EQ(Ranges("chr1"), string("100-200"));
+    REQUIRE_EQ(Ranges("chr2"), string("300-0"));
+    REQUIRE_EQ(Ranges("chr3"), string("0-0"));
+    REQUIRE_EQ(count_ref_regions(&regions), 3u);
+}
+
+FIXTURE_TEST_CASE(Regions_UnsortedOverlappingAreMerged, RegionsFixture)
+{
+    const char * defs[] = { "chr1:500-600", "chr1:100-200", "chr1:1000-1100", "chr1:150-300",
+                            "chr1:550-700", "chr1:300-310", "chr1:311-320", NULL };
+    Make(defs, 0);
+    /* touching ranges stay apart, they have no base in common */
+    REQUIRE_EQ(Ranges("chr1"), string("100-310,311-320,500-700,1000-1100"));
+}
+
+FIXTURE_TEST_CASE(RegionFile_BedIsZeroBasedWithExclusiveEnd, RegionsFixture)
+{
+    REQUIRE_RC(FromFile("chr1\t0\t1\nchr1\t99\t200\nchr2\t9\t10\n"));
+    REQUIRE_EQ(Ranges("chr1"), string("1-1,100-200"));
+    REQUIRE_EQ(Ranges("chr2"), string("10-10"));
+}
+
+FIXTURE_TEST_CASE(RegionFile_EqualsNameFromTo, RegionsFixture)
+{
+    REQUIRE_RC(FromFile("chr1 99 200\nchr1 499 700\n"));
+    string from_file = Ranges("chr1");
+    free_ref_regions(&regions);
+    BSTreeInit(&regions);
+    const char * defs[] = { "chr1:100-200", "chr1:500-700", NULL };
+    Make(defs, 0);
+    REQUIRE_EQ(Ranges("chr1"), from_file);
+}
+
+FIXTURE_TEST_CASE(RegionFile_CommentsAndBlankLines, RegionsFixture)
+{
+    REQUIRE_RC(FromFile("# regions\n"
+                        "\n"
+                        "  \t \n"
+                        "track name=regions description=\"a test\"\n"
+                        "browser position chr1:1-1000\n"
+                        "chr1\t9\t20\tregion-1\t0\t+\r\n"
+                        "chr1\t50\t50\n"
+                        "#chr1\t60\t70\n"));
+    /* the empty range 50..50 is skipped */
+    REQUIRE_EQ(Ranges("chr1"), string("10-20"));
+    REQUIRE_EQ(count_ref_regions(&regions), 1u);
+}
+
+FIXTURE_TEST_CASE(RegionFile_UnsortedOverlappingAreMerged, RegionsFixture)
+{
+    REQUIRE_RC(FromFile("chr2\t100\t200\nchr1\t499\t600\nchr1\t99\t200\nchr1\t149\t300\nchr2\t150\t250\n"));
+    REQUIRE_EQ(Ranges("chr1"), string("100-300,500-600"));
+    REQUIRE_EQ(Ranges("chr2"), string("101-250"));
+}
+
+FIXTURE_TEST_CASE(RegionFile_Invalid, RegionsFixture)
+{
+    REQUIRE_RC_FAIL(FromFile("chr1\t20\t10\n"));
+    REQUIRE_RC_FAIL(FromFile("chr1\t20\n"));
+    REQUIRE_RC_FAIL(FromFile("chr1\tx\t10\n"));
+    REQUIRE_RC_FAIL(FromFile("chr1\t-1\t10\n"));
+    REQUIRE_RC_FAIL(FromFile("chr1:1-10\n"));
+}
+
+static const char * const MANY_REGIONS[] = {
+    "chr1:1000-2000", "chr1:2500-3000", "chr1:5000-6000", "chr1:9000-9500",
+    "chr1:9600-9700", "chr1:9800-9900", "chr1:19000-21000", "chr2:100-200", "chr2:300-400", NULL };
+
+FIXTURE_TEST_CASE(Skiplist_GapsBetweenMergedRegions, RegionsFixture)
+{
+    Make(MANY_REGIONS, 10000);
+    REQUIRE(skl != NULL);
+    vector<bool> seq = Sequential("chr1", 25000);
+    for (uint64_t pos = 1; pos <= 25000; ++pos)
+    {
+        bool gap = (pos >= 2001 && pos <= 2499) || (pos >= 3001 && pos <= 4999) ||
+                   (pos >= 6001 && pos <= 8999) || (pos >= 9501 && pos <= 9599) ||
+                   (pos >= 9701 && pos <= 9799) || (pos >= 9901 && pos <= 18999);
+        REQUIRE_EQ((bool)seq[pos], gap);
+    }
+}
+
+FIXTURE_TEST_CASE(Skiplist_ShardStartSeeksTheSkipRange, RegionsFixture)
+{
+    Make(MANY_REGIONS, 10000);
+    REQUIRE(skl != NULL);
+    /* a shard starting far into the reference: the first query has to find the 5th skip-range */
+    skiplist_enter_ref(skl, "chr1");
+    REQUIRE(!skiplist_is_skip_position(skl, 9550 - 50));
+    skiplist_enter_ref(skl, "chr1");
+    REQUIRE(skiplist_is_skip_position(skl, 9550));
+    REQUIRE(skiplist_is_skip_position(skl, 12000));
+    REQUIRE(!skiplist_is_skip_position(skl, 20000));
+    /* jumping back */
+    REQUIRE(skiplist_is_skip_position(skl, 2100));
+    REQUIRE(!skiplist_is_skip_position(skl, 1000));
+    REQUIRE(!skiplist_is_skip_position(skl, 30000));
+}
+
+FIXTURE_TEST_CASE(Skiplist_ShardedEqualsSequential, RegionsFixture)
+{
+    Make(MANY_REGIONS, 10000);
+    REQUIRE(skl != NULL);
+    vector<bool> seq = Sequential("chr1", 25000);
+    const uint64_t sizes[] = { 1, 7, 333, 1000, 4096, 30000 };
+    for (size_t i = 0; i < sizeof sizes / sizeof sizes[0]; ++i)
+    {
+        REQUIRE(Sharded("chr1", 25000, sizes[i], false) == seq);
+        REQUIRE(Sharded("chr1", 25000, sizes[i], true) == seq);
+    }
+    vector<bool> seq2 = Sequential("chr2", 500);
+    REQUIRE(seq2[250]);
+    REQUIRE(Sharded("chr2", 500, 100, true) == seq2);
+}
+
+FIXTURE_TEST_CASE(Skiplist_MergeDistance, RegionsFixture)
+{
+    /* gaps not shorter than the merge-distance stay separate regions, nothing to skip there */
+    Make(MANY_REGIONS, 1000);
+    REQUIRE(skl != NULL);
+    vector<bool> seq = Sequential("chr1", 25000);
+    for (uint64_t pos = 1; pos <= 25000; ++pos)
+    {
+        bool gap = (pos >= 2001 && pos <= 2499) || (pos >= 9501 && pos <= 9599) ||
+                   (pos >= 9701 && pos <= 9799);
+        REQUIRE_EQ((bool)seq[pos], gap);
+    }
+    REQUIRE(Sharded("chr1", 25000, 97, true) == seq);
+}
+
+FIXTURE_TEST_CASE(Skiplist_NoMerge, RegionsFixture)
+{
+    Make(MANY_REGIONS, 0);
+    REQUIRE(skl == NULL);
+    REQUIRE(!skiplist_is_skip_position(skl, 2100));
+}
+
+FIXTURE_TEST_CASE(Skiplist_UnknownReference, RegionsFixture)
+{
+    Make(MANY_REGIONS, 10000);
+    REQUIRE(skl != NULL);
+    skiplist_enter_ref(skl, "chr1");
+    REQUIRE(skiplist_is_skip_position(skl, 2100));
+    skiplist_enter_ref(skl, "chrX");
+    REQUIRE(!skiplist_is_skip_position(skl, 2100));
+}
+
+//////////////////////////////////////////// Main
+#include <kapp/args.h>
+
+extern "C"
+{
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+
+const char UsageDefaultName[] = "test-ref-regions";
+
+rc_t CC UsageSummary (const char * progname)
+{
+    return KOutMsg ( "Usage:\n" "\t%s [options]\n\n", progname );
+}
+
+rc_t CC Usage( const Args* args )
+{
+    return 0;
+}
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    rc_t rc = RefRegionsTestSuite(argc, argv);
+    return rc;
+}
+
+}
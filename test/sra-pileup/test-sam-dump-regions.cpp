@@ -0,0 +1,225 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+/**
+* sam-dump's regions: the parsers of --aligned-region and --regions-file and the merging of the regions
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/out.h>
+#include <klib/rc.h>
+#include <klib/container.h>
+
+#include <sysalloc.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+extern "C" {
+#include "../../tools/sra-pileup/sam-dump-opts.h"
+}
+
+using namespace std;
+
+TEST_SUITE(SamDumpRegionsTestSuite);
+
+static rc_t CC on_reference(const char * name, Vector * ranges, void * data)
+{
+    string * res = (string *)data;
+    *res += name;
+    *res += ":";
+    for (uint32_t i = VectorStart(ranges); i < VectorStart(ranges) + VectorLength(ranges); ++i)
+    {
+        const range * r = (const range *)VectorGet(ranges, i);
+        char tmp[64];
+        if (r->end == RANGE_OPEN_END)
+            sprintf(tmp, "%s%lu-*", i > VectorStart(ranges) ? "," : "", (unsigned long)r->start);
+        else
+            sprintf(tmp, "%s%lu-%lu", i > VectorStart(ranges) ? "," : "",
+                    (unsigned long)r->start, (unsigned long)r->end);
+        *res += tmp;
+    }
+    *res += " ";
+    return 0;
+}
+
+class RegionsFixture
+{
+public:
+    RegionsFixture()
+    {
+        BSTreeInit(&regions);
+    }
+    ~RegionsFixture()
+    {
+        free_ref_regions(&regions);
+    }
+    void Add(const char * const * defs)
+    {
+        for (size_t i = 0; defs[i] != NULL; ++i)
+        {
+            if (parse_and_add_region(&regions, defs[i]) != 0)
+                throw logic_error("parse_and_add_region failed");
+        }
+    }
+    rc_t AddFile(const char * content)
+    {
+        FILE * f = fopen(FILE_NAME, "w");
+        if (f == NULL)
+            throw logic_error("cannot create the region-file");
+        fputs(content, f);
+        fclose(f);
+        rc_t rc = add_regions_from_file(&regions, FILE_NAME);
+        remove(FILE_NAME);
+        return rc;
+    }
+    /* all references after check_ref_regions(), as "name:start-end,start-end... " */
+    string Ranges()
+    {
+        string res;
+        check_ref_regions(&regions);
+        if (foreach_reference(&regions, on_reference, &res) != 0)
+            throw logic_error("foreach_reference failed");
+        return res;
+    }
+
+    static const char * FILE_NAME;
+    BSTree regions;
+};
+
+const char * RegionsFixture::FILE_NAME = "test-sam-dump-regions.bed";
+
+FIXTURE_TEST_CASE(NameFromTo_IsOneBased, RegionsFixture)
+{
+    const char * defs[] = { "chr1:100-200", "chr2:1-1", "chr3:200-100", NULL };
+    Add(defs);
+    REQUIRE_EQ(Ranges(), string("chr1:99-199 chr2:0-0 chr3:99-199 "));
+}
+
+FIXTURE_TEST_CASE(NameFromTo_WithoutEnd, RegionsFixture)
+{
+    const char * defs[] = { "chr1:300", "chr2", "chr3:1-", NULL };
+    Add(defs);
+    REQUIRE_EQ(Ranges(), string("chr1:299-* chr2:0-* chr3:0-* "));
+}
+
+FIXTURE_TEST_CASE(Bed_IsZeroBasedWithExclusiveEnd, RegionsFixture)
+{
+    REQUIRE_RC(AddFile("chr1\t99\t200\nchr2\t0\t1\nchr3\t9\t10\n"));
+    REQUIRE_EQ(Ranges(), string("chr1:99-199 chr2:0-0 chr3:9-9 "));
+}
+
+FIXTURE_TEST_CASE(Bed_FirstBaseIsNotTheWholeReference, RegionsFixture)
+{
+    const char * defs[] = { "chr2", NULL };
+    Add(defs);
+    REQUIRE_RC(AddFile("chr1\t0\t1\n"));
+    REQUIRE_EQ(Ranges(), string("chr1:0-0 chr2:0-* "));
+}
+
+FIXTURE_TEST_CASE(Bed_EqualsNameFromTo, RegionsFixture)
+{
+    REQUIRE_RC(AddFile("chr1 99 200\nchr1 499 700\nchr2 0 1\n"));
+    string from_file = Ranges();
+    free_ref_regions(&regions);
+    BSTreeInit(&regions);
+    const char * defs[] = { "chr1:100-200", "chr1:500-700", "chr2:1-1", NULL };
+    Add(defs);
+    REQUIRE_EQ(Ranges(), from_file);
+}
+
+FIXTURE_TEST_CASE(Bed_CommentsAndBlankLines, RegionsFixture)
+{
+    REQUIRE_RC(AddFile("# regions\n"
+                       "\n"
+                       "  \t \n"
+                       "track name=regions description=\"a test\"\n"
+                       "browser position chr1:1-1000\n"
+                       "chr1\t9\t20\tregion-1\t0\t+\r\n"
+                       "chr1\t50\t50\n"
+                       "#chr1\t60\t70\n"));
+    /* the empty range 50..50 is skipped */
+    REQUIRE_EQ(Ranges(), string("chr1:9-19 "));
+    REQUIRE_EQ(count_ref_regions(&regions), 1u);
+}
+
+FIXTURE_TEST_CASE(Bed_Invalid, RegionsFixture)
+{
+    REQUIRE_RC_FAIL(AddFile("chr1\t20\t10\n"));
+    REQUIRE_RC_FAIL(AddFile("chr1\t20\n"));
+    REQUIRE_RC_FAIL(AddFile("chr1\tx\t10\n"));
+    REQUIRE_RC_FAIL(AddFile("chr1:1-10\n"));
+}
+
+FIXTURE_TEST_CASE(UnsortedOverlappingAreMerged, RegionsFixture)
+{
+    const char * defs[] = { "chr1:500-600", "chr1:100-200", "chr1:1000-1100", "chr1:150-300",
+                            "chr1:550-700", NULL };
+    Add(defs);
+    REQUIRE_RC(AddFile("chr1\t299\t310\nchr1\t310\t320\nchr2\t100\t200\nchr2\t150\t250\n"));
+    /* touching ranges stay apart, they have no base in common */
+    REQUIRE_EQ(Ranges(), string("chr1:99-309,310-319,499-699,999-1099 chr2:100-249 "));
+    REQUIRE_EQ(count_ref_regions(&regions), 5u);
+}
+
+FIXTURE_TEST_CASE(OpenEndSwallowsTheRangesBehindIt, RegionsFixture)
+{
+    const char * defs[] = { "chr1:1000-1100", "chr1:500", "chr1:100-200", "chr1:400-600", NULL };
+    Add(defs);
+    REQUIRE_EQ(Ranges(), string("chr1:99-199,399-* "));
+}
+
+//////////////////////////////////////////// Main
+#include <kapp/args.h>
+
+extern "C"
+{
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+
+const char UsageDefaultName[] = "test-sam-dump-regions";
+
+rc_t CC UsageSummary (const char * progname)
+{
+    return KOutMsg ( "Usage:\n" "\t%s [options]\n\n", progname );
+}
+
+rc_t CC Usage( const Args* args )
+{
+    return 0;
+}
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    rc_t rc = SamDumpRegionsTestSuite(argc, argv);
+    return rc;
+}
+
+}
@@ -0,0 +1,208 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+/**
+* the ordered shard-scheduler of sam-dump and sra-pileup: order of the writes, window, failures
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/out.h>
+#include <klib/rc.h>
+#include <klib/time.h>
+#include <atomic32.h>
+
+#include <sysalloc.h>
+#include <cstdlib>
+#include <vector>
+
+extern "C" {
+#include "../../tools/sra-pileup/shard_sched.h"
+}
+
+using namespace std;
+
+TEST_SUITE(ShardSchedTestSuite);
+
+static rc_t const WalkError = RC(rcApp, rcData, rcProcessing, rcData, rcCorrupt);
+static rc_t const WriteError = RC(rcApp, rcData, rcWriting, rcData, rcInvalid);
+
+// what the callbacks saw, checked after run_shards() returned
+struct Shards
+{
+    Shards(uint32_t count, uint32_t threads)
+        : walked(count, 0), threads(threads), failWalkAt(count), failWriteAt(count)
+    {
+        atomic32_set(&written, 0);
+        atomic32_set(&outOfWindow, 0);
+        atomic32_set(&maxWalked, 0);
+    }
+
+    vector<uint32_t> walked;    // how often each shard was walked, every one on its own slot
+    vector<uint32_t> order;     // the shards in the order they were written
+    uint32_t threads;
+    uint32_t failWalkAt;
+    uint32_t failWriteAt;
+    atomic32_t written;
+    atomic32_t maxWalked;
+    atomic32_t outOfWindow;
+};
+
+struct Worker
+{
+    Shards * shards;
+    uint32_t walks;
+};
+
+static rc_t OnWalk(void * worker, uint32_t idx)
+{
+    Worker * self = (Worker *)worker;
+    Shards * s = self->shards;
+
+    // the workers stay no more than 2 x threads shards ahead of the writer
+    if (idx >= (uint32_t)atomic32_read(&s->written) + 2 * s->threads)
+        atomic32_set(&s->outOfWindow, 1);
+    s->walked[idx]++;
+    self->walks++;
+    for (int m = atomic32_read(&s->maxWalked); m < (int)idx + 1; m = atomic32_read(&s->maxWalked))
+        atomic32_test_and_set(&s->maxWalked, idx + 1, m);
+    // shards take different times, so they finish out of order
+    if (rand() % 4 == 0)
+        KSleepMs(1);
+    return idx == s->failWalkAt ? WalkError : 0;
+}
+
+static rc_t OnWrite(void * data, uint32_t idx)
+{
+    Shards * s = (Shards *)data;
+    s->order.push_back(idx);
+    atomic32_inc(&s->written);
+    return idx == s->failWriteAt ? WriteError : 0;
+}
+
+static rc_t Run(Shards & s, vector<Worker> & workers)
+{
+    workers.assign(s.threads, Worker());
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].shards = &s;
+        workers[i].walks = 0;
+    }
+    return run_shards((uint32_t)s.walked.size(), &workers[0], sizeof(workers[0]), s.threads,
+                      OnWalk, OnWrite, &s);
+}
+
+TEST_CASE(ShardSched_WritesInOrder)
+{
+    Shards s(300, 4);
+    vector<Worker> workers;
+    REQUIRE_RC(Run(s, workers));
+
+    REQUIRE_EQ(s.order.size(), s.walked.size());
+    for (uint32_t i = 0; i < s.order.size(); ++i) {
+        REQUIRE_EQ(s.order[i], i);
+        REQUIRE_EQ(s.walked[i], 1u);
+    }
+    REQUIRE_EQ(atomic32_read(&s.outOfWindow), 0);
+    uint32_t walks = 0;
+    for (size_t i = 0; i < workers.size(); ++i)
+        walks += workers[i].walks;
+    REQUIRE_EQ(walks, 300u);
+}
+
+TEST_CASE(ShardSched_OneThread)
+{
+    Shards s(20, 1);
+    vector<Worker> workers;
+    REQUIRE_RC(Run(s, workers));
+    REQUIRE_EQ(s.order.size(), (size_t)20);
+    REQUIRE_EQ(workers[0].walks, 20u);
+    REQUIRE_EQ(atomic32_read(&s.outOfWindow), 0);
+}
+
+TEST_CASE(ShardSched_NoShards)
+{
+    Shards s(0, 4);
+    vector<Worker> workers;
+    REQUIRE_RC(Run(s, workers));
+    REQUIRE(s.order.empty());
+}
+
+TEST_CASE(ShardSched_WalkError)
+{
+    Shards s(300, 4);
+    s.failWalkAt = 50;
+    vector<Worker> workers;
+    REQUIRE_EQ(Run(s, workers), WalkError);
+
+    // the shards before the failed one are written, none after it
+    REQUIRE_EQ(s.order.size(), (size_t)50);
+    for (uint32_t i = 0; i < s.order.size(); ++i)
+        REQUIRE_EQ(s.order[i], i);
+    // and no more shards are handed out than the window allows
+    REQUIRE_GE(50u + 2 * s.threads, (uint32_t)atomic32_read(&s.maxWalked));
+}
+
+TEST_CASE(ShardSched_WriteError)
+{
+    Shards s(300, 4);
+    s.failWriteAt = 10;
+    vector<Worker> workers;
+    REQUIRE_EQ(Run(s, workers), WriteError);
+
+    REQUIRE_EQ(s.order.size(), (size_t)11);
+    REQUIRE_GE(11u + 2 * s.threads, (uint32_t)atomic32_read(&s.maxWalked));
+}
+
+//////////////////////////////////////////// Main
+#include <kapp/args.h>
+
+extern "C"
+{
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+
+const char UsageDefaultName[] = "test-shard-sched";
+
+rc_t CC UsageSummary (const char * progname)
+{
+    return KOutMsg ( "Usage:\n" "\t%s [options]\n\n", progname );
+}
+
+rc_t CC Usage( const Args* args )
+{
+    return 0;
+}
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    rc_t rc = ShardSchedTestSuite(argc, argv);
+    return rc;
+}
+
+}
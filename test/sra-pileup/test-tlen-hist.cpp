@@ -0,0 +1,173 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+/**
+* the template-length histogram of sra-pileup's stat function against a sorted window
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/out.h>
+
+#include <sysalloc.h>
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <vector>
+
+extern "C" {
+#include "../../tools/sra-pileup/tlen_hist.h"
+}
+
+using namespace std;
+
+TEST_SUITE(TlenHistTestSuite);
+
+class HistFixture
+{
+public:
+    HistFixture()
+    {
+        srand(12345);
+        if (tlen_hist_init(&hist) != 0)
+            throw logic_error("tlen_hist_init failed");
+    }
+    ~HistFixture()
+    {
+        tlen_hist_finish(&hist);
+    }
+    // every order statistic of the histogram against the sorted window
+    bool Same() const
+    {
+        vector<uint32_t> sorted(window.begin(), window.end());
+        sort(sorted.begin(), sorted.end());
+        if (tlen_hist_count(&hist) != sorted.size())
+            return false;
+        for (uint32_t k = 0; k != sorted.size(); ++k) {
+            if (tlen_hist_kth(&hist, k) != sorted[k])
+                return false;
+        }
+        return true;
+    }
+    void Insert(uint32_t value)
+    {
+        window.push_back(value);
+        if (tlen_hist_insert(&hist, value) != 0)
+            throw logic_error("tlen_hist_insert failed");
+    }
+    void RemoveOldest()
+    {
+        tlen_hist_remove(&hist, window.front());
+        window.pop_front();
+    }
+    tlen_hist hist;
+    deque<uint32_t> window;
+};
+
+// mostly small template-lengths, some on the bucket edges, some beyond TLEN_HIST_LIMIT
+static uint32_t RandomTlen()
+{
+    switch (rand() % 8) {
+    case 0:  return TLEN_HIST_LIMIT + rand() % 100;
+    case 1:  return (rand() % 16) << (rand() % 4 * 4);
+    case 2:  return TLEN_HIST_LIMIT - 1 - rand() % 4;
+    default: return 1 + rand() % 1000;
+    }
+}
+
+FIXTURE_TEST_CASE(TlenHist_Empty, HistFixture)
+{
+    REQUIRE_EQ(tlen_hist_count(&hist), 0u);
+    Insert(5);
+    RemoveOldest();
+    REQUIRE(Same());
+}
+
+FIXTURE_TEST_CASE(TlenHist_Duplicates, HistFixture)
+{
+    for (unsigned i = 0; i != 100; ++i) {
+        Insert(300);
+        Insert(TLEN_HIST_LIMIT + 7);
+    }
+    REQUIRE(Same());
+    REQUIRE_EQ(tlen_hist_kth(&hist, 99), 300u);
+    REQUIRE_EQ(tlen_hist_kth(&hist, 100), (uint32_t)TLEN_HIST_LIMIT + 7);
+}
+
+FIXTURE_TEST_CASE(TlenHist_SlidingWindow, HistFixture)
+{
+    for (unsigned round = 0; round != 2000; ++round) {
+        unsigned const adds = rand() % 20;
+        for (unsigned i = 0; i != adds; ++i)
+            Insert(RandomTlen());
+        while (window.size() > 300)
+            RemoveOldest();
+        REQUIRE(Same());
+    }
+}
+
+FIXTURE_TEST_CASE(TlenHist_Clear, HistFixture)
+{
+    for (unsigned i = 0; i != 1000; ++i)
+        Insert(RandomTlen());
+    tlen_hist_clear(&hist);
+    window.clear();
+    REQUIRE(Same());
+    for (unsigned i = 0; i != 1000; ++i)
+        Insert(RandomTlen());
+    REQUIRE(Same());
+}
+
+//////////////////////////////////////////// Main
+#include <kapp/args.h>
+
+extern "C"
+{
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+
+const char UsageDefaultName[] = "test-tlen-hist";
+
+rc_t CC UsageSummary (const char * progname)
+{
+    return KOutMsg ( "Usage:\n" "\t%s [options]\n\n", progname );
+}
+
+rc_t CC Usage( const Args* args )
+{
+    return 0;
+}
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    rc_t rc = TlenHistTestSuite(argc, argv);
+    return rc;
+}
+
+}
@@ -0,0 +1,73 @@
+#!/usr/bin/env python
+
+import sys, getopt, subprocess
+
+
+def pileup( sra_pileup, acc, regions, merge_dist, threads, shard_size ) :
+    cmd = [ sra_pileup, acc, '--merge-dist', str( merge_dist ) ]
+    for r in regions :
+        cmd += [ '-r', r ]
+    if threads != None :
+        cmd += [ '--threads', str( threads ), '--shard-size', str( shard_size ) ]
+    p = subprocess.Popen( cmd, stdout = subprocess.PIPE )
+    out = p.communicate()[ 0 ]
+    if p.returncode != 0 :
+        print ' '.join( cmd ), ' failed with ', p.returncode
+        sys.exit( 3 )
+    return out.splitlines()
+
+
+def usage() :
+    print sys.argv[ 0 ], ' -a <accession> -r <region> [-r <region>...] -d <merge-dist> -t <threads> -s <shard-size> -p <sra-pileup-binary>'
+
+
+if __name__ == '__main__':
+    acc = 'SRR341578'
+    regions = []
+    merge_dist = 10000
+    threads = 4
+    shard_size = 5000
+    sra_pileup = 'sra-pileup'
+
+    short_opts = "ha:r:d:t:s:p:"
+    long_opts = [ "acc=", "region=", "merge_dist=", "threads=", "shard_size=", "sra_pileup=" ]
+    try :
+        opts, args = getopt.getopt( sys.argv[ 1: ], short_opts, long_opts )
+    except getopt.GetoptError :
+        usage()
+        sys.exit( 2 )
+    for opt, arg in opts :
+        if opt == '-h' :
+            usage()
+            sys.exit()
+        elif opt in ( "-a", "--acc" ) :
+            acc = arg
+        elif opt in ( "-r", "--region" ) :
+            regions.append( arg )
+        elif opt in ( "-d", "--merge_dist" ) :
+            merge_dist = int( arg )
+        elif opt in ( "-t", "--threads" ) :
+            threads = int( arg )
+        elif opt in ( "-s", "--shard_size" ) :
+            shard_size = int( arg )
+        elif opt in ( "-p", "--sra_pileup" ) :
+            sra_pileup = arg
+
+    print 'accession = ', acc
+    print 'regions   = ', regions
+    print 'merge-dist = ', merge_dist, ' threads = ', threads, ' shard-size = ', shard_size
+
+    seq = pileup( sra_pileup, acc, regions, merge_dist, None, None )
+    par = pileup( sra_pileup, acc, regions, merge_dist, threads, shard_size )
+
+    print "sequential : ", len( seq ), " lines"
+    print "sharded    : ", len( par ), " lines"
+    if seq != par :
+        for i in range( min( len( seq ), len( par ) ) ) :
+            if seq[ i ] != par[ i ] :
+                print "first difference in line ", i + 1
+                print "sequential : ", seq[ i ]
+                print "sharded    : ", par[ i ]
+                break
+        print "the sharded pileup differs from the sequential one!"
+        sys.exit( 3 )
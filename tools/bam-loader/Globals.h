@@ -29,6 +29,13 @@ enum LoaderModes {
     mode_Remap
 };
 
+/* where the per-spot id2value array lives */
+enum IdMapModes {
+    idmap_File,     /* unlinked file in tmpfs, mapped a chunk at a time */
+    idmap_Memory,   /* reserved anonymous memory, THP advised, prefaulted */
+    idmap_HugeTLB   /* like idmap_Memory but chunks on explicit huge pages */
+};
+
 typedef struct globals
 {
     char const *inpath;
@@ -36,6 +43,7 @@ typedef struct globals
     char const *outname;
     char const *firstOut;
     char const *tmpfs;
+    char const *headerCachePath; /* where parsed BAM headers are kept between runs */
     
     struct KFile *noMatchLog;
     
@@ -60,10 +68,13 @@ typedef struct globals
     unsigned maxWarnCount_NoMatch;
     unsigned maxWarnCount_DupConflict;
     unsigned pid;
+    unsigned inflateThreads; /* BGZF decompression threads, 0 = on the reading thread */
+    unsigned parallelFiles; /* input files being read at the same time */
     unsigned minMatchCount; /* minimum number of matches to count as an alignment */
     int minMapQual;
     enum LoaderModes mode;
     enum LoaderModes globalMode;
+    enum IdMapModes idMapMode;
     uint32_t maxSeqLen;
     bool omit_aligned_reads;
     bool omit_reference_reads;
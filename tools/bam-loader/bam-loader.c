@@ -66,6 +66,10 @@ Global Options:
 * options effecting performance optimisation
   tmpfs <directory>                 where to store temparary files, default: '/tmp'
   cache-size <mbytes>               the limit in MB for temparary files
+  inflate-threads <count>           threads decompressing the BAM file, 0 to decompress on the reading thread, default: half the cpus, at most 8
+  parallel-files <count>            input files read at the same time, default: 1
+  header-cache <directory>          where to keep parsed BAM headers for reuse by later loads
+  id-map <file|memory|hugetlb>      where to keep per-spot data, default: file ( in tmpfs )
 
 * options effecting error limits
   max-err-count <number>            the maximum number of errors to ignore
@@ -149,6 +153,10 @@ static char const option_accept_hard_clip[] = "accept-hard-clip";
 static char const option_allow_multi_map[] = "allow-multi-map";
 static char const option_allow_secondary[] = "make-spots-with-secondary";
 static char const option_defer_secondary[] = "defer-secondary";
+static char const option_inflate_threads[] = "inflate-threads";
+static char const option_parallel_files[] = "parallel-files";
+static char const option_header_cache[] = "header-cache";
+static char const option_id_map[] = "id-map";
 
 #define OPTION_INPUT option_input
 #define OPTION_OUTPUT option_output
@@ -174,6 +182,10 @@ static char const option_defer_secondary[] = "defer-secondary";
 #define OPTION_ALLOW_MULTI_MAP option_allow_multi_map
 #define OPTION_ALLOW_SECONDARY option_allow_secondary
 #define OPTION_DEFER_SECONDARY option_defer_secondary
+#define OPTION_INFLATE_THREADS option_inflate_threads
+#define OPTION_PARALLEL_FILES option_parallel_files
+#define OPTION_HEADER_CACHE option_header_cache
+#define OPTION_ID_MAP option_id_map
 
 #define ALIAS_INPUT  "i"
 #define ALIAS_OUTPUT "o"
@@ -261,6 +273,40 @@ char const * mrc_usage[] =
     NULL
 };
 
+static
+char const * inflate_threads_usage[] = 
+{
+    "Set the number of threads decompressing the BAM file",
+    "0 decompresses on the reading thread",
+    NULL
+};
+
+static
+char const * parallel_files_usage[] = 
+{
+    "Set the number of input files read at the same time",
+    "records are still loaded in the order of the files",
+    NULL
+};
+
+static
+char const * header_cache_usage[] = 
+{
+    "Directory where parsed BAM headers are kept",
+    "later loads of files with the same header skip parsing it",
+    NULL
+};
+
+static
+char const * id_map_usage[] = 
+{
+    "Where to keep the per-spot data used to match mates:",
+    "'file': a file in tmpfs, mapped as it grows ( default );",
+    "'memory': reserved memory with transparent huge pages, interleaved over NUMA nodes;",
+    "'hugetlb': like 'memory' but using the huge pages reserved by the system first",
+    NULL
+};
+
 static
 char const * mec_usage[] = 
 {
@@ -458,7 +504,11 @@ OptDef Options[] =
     { OPTION_ACCEPT_HARD_CLIP, NULL, NULL, use_accept_hard_clip, 1, false, false },
     { OPTION_ALLOW_MULTI_MAP, NULL, NULL, use_allow_multi_map, 1, false, false },
     { OPTION_ALLOW_SECONDARY, NULL, NULL, use_allow_secondary, 1, false, false },
-    { OPTION_DEFER_SECONDARY, NULL, NULL, use_defer_secondary, 1, false, false }
+    { OPTION_DEFER_SECONDARY, NULL, NULL, use_defer_secondary, 1, false, false },
+    { OPTION_INFLATE_THREADS, NULL, NULL, inflate_threads_usage, 1, true, false },
+    { OPTION_PARALLEL_FILES, NULL, NULL, parallel_files_usage, 1, true, false },
+    { OPTION_HEADER_CACHE, NULL, NULL, header_cache_usage, 1, true, false },
+    { OPTION_ID_MAP, NULL, NULL, id_map_usage, 1, true, false }
 };
 
 const char* OptHelpParam[] =
@@ -496,7 +546,11 @@ const char* OptHelpParam[] =
     NULL,				/* allow hard clipping */
     NULL,				/* allow multimapping */
     NULL,				/* allow secondary */
-    NULL				/* defer secondary */
+    NULL,				/* defer secondary */
+    "count",			/* inflate threads */
+    "count",			/* parallel files */
+    "path",				/* header cache */
+    "mode"				/* id map */
 };
 
 rc_t UsageSummary (char const * progname)
@@ -567,6 +621,18 @@ static void set_pid(void)
     G.pid = getpid();
 }
 
+/* half of the cpus, the other half parse and write */
+static unsigned DefaultInflateThreads(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long const cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    
+    if (cpus > 1)
+        return cpus / 2 < 8 ? (unsigned)(cpus / 2) : 8;
+#endif
+    return 1;
+}
+
 static rc_t PathWithBasePath(char rslt[], size_t sz, char const path[], char const base[])
 {
     size_t const plen = strlen(path);
@@ -922,6 +988,60 @@ static rc_t main_1(int argc, char *argv[], bool const continuing, unsigned const
             G.maxErrCount = strtoul(value, &dummy, 0);
         }
         
+        rc = ArgsOptionCount (args, OPTION_INFLATE_THREADS, &pcount);
+        if (rc)
+            break;
+        if (pcount == 1)
+        {
+            rc = ArgsOptionValue (args, OPTION_INFLATE_THREADS, 0, (const void **)&value);
+            if (rc)
+                break;
+            G.inflateThreads = strtoul(value, &dummy, 0);
+        }
+        
+        rc = ArgsOptionCount (args, OPTION_PARALLEL_FILES, &pcount);
+        if (rc)
+            break;
+        if (pcount == 1)
+        {
+            rc = ArgsOptionValue (args, OPTION_PARALLEL_FILES, 0, (const void **)&value);
+            if (rc)
+                break;
+            G.parallelFiles = strtoul(value, &dummy, 0);
+        }
+        
+        rc = ArgsOptionCount (args, OPTION_HEADER_CACHE, &pcount);
+        if (rc)
+            break;
+        if (pcount == 1)
+        {
+            rc = getArgValue(args, OPTION_HEADER_CACHE, 0, &G.headerCachePath);
+            if (rc)
+                break;
+        }
+        
+        rc = ArgsOptionCount (args, OPTION_ID_MAP, &pcount);
+        if (rc)
+            break;
+        if (pcount == 1)
+        {
+            rc = ArgsOptionValue (args, OPTION_ID_MAP, 0, (const void **)&value);
+            if (rc)
+                break;
+            if (strcmp(value, "file") == 0)
+                G.idMapMode = idmap_File;
+            else if (strcmp(value, "memory") == 0)
+                G.idMapMode = idmap_Memory;
+            else if (strcmp(value, "hugetlb") == 0)
+                G.idMapMode = idmap_HugeTLB;
+            else {
+                rc = RC(rcApp, rcArgv, rcAccessing, rcParam, rcIncorrect);
+                OUTMSG (("id-map: bad value\n"));
+                MiniUsage (args);
+                break;
+            }
+        }
+        
         rc = ArgsOptionCount (args, OPTION_MIN_MATCH, &pcount);
         if (rc)
             break;
@@ -1120,6 +1240,7 @@ static void cleanupGlobal(void)
         free((void *)G.refFiles);
     }
     free((void *)G.tmpfs);
+    free((void *)G.headerCachePath);
     free((void *)G.inpath);
     free((void *)G.refFilter);
     free((void *)G.refXRefPath);
@@ -1247,6 +1368,8 @@ rc_t CC KMain(int argc, char *argv[])
     G.tmpfs = strdup("/tmp");
     G.cache_size = ((size_t)16) << 30;
     G.maxErrCount = 1000;
+    G.inflateThreads = DefaultInflateThreads();
+    G.parallelFiles = 1;
     G.minMatchCount = 10;
     
     set_pid();
@@ -31,6 +31,7 @@ typedef struct BAMIndex BAMIndex;
 typedef struct BufferedFile BufferedFile;
 typedef struct SAMFile SAMFile;
 typedef struct BGZFile BGZFile;
+typedef struct BGZFilePool BGZFilePool;
 
 #define ZLIB_BLOCK_SIZE  (64u * 1024u)
 #define RGLR_BUFFER_SIZE (16u * ZLIB_BLOCK_SIZE)
@@ -61,6 +62,9 @@ struct BufferedFile {
 
 struct SAMFile {
     BufferedFile file;
+    char *line;         /* holds lines that span buffer reads */
+    size_t linemax;
+    unsigned lastRef;   /* most recently matched RNAME */
     int putback;
     rc_t last;
 };
@@ -68,6 +72,7 @@ struct SAMFile {
 struct BGZFile {
     BufferedFile file;
     z_stream zs;
+    BGZFilePool *pool;  /* if not NULL, blocks are inflated by its threads */
 };
 
 struct BAM_File {
@@ -85,6 +90,7 @@ struct BAM_File {
     char const *header;
     void *headerData1;          /* gets used for refSeq and readGroup */
     void *headerData2;          /* gets used for refSeq */
+    struct KMMap const *headerMap; /* the parsed header, if it came from the cache */
     BAM_Alignment *nocopy;       /* used to hold current record for BAM_FileRead2 */
 
     uint64_t fpos_cur;
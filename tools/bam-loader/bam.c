@@ -35,6 +35,9 @@
 #include <klib/log.h>
 #include <klib/text.h>
 #include <klib/refcount.h>
+#include <kproc/thread.h>
+#include <kproc/lock.h>
+#include <kproc/cond.h>
 #include <sysalloc.h>
 
 #include <atomic32.h>
@@ -50,6 +53,7 @@
 #include <ctype.h>
 #include <math.h>
 #include <assert.h>
+#include <unistd.h>
 #if 1
 /*_DEBUGGING*/
 #include <stdio.h>
@@ -61,6 +65,11 @@
 
 #include <zlib.h>
 
+#if defined(__GNUC__) && defined(__SSE2__)
+#define HAVE_SSE2_SAM_SCAN 1
+#include <emmintrin.h>
+#endif
+
 #include "bam-priv.h"
 
 static rc_t BufferedFileRead(BufferedFile *const self)
@@ -134,6 +143,32 @@ static uint64_t BufferedFileGetSize(BufferedFile const *const self)
     return self->fmax;
 }
 
+/* copies the next len bytes of the file into dst; *copied < len only at eof */
+static rc_t BufferedFileCopy(BufferedFile *const self, size_t const len, uint8_t dst[], size_t *const copied)
+{
+    size_t cur = 0;
+
+    while (cur < len) {
+        size_t n;
+
+        if (self->bpos == self->bmax) {
+            rc_t const rc = BufferedFileRead(self);
+            if (rc)
+                return rc;
+            if (self->bmax == 0)
+                break;
+        }
+        n = self->bmax - self->bpos;
+        if (n > len - cur)
+            n = len - cur;
+        memmove(&dst[cur], &((uint8_t const *)self->buf)[self->bpos], n);
+        self->bpos += n;
+        cur += n;
+    }
+    *copied = cur;
+    return 0;
+}
+
 static int SAMFileRead1(SAMFile *const self)
 {
     if (self->putback < 0) {
@@ -165,6 +200,93 @@ static void SAMFilePutBack(SAMFile *const self, int ch)
         self->putback = ch;
 }
 
+static rc_t SAMFileGrowLine(SAMFile *const self, size_t const need)
+{
+    if (need > self->linemax) {
+        size_t const newmax = need < 4096 ? 4096 : (need + need / 2);
+        void *const tmp = realloc(self->line, newmax);
+
+        if (tmp == NULL)
+            return RC(rcAlign, rcFile, rcReading, rcMemory, rcExhausted);
+        self->line = tmp;
+        self->linemax = newmax;
+    }
+    return 0;
+}
+
+/* returns the next line without its line terminator (\n or \r\n);
+ * the line points into the read buffer whenever the whole line is in it
+ * and stays valid (and writable) until the next read from the file */
+static rc_t SAMFileReadLine(SAMFile *const self, char **const line, unsigned *const len)
+{
+    size_t have = 0;
+    char *rslt = NULL;
+
+    if (self->putback >= 0) {
+        rc_t const rc = SAMFileGrowLine(self, 1);
+        if (rc)
+            return rc;
+        self->line[have++] = self->putback;
+        self->putback = -1;
+    }
+    for ( ; ; ) {
+        char *buf;
+        char const *eol;
+        size_t avail;
+        size_t n;
+
+        if (self->file.bpos == self->file.bmax) {
+            rc_t const rc = BufferedFileRead(&self->file);
+
+            self->last = rc;
+            if (rc)
+                return rc;
+            if (self->file.bmax == 0) {
+                if (have == 0)
+                    return SILENT_RC(rcAlign, rcFile, rcReading, rcData, rcInsufficient);
+                rslt = self->line; /* last line has no line terminator */
+                break;
+            }
+        }
+        buf = &((char *)self->file.buf)[self->file.bpos];
+        avail = self->file.bmax - self->file.bpos;
+        eol = memchr(buf, '\n', avail);
+        n = eol ? (size_t)(eol - buf) : avail;
+        self->file.bpos += eol ? n + 1 : n;
+
+        if (eol && have == 0) {
+            rslt = buf;
+            have = n;
+            break;
+        }
+        {
+            rc_t const rc = SAMFileGrowLine(self, have + n);
+            if (rc)
+                return rc;
+        }
+        memmove(&self->line[have], buf, n);
+        have += n;
+        if (eol) {
+            rslt = self->line;
+            break;
+        }
+    }
+    if (have > 0 && rslt[have - 1] == '\r')
+        --have;
+    if (have >= UINT_MAX)
+        return RC(rcAlign, rcFile, rcReading, rcData, rcExcessive);
+    *line = rslt;
+    *len = (unsigned)have;
+    return 0;
+}
+
+static void SAMFileWhack(SAMFile *const self)
+{
+    free(self->line);
+    self->line = NULL;
+    self->linemax = 0;
+}
+
 static rc_t SAMFileInit(SAMFile *self, RawFile_vt *vt)
 {
     static RawFile_vt const my_vt = {
@@ -173,9 +295,12 @@ static rc_t SAMFileInit(SAMFile *self, RawFile_vt *vt)
         (float (*)(void const *))BufferedFileProPos,
         (uint64_t (*)(void const *))BufferedFileGetSize,
         (rc_t (*)(void *, uint64_t))BufferedFileSetPos,
-        (void (*)(void *))NULL
+        (void (*)(void *))SAMFileWhack
     };
     
+    self->line = NULL;
+    self->linemax = 0;
+    self->lastRef = 0;
     self->putback = -1;
     self->last = 0;
     *vt = my_vt;
@@ -207,6 +332,8 @@ static rc_t BGZFileGetMoreBytes(BGZFile *self)
     return 0;
 }
 
+static rc_t BGZFilePoolRead(BGZFile *self, zlib_block_t dst, unsigned *pNumRead);
+
 static rc_t BGZFileRead(BGZFile *self, zlib_block_t dst, unsigned *pNumRead)
 {
 #if VALIDATE_BGZF_HEADER
@@ -217,6 +344,9 @@ static rc_t BGZFileRead(BGZFile *self, zlib_block_t dst, unsigned *pNumRead)
     unsigned loops;
     int zr;
     
+    if (self->pool)
+        return BGZFilePoolRead(self, dst, pNumRead);
+
     *pNumRead = 0;
     if (self->file.bmax == 0 || self->zs.avail_in == 0) {
         rc = BGZFileGetMoreBytes(self);
@@ -309,8 +439,302 @@ static rc_t BGZFileRead(BGZFile *self, zlib_block_t dst, unsigned *pNumRead)
     return RC(rcAlign, rcFile, rcReading, rcFile, rcTooShort);
 }
 
+/* MARK: BGZFile inflate pool */
+
+/* Every BGZF block is a complete gzip member, so blocks can be inflated
+ * independently. With a pool, the reading thread only copies compressed
+ * blocks out of the file, the workers inflate them and the reading thread
+ * picks them up again in file order.
+ */
+
+#define BGZF_HEADER_SIZE (12u)  /* gzip header up to and including XLEN */
+#define BGZF_FOOTER_SIZE (8u)   /* CRC32 and ISIZE */
+#define BGZF_POOL_BLOCKS_PER_THREAD (4u)
+#define BGZF_POOL_MAX_THREADS (64u)
+
+typedef struct BGZFBlock {
+    uint64_t fend;          /* position in file after the compressed block */
+    rc_t rc;
+    unsigned zsize;         /* compressed size */
+    unsigned usize;         /* inflated size */
+    bool done;              /* guarded by the pool lock */
+    uint8_t zdata[ZLIB_BLOCK_SIZE];
+    zlib_block_t data;
+} BGZFBlock;
+
+typedef struct BGZFWorker {
+    BGZFilePool *pool;
+    KThread *thread;
+    z_stream zs;
+    bool zsInit;
+} BGZFWorker;
+
+struct BGZFilePool {
+    KLock *lock;
+    KCondition *queued;     /* a block was queued or the pool is quitting */
+    KCondition *inflated;   /* a block was inflated */
+    BGZFBlock *block;       /* ring of blocks, indexed by sequence number */
+    BGZFWorker *worker;
+    uint64_t filled;        /* blocks queued; written by the reading thread only */
+    uint64_t taken;         /* blocks taken by a worker */
+    uint64_t consumed;      /* blocks handed back; reading thread only */
+    uint64_t fpos;          /* position in file after the last block handed back */
+    rc_t rc;                /* error reading ahead, returned after the queued blocks */
+    unsigned blocks;
+    unsigned workers;
+    bool eof;
+    bool quitting;
+};
+
+/* copies the next compressed block out of the file; zsize is 0 at eof */
+static rc_t BGZFileReadBlock(BGZFile *const self, BGZFBlock *const b)
+{
+    uint8_t *const z = b->zdata;
+    unsigned xlen;
+    unsigned bsize = 0;
+    unsigned i;
+    size_t n = 0;
+    rc_t rc = BufferedFileCopy(&self->file, BGZF_HEADER_SIZE, z, &n);
+
+    b->zsize = 0;
+    b->usize = 0;
+    b->rc = 0;
+    if (rc || n == 0)
+        return rc;
+    if (n < BGZF_HEADER_SIZE)
+        return RC(rcAlign, rcFile, rcReading, rcFile, rcTooShort);
+    if (z[0] != 31 || z[1] != 139 || z[2] != 8 || (z[3] & 4) == 0) {
+        DBGMSG(DBG_ALIGN, DBG_FLAG(DBG_ALIGN_BGZF), ("GZIP Header not found\n"));
+        return RC(rcAlign, rcFile, rcReading, rcFile, rcCorrupt);
+    }
+    xlen = LE2HUI16(&z[10]);
+    if (BGZF_HEADER_SIZE + xlen + BGZF_FOOTER_SIZE > ZLIB_BLOCK_SIZE)
+        return RC(rcAlign, rcFile, rcReading, rcFormat, rcInvalid);
+
+    rc = BufferedFileCopy(&self->file, xlen, &z[BGZF_HEADER_SIZE], &n);
+    if (rc)
+        return rc;
+    if (n < xlen)
+        return RC(rcAlign, rcFile, rcReading, rcFile, rcTooShort);
+    for (i = 0; i + 4 <= xlen; ) {
+        uint8_t const *const sub = &z[BGZF_HEADER_SIZE + i];
+        unsigned const slen = LE2HUI16(&sub[2]);
+
+        if (sub[0] == 'B' && sub[1] == 'C' && slen == 2 && i + 6 <= xlen) {
+            bsize = 1 + LE2HUI16(&sub[4]);
+            break;
+        }
+        i += slen + 4;
+    }
+    if (bsize < BGZF_HEADER_SIZE + xlen + BGZF_FOOTER_SIZE) {
+        DBGMSG(DBG_ALIGN, DBG_FLAG(DBG_ALIGN_BGZF), ("BGZF Header extra field BC not found\n"));
+        return RC(rcAlign, rcFile, rcReading, rcFormat, rcInvalid); /* not BGZF */
+    }
+
+    n = bsize - BGZF_HEADER_SIZE - xlen;
+    rc = BufferedFileCopy(&self->file, n, &z[BGZF_HEADER_SIZE + xlen], &n);
+    if (rc)
+        return rc;
+    if (n < bsize - BGZF_HEADER_SIZE - xlen) {
+        DBGMSG(DBG_ALIGN, DBG_FLAG(DBG_ALIGN_BGZF), ("EOF in Zlib block after %lu bytes\n", BufferedFileGetPos(&self->file)));
+        return RC(rcAlign, rcFile, rcReading, rcFile, rcTooShort);
+    }
+    b->zsize = bsize;
+    b->fend = BufferedFileGetPos(&self->file);
+    return 0;
+}
+
+static rc_t BGZFBlockInflate(BGZFBlock *const b, z_stream *const zs)
+{
+    rc_t rc = 0;
+    int zr;
+
+    zs->next_in = (Bytef *)b->zdata;
+    zs->avail_in = b->zsize;
+    zs->next_out = (Bytef *)b->data;
+    zs->avail_out = sizeof(b->data);
+
+    zr = inflate(zs, Z_FINISH);
+    if (zr == Z_STREAM_END && zs->avail_in == 0)
+        b->usize = (unsigned)zs->total_out; /* <= 64k */
+    else {
+        DBGMSG(DBG_ALIGN, DBG_FLAG(DBG_ALIGN_BGZF), ("Unexpected Zlib result %i: %s\n", zr, zs->msg ? zs->msg : "unknown"));
+        rc = RC(rcAlign, rcFile, rcReading, rcFile, rcCorrupt);
+    }
+    zr = inflateReset(zs);
+    assert(zr == Z_OK);
+    return rc;
+}
+
+static rc_t CC BGZFilePoolWorkerMain(KThread const *const th, void *const vp)
+{
+    BGZFWorker *const self = vp;
+    BGZFilePool *const pool = self->pool;
+
+    KLockAcquire(pool->lock);
+    for ( ; ; ) {
+        BGZFBlock *b;
+
+        while (!pool->quitting && pool->taken == pool->filled)
+            KConditionWait(pool->queued, pool->lock);
+        if (pool->quitting)
+            break;
+        b = &pool->block[pool->taken++ % pool->blocks];
+        KLockUnlock(pool->lock);
+
+        b->rc = BGZFBlockInflate(b, &self->zs);
+
+        KLockAcquire(pool->lock);
+        b->done = true;
+        KConditionSignal(pool->inflated);
+    }
+    KLockUnlock(pool->lock);
+    return 0;
+}
+
+static void BGZFilePoolWhack(BGZFilePool *const self)
+{
+    unsigned i;
+
+    if (self->queued) {
+        KLockAcquire(self->lock);
+        self->quitting = true;
+        KConditionBroadcast(self->queued);
+        KLockUnlock(self->lock);
+    }
+    for (i = 0; i < self->workers; ++i) {
+        BGZFWorker *const w = &self->worker[i];
+
+        if (w->thread) {
+            KThreadWait(w->thread, NULL);
+            KThreadRelease(w->thread);
+        }
+        if (w->zsInit)
+            inflateEnd(&w->zs);
+    }
+    KConditionRelease(self->inflated);
+    KConditionRelease(self->queued);
+    KLockRelease(self->lock);
+    free(self->worker);
+    free(self->block);
+    free(self);
+}
+
+/* the pool continues reading at the current position of the file, which has
+ * to be at a block boundary; BGZFileRead leaves it there */
+static rc_t BGZFilePoolMake(BGZFilePool **const rslt, BGZFile const *const file, unsigned const workers)
+{
+    BGZFilePool *const self = calloc(1, sizeof(*self));
+    unsigned i;
+    rc_t rc;
+
+    if (self == NULL)
+        return RC(rcAlign, rcFile, rcConstructing, rcMemory, rcExhausted);
+
+    self->fpos = BufferedFileGetPos(&file->file);
+    self->workers = workers;
+    self->blocks = workers * BGZF_POOL_BLOCKS_PER_THREAD;
+    self->block = calloc(self->blocks, sizeof(self->block[0]));
+    self->worker = calloc(self->workers, sizeof(self->worker[0]));
+    if (self->block == NULL || self->worker == NULL) {
+        BGZFilePoolWhack(self);
+        return RC(rcAlign, rcFile, rcConstructing, rcMemory, rcExhausted);
+    }
+    rc = KLockMake(&self->lock);
+    if (rc == 0)
+        rc = KConditionMake(&self->inflated);
+    if (rc == 0)
+        rc = KConditionMake(&self->queued);
+    for (i = 0; rc == 0 && i < self->workers; ++i) {
+        BGZFWorker *const w = &self->worker[i];
+
+        w->pool = self;
+        switch (inflateInit2(&w->zs, MAX_WBITS + 16)) { /* max + enable gzip headers */
+        case Z_OK:
+            w->zsInit = true;
+            rc = KThreadMake(&w->thread, BGZFilePoolWorkerMain, w);
+            break;
+        case Z_MEM_ERROR:
+            rc = RC(rcAlign, rcFile, rcConstructing, rcMemory, rcExhausted);
+            break;
+        default:
+            rc = RC(rcAlign, rcFile, rcConstructing, rcNoObj, rcUnexpected);
+            break;
+        }
+    }
+    if (rc) {
+        BGZFilePoolWhack(self);
+        return rc;
+    }
+    DBGMSG(DBG_ALIGN, DBG_FLAG(DBG_ALIGN_BGZF), ("Inflating with %u threads from position %lu\n", workers, self->fpos));
+    *rslt = self;
+    return 0;
+}
+
+static rc_t BGZFilePoolRead(BGZFile *const self, zlib_block_t dst, unsigned *const pNumRead)
+{
+    BGZFilePool *const pool = self->pool;
+    BGZFBlock *b;
+
+    *pNumRead = 0;
+
+    /* read ahead into every free block */
+    while (!pool->eof && pool->filled - pool->consumed < pool->blocks) {
+        rc_t const rc = BGZFileReadBlock(self, &pool->block[pool->filled % pool->blocks]);
+
+        if (rc || pool->block[pool->filled % pool->blocks].zsize == 0) {
+            pool->rc = rc;
+            pool->eof = true;
+            break;
+        }
+        KLockAcquire(pool->lock);
+        ++pool->filled;
+        KConditionSignal(pool->queued);
+        KLockUnlock(pool->lock);
+    }
+    if (pool->consumed == pool->filled)
+        return pool->rc ? pool->rc : RC(rcAlign, rcFile, rcReading, rcData, rcInsufficient);
+
+    b = &pool->block[pool->consumed % pool->blocks];
+    KLockAcquire(pool->lock);
+    while (!b->done)
+        KConditionWait(pool->inflated, pool->lock);
+    b->done = false;
+    KLockUnlock(pool->lock);
+
+    ++pool->consumed;
+    pool->fpos = b->fend;
+    if (b->rc)
+        return b->rc;
+
+    memmove(dst, b->data, b->usize);
+    *pNumRead = b->usize;
+    return 0;
+}
+
+static uint64_t BGZFileGetPos(BGZFile const *const self)
+{
+    return self->pool ? self->pool->fpos : BufferedFileGetPos(&self->file);
+}
+
+static float BGZFileProPos(BGZFile const *const self)
+{
+    return self->file.fmax == 0 ? -1.0 : (BGZFileGetPos(self) / (double)self->file.fmax);
+}
+
+static rc_t BGZFileSetPos(BGZFile *const self, uint64_t const pos)
+{
+    if (self->pool)
+        return RC(rcAlign, rcFile, rcPositioning, rcFunction, rcUnsupported);
+    return BufferedFileSetPos(&self->file, pos);
+}
+
 static void BGZFileWhack(BGZFile *self)
 {
+    if (self->pool) {
+        BGZFilePoolWhack(self->pool);
+        self->pool = NULL;
+    }
     inflateEnd(&self->zs);
 }
 
@@ -319,10 +743,10 @@ static rc_t BGZFileInit(BGZFile *const self, RawFile_vt *const vt)
     int i;
     static RawFile_vt const my_vt = {
         (rc_t (*)(void *, zlib_block_t, unsigned *))BGZFileRead,
-        (uint64_t (*)(void const *))BufferedFileGetPos,
-        (float (*)(void const *))BufferedFileProPos,
+        (uint64_t (*)(void const *))BGZFileGetPos,
+        (float (*)(void const *))BGZFileProPos,
         (uint64_t (*)(void const *))BufferedFileGetSize,
-        (rc_t (*)(void *, uint64_t))BufferedFileSetPos,
+        (rc_t (*)(void *, uint64_t))BGZFileSetPos,
         (void (*)(void *))BGZFileWhack
     };
     
@@ -1003,6 +1427,309 @@ static unsigned MeasureHeader(unsigned *RG, unsigned *SQ, char const text[])
     }
 }
 
+/* MARK: parsed header cache
+ *
+ * the parsed and sorted header is saved under headerCacheDir, named by a
+ * hash of the header text; files with the same header text load it from
+ * there instead of parsing it again. the string pointers are saved as
+ * offsets into the parsed copy of the text. warnings about the header
+ * are only logged when it is parsed.
+ */
+
+static char const *headerCacheDir;
+
+#define HEADER_CACHE_MAGIC "BAMHDRCH"
+#define HEADER_CACHE_VERSION 2
+
+/* the structs are saved as they are in memory, a file written by a build
+ * with a different format version or struct sizes is a cache miss */
+typedef struct HeaderCacheHead {
+    char magic[8];
+    uint32_t formatVersion;
+    uint32_t headSize;
+    uint32_t refSeqSize;
+    uint32_t readGroupSize;
+    uint64_t fileSize;
+    uint64_t textSize;      /* the header text, to compare against */
+    uint64_t dataSize;      /* the parsed copy that the strings point into */
+    uint64_t version;       /* offset of @HD VN or 0 */
+    uint32_t refSeqs;
+    uint32_t readGroups;
+} HeaderCacheHead;
+
+rc_t BAM_SetHeaderCacheDir(char const path[])
+{
+    headerCacheDir = path;
+    return 0;
+}
+
+static uint64_t HeaderCacheHash(char const text[], size_t const size)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    size_t i;
+
+    for (i = 0; i < size; ++i) {
+        h ^= (uint8_t)text[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+static size_t HeaderCacheAlign(size_t const offset)
+{
+    return (offset + 7) & ~((size_t)7);
+}
+
+/* the parts are written in this order, each padded to 8 bytes */
+static uint64_t HeaderCacheFileSize(HeaderCacheHead const *const head)
+{
+    return HeaderCacheAlign(sizeof(*head))
+         + HeaderCacheAlign(head->textSize)
+         + HeaderCacheAlign(head->refSeqs * sizeof(BAMRefSeq))
+         + HeaderCacheAlign(head->readGroups * sizeof(BAMReadGroup))
+         + HeaderCacheAlign(head->dataSize);
+}
+
+/* offsets are biased by 1 so that NULL stays NULL */
+static char const *HeaderCacheOffset(char const *const ptr, char const data[], size_t const size, bool *const ok)
+{
+    if (ptr == NULL)
+        return NULL;
+    if (ptr < data || ptr >= data + size) {
+        *ok = false;
+        return NULL;
+    }
+    return (char const *)(uintptr_t)(ptr - data + 1);
+}
+
+static char const *HeaderCachePointer(char const *const offset, char const data[], size_t const size, bool *const ok)
+{
+    uintptr_t const value = (uintptr_t)offset;
+
+    if (value == 0)
+        return NULL;
+    if (value > size) {
+        *ok = false;
+        return NULL;
+    }
+    return data + value - 1;
+}
+
+static void HeaderCacheRefSeq(BAMRefSeq *const rs, char const *(*xform)(char const *, char const *, size_t, bool *),
+                              char const data[], size_t const size, bool *const ok)
+{
+    rs->name = xform(rs->name, data, size, ok);
+    rs->assemblyId = xform(rs->assemblyId, data, size, ok);
+    rs->uri = xform(rs->uri, data, size, ok);
+    rs->species = xform(rs->species, data, size, ok);
+}
+
+static void HeaderCacheReadGroup(BAMReadGroup *const rg, char const *(*xform)(char const *, char const *, size_t, bool *),
+                                 char const data[], size_t const size, bool *const ok)
+{
+    rg->name = xform(rg->name, data, size, ok);
+    rg->sample = xform(rg->sample, data, size, ok);
+    rg->library = xform(rg->library, data, size, ok);
+    rg->description = xform(rg->description, data, size, ok);
+    rg->unit = xform(rg->unit, data, size, ok);
+    rg->insertSize = xform(rg->insertSize, data, size, ok);
+    rg->center = xform(rg->center, data, size, ok);
+    rg->runDate = xform(rg->runDate, data, size, ok);
+    rg->platform = xform(rg->platform, data, size, ok);
+}
+
+/* returns true if the parsed header was loaded from the cache */
+static bool HeaderCacheLoad(BAM_File *const self, char const text[], size_t const size)
+{
+    KDirectory *dir = NULL;
+    KFile const *kf = NULL;
+    KMMap const *mm = NULL;
+    void const *addr = NULL;
+    size_t msize = 0;
+    bool ok = false;
+
+    if (KDirectoryNativeDir(&dir) != 0)
+        return false;
+    if (KDirectoryOpenFileRead(dir, &kf, "%s/bam-header.%016lx", headerCacheDir, HeaderCacheHash(text, size)) == 0) {
+        if (KMMapMakeRead(&mm, kf) == 0 && KMMapAddrRead(mm, &addr) == 0 && KMMapSize(mm, &msize) == 0)
+            ok = true;
+        KFileRelease(kf);
+    }
+    KDirectoryRelease(dir);
+
+    if (ok) {
+        HeaderCacheHead const *const head = addr;
+        char const *const base = addr;
+        size_t const rsOffset = HeaderCacheAlign(sizeof(*head)) + HeaderCacheAlign(size);
+        size_t rgOffset = 0;
+        size_t dataOffset = 0;
+
+        /* magic, version and the sizes first, the rest of the head is only
+         * valid if they match this build */
+        ok =   msize >= sizeof(*head)
+            && memcmp(head->magic, HEADER_CACHE_MAGIC, 8) == 0
+            && head->formatVersion == HEADER_CACHE_VERSION
+            && head->headSize == sizeof(*head)
+            && head->refSeqSize == sizeof(self->refSeq[0])
+            && head->readGroupSize == sizeof(self->readGroup[0])
+            && head->fileSize == msize
+            && head->textSize == size
+            && head->dataSize == size + 1
+            && HeaderCacheFileSize(head) == msize;
+        if (ok) {
+            rgOffset = rsOffset + HeaderCacheAlign(head->refSeqs * sizeof(self->refSeq[0]));
+            dataOffset = rgOffset + HeaderCacheAlign(head->readGroups * sizeof(self->readGroup[0]));
+            ok = memcmp(base + sizeof(*head), text, size) == 0;
+        }
+        if (ok) {
+            char const *const data = base + dataOffset;
+            size_t const dsize = head->dataSize;
+            unsigned i;
+
+            self->refSeq = head->refSeqs ? malloc(head->refSeqs * sizeof(self->refSeq[0])) : NULL;
+            self->readGroup = head->readGroups ? malloc(head->readGroups * sizeof(self->readGroup[0])) : NULL;
+            if ((head->refSeqs && self->refSeq == NULL) || (head->readGroups && self->readGroup == NULL))
+                ok = false;
+            else {
+                memmove(self->refSeq, base + rsOffset, head->refSeqs * sizeof(self->refSeq[0]));
+                memmove(self->readGroup, base + rgOffset, head->readGroups * sizeof(self->readGroup[0]));
+                self->refSeqs = head->refSeqs;
+                self->readGroups = head->readGroups;
+                self->version = HeaderCachePointer((char const *)(uintptr_t)head->version, data, dsize, &ok);
+                for (i = 0; i < self->refSeqs; ++i) {
+                    BAMRefSeq *const rs = &self->refSeq[i];
+
+                    HeaderCacheRefSeq(rs, HeaderCachePointer, data, dsize, &ok);
+                    if (rs->checksum)
+                        rs->checksum = &rs->checksum_array[0];
+                }
+                for (i = 0; i < self->readGroups; ++i)
+                    HeaderCacheReadGroup(&self->readGroup[i], HeaderCachePointer, data, dsize, &ok);
+            }
+            if (ok) {
+                self->headerMap = mm;
+                DBGMSG(DBG_ALIGN, DBG_FLAG(DBG_ALIGN_BAM), ("BAM header loaded from cache\n"));
+                return true;
+            }
+            free(self->refSeq);
+            free(self->readGroup);
+            self->refSeq = NULL;
+            self->readGroup = NULL;
+            self->refSeqs = 0;
+            self->readGroups = 0;
+            self->version = NULL;
+        }
+    }
+    KMMapRelease(mm);
+    return false;
+}
+
+static rc_t HeaderCacheWrite(KFile *const kf, uint64_t *const pos, void const *const data, size_t const size)
+{
+    static uint8_t const zeros[8];
+    size_t const pad = HeaderCacheAlign(size) - size;
+    size_t num_writ = 0;
+    rc_t rc = 0;
+
+    if (size > 0) {
+        rc = KFileWriteAll(kf, *pos, data, size, &num_writ);
+        if (rc == 0 && num_writ != size)
+            rc = RC(rcAlign, rcFile, rcWriting, rcTransfer, rcIncomplete);
+    }
+    if (rc == 0 && pad > 0) {
+        rc = KFileWriteAll(kf, *pos + size, zeros, pad, &num_writ);
+        if (rc == 0 && num_writ != pad)
+            rc = RC(rcAlign, rcFile, rcWriting, rcTransfer, rcIncomplete);
+    }
+    *pos += size + pad;
+    return rc;
+}
+
+/* saves the parsed header; failures only mean it will be parsed again */
+static void HeaderCacheStore(BAM_File const *const self, char const text[], size_t const size)
+{
+    char const *const data = self->headerData1;
+    size_t const dsize = size + 1;
+    HeaderCacheHead head;
+    BAMRefSeq *refSeq = NULL;
+    BAMReadGroup *readGroup = NULL;
+    KDirectory *dir = NULL;
+    KFile *kf = NULL;
+    uint64_t const hash = HeaderCacheHash(text, size);
+    uint64_t pos = 0;
+    bool ok = true;
+    unsigned i;
+    rc_t rc;
+
+    memset(&head, 0, sizeof(head));
+    memmove(head.magic, HEADER_CACHE_MAGIC, 8);
+    head.formatVersion = HEADER_CACHE_VERSION;
+    head.headSize = sizeof(head);
+    head.refSeqSize = sizeof(refSeq[0]);
+    head.readGroupSize = sizeof(readGroup[0]);
+    head.textSize = size;
+    head.dataSize = dsize;
+    head.refSeqs = self->refSeqs;
+    head.readGroups = self->readGroups;
+    head.fileSize = HeaderCacheFileSize(&head);
+    head.version = (uintptr_t)HeaderCacheOffset(self->version, data, dsize, &ok);
+
+    if (self->refSeqs) {
+        refSeq = malloc(self->refSeqs * sizeof(refSeq[0]));
+        if (refSeq == NULL)
+            return;
+        memmove(refSeq, self->refSeq, self->refSeqs * sizeof(refSeq[0]));
+        for (i = 0; i < self->refSeqs; ++i) {
+            HeaderCacheRefSeq(&refSeq[i], HeaderCacheOffset, data, dsize, &ok);
+            if (refSeq[i].checksum)
+                refSeq[i].checksum = (uint8_t const *)(uintptr_t)1;
+        }
+    }
+    if (self->readGroups) {
+        readGroup = malloc(self->readGroups * sizeof(readGroup[0]));
+        if (readGroup == NULL) {
+            free(refSeq);
+            return;
+        }
+        memmove(readGroup, self->readGroup, self->readGroups * sizeof(readGroup[0]));
+        for (i = 0; i < self->readGroups; ++i)
+            HeaderCacheReadGroup(&readGroup[i], HeaderCacheOffset, data, dsize, &ok);
+    }
+    if (ok && KDirectoryNativeDir(&dir) == 0) {
+        char path[4096];
+        char temp[4096];
+
+        rc = string_printf(path, sizeof(path), NULL, "%s/bam-header.%016lx", headerCacheDir, hash);
+        if (rc == 0)
+            rc = string_printf(temp, sizeof(temp), NULL, "%s.%u", path, (unsigned)getpid());
+        /* written under a temporary name, then renamed so that readers
+         * never see a partial file */
+        if (rc == 0)
+            rc = KDirectoryCreateFile(dir, &kf, false, 0664, kcmInit | kcmParents, "%s", temp);
+        if (rc == 0) {
+            rc = HeaderCacheWrite(kf, &pos, &head, sizeof(head));
+            if (rc == 0)
+                rc = HeaderCacheWrite(kf, &pos, text, size);
+            if (rc == 0)
+                rc = HeaderCacheWrite(kf, &pos, refSeq, self->refSeqs * sizeof(refSeq[0]));
+            if (rc == 0)
+                rc = HeaderCacheWrite(kf, &pos, readGroup, self->readGroups * sizeof(readGroup[0]));
+            if (rc == 0)
+                rc = HeaderCacheWrite(kf, &pos, data, dsize);
+            KFileRelease(kf);
+            if (rc == 0)
+                rc = KDirectoryRename(dir, true, temp, path);
+            if (rc)
+                KDirectoryRemove(dir, false, "%s", temp);
+        }
+        if (rc)
+            (void)LOGERR(klogWarn, rc, "failed to save the BAM header to the cache");
+        KDirectoryRelease(dir);
+    }
+    free(readGroup);
+    free(refSeq);
+}
+
 static rc_t ProcessHeaderText(BAM_File *self, char const text[], bool makeCopy)
 {
     unsigned RG = 0;
@@ -1010,6 +1737,19 @@ static rc_t ProcessHeaderText(BAM_File *self, char const text[], bool makeCopy)
     unsigned const size = MeasureHeader(&RG, &SQ, text);
     unsigned i;
 
+    if (makeCopy) {
+        void *const tmp = malloc(size + 1);
+        if (tmp == NULL)
+            return RC(rcAlign, rcFile, rcConstructing, rcMemory, rcExhausted);
+        self->header = tmp;  /* a const copy of the original */
+        memmove(tmp, text, size + 1);
+    }
+    else
+        self->header = text;
+
+    if (headerCacheDir != NULL && HeaderCacheLoad(self, text, size))
+        return 0;
+
     if (SQ) {
         self->refSeq = calloc(SQ, sizeof(self->refSeq[0]));
         if (self->refSeq == NULL)
@@ -1024,15 +1764,6 @@ static rc_t ProcessHeaderText(BAM_File *self, char const text[], bool makeCopy)
     }
     self->readGroups = RG;
 
-    if (makeCopy) {
-        void *const tmp = malloc(size + 1);
-        if (tmp == NULL)
-            return RC(rcAlign, rcFile, rcConstructing, rcMemory, rcExhausted);
-        self->header = tmp;  /* a const copy of the original */
-        memmove(tmp, text, size + 1);
-    }
-    else
-        self->header = text;
     {
     char *const copy = malloc(size + 1); /* an editable copy */
     if (copy == NULL)
@@ -1112,6 +1843,9 @@ static rc_t ProcessHeaderText(BAM_File *self, char const text[], bool makeCopy)
             (void)PLOGMSG(klogWarn, (klogWarn, "Reference '$(ref)' has zero length", "ref=%s", rs->name));
     }
 
+    if (headerCacheDir != NULL)
+        HeaderCacheStore(self, text, size);
+
     return 0;
 }
 
@@ -1369,6 +2103,7 @@ static void BAM_FileWhack(BAM_File *self) {
         free((void *)self->headerData1);
     if (self->headerData2)
         free((void *)self->headerData2);
+    KMMapRelease(self->headerMap);
     if (self->nocopy)
         free(self->nocopy);
     if (self->vt.FileWhack)
@@ -1416,6 +2151,7 @@ static rc_t BAM_FileMakeWithKFileAndHeader(BAM_File **cself,
             return 0;
         }
     }
+    SAMFileWhack(&self->file.sam);
     BufferedFileWhack(&self->file.sam.file);
     free(self);
 
@@ -1489,6 +2225,19 @@ rc_t BAM_FileGetPosition(const BAM_File *self, BAM_FilePosition *pos) {
     return 0;
 }
 
+rc_t BAM_FileSetInflateThreads(const BAM_File *cself, unsigned threads)
+{
+    BAM_File *const self = (BAM_File *)cself;
+
+    if (self == NULL)
+        return RC(rcAlign, rcFile, rcConstructing, rcSelf, rcNull);
+    if (self->isSAM || self->file.bam.pool != NULL || threads == 0)
+        return 0;
+    if (threads > BGZF_POOL_MAX_THREADS)
+        threads = BGZF_POOL_MAX_THREADS;
+    return BGZFilePoolMake(&self->file.bam.pool, &self->file.bam, threads);
+}
+
 static void BAM_FileAdvance(BAM_File *const self, unsigned distance)
 {
     self->bufCurrent += distance;
@@ -1958,176 +2707,193 @@ static void SAM2BAM_ConvertInt(void *const Dst, int value)
     dst[3] = (uint8_t)(value >> 24);
 }
 
-static int SAM2BAM_CIGAR_OpCount(char const cigar[])
+/* splits a line at its tabs; end[k] is the offset of the end of field k
+ * returns the number of fields or 0 if there are more than max */
+static unsigned SAM2BAM_SplitFields(char const line[], unsigned const len, unsigned end[], unsigned const max)
 {
-    unsigned i;
     unsigned n = 0;
-    int st = 0;
-    
-    if (cigar[0] == '*' && cigar[1] == '\0')
-        return 0;
-    
-    for (i = 0; ; ++i) {
-        int const ch = cigar[i];
-        
-        if (ch == '\0')
-            break;
+    unsigned i = 0;
 
-        if (st == 0) {
-            if (!isdigit(ch))
-                return -1;
-            st = 1;
+#if HAVE_SSE2_SAM_SCAN
+    __m128i const tab = _mm_set1_epi8('\t');
+
+    for ( ; i + 16 <= len; i += 16) {
+        __m128i const chunk = _mm_loadu_si128((__m128i const *)&line[i]);
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, tab));
+
+        while (mask) {
+            if (n + 1 >= max)
+                return 0;
+            end[n++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
         }
-        else if (!isdigit(ch)) {
-            ++n;
-            st = 0;
+    }
+#endif
+    for ( ; i < len; ++i) {
+        if (line[i] == '\t') {
+            if (n + 1 >= max)
+                return 0;
+            end[n++] = i;
         }
     }
-    return st == 0 ? n : -1;
+    end[n++] = len;
+    return n;
 }
 
-static int SAM2BAM_ConvertCIGAR1(uint8_t dst[4], char const value[])
+/* parses a decimal integer with an optional sign; an empty field is 0 */
+static bool SAM2BAM_ParseInt(char const value[], unsigned const len, int *const rslt)
 {
-    int len = 0;
-    int code = 0;
     unsigned i = 0;
-    
-    if (value[0] == '\0')
-        return 0;
-    
-    for ( ; ; ) {
-        int const ch = value[i++];
-        
-        if (!isdigit(ch)) {
-            switch (ch) {
-            case 'M':
-                code = 0;
-                break;
-            case 'I':
-                code = 1;
-                break;
-            case 'D':
-                code = 2;
-                break;
-            case 'N':
-                code = 3;
-                break;
-            case 'S':
-                code = 4;
-                break;
-            case 'H':
-                code = 5;
-                break;
-            case 'P':
-                code = 6;
-                break;
-            case '=':
-                code = 7;
-                break;
-            case 'X':
-                code = 8;
-                break;
-            default:
-                return -1;
-            }
-            break;
-        }
-        len = (len * 10) + (ch - '0');
-        if (len >= (1 << 24))
-            return -2;
+    bool neg = false;
+    int64_t x = 0;
+
+    if (len > 0 && (value[0] == '-' || value[0] == '+')) {
+        neg = value[0] == '-';
+        i = 1;
     }
-    SAM2BAM_ConvertInt(dst, (len << 4) | code);
-    return i;
+    if (len - i > 10)
+        return false;
+    for ( ; i < len; ++i) {
+        unsigned const digit = (unsigned)(value[i] - '0');
+        if (digit > 9)
+            return false;
+        x = x * 10 + digit;
+    }
+    if (neg)
+        x = -x;
+    if (x < INT32_MIN || x > INT32_MAX)
+        return false;
+    *rslt = (int)x;
+    return true;
 }
 
-static rc_t SAM2BAM_ConvertCIGAR(unsigned const insize, void /* inout */ *const data, void const *const endp)
+/* BAM CIGAR operation codes by character, -1 if not an operation */
+static int8_t const SAM2BAM_CIGAR_OpCode[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  7, -1, -1,
+    -1, -1, -1, -1,  2, -1, -1, -1,  5,  1, -1, -1, -1,  0,  3, -1,
+     6, -1, -1,  4, -1, -1, -1, -1,  8, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+/* returns the number of operations written to dst or -1 on a parse error */
+static int SAM2BAM_ConvertCIGAR(char const value[], unsigned const len, uint8_t *const dst, void const *const endp)
 {
-    char *const value = data;
-    uint8_t *const dst = (void *)(value + insize);
-    unsigned j = 0;
-    unsigned i;
+    unsigned i = 0;
+    int n = 0;
 
-    for (i = 0; i < insize; ++j) {
-        if ((void const *)(dst + j * 4 + 4) >= endp)
-            return RC(rcAlign, rcFile, rcReading, rcBuffer, rcInsufficient);
-        {
-        int const k = SAM2BAM_ConvertCIGAR1(dst + j * 4, value + i);
-        if (k > 0)
-            i += k;
-        else
-            return k == 0 ? 0 : RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
+    if (len == 1 && value[0] == '*')
+        return 0;
+
+    while (i < len) {
+        unsigned const start = i;
+        unsigned oplen = 0;
+        int code;
+
+        for ( ; i < len; ++i) {
+            unsigned const digit = (unsigned)(value[i] - '0');
+            if (digit > 9)
+                break;
+            oplen = oplen * 10 + digit;
+            if (oplen >= (1u << 24))
+                return -1;
         }
+        if (i == start || i == len)
+            return -1;
+        code = SAM2BAM_CIGAR_OpCode[(uint8_t)value[i++]];
+        if (code < 0)
+            return -1;
+        if ((void const *)(dst + 4 * n + 4) > endp)
+            return -1;
+        SAM2BAM_ConvertInt(dst + 4 * n, (oplen << 4) | code);
+        ++n;
     }
-    memmove(data, dst, 4 * j);
-    return 0;
+    return n;
 }
 
-static int SAM2BAM_ConvertBase(int base)
-{
-    static char const tr[] = {
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,0x0, -1, -1,
-        -1,0x1,0xE,0x2,0xD, -1, -1,0x4,0xB, -1, -1,0xC, -1,0x3,0xF, -1,
-        -1, -1,0x5,0x6,0x8, -1,0x7,0x9, -1,0xA, -1, -1, -1, -1, -1, -1,
-        -1,0x1,0xE,0x2,0xD, -1, -1,0x4,0xB, -1, -1,0xC, -1,0x3,0xF, -1,
-        -1, -1,0x5,0x6,0x8, -1,0x7,0x9, -1,0xA, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-    };
-    return tr[base];
-}
+/* 4na codes by character, 0xFF if not a base */
+static uint8_t const SAM2BAM_Base[256] = {
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF, 0x0,0xFF,0xFF,
+    0xFF, 0x1, 0xE, 0x2, 0xD,0xFF,0xFF, 0x4, 0xB,0xFF,0xFF, 0xC,0xFF, 0x3, 0xF,0xFF,
+    0xFF,0xFF, 0x5, 0x6, 0x8,0xFF, 0x7, 0x9,0xFF, 0xA,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF, 0x1, 0xE, 0x2, 0xD,0xFF,0xFF, 0x4, 0xB,0xFF,0xFF, 0xC,0xFF, 0x3, 0xF,0xFF,
+    0xFF,0xFF, 0x5, 0x6, 0x8,0xFF, 0x7, 0x9,0xFF, 0xA,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+};
 
-static rc_t SAM2BAM_ConvertSEQ(unsigned const insize, void /* inout */ *const data, void const *const endp)
+static rc_t SAM2BAM_ConvertSEQ(char const value[], unsigned const len, uint8_t dst[])
 {
-    char const *const value = data;
-    uint8_t *const dst = data;
-    unsigned const n = insize & ~((unsigned)1);
-    unsigned j = 0;
+    uint8_t const *const src = (uint8_t const *)value;
+    unsigned const n = len & ~((unsigned)1);
+    unsigned bad = 0;
     unsigned i;
 
-    for (i = 0; i < n; i += 2, ++j) {
-        int const hi = SAM2BAM_ConvertBase(value[i + 0]);
-        int const lo = SAM2BAM_ConvertBase(value[i + 1]);
-        
-        if (hi < 0 || lo < 0)
-            return RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
+    for (i = 0; i < n; i += 2) {
+        unsigned const hi = SAM2BAM_Base[src[i + 0]];
+        unsigned const lo = SAM2BAM_Base[src[i + 1]];
 
-        dst[j] = (hi << 4) | lo;
+        bad |= hi | lo;
+        dst[i >> 1] = (uint8_t)((hi << 4) | (lo & 0xF));
     }
-    if (n != insize) {
-        int const hi = SAM2BAM_ConvertBase(value[n]);
-        int const lo = 0;
-        
-        if (hi < 0 || lo < 0)
-            return RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-        
-        dst[j] = (hi << 4) | lo;
+    if (n != len) {
+        unsigned const hi = SAM2BAM_Base[src[n]];
+
+        bad |= hi;
+        dst[n >> 1] = (uint8_t)(hi << 4);
     }
-    return 0;
+    return (bad & 0xF0) == 0 ? 0 : RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
 }
 
-static rc_t SAM2BAM_ConvertQUAL(unsigned const insize, void /* inout */ *const data, void const *const endp)
+static rc_t SAM2BAM_ConvertQUAL(char const value[], unsigned const len, uint8_t dst[])
 {
-    char const *const value = data;
-    uint8_t *const dst = data;
-    unsigned i;
+    unsigned i = 0;
+    unsigned bad = 0;
 
-    for (i = 0; i < insize; ++i) {
-        int const ch = value[i];
-        
-        if (ch < '!' || ch > '~')
-            return RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-        dst[i] = ch - 33;
+#if HAVE_SSE2_SAM_SCAN
+    {
+        __m128i const lower = _mm_set1_epi8('!');
+        __m128i const upper = _mm_set1_epi8('~');
+        __m128i anybad = _mm_setzero_si128();
+
+        /* bytes >= 0x80 compare as negative, so they are below '!' too */
+        for ( ; i + 16 <= len; i += 16) {
+            __m128i const chunk = _mm_loadu_si128((__m128i const *)&value[i]);
+
+            anybad = _mm_or_si128(anybad, _mm_cmplt_epi8(chunk, lower));
+            anybad = _mm_or_si128(anybad, _mm_cmpgt_epi8(chunk, upper));
+            _mm_storeu_si128((__m128i *)&dst[i], _mm_sub_epi8(chunk, lower));
+        }
+        bad = (unsigned)_mm_movemask_epi8(anybad);
     }
-    return 0;
+#endif
+    for ( ; i < len; ++i) {
+        unsigned const ch = (uint8_t)value[i];
+
+        bad |= (ch < '!') | (ch > '~');
+        dst[i] = (uint8_t)(ch - 33);
+    }
+    return bad == 0 ? 0 : RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
 }
 
 static int SAM2BAM_ScanValue(void *const dst, char const *src, bool isFloat, bool isArray)
@@ -2249,6 +3015,13 @@ static int SAM2BAM_ConvertEXTRA(unsigned const insize, void /* inout */ *const d
             case 'f': {
                 if ((void const *)&dst[7] >= endp)
                     return -2;
+                if (type == 'i') {
+                    int value;
+                    if (SAM2BAM_ParseInt(src + 5, insize - 5, &value)) {
+                        SAM2BAM_ConvertInt(&dst[3], value);
+                        return 7;
+                    }
+                }
                 {
                     int const n = SAM2BAM_ScanValue(&dst[3], src + 5, type == 'f', false);
                     return (n < 0 || n + 5 != insize) ? -4 : 7;
@@ -2276,7 +3049,8 @@ static int SAM2BAM_ConvertEXTRA(unsigned const insize, void /* inout */ *const d
                 return -3;
             }
             {
-                uint8_t *const scratch = (void *)(src + insize);
+                /* behind the terminator, the values are scanned up to it */
+                uint8_t *const scratch = (void *)(src + insize + 1);
                 int const subtype = src[5] == 'f' ? 'f' : 'i';
                 unsigned i;
                 unsigned j;
@@ -2300,10 +3074,36 @@ static int SAM2BAM_ConvertEXTRA(unsigned const insize, void /* inout */ *const d
     }
 }
 
+static rc_t SAM2BAM_FindRNAME(SAMFile *const file, BAM_File const *const self, char const name[], int *const rslt)
+{
+    if (name[0] == '*' && name[1] == '\0') {
+        *rslt = -1;
+        return 0;
+    }
+    /* records are mostly grouped by reference */
+    if (file->lastRef < self->refSeqs && strcmp(name, self->refSeq[file->lastRef].name) == 0) {
+        *rslt = file->lastRef;
+        return 0;
+    }
+    {
+        unsigned const id = FindRefSeqByName(name, true, self->refSeqs, self->refSeq);
+        if (id < self->refSeqs) {
+            file->lastRef = id;
+            *rslt = id;
+            return 0;
+        }
+    }
+    return RC(rcAlign, rcFile, rcReading, rcRow, rcInvalid);
+}
+
+#define SAM_MAX_FIELDS (4096)
+
 static rc_t BAM_FileReadSAM(BAM_File *const self, BAM_Alignment const **const rslt)
 {
     void const *const endp = self->buffer + sizeof(self->buffer);
     struct bam_alignment_s *raw = (void *)self->buffer;
+    rc_t const invalid = RC(rcAlign, rcFile, rcReading, rcRow, rcInvalid);
+    unsigned end[SAM_MAX_FIELDS];
     struct {
         int namelen;
         int FLAG;
@@ -2316,215 +3116,131 @@ static rc_t BAM_FileReadSAM(BAM_File *const self, BAM_Alignment const **const rs
         int TLEN;
         
         int readlen;
-        
-        char *QNAME;
-        uint32_t *CIGAR; /* probably not aligned */
-        uint8_t *SEQ;
-        uint8_t *QUAL;
-        char *EXTRA;
     } temp;
-    unsigned field = 1;
-    char *scratch = &raw->read_name[0];
-    int *intScratch = NULL;
-    int sgn = 1;
-    unsigned i = 0;
+    uint8_t *scratch = (uint8_t *)&raw->read_name[0];
+    char *line = NULL;
+    unsigned len = 0;
+    unsigned fields;
+    unsigned field;
+
+    {
+        rc_t const rc = SAMFileReadLine(&self->file.sam, &line, &len);
+        if (rc)
+            return GetRCState(rc) == rcInsufficient ? SILENT_RC(rcAlign, rcFile, rcReading, rcRow, rcNotFound) : rc;
+    }
+    fields = SAM2BAM_SplitFields(line, len, end, SAM_MAX_FIELDS);
+    if (fields == 0) {
+        LOGERR(klogErr, invalid, "SAM Record error too many fields");
+        return RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
+    }
+    if (fields < 11) {
+        rc_t const rc = RC(rcAlign, rcFile, rcReading, rcRow, rcTooShort);
+        LOGERR(klogErr, rc, "SAM Record error too few fields");
+        return rc;
+    }
+    /* terminate every field in place */
+    for (field = 0; field < fields; ++field)
+        line[end[field]] = '\0';
+
+#define FIELD(N) (&line[(N) == 0 ? 0 : end[(N) - 1] + 1])
+#define FIELD_LEN(N) (end[N] - ((N) == 0 ? 0 : end[(N) - 1] + 1))
 
     memset(raw, 0, sizeof(*raw));
     memset(&temp, 0, sizeof(temp));
-    temp.QNAME = scratch;
-    
-    for ( ; ; ) {
-        int const ch = SAMFileRead1(&self->file.sam);
-        if (ch < 0) {
-            rc_t const rc = SAMFileLastError(&self->file.sam);
-            return (i == 0 && field == 1 && (rc == 0 || GetRCState(rc) == rcInsufficient)) ? SILENT_RC(rcAlign, rcFile, rcReading, rcRow, rcNotFound) : rc;
+
+    /* QNAME */
+    if (FIELD_LEN(0) == 1 && FIELD(0)[0] == '*')
+        temp.namelen = 0;
+    else {
+        temp.namelen = FIELD_LEN(0) + 1; /* includes NULL terminator */
+        if (temp.namelen > 255) {
+            LOGERR(klogErr, invalid, "SAM Record error QNAME is too long");
+            return RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
         }
-        if ((void const *)&scratch[i] >= endp)
-            return RC(rcAlign, rcFile, rcReading, rcBuffer, rcInsufficient);
+        memmove(scratch, FIELD(0), temp.namelen);
+        scratch += temp.namelen;
+    }
+    if (   !SAM2BAM_ParseInt(FIELD(1), FIELD_LEN(1), &temp.FLAG)
+        || !SAM2BAM_ParseInt(FIELD(3), FIELD_LEN(3), &temp.POS)
+        || !SAM2BAM_ParseInt(FIELD(4), FIELD_LEN(4), &temp.MAPQ)
+        || !SAM2BAM_ParseInt(FIELD(7), FIELD_LEN(7), &temp.PNEXT)
+        || !SAM2BAM_ParseInt(FIELD(8), FIELD_LEN(8), &temp.TLEN))
+    {
+        LOGERR(klogErr, invalid, "SAM Record error parsing integer field");
+        return RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
+    }
+    if (SAM2BAM_FindRNAME(&self->file.sam, self, FIELD(2), &temp.RNAME) != 0) {
+        LOGERR(klogErr, invalid, "SAM Record missing reference");
+        return RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
+    }
+    if (temp.MAPQ > 255) {
+        LOGERR(klogErr, invalid, "SAM Record error MAPQ > 255");
+        return RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
+    }
 
-        if (ch == '\n' && i > 0 && scratch[i - 1] == '\r') {
-            /* handle \r\n line endings */
-            --i;
+    /* CIGAR */
+    temp.cigars = SAM2BAM_ConvertCIGAR(FIELD(5), FIELD_LEN(5), scratch, endp);
+    if (temp.cigars < 0 || temp.cigars > 0xFFFF) {
+        LOGERR(klogErr, invalid, "SAM Record error parsing CIGAR");
+        return RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
+    }
+    scratch += 4 * temp.cigars;
+
+    /* RNEXT */
+    if (FIELD_LEN(6) == 1 && FIELD(6)[0] == '=')
+        temp.RNEXT = temp.RNAME;
+    else if (SAM2BAM_FindRNAME(&self->file.sam, self, FIELD(6), &temp.RNEXT) != 0) {
+        LOGERR(klogErr, invalid, "SAM Record missing reference");
+        return RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
+    }
+
+    /* SEQ and QUAL */
+    if (!(FIELD_LEN(9) == 1 && FIELD(9)[0] == '*')) {
+        temp.readlen = FIELD_LEN(9);
+        if ((void const *)(scratch + (temp.readlen + 1) / 2 + temp.readlen) > endp)
+            return RC(rcAlign, rcFile, rcReading, rcBuffer, rcInsufficient);
+        {
+            rc_t const rc = SAM2BAM_ConvertSEQ(FIELD(9), temp.readlen, scratch);
+            if (rc) {
+                LOGERR(klogErr, rc, "SAM Record error converting SEQ");
+                return RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
+            }
         }
-        if (!(ch == '\t' || ch == '\n')) {
-            if (field != 0) {
-                if (intScratch == NULL) {
-                    scratch[i] = ch;
-                }
-                else {
-                    int const value = ch - '0';
-                    if (ch == '-' && i == 0) {
-                        sgn = -1;
-                    }
-                    else if (ch == '-' && i == 0) {
-                        sgn = 1;
-                    }
-                    else {
-                        if (value < 0 || value > 9) {
-                            LOGERR(klogErr, RC(rcAlign, rcFile, rcReading, rcRow, rcInvalid), "SAM Record error parsing integer field");
-                            return RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-                        }
-                        *intScratch = *intScratch * 10 + value * sgn;
-                    }
-                }
+        scratch += (temp.readlen + 1) / 2;
+
+        if (FIELD_LEN(10) == 1 && FIELD(10)[0] == '*')
+            memset(scratch, 0xFF, temp.readlen);
+        else if (FIELD_LEN(10) == temp.readlen) {
+            rc_t const rc = SAM2BAM_ConvertQUAL(FIELD(10), temp.readlen, scratch);
+            if (rc) {
+                LOGERR(klogErr, rc, "SAM Record error converting QUAL");
+                return RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
             }
-            ++i;
-            continue;
         }
-        if (intScratch == NULL)
-            scratch[i] = '\0';
         else {
-            intScratch = NULL;
-            sgn = 1;
-        }
-        switch (field) {
-            case 0:
-                if (ch == '\n')
-                    return RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-                break;
-            case 1:
-                if (i == 1 && scratch[0] == '*') {
-                    temp.namelen = 0;
-                }
-                else {
-                    temp.namelen = i + 1; /* includes NULL terminator */
-                    scratch += i + 1;     /* don't want to overwrite it */
-                    if (temp.namelen > 255) {
-                        LOGERR(klogErr, RC(rcAlign, rcFile, rcReading, rcRow, rcInvalid), "SAM Record error QNAME is too long");
-                        field = 0;
-                    }
-                }
-                temp.CIGAR = (void *)scratch;
-                intScratch = &temp.FLAG;
-                break;
-            case 2:
-                break;
-            case 3:
-                if (i == 1 && scratch[0] == '*')
-                    temp.RNAME = -1;
-                else {
-                    unsigned const id = FindRefSeqByName(scratch, true, self->refSeqs, self->refSeq);
-                    if (id < self->refSeqs)
-                        temp.RNAME = id;
-                    else {
-                        LOGERR(klogErr, RC(rcAlign, rcFile, rcReading, rcRow, rcInvalid), "SAM Record missing reference");
-                        field = 0;
-                    }
-                }
-                intScratch = &temp.POS;
-                break;
-            case 4:
-                intScratch = &temp.MAPQ;
-                break;
-            case 5:
-                if (temp.MAPQ > 255) {
-                    LOGERR(klogErr, RC(rcAlign, rcFile, rcReading, rcRow, rcInvalid), "SAM Record error MAPQ > 255");
-                    field = 0;
-                }
-                break;
-            case 6:
-                temp.cigars = SAM2BAM_CIGAR_OpCount(scratch);
-                if (temp.cigars < 0) {
-                    LOGERR(klogErr, RC(rcAlign, rcFile, rcReading, rcRow, rcInvalid), "SAM Record error parsing CIGAR");
-                    field = 0;
-                }
-                else if (temp.cigars > 0) {
-                    scratch += 4 * temp.cigars;
-                    temp.SEQ = (uint8_t *)scratch;
-                    {
-                        rc_t const rc = SAM2BAM_ConvertCIGAR(i, temp.CIGAR, endp);
-                        if (rc) {
-                            LOGERR(klogErr, rc, "SAM Record error parsing CIGAR");
-                            field = 0;
-                        }
-                    }
-                }
-                else
-                    temp.SEQ = (uint8_t *)scratch;
-                break;
-            case 7:
-                if (i == 1 && scratch[0] == '*')
-                    temp.RNEXT = -1;
-                else if (i == 1 && scratch[0] == '=')
-                    temp.RNEXT = temp.RNAME;
-                else {
-                    unsigned const id = FindRefSeqByName(scratch, true, self->refSeqs, self->refSeq);
-                    if (id < self->refSeqs)
-                        temp.RNEXT = id;
-                    else {
-                        LOGERR(klogErr, RC(rcAlign, rcFile, rcReading, rcRow, rcInvalid), "SAM Record missing reference");
-                        field = 0;
-                    }
-                }
-                intScratch = &temp.PNEXT;
-                break;
-            case 8:
-                intScratch = &temp.TLEN;
-                break;
-            case 9:
-                break;
-            case 10:
-                if (i == 1 && scratch[0] == '*')
-                    temp.readlen = 0;
-                else {
-                    temp.readlen = i;
-                    scratch += (temp.readlen + 1) / 2;
-                    temp.QUAL = (uint8_t *)scratch;
-                    {
-                        rc_t const rc = SAM2BAM_ConvertSEQ(i, temp.SEQ, endp);
-                        if (rc) {
-                            LOGERR(klogErr, rc, "SAM Record error converting SEQ");
-                            field = 0;
-                        }
-                    }
-                }
-                break;
-            case 11:
-                if (temp.readlen == 0)
-                    break;
-                if (i == 1 && scratch[0] == '*')
-                    memset(temp.QUAL, 0xFF, temp.readlen);
-                else if (i == temp.readlen) {
-                    rc_t const rc = SAM2BAM_ConvertQUAL(i, temp.QUAL, endp);
-                    if (rc) {
-                        LOGERR(klogErr, rc, "SAM Record error converting QUAL");
-                        field = 0;
-                    }
-                }
-                else {
-                    LOGERR(klogErr, RC(rcAlign, rcFile, rcReading, rcRow, rcInvalid), "SAM Record error length of SEQ != length of QUAL");
-                    field = 0;
-                }
-                scratch += temp.readlen;
-                break;
-            default:
-            {
-                int const n = SAM2BAM_ConvertEXTRA(i, scratch, endp);
-                if (n < 0) {
-                    LOGERR(klogErr, RC(rcAlign, rcFile, rcReading, rcRow, rcInvalid), "SAM Record error parsing optional field");
-                    field = 0;
-                }
-                else {
-                    if (n == 0)
-                        --field;
-                    else
-                        scratch += n;
-                }
-                break;
-            }
+            LOGERR(klogErr, invalid, "SAM Record error length of SEQ != length of QUAL");
+            return RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
         }
-        if (ch == '\n') {
-            if (field < 11) {
-                rc_t const rc = RC(rcAlign, rcFile, rcReading, rcRow, rcTooShort);
-                LOGERR(klogErr, rc, "SAM Record error too few fields");
-                return rc;
-            }
-            break;
+        scratch += temp.readlen;
+    }
+
+    /* optional fields are converted in place after being copied to the record */
+    for (field = 11; field < fields; ++field) {
+        unsigned const flen = FIELD_LEN(field);
+        int n;
+
+        if ((void const *)(scratch + flen + 1) > endp)
+            return RC(rcAlign, rcFile, rcReading, rcBuffer, rcInsufficient);
+        memmove(scratch, FIELD(field), flen + 1);
+        n = SAM2BAM_ConvertEXTRA(flen, scratch, endp);
+        if (n < 0) {
+            LOGERR(klogErr, invalid, "SAM Record error parsing optional field");
+            return RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
         }
-        i = 0;
-        if (field > 0)
-            ++field;
+        scratch += n;
     }
+#undef FIELD
+#undef FIELD_LEN
 
     SAM2BAM_ConvertInt(raw->rID, temp.RNAME);
     SAM2BAM_ConvertInt(raw->pos, temp.POS - 1);
@@ -523,6 +523,22 @@ rc_t BAM_FileGetPosition ( const BAM_File *self, BAM_FilePosition *pos );
  */
 float BAM_FileGetProportionalPosition ( const BAM_File *self );
 
+
+/* SetInflateThreads
+ *  inflate the compressed blocks on this many background threads while
+ *  the calling thread parses records; 0 inflates on the calling thread
+ *  does nothing for SAM files; call before the first read
+ */
+rc_t BAM_FileSetInflateThreads ( const BAM_File *self, unsigned threads );
+
+
+/* SetHeaderCacheDir
+ *  save parsed headers in this directory and reuse them for files
+ *  with the same header text; NULL turns the cache off
+ *  applies to files made after the call; the path is not copied
+ */
+rc_t BAM_SetHeaderCacheDir ( const char *path );
+
     
 /* Read
  *  read an aligment
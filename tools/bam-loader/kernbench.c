@@ -0,0 +1,147 @@
+/* ===========================================================================
+ *
+ *                            PUBLIC DOMAIN NOTICE
+ *               National Center for Biotechnology Information
+ *
+ *  This software/database is a "United States Government Work" under the
+ *  terms of the United States Copyright Act.  It was written as part of
+ *  the author's official duties as a United States Government employee and
+ *  thus cannot be copyrighted.  This software/database is freely available
+ *  to the public for use. The National Library of Medicine and the U.S.
+ *  Government have not placed any restriction on its use or reproduction.
+ *
+ *  Although all reasonable efforts have been taken to ensure the accuracy
+ *  and reliability of the software and data, the NLM and the U.S.
+ *  Government do not and cannot warrant the performance or results that
+ *  may be obtained by using this software or data. The NLM and the U.S.
+ *  Government disclaim all warranties, express or implied, including
+ *  warranties of performance, merchantability or fitness for any particular
+ *  purpose.
+ *
+ *  Please cite the author in any work or product based on this material.
+ *
+ * ===========================================================================
+ *
+ * Measures the per-base kernels in read-kernels.c against their scalar
+ * versions on random reads:
+ *   kernbench [ <read length> [ <megabases> ] ]
+ * the defaults are 150 bases and 256 megabases.
+ */
+
+#include <kapp/args.h>
+#include <kapp/main.h>
+#include <klib/log.h>
+#include <klib/time.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "read-kernels.h"
+
+#include <klib/rc.h>
+
+#define READS (4096u)
+
+typedef void (*kernel_f)(uint8_t dst[], uint8_t const src[], unsigned len, unsigned arg);
+
+static QualityBins bins;
+
+static void copyQuality(uint8_t dst[], uint8_t const src[], unsigned len, unsigned arg) { CopyQuality(dst, src, len, true); }
+static void copyQualityScalar(uint8_t dst[], uint8_t const src[], unsigned len, unsigned arg) { CopyQualityScalar(dst, src, len, true); }
+static void copyRead(uint8_t dst[], uint8_t const src[], unsigned len, unsigned arg) { CopyRead((char *)dst, (char const *)src, len, true); }
+static void copyReadScalar(uint8_t dst[], uint8_t const src[], unsigned len, unsigned arg) { CopyReadScalar((char *)dst, (char const *)src, len, true); }
+static void offsetQuality(uint8_t dst[], uint8_t const src[], unsigned len, unsigned arg) { OffsetQuality(dst, src, len, 33); }
+static void offsetQualityScalar(uint8_t dst[], uint8_t const src[], unsigned len, unsigned arg) { OffsetQualityScalar(dst, src, len, 33); }
+static void quantizeQuality(uint8_t dst[], uint8_t const src[], unsigned len, unsigned arg) { QuantizeQuality(dst, src, len, &bins); }
+static void quantizeQualityScalar(uint8_t dst[], uint8_t const src[], unsigned len, unsigned arg) { QuantizeQualityScalar(dst, src, len, &bins); }
+
+static double run(kernel_f const kernel, uint8_t dst[], uint8_t const src[], unsigned const readlen, uint64_t const bases, uint64_t *const check)
+{
+    KTimeMs_t const start = KTimeMsStamp();
+    uint64_t done = 0;
+    uint64_t sum = 0;
+    unsigned r = 0;
+
+    while (done < bases) {
+        kernel(dst, &src[r * readlen], readlen, 0);
+        sum += dst[r % readlen];
+        done += readlen;
+        if (++r == READS)
+            r = 0;
+    }
+    *check = sum;
+    {
+        KTimeMs_t const elapsed = KTimeMsStamp() - start;
+        return done / ((elapsed ? elapsed : 1) / 1000.0) / 1.0e6;
+    }
+}
+
+static rc_t kernbench(unsigned const readlen, uint64_t const bases)
+{
+    static struct {
+        char const *name;
+        kernel_f vector, scalar;
+        bool isRead;
+    } const kernels[] = {
+        { "reverse quality", copyQuality, copyQualityScalar, false },
+        { "reverse complement", copyRead, copyReadScalar, true },
+        { "quality offset", offsetQuality, offsetQualityScalar, false },
+        { "quantize quality", quantizeQuality, quantizeQualityScalar, false },
+    };
+    uint8_t *const reads = malloc(READS * readlen);
+    uint8_t *const quals = malloc(READS * readlen);
+    uint8_t *const dst = malloc(readlen);
+    uint8_t lookup[256];
+    unsigned i;
+
+    if (reads == NULL || quals == NULL || dst == NULL) {
+        rc_t const rc = RC(rcExe, rcBuffer, rcAllocating, rcMemory, rcExhausted);
+        free(reads); free(quals); free(dst);
+        LOGERR(klogErr, rc, "out of memory");
+        return rc;
+    }
+    srand(1);
+    for (i = 0; i != READS * readlen; ++i) {
+        reads[i] = "ACGT"[rand() & 3];
+        quals[i] = 33 + rand() % 42;
+    }
+    /* qual-quant 1 */
+    for (i = 0; i != 256; ++i)
+        lookup[i] = i < 10 ? 1 : i < 20 ? 10 : i < 30 ? 20 : 30;
+    QualityBinsMake(&bins, lookup);
+
+    printf("%u bases per read, %llu bases, MB/s\n", readlen, (unsigned long long)bases);
+    for (i = 0; i != sizeof(kernels) / sizeof(kernels[0]); ++i) {
+        uint8_t const *const src = kernels[i].isRead ? reads : quals;
+        uint64_t check1 = 0;
+        uint64_t check2 = 0;
+        double const scalar = run(kernels[i].scalar, dst, src, readlen, bases, &check1);
+        double const vector = run(kernels[i].vector, dst, src, readlen, bases, &check2);
+
+        printf("%-20s scalar: %8.1f vector: %8.1f x%.1f%s\n", kernels[i].name,
+               scalar, vector, vector / scalar, check1 == check2 ? "" : " MISMATCH");
+    }
+    free(reads);
+    free(quals);
+    free(dst);
+    return 0;
+}
+
+rc_t CC UsageSummary(char const *name)
+{
+    return 0;
+}
+
+rc_t CC Usage(Args const *args)
+{
+    return 0;
+}
+
+rc_t CC KMain(int argc, char *argv[])
+{
+    unsigned readlen = argc > 1 ? strtoul(argv[1], NULL, 0) : 0;
+    uint64_t bases = argc > 2 ? strtoul(argv[2], NULL, 0) : 0;
+
+    return kernbench(readlen ? readlen : 150, (bases ? bases : 256) * 1000000);
+}
@@ -38,7 +38,6 @@
 
 #include <kfs/directory.h>
 #include <kfs/file.h>
-#include <kdb/btree.h>
 #include <kdb/manager.h>
 #include <kdb/database.h>
 #include <kdb/table.h>
@@ -63,9 +62,6 @@
 #include <kapp/log-xml.h>
 #include <kapp/progressbar.h>
 
-#include <kproc/queue.h>
-#include <kproc/thread.h>
-#include <kproc/timeout.h>
 #include <os-native.h>
 
 #include <sysalloc.h>
@@ -74,6 +70,10 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -89,7 +89,10 @@
 #include "reference-writer.h"
 #include "alignment-writer.h"
 #include "mem-bank.h"
+#include "name-index.h"
+#include "read-kernels.h"
 #include "low-match-count.h"
+#include "record-queue.h"
 
 #define NUM_ID_SPACES (256u)
 
@@ -103,6 +106,15 @@ typedef struct {
     size_t elemSize;
     off_t fsize;
     uint8_t *current;
+    enum IdMapModes mode;
+    size_t binSize; /* bytes reserved for an id space when not idmap_File */
+    uint8_t *reserved[NUM_ID_SPACES];
+    struct {
+        uint64_t chunks;
+        uint64_t hugetlb; /* chunks on explicit huge pages */
+        long minflt; /* page faults of the process when the array was made */
+        long majflt;
+    } stats;
     struct mma_map_s {
         struct mma_submap_s {
             uint8_t *base;
@@ -146,7 +158,7 @@ typedef struct FragmentInfo {
 } FragmentInfo;
 
 typedef struct KeyToID {
-    KBTree *key2id[NUM_ID_SPACES];
+    NameIndex *key2id[NUM_ID_SPACES];
     char *key2id_names;
 
     uint32_t idCount[NUM_ID_SPACES];
@@ -189,14 +201,21 @@ static char const *Print_ctx_value_t(ctx_value_t const *const self)
 }
 #endif
 
-static rc_t MMArrayMake(MMArray **rslt, int fd, uint32_t elemSize)
+static rc_t MMArrayMake(MMArray **rslt, int fd, uint32_t elemSize, enum IdMapModes mode)
 {
     MMArray *const self = calloc(1, sizeof(*self));
+    struct rusage ru;
 
     if (self == NULL)
         return RC(rcExe, rcMemMap, rcConstructing, rcMemory, rcExhausted);
     self->elemSize = (elemSize + 3) & ~(3u); /** align to 4 byte **/
     self->fd = fd;
+    self->mode = mode;
+    self->binSize = (size_t)MMA_SUBCHUNK_COUNT * MMA_SUBCHUNK_SIZE * self->elemSize;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        self->stats.minflt = ru.ru_minflt;
+        self->stats.majflt = ru.ru_majflt;
+    }
     *rslt = self;
     return 0;
 }
@@ -204,6 +223,122 @@ static rc_t MMArrayMake(MMArray **rslt, int fd, uint32_t elemSize)
 #define PERF 0
 #define PROT 0
 
+/* spread the pages over the NUMA nodes, so that random lookups from one
+ * socket are not all served by the memory of another */
+static void MMArrayInterleave(void *const base, size_t const size)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    static unsigned long nodes[16];
+    static int nodeCount = -1;
+
+    if (nodeCount < 0) {
+        FILE *const fp = fopen("/sys/devices/system/node/online", "r");
+        unsigned const bits = sizeof(nodes[0]) * 8;
+        unsigned first;
+        unsigned last;
+        int ch = ',';
+
+        nodeCount = 0;
+        while (fp && ch == ',' && fscanf(fp, "%u", &first) == 1) {
+            last = first;
+            ch = fgetc(fp);
+            if (ch == '-') {
+                if (fscanf(fp, "%u", &last) != 1)
+                    break;
+                ch = fgetc(fp);
+            }
+            for ( ; first <= last && first < sizeof(nodes) * 8; ++first, ++nodeCount)
+                nodes[first / bits] |= 1ul << (first % bits);
+        }
+        if (fp)
+            fclose(fp);
+    }
+    if (nodeCount > 1) {
+        /* 3 is MPOL_INTERLEAVE; a failure just leaves the default policy */
+        if (syscall(SYS_mbind, base, size, 3, nodes, sizeof(nodes) * 8 + 1, 0) != 0)
+            (void)LOGMSG(klogDebug, "mbind failed, id2value is not interleaved");
+    }
+#endif
+}
+
+/* fault the pages in now rather than one at a time at random later */
+static void MMArrayPrefault(uint8_t *const base, size_t const size)
+{
+    size_t const page = sysconf(_SC_PAGESIZE);
+    size_t i;
+
+#if defined(MADV_POPULATE_WRITE)
+    if (madvise(base, size, MADV_POPULATE_WRITE) == 0)
+        return;
+#endif
+    for (i = 0; i < size; i += page)
+        ((uint8_t volatile *)base)[i] = 0;
+}
+
+static rc_t MMArrayMapFile(MMArray *const self, uint8_t **const rslt, size_t const chunk)
+{
+    off_t const cur_fsize = self->fsize;
+    off_t const new_fsize = cur_fsize + chunk;
+
+    if (ftruncate(self->fd, new_fsize) != 0)
+        return RC(rcExe, rcFile, rcResizing, rcSize, rcExcessive);
+    else {
+        void *const base = mmap(NULL, chunk, PROT_READ|PROT_WRITE,
+                                MAP_FILE|MAP_SHARED, self->fd, cur_fsize);
+
+        self->fsize = new_fsize;
+        if (base == MAP_FAILED)
+            return RC(rcExe, rcMemMap, rcConstructing, rcMemory, rcExhausted);
+        *rslt = base;
+        return 0;
+    }
+}
+
+/* the whole id space is reserved on its first use, aligned for transparent
+ * huge pages; its chunks are faulted in as they are first used */
+static rc_t MMArrayMapMemory(MMArray *const self, uint8_t **const rslt, size_t const chunk, unsigned const bin_no, unsigned const subbin)
+{
+#if defined(MAP_HUGETLB)
+    if (self->mode == idmap_HugeTLB) {
+        void *const base = mmap(NULL, chunk, PROT_READ|PROT_WRITE,
+                                MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+
+        if (base != MAP_FAILED) {
+            MMArrayInterleave(base, chunk);
+            MMArrayPrefault(base, chunk);
+            ++self->stats.hugetlb;
+            *rslt = base;
+            return 0;
+        }
+        (void)LOGMSG(klogWarn, "no more huge pages for id2value, using transparent huge pages");
+        self->mode = idmap_Memory;
+    }
+#endif
+    if (self->reserved[bin_no] == NULL) {
+        size_t const align = ((size_t)2) << 20;
+        uint8_t *const raw = mmap(NULL, self->binSize + align, PROT_READ|PROT_WRITE,
+                                  MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        uint8_t *base;
+
+        if ((void *)raw == MAP_FAILED)
+            return RC(rcExe, rcMemMap, rcConstructing, rcMemory, rcExhausted);
+
+        base = (uint8_t *)(((uintptr_t)raw + align - 1) & ~((uintptr_t)align - 1));
+        if (base != raw)
+            munmap(raw, base - raw);
+        if (base != raw + align)
+            munmap(base + self->binSize, raw + align - base);
+#if defined(MADV_HUGEPAGE)
+        madvise(base, self->binSize, MADV_HUGEPAGE);
+#endif
+        MMArrayInterleave(base, self->binSize);
+        self->reserved[bin_no] = base;
+    }
+    *rslt = self->reserved[bin_no] + (size_t)subbin * chunk;
+    MMArrayPrefault(*rslt, chunk);
+    return 0;
+}
+
 static rc_t MMArrayGet(MMArray *const self, void **const value, uint64_t const element)
 {
     size_t const chunk = MMA_SUBCHUNK_SIZE * self->elemSize;
@@ -215,28 +350,24 @@ static rc_t MMArrayGet(MMArray *const self, void **const value, uint64_t const e
         return RC(rcExe, rcMemMap, rcConstructing, rcId, rcExcessive);
 
     if (self->map[bin_no].submap[subbin].base == NULL) {
-        off_t const cur_fsize = self->fsize;
-        off_t const new_fsize = cur_fsize + chunk;
+        uint8_t *base = NULL;
+        rc_t const rc = self->mode == idmap_File
+                      ? MMArrayMapFile(self, &base, chunk)
+                      : MMArrayMapMemory(self, &base, chunk, bin_no, subbin);
 
-        if (ftruncate(self->fd, new_fsize) != 0)
-            return RC(rcExe, rcFile, rcResizing, rcSize, rcExcessive);
-        else {
-            void *const base = mmap(NULL, chunk, PROT_READ|PROT_WRITE,
-                                    MAP_FILE|MAP_SHARED, self->fd, cur_fsize);
-
-            self->fsize = new_fsize;
-            if (base == MAP_FAILED) {
+        if (rc) {
+            if (GetRCObject(rc) == rcMemory)
                 PLOGMSG(klogErr, (klogErr, "Failed to construct map for bin $(bin), subbin $(subbin)", "bin=%u,subbin=%u", bin_no, subbin));
-                return RC(rcExe, rcMemMap, rcConstructing, rcMemory, rcExhausted);
-            }
-            else {
+            return rc;
+        }
+        else {
 #if PERF
-                static unsigned mapcount = 0;
+            static unsigned mapcount = 0;
 
-                (void)PLOGMSG(klogInfo, (klogInfo, "Number of mmaps: $(cnt)", "cnt=%u", ++mapcount));
+            (void)PLOGMSG(klogInfo, (klogInfo, "Number of mmaps: $(cnt)", "cnt=%u", ++mapcount));
 #endif
-                self->map[bin_no].submap[subbin].base = base;
-            }
+            ++self->stats.chunks;
+            self->map[bin_no].submap[subbin].base = base;
         }
     }
     uint8_t *const next = self->map[bin_no].submap[subbin].base;
@@ -321,56 +452,78 @@ static void MMArrayClear(MMArray *self)
 #endif
 }
 
+static void MMArrayLogStats(MMArray const *const self)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        (void)PLOGMSG(klogInfo, (klogInfo, "id2value: $(chunks) chunks of $(size) MB, $(huge) on huge pages; "
+                                 "$(minflt) minor and $(majflt) major page faults while loading",
+                                 "chunks=%lu,size=%lu,huge=%lu,minflt=%ld,majflt=%ld",
+                                 self->stats.chunks, (uint64_t)(MMA_SUBCHUNK_SIZE * self->elemSize) >> 20,
+                                 self->stats.hugetlb,
+                                 (long)ru.ru_minflt - self->stats.minflt,
+                                 (long)ru.ru_majflt - self->stats.majflt));
+    }
+}
+
 static void MMArrayWhack(MMArray *self)
 {
     size_t const chunk = MMA_SUBCHUNK_SIZE * self->elemSize;
     unsigned i;
 
+    MMArrayLogStats(self);
     for (i = 0; i != sizeof(self->map)/sizeof(self->map[0]); ++i) {
+        uint8_t *const reserved = self->reserved[i];
         unsigned j;
 
         for (j = 0; j != sizeof(self->map[0].submap)/sizeof(self->map[0].submap[0]); ++j) {
-            if (self->map[i].submap[j].base)
-            	munmap(self->map[i].submap[j].base, chunk);
+            uint8_t *const base = self->map[i].submap[j].base;
+
+            if (base && !(reserved && reserved <= base && base < reserved + self->binSize))
+            	munmap(base, chunk);
         }
+        if (reserved)
+            munmap(reserved, self->binSize);
     }
-    close(self->fd);
+    if (self->fd >= 0)
+        close(self->fd);
     free(self);
 }
 
-static rc_t OpenKBTree(KBTree **const rslt, unsigned n, unsigned max)
+static rc_t OpenNameIndex(NameIndex **const rslt, unsigned n)
 {
-    size_t const cacheSize = (((G.cache_size - (G.cache_size / 2) - (G.cache_size / 8)) / max)
-                            + 0xFFFFF) & ~((size_t)0xFFFFF);
-    KFile *file = NULL;
-    KDirectory *dir;
-    char fname[4096];
-    rc_t rc;
+    char path[4096];
+    rc_t rc = string_printf(path, sizeof(path), NULL, "%s/key2id.%u.%u", G.tmpfs, G.pid, n);
 
-    rc = KDirectoryNativeDir(&dir);
-    if (rc)
-        return rc;
+    if (rc == 0)
+        rc = NameIndexMake(rslt, path, NAME_INDEX_DEFAULT_LOAD_FACTOR);
+    return rc;
+}
 
-    rc = string_printf(fname, sizeof(fname), NULL, "%s/key2id.%u.%u", G.tmpfs, G.pid, n); if (rc) return rc;
-    rc = KDirectoryCreateFile(dir, &file, true, 0600, kcmInit, "%s", fname);
-    KDirectoryRemove(dir, 0, "%s", fname);
-    KDirectoryRelease(dir);
-    if (rc == 0) {
-        rc = KBTreeMakeUpdate(rslt, file, cacheSize,
-                              false, kbtOpaqueKey,
-                              1, 255, sizeof ( uint32_t ),
-                              NULL
-                              );
-        KFileRelease(file);
-#if PERF
-        if (rc == 0) {
-            static unsigned treecount = 0;
+static void LogNameIndexStats(KeyToID const *const ctx)
+{
+    uint64_t names = 0;
+    uint64_t lookups = 0;
+    uint64_t probes = 0;
+    uint64_t bytes = 0;
+    unsigned max_probe = 0;
+    unsigned i;
 
-            (void)PLOGMSG(klogInfo, (klogInfo, "Number of trees: $(cnt)", "cnt=%u", ++treecount));
-        }
-#endif
+    for (i = 0; i != ctx->key2id_count; ++i) {
+        NameIndexStats stats;
+
+        NameIndexGetStats(ctx->key2id[i], &stats);
+        names += stats.count;
+        lookups += stats.lookups;
+        probes += stats.probes;
+        bytes += stats.bytes;
+        if (max_probe < stats.max_probe)
+            max_probe = stats.max_probe;
     }
-    return rc;
+    (void)PLOGMSG(klogInfo, (klogInfo, "key2id: $(names) names in $(indices) indices, $(bytes) bytes, $(probes) slots per lookup, longest probe $(max)",
+                             "names=%lu,indices=%u,bytes=%lu,probes=%.2f,max=%u",
+                             names, ctx->key2id_count, bytes, lookups ? (double)probes / lookups : 0.0, max_probe));
 }
 
 static rc_t GetKeyIDOld(KeyToID *const ctx, uint64_t *const rslt, bool *const wasInserted, char const key[], char const name[], unsigned const namelen)
@@ -380,14 +533,14 @@ static rc_t GetKeyIDOld(KeyToID *const ctx, uint64_t *const rslt, bool *const wa
     uint64_t tmpKey;
 
     if (ctx->key2id_count == 0) {
-        rc = OpenKBTree(&ctx->key2id[0], 1, 1);
+        rc = OpenNameIndex(&ctx->key2id[0], 1);
         if (rc) return rc;
         ctx->key2id_count = 1;
     }
     if (memcmp(key, name, keylen) == 0) {
         /* qname starts with read group; no append */
         tmpKey = ctx->idCount[0];
-        rc = KBTreeEntry(ctx->key2id[0], &tmpKey, wasInserted, name, namelen);
+        rc = NameIndexEntry(ctx->key2id[0], &tmpKey, wasInserted, name, namelen);
     }
     else {
         char sbuf[4096];
@@ -405,7 +558,7 @@ static rc_t GetKeyIDOld(KeyToID *const ctx, uint64_t *const rslt, bool *const wa
         rc = string_printf(buf, bsize, &actsize, "%s\t%.*s", key, (int)namelen, name);
 
         tmpKey = ctx->idCount[0];
-        rc = KBTreeEntry(ctx->key2id[0], &tmpKey, wasInserted, buf, actsize);
+        rc = NameIndexEntry(ctx->key2id[0], &tmpKey, wasInserted, buf, actsize);
         if (hbuf)
             free(hbuf);
     }
@@ -571,8 +724,8 @@ rc_t GetKeyID(KeyToID *const ctx,
         }
         if (ctx->key2id_count < ctx->key2id_max) {
             unsigned const name_max = ctx->key2id_name_max + keylen + 1;
-            KBTree *tree;
-            rc_t rc = OpenKBTree(&tree, ctx->key2id_count + 1, 1); /* ctx->key2id_max); */
+            NameIndex *tree;
+            rc_t rc = OpenNameIndex(&tree, ctx->key2id_count + 1);
 
             if (rc) return rc;
 
@@ -615,7 +768,7 @@ rc_t GetKeyID(KeyToID *const ctx,
             }
         GET_ID:
             tmpKey = ctx->idCount[f];
-            rc = KBTreeEntry(ctx->key2id[f], &tmpKey, wasInserted, name, namelen);
+            rc = NameIndexEntry(ctx->key2id[f], &tmpKey, wasInserted, name, namelen);
             if (rc == 0) {
                 *rslt = (((uint64_t)f) << 32) | tmpKey;
                 if (*wasInserted)
@@ -633,8 +786,12 @@ static rc_t OpenMMapFile(context_t *const ctx, KDirectory *const dir)
 {
     int fd;
     char fname[4096];
-    rc_t rc = string_printf(fname, sizeof(fname), NULL, "%s/id2value.%u", G.tmpfs, G.pid);
+    rc_t rc;
+
+    if (G.idMapMode != idmap_File)
+        return MMArrayMake(&ctx->id2value, -1, sizeof(ctx_value_t), G.idMapMode);
 
+    rc = string_printf(fname, sizeof(fname), NULL, "%s/id2value.%u", G.tmpfs, G.pid);
     if (rc)
         return rc;
 
@@ -642,7 +799,7 @@ static rc_t OpenMMapFile(context_t *const ctx, KDirectory *const dir)
     if (fd < 0)
         return RC(rcExe, rcFile, rcCreating, rcFile, rcNotFound);
     unlink(fname);
-    return MMArrayMake(&ctx->id2value, fd, sizeof(ctx_value_t));
+    return MMArrayMake(&ctx->id2value, fd, sizeof(ctx_value_t), idmap_File);
 }
 
 static rc_t TmpfsDirectory(KDirectory **const rslt)
@@ -715,68 +872,6 @@ static void ContextRelease(context_t *ctx, bool continuing)
         MMArrayClear(ctx->id2value);
 }
 
-static
-void COPY_QUAL(uint8_t D[], uint8_t const S[], unsigned const L, bool const R)
-{
-    if (R) {
-        unsigned i;
-        unsigned j;
-
-        for (i = 0, j = L - 1; i != L; ++i, --j)
-            D[i] = S[j];
-    }
-    else
-        memmove(D, S, L);
-}
-
-static
-void COPY_READ(INSDC_dna_text D[], INSDC_dna_text const S[], unsigned const L, bool const R)
-{
-    static INSDC_dna_text const compl[] = {
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 , '.',  0 ,
-        '0', '1', '2', '3',  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 , 'T', 'V', 'G', 'H',  0 ,  0 , 'C',
-        'D',  0 ,  0 , 'M',  0 , 'K', 'N',  0 ,
-         0 ,  0 , 'Y', 'S', 'A', 'A', 'B', 'W',
-         0 , 'R',  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 , 'T', 'V', 'G', 'H',  0 ,  0 , 'C',
-        'D',  0 ,  0 , 'M',  0 , 'K', 'N',  0 ,
-         0 ,  0 , 'Y', 'S', 'A', 'A', 'B', 'W',
-         0 , 'R',  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
-         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0
-    };
-    if (R) {
-        unsigned i;
-        unsigned j;
-
-        for (i = 0, j = L - 1; i != L; ++i, --j)
-            D[i] = compl[((uint8_t const *)S)[j]];
-    }
-    else
-        memmove(D, S, L);
-}
-
 static KFile *MakeDeferralFile() {
     if (G.deferSecondary) {
         char template[4096];
@@ -796,7 +891,7 @@ static KFile *MakeDeferralFile() {
     return NULL;
 }
 
-static rc_t OpenBAM(const BAM_File **bam, VDatabase *db, const char bamFile[])
+static rc_t OpenBAM(const BAM_File **bam, const char bamFile[])
 {
     rc_t rc = 0;
 
@@ -806,31 +901,41 @@ static rc_t OpenBAM(const BAM_File **bam, VDatabase *db, const char bamFile[])
     else {
         rc = BAM_FileMake(bam, MakeDeferralFile(), G.headerText, "%s", bamFile);
     }
+    if (rc == 0) {
+        /* the inputs being read at the same time share the threads */
+        unsigned threads = G.inflateThreads;
+
+        if (threads > 0 && G.parallelFiles > 1)
+            threads = threads > G.parallelFiles ? threads / G.parallelFiles : 1;
+        rc = BAM_FileSetInflateThreads(*bam, threads);
+    }
     if (rc) {
         (void)PLOGERR(klogErr, (klogErr, rc, "Failed to open '$(file)'", "file=%s", bamFile));
     }
-    else if (db) {
-        KMetadata *dbmeta;
+    return rc;
+}
+
+static rc_t WriteBAMHeader(BAM_File const *bam, VDatabase *db)
+{
+    KMetadata *dbmeta;
+    rc_t rc = VDatabaseOpenMetadataUpdate(db, &dbmeta);
+
+    if (rc == 0) {
+        KMDataNode *node;
 
-        rc = VDatabaseOpenMetadataUpdate(db, &dbmeta);
+        rc = KMetadataOpenNodeUpdate(dbmeta, &node, "BAM_HEADER");
+        KMetadataRelease(dbmeta);
         if (rc == 0) {
-            KMDataNode *node;
+            char const *header;
+            size_t size;
 
-            rc = KMetadataOpenNodeUpdate(dbmeta, &node, "BAM_HEADER");
-            KMetadataRelease(dbmeta);
+            rc = BAM_FileGetHeaderText(bam, &header, &size);
             if (rc == 0) {
-                char const *header;
-                size_t size;
-
-                rc = BAM_FileGetHeaderText(*bam, &header, &size);
-                if (rc == 0) {
-                    rc = KMDataNodeWrite(node, header, size);
-                }
-                KMDataNodeRelease(node);
+                rc = KMDataNodeWrite(node, header, size);
             }
+            KMDataNodeRelease(node);
         }
     }
-
     return rc;
 }
 
@@ -1394,106 +1499,125 @@ static rc_t FixOverhangingAlignment(KDataBuffer *cigBuf, uint32_t *opCount, uint
 }
 
 static context_t GlobalContext;
-static timeout_t bamq_tm;
-static KQueue *bamq;
-static KThread *bamread_thread;
 
-static rc_t run_bamread_thread(const KThread *self, void *const file)
-{
-    rc_t rc = 0;
-    size_t NR = 0;
+/* an input file and the thread reading it, see record-queue.h */
+typedef struct BAMInput {
+    char const *path;
+    BAM_File const *bam;
+    RecordQueue queue;
+} BAMInput;
 
-    while (rc == 0) {
-        BAM_Alignment const *crec = NULL;
-        BAM_Alignment *rec = NULL;
+static RecordTurn inputTurn;    /* whose records are being keyed */
 
-        ++NR;
-        rc = BAM_FileRead2(file, &crec);
-        if ((int)GetRCObject(rc) == rcRow && (int)GetRCState(rc) == rcEmpty) {
-            rc = CheckLimitAndLogError();
-            continue;
-        }
-        if ((int)GetRCObject(rc) == rcRow && (int)GetRCState(rc) == rcNotFound) {
-            /* EOF */
-            rc = 0;
-            --NR;
-            break;
-        }
-        if (rc) break;
-        rc = BAM_AlignmentCopy(crec, &rec);
+static rc_t CC readRecord(void *const data, void **const rslt)
+{
+    BAMInput const *const self = data;
+    BAM_Alignment const *crec = NULL;
+    rc_t rc = BAM_FileRead2(self->bam, &crec);
+
+    if (rc == 0) {
+        rc = BAM_AlignmentCopy(crec, (BAM_Alignment **)rslt);
         BAM_AlignmentRelease(crec);
-        if (rc) break;
+    }
+    return rc;
+}
 
-        {
-            static char const dummy[] = "";
-            char const *spotGroup;
-            char const *name;
-            size_t namelen;
+/* looks up the names of the records in the block, in the order of the inputs */
+static rc_t CC keyRecords(void *const data, RecordBlock *const block)
+{
+    static char const dummy[] = "";
+    rc_t rc = 0;
+    unsigned i;
 
-            BAM_AlignmentGetReadName2(rec, &name, &namelen);
-            BAM_AlignmentGetReadGroupName(rec, &spotGroup);
-            rc = GetKeyID(&GlobalContext.keyToID, &rec->keyId, &rec->wasInserted, spotGroup ? spotGroup : dummy, name, namelen);
-            if (rc) break;
-        }
+    for (i = 0; i < block->empty && rc == 0; ++i)
+        rc = CheckLimitAndLogError();
+    for (i = 0; i < block->count && rc == 0; ++i) {
+        BAM_Alignment *const rec = block->rec[i];
+        char const *spotGroup;
+        char const *name;
+        size_t namelen;
 
-        for ( ; ; ) {
-            rc = KQueuePush(bamq, rec, &bamq_tm);
-            if (rc == 0 || (int)GetRCObject(rc) != rcTimeout)
-                break;
-        }
-    }
-    KQueueSeal(bamq);
-    if (rc) {
-        (void)LOGERR(klogErr, rc, "bamread_thread done");
-    }
-    else {
-        (void)PLOGMSG(klogInfo, (klogInfo, "bamread_thread done; read $(NR) records", "NR=%lu", NR));
+        BAM_AlignmentGetReadName2(rec, &name, &namelen);
+        BAM_AlignmentGetReadGroupName(rec, &spotGroup);
+        rc = GetKeyID(&GlobalContext.keyToID, &rec->keyId, &rec->wasInserted, spotGroup ? spotGroup : dummy, name, namelen);
     }
     return rc;
 }
 
-/* call on main thread only */
-static BAM_Alignment const *getNextRecord(BAM_File const *const bam, rc_t *const rc)
+static void CC releaseRecord(void *const rec)
 {
-    if (bamq == NULL) {
-        TimeoutInit(&bamq_tm, 10000); /* 10 seconds */
-        *rc = KQueueMake(&bamq, 4096);
-        if (*rc) return NULL;
-        *rc = KThreadMake(&bamread_thread, run_bamread_thread, (void *)bam);
-        if (*rc) {
-            KQueueRelease(bamq);
-            bamq = NULL;
-            return NULL;
-        }
-    }
-    while (*rc == 0 && (*rc = Quitting()) == 0) {
-        BAM_Alignment const *rec = NULL;
-
-        *rc = KQueuePop(bamq, (void **)&rec, &bamq_tm);
-        if (*rc == 0)
-            return rec; /* this is the normal return */
-
-        if ((int)GetRCObject(*rc) == rcTimeout)
-            *rc = 0;
-        else {
-            if ((int)GetRCObject(*rc) == rcData && (int)GetRCState(*rc) == rcDone)
-                (void)LOGMSG(klogDebug, "KQueuePop Done");
-            else
-                (void)PLOGERR(klogWarn, (klogWarn, *rc, "KQueuePop Error", NULL));
+    BAM_AlignmentRelease(rec);
+}
+
+/* stops the reader thread if it is still running; returns its rc */
+static rc_t BAMInputWhack(BAMInput *const self)
+{
+    rc_t const rc = RecordQueueWhack(&self->queue);
+
+    BAM_FileRelease(self->bam);
+    memset(self, 0, sizeof(*self));
+    return rc;
+}
+
+static void SetupKeyToID(context_t *const ctx, BAM_File const *const bam)
+{
+    uint32_t rgcount;
+    unsigned rgi;
+
+    BAM_FileGetReadGroupCount(bam, &rgcount);
+    if (rgcount > (sizeof(ctx->keyToID.key2id)/sizeof(ctx->keyToID.key2id[0]) - 1))
+        ctx->keyToID.key2id_max = 1;
+    else
+        ctx->keyToID.key2id_max = sizeof(ctx->keyToID.key2id)/sizeof(ctx->keyToID.key2id[0]);
+
+    for (rgi = 0; rgi != rgcount; ++rgi) {
+        BAMReadGroup const *rg;
+
+        BAM_FileGetReadGroup(bam, rgi, &rg);
+        if (rg && rg->platform && platform_cmp(rg->platform, "CAPILLARY")) {
+            G.hasTI = true;
+            break;
         }
     }
-	KQueueSeal(bamq);
-    {
-        rc_t rc2 = 0;
-        KThreadWait(bamread_thread, &rc2);
-        if (rc2 != 0)
-            *rc = rc2;
-    }
-    KThreadRelease(bamread_thread);
-    bamread_thread = NULL;
-	KQueueRelease(bamq);
-    bamq = NULL;
-    return NULL;
+}
+
+static rc_t BAMInputOpen(BAMInput *const self, char const path[], unsigned const order)
+{
+    memset(self, 0, sizeof(*self));
+    self->path = path;
+    self->queue.order = order;
+    return OpenBAM(&self->bam, path);
+}
+
+/* starts reading the input; call on main thread only, in the order of the inputs */
+static rc_t BAMInputStart(BAMInput *const self)
+{
+    RecordSource src;
+
+    if (self->queue.thread != NULL)
+        return 0;
+    if (inputTurn.lock == NULL) {
+        rc_t const rc = RecordTurnInit(&inputTurn);
+        if (rc) return rc;
+    }
+    if (GlobalContext.keyToID.key2id_max == 0)
+        SetupKeyToID(&GlobalContext, self->bam);
+
+    src.read = readRecord;
+    src.prepare = keyRecords;
+    src.release = releaseRecord;
+    src.data = self;
+    return RecordQueueStart(&self->queue, &inputTurn, self->queue.order, &src, self->path);
+}
+
+/* call on main thread only; returns NULL at the end or on any error, see RecordQueueNext */
+static BAM_Alignment const *getNextRecord(BAMInput *const self, rc_t *const rc)
+{
+    if (*rc == 0 && self->queue.thread == NULL)
+        *rc = BAMInputStart(self);
+    if (*rc != 0 && self->queue.thread == NULL)
+        return NULL;
+    return RecordQueueNext(&self->queue, rc);
 }
 
 static void getSpotGroup(BAM_Alignment const *const rec, char spotGroup[])
@@ -1536,13 +1660,14 @@ static char const *getLinkageGroup(BAM_Alignment const *const rec)
     return linkageGroup;
 }
 
-static rc_t ProcessBAM(char const bamFile[], context_t *ctx, VDatabase *db,
+static rc_t ProcessBAM(BAMInput *input, context_t *ctx, VDatabase *db,
                         /* data outputs */
                        Reference *ref, Sequence *seq, Alignment *align,
                        /* output parameters */
                        bool *had_alignments, bool *had_sequences)
 {
-    const BAM_File *bam;
+    char const *const bamFile = input->path;
+    const BAM_File *const bam = input->bam;
     const BAM_Alignment *rec;
     KDataBuffer buf;
     KDataBuffer fragBuf;
@@ -1589,34 +1714,12 @@ static rc_t ProcessBAM(char const bamFile[], context_t *ctx, VDatabase *db,
     srec.aligned        = srecStorage.aligned;
     srec.cskey          = srecStorage. cskey;
 
-    rc = OpenBAM(&bam, db, bamFile);
+    rc = db ? WriteBAMHeader(bam, db) : 0;
     if (rc) return rc;
     if (!G.noVerifyReferences && ref != NULL) {
         rc = VerifyReferences(bam, ref);
-        if (G.onlyVerifyReferences) {
-            BAM_FileRelease(bam);
+        if (G.onlyVerifyReferences)
             return rc;
-        }
-    }
-    if (ctx->keyToID.key2id_max == 0) {
-        uint32_t rgcount;
-        unsigned rgi;
-        
-        BAM_FileGetReadGroupCount(bam, &rgcount);
-        if (rgcount > (sizeof(ctx->keyToID.key2id)/sizeof(ctx->keyToID.key2id[0]) - 1))
-            ctx->keyToID.key2id_max = 1;
-        else
-            ctx->keyToID.key2id_max = sizeof(ctx->keyToID.key2id)/sizeof(ctx->keyToID.key2id[0]);
-
-        for (rgi = 0; rgi != rgcount; ++rgi) {
-            BAMReadGroup const *rg;
-
-            BAM_FileGetReadGroup(bam, rgi, &rg);
-            if (rg && rg->platform && platform_cmp(rg->platform, "CAPILLARY")) {
-                G.hasTI = true;
-                break;
-            }
-        }
     }
 
     /* setting up more buffers */
@@ -1644,7 +1747,7 @@ static rc_t ProcessBAM(char const bamFile[], context_t *ctx, VDatabase *db,
         (void)PLOGMSG(klogInfo, (klogInfo, "Loading '$(file)'", "file=%s", bamFile));
     }
 
-    while ((rec = getNextRecord(bam, &rc)) != NULL) {
+    while ((rec = getNextRecord(input, &rc)) != NULL) {
         bool aligned;
         uint32_t readlen;
         uint16_t flags;
@@ -1913,7 +2016,6 @@ MIXED_BASE_AND_COLOR:
             else {
                 uint8_t const *squal;
                 uint8_t qoffset = 0;
-                unsigned i;
 
                 rc = BAM_AlignmentGetQuality2(rec, &squal, &qoffset);
                 if (rc) {
@@ -1921,8 +2023,7 @@ MIXED_BASE_AND_COLOR:
                     goto LOOP_END;
                 }
                 if (qoffset) {
-                    for (i = 0; i != readlen; ++i)
-                        qual[i + lpad] = squal[i] - qoffset;
+                    OffsetQuality(qual + lpad, squal, readlen, qoffset);
                     QUAL_CHANGED_OQ;
                 }
                 else
@@ -1963,8 +2064,8 @@ MIXED_BASE_AND_COLOR:
 
         revcmp = (isColorSpace && !aligned) ? false : AR_REF_ORIENT(data);
         (void)PLOGMSG(klogDebug, (klogDebug, "Read '$(name)' is $(or) at $(ref):$(pos)", "name=%s,or=%s,ref=%s,pos=%i", name, revcmp ? "reverse" : "forward", refSeq ? refSeq->name : "(none)", rpos));
-        COPY_READ(seqBuffer.base, seqDNA, readlen, revcmp);
-        COPY_QUAL(qualBuffer.base, qual, readlen, revcmp);
+        CopyRead(seqBuffer.base, seqDNA, readlen, revcmp);
+        CopyQuality(qualBuffer.base, qual, readlen, revcmp);
 
         AR_MAPQ(data) = GetMapQ(rec);
         if (!isPrimary && AR_MAPQ(data) < G.minMapQual)
@@ -2640,7 +2741,6 @@ WRITE_ALIGNMENT:
         rc = RC(rcAlign, rcFile, rcReading, rcData, rcEmpty);
     }
 
-    BAM_FileRelease(bam);
     MMArrayLock(ctx->id2value);
     KDataBufferWhack(&buf);
     KDataBufferWhack(&fragBuf);
@@ -2875,6 +2975,10 @@ static rc_t ArchiveBAM(VDBManager *mgr, VDatabase *db,
     Alignment *align;
     static context_t *ctx = &GlobalContext;
     bool has_sequences = false;
+    unsigned const files = bamFiles + seqFiles;
+    unsigned const window = G.parallelFiles > 1 ? G.parallelFiles : 1;
+    BAMInput *input;
+    unsigned started = 0;
     unsigned i;
 
     *has_alignments = false;
@@ -2884,7 +2988,13 @@ static rc_t ArchiveBAM(VDBManager *mgr, VDatabase *db,
 
     if (G.onlyVerifyReferences) {
         for (i = 0; i < bamFiles && rc == 0; ++i) {
-            rc = ProcessBAM(bamFile[i], NULL, db, &ref, NULL, NULL, NULL, NULL);
+            BAMInput verify;
+
+            rc = BAMInputOpen(&verify, bamFile[i], i);
+            if (rc == 0) {
+                rc = ProcessBAM(&verify, NULL, db, &ref, NULL, NULL, NULL, NULL);
+                BAMInputWhack(&verify);
+            }
         }
         ReferenceWhack(&ref, false);
         return rc;
@@ -2892,32 +3002,43 @@ static rc_t ArchiveBAM(VDBManager *mgr, VDatabase *db,
     SequenceInit(&seq, db);
     align = AlignmentMake(db);
 
-    rc = SetupContext(ctx, bamFiles + seqFiles);
+    rc = SetupContext(ctx, files);
     if (rc)
         return rc;
 
-    ctx->pass = 1;
-    for (i = 0; i < bamFiles && rc == 0; ++i) {
-        bool this_has_alignments = false;
-        bool this_has_sequences = false;
+    /* the inputs in load order, the BAM files then the sequence files;
+     * up to window of them are open and being read at once */
+    input = calloc(files, sizeof(input[0]));
+    if (input == NULL)
+        return RC(rcExe, rcFile, rcAllocating, rcMemory, rcExhausted);
 
-        rc = ProcessBAM(bamFile[i], ctx, db, &ref, &seq, align, &this_has_alignments, &this_has_sequences);
-        *has_alignments |= this_has_alignments;
-        has_sequences |= this_has_sequences;
-    }
-    for (i = 0; i < seqFiles && rc == 0; ++i) {
+    ctx->pass = 1;
+    for (i = 0; i < files && rc == 0; ++i) {
         bool this_has_alignments = false;
         bool this_has_sequences = false;
 
-        rc = ProcessBAM(seqFile[i], ctx, db, &ref, &seq, align, &this_has_alignments, &this_has_sequences);
+        while (rc == 0 && started < files && started < i + window) {
+            rc = BAMInputOpen(&input[started], started < bamFiles ? bamFile[started] : seqFile[started - bamFiles], started);
+            if (rc == 0)
+                rc = BAMInputStart(&input[started]);
+            ++started;
+        }
+        if (rc == 0)
+            rc = ProcessBAM(&input[i], ctx, db, &ref, &seq, align, &this_has_alignments, &this_has_sequences);
         *has_alignments |= this_has_alignments;
         has_sequences |= this_has_sequences;
+        BAMInputWhack(&input[i]);
     }
+    /* anything left open after an error */
+    for ( ; i < started; ++i)
+        BAMInputWhack(&input[i]);
+    free(input);
+    RecordTurnWhack(&inputTurn);
     if (!continuing) {
 /*** No longer need memory for key2id ***/
+        LogNameIndexStats(&ctx->keyToID);
         for (i = 0; i != ctx->keyToID.key2id_count; ++i) {
-            KBTreeDropBacking(ctx->keyToID.key2id[i]);
-            KBTreeRelease(ctx->keyToID.key2id[i]);
+            NameIndexWhack(ctx->keyToID.key2id[i]);
             ctx->keyToID.key2id[i] = NULL;
         }
         free(ctx->keyToID.key2id_names);
@@ -3026,6 +3147,8 @@ rc_t run(char const progName[],
 
         /* VDBManagerDisableFlushThread(mgr); */
         rc = VDBManagerDisablePagemapThread(mgr);
+        if (rc == 0 && G.headerCachePath != NULL)
+            rc = BAM_SetHeaderCacheDir(G.headerCachePath);
         if (rc == 0)
         {
             if (G.onlyVerifyReferences) {
@@ -0,0 +1,355 @@
+/* ===========================================================================
+ *
+ *                            PUBLIC DOMAIN NOTICE
+ *               National Center for Biotechnology Information
+ *
+ *  This software/database is a "United States Government Work" under the
+ *  terms of the United States Copyright Act.  It was written as part of
+ *  the author's official duties as a United States Government employee and
+ *  thus cannot be copyrighted.  This software/database is freely available
+ *  to the public for use. The National Library of Medicine and the U.S.
+ *  Government have not placed any restriction on its use or reproduction.
+ *
+ *  Although all reasonable efforts have been taken to ensure the accuracy
+ *  and reliability of the software and data, the NLM and the U.S.
+ *  Government do not and cannot warrant the performance or results that
+ *  may be obtained by using this software or data. The NLM and the U.S.
+ *  Government disclaim all warranties, express or implied, including
+ *  warranties of performance, merchantability or fitness for any particular
+ *  purpose.
+ *
+ *  Please cite the author in any work or product based on this material.
+ *
+ * ===========================================================================
+ *
+ */
+
+#include <klib/defs.h>
+#include <klib/rc.h>
+#include <klib/printf.h>
+#include <sysalloc.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "name-index.h"
+
+#define NAME_CHUNK_BITS (24u) /* names are mapped 16MB at a time */
+#define NAME_CHUNK_SIZE (((size_t)1) << NAME_CHUNK_BITS)
+#define NAME_MAX_LEN (0xFFFFu)
+#define NAME_FIRST (2u) /* offset 0 marks an empty slot */
+#define INITIAL_CAPACITY (((uint64_t)1) << 16)
+#define MAX_CAPACITY (((uint64_t)1) << 32) /* the hash has 32 bits */
+
+typedef struct NameIndexSlot {
+    uint32_t hash;
+    uint32_t id;
+    uint64_t name;  /* offset of [ uint16 length ][ bytes ] in the names, 0 if empty */
+} NameIndexSlot;
+
+struct NameIndex {
+    NameIndexSlot *table;
+    uint8_t **chunk;        /* the mapped chunks of the names-file */
+    char *path;
+    uint64_t mask;          /* capacity - 1 */
+    uint64_t limit;         /* grow when count reaches this */
+    uint64_t count;
+    uint64_t name_end;      /* next free offset in the names */
+    uint64_t lookups;
+    uint64_t probes;
+    double load_factor;
+    int table_fd;
+    int name_fd;
+    unsigned chunks;
+    unsigned max_probe;
+    unsigned grown;
+};
+
+/* FNV-1a with folding, like HashKey in the loaders */
+static uint32_t NameHash(void const *const name, size_t const namelen)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    size_t i;
+
+    for (i = 0; i < namelen; ++i) {
+        uint8_t const octet = ((uint8_t const *)name)[i];
+        h = (h ^ octet) * 0x100000001b3ull;
+    }
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+/* the file is removed right away, it goes when its descriptor is closed */
+static rc_t OpenScratchFile(int *const fd, char const path[], char const suffix[], unsigned const gen)
+{
+    char fname[4096];
+    rc_t rc = string_printf(fname, sizeof(fname), NULL, "%s.%s.%u", path, suffix, gen);
+
+    if (rc)
+        return rc;
+    *fd = open(fname, O_RDWR|O_TRUNC|O_CREAT, S_IRUSR|S_IWUSR);
+    if (*fd < 0)
+        return RC(rcExe, rcFile, rcCreating, rcFile, rcNotFound);
+    unlink(fname);
+    return 0;
+}
+
+static rc_t MapScratchFile(void **const base, int const fd, uint64_t const offset, size_t const size)
+{
+    void *map;
+
+    if (ftruncate(fd, offset + size) != 0)
+        return RC(rcExe, rcFile, rcResizing, rcStorage, rcExhausted);
+    map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, offset);
+    if (map == MAP_FAILED)
+        return RC(rcExe, rcMemMap, rcAllocating, rcMemory, rcExhausted);
+    *base = map;
+    return 0;
+}
+
+static rc_t MakeTable(NameIndex *const self, uint64_t const capacity)
+{
+    void *table;
+    int fd;
+    rc_t rc = OpenScratchFile(&fd, self->path, "table", self->grown);
+
+    if (rc)
+        return rc;
+    /* a new file is all zeros, i.e. all slots are empty */
+    rc = MapScratchFile(&table, fd, 0, capacity * sizeof(NameIndexSlot));
+    if (rc) {
+        close(fd);
+        return rc;
+    }
+    self->table = table;
+    self->table_fd = fd;
+    self->mask = capacity - 1;
+    self->limit = (uint64_t)(capacity * self->load_factor);
+    return 0;
+}
+
+static void WhackTable(NameIndexSlot *const table, int const fd, uint64_t const capacity)
+{
+    if (table)
+        munmap(table, capacity * sizeof(NameIndexSlot));
+    if (fd >= 0)
+        close(fd);
+}
+
+static unsigned ProbeDistance(NameIndex const *const self, uint64_t const pos, uint32_t const hash)
+{
+    return (unsigned)((pos - hash) & self->mask);
+}
+
+/* Robin Hood: whoever is further from home keeps the slot, the other one moves on */
+static void Place(NameIndex *const self, NameIndexSlot slot, uint64_t pos, unsigned dist)
+{
+    for ( ; ; ) {
+        NameIndexSlot *const s = &self->table[pos];
+
+        if (s->name == 0) {
+            *s = slot;
+            if (self->max_probe < dist)
+                self->max_probe = dist;
+            return;
+        }
+        {
+            unsigned const sdist = ProbeDistance(self, pos, s->hash);
+
+            if (sdist < dist) {
+                NameIndexSlot const tmp = *s;
+
+                *s = slot;
+                slot = tmp;
+                if (self->max_probe < dist)
+                    self->max_probe = dist;
+                dist = sdist;
+            }
+        }
+        pos = (pos + 1) & self->mask;
+        ++dist;
+    }
+}
+
+static rc_t Grow(NameIndex *const self)
+{
+    NameIndexSlot *const old = self->table;
+    int const old_fd = self->table_fd;
+    uint64_t const old_capacity = self->mask + 1;
+    uint64_t i;
+    rc_t rc;
+
+    if (old_capacity >= MAX_CAPACITY)
+        return RC(rcExe, rcIndex, rcInserting, rcRange, rcExcessive);
+
+    ++self->grown;
+    rc = MakeTable(self, old_capacity * 2);
+    if (rc) {
+        --self->grown;
+        return rc;
+    }
+    self->max_probe = 0;
+    for (i = 0; i < old_capacity; ++i) {
+        if (old[i].name != 0)
+            Place(self, old[i], old[i].hash & self->mask, 0);
+    }
+    WhackTable(old, old_fd, old_capacity);
+    return 0;
+}
+
+static uint8_t const *NameAt(NameIndex const *const self, uint64_t const offset)
+{
+    return self->chunk[offset >> NAME_CHUNK_BITS] + (offset & (NAME_CHUNK_SIZE - 1));
+}
+
+static bool NameEquals(NameIndex const *const self, uint64_t const offset, void const *const name, size_t const namelen)
+{
+    uint8_t const *const stored = NameAt(self, offset);
+    size_t const len = stored[0] | (((size_t)stored[1]) << 8);
+
+    return len == namelen && memcmp(stored + 2, name, namelen) == 0;
+}
+
+static rc_t AppendName(NameIndex *const self, uint64_t *const offset, void const *const name, size_t const namelen)
+{
+    size_t const size = namelen + 2;
+    uint8_t *dst;
+
+    if (((self->name_end + size - 1) >> NAME_CHUNK_BITS) != (self->name_end >> NAME_CHUNK_BITS)
+        || (self->name_end >> NAME_CHUNK_BITS) == self->chunks)
+    {
+        /* names do not straddle chunks, start the next one */
+        uint64_t const next = ((uint64_t)self->chunks) << NAME_CHUNK_BITS;
+        void *tmp = realloc(self->chunk, (self->chunks + 1) * sizeof(self->chunk[0]));
+        void *map;
+        rc_t rc;
+
+        if (tmp == NULL)
+            return RC(rcExe, rcIndex, rcAllocating, rcMemory, rcExhausted);
+        self->chunk = tmp;
+        rc = MapScratchFile(&map, self->name_fd, next, NAME_CHUNK_SIZE);
+        if (rc)
+            return rc;
+        self->chunk[self->chunks++] = map;
+        if (self->name_end < next)
+            self->name_end = next;
+        if (next == 0)
+            self->name_end = NAME_FIRST;
+    }
+    dst = self->chunk[self->name_end >> NAME_CHUNK_BITS] + (self->name_end & (NAME_CHUNK_SIZE - 1));
+    dst[0] = (uint8_t)namelen;
+    dst[1] = (uint8_t)(namelen >> 8);
+    memmove(dst + 2, name, namelen);
+    *offset = self->name_end;
+    self->name_end += size;
+    return 0;
+}
+
+rc_t NameIndexMake(NameIndex **const rslt, char const path[], double load_factor)
+{
+    NameIndex *const self = calloc(1, sizeof(*self));
+    rc_t rc;
+
+    *rslt = NULL;
+    if (self == NULL)
+        return RC(rcExe, rcIndex, rcConstructing, rcMemory, rcExhausted);
+    if (!(load_factor > 0.0 && load_factor <= 0.95))
+        load_factor = NAME_INDEX_DEFAULT_LOAD_FACTOR;
+    self->load_factor = load_factor;
+    self->table_fd = -1;
+    self->name_fd = -1;
+    self->path = strdup(path);
+    if (self->path == NULL) {
+        free(self);
+        return RC(rcExe, rcIndex, rcConstructing, rcMemory, rcExhausted);
+    }
+    rc = OpenScratchFile(&self->name_fd, path, "names", 0);
+    if (rc == 0)
+        rc = MakeTable(self, INITIAL_CAPACITY);
+    if (rc) {
+        NameIndexWhack(self);
+        return rc;
+    }
+    *rslt = self;
+    return 0;
+}
+
+void NameIndexWhack(NameIndex *const self)
+{
+    if (self != NULL) {
+        unsigned i;
+
+        WhackTable(self->table, self->table_fd, self->mask + 1);
+        for (i = 0; i < self->chunks; ++i)
+            munmap(self->chunk[i], NAME_CHUNK_SIZE);
+        if (self->name_fd >= 0)
+            close(self->name_fd);
+        free(self->chunk);
+        free(self->path);
+        free(self);
+    }
+}
+
+rc_t NameIndexEntry(NameIndex *const self, uint64_t *const id, bool *const wasInserted, void const *const name, size_t const namelen)
+{
+    uint32_t const hash = NameHash(name, namelen);
+    uint64_t pos = hash & self->mask;
+    unsigned dist = 0;
+    NameIndexSlot slot;
+    rc_t rc;
+
+    ++self->lookups;
+    for ( ; ; ++dist, pos = (pos + 1) & self->mask) {
+        NameIndexSlot const *const s = &self->table[pos];
+
+        ++self->probes;
+        if (s->name == 0 || ProbeDistance(self, pos, s->hash) < dist)
+            break; /* a Robin Hood table would have put it here */
+        if (s->hash == hash && NameEquals(self, s->name, name, namelen)) {
+            *id = s->id;
+            *wasInserted = false;
+            return 0;
+        }
+    }
+
+    if (namelen > NAME_MAX_LEN)
+        return RC(rcExe, rcIndex, rcInserting, rcName, rcTooLong);
+    if (*id > UINT32_MAX)
+        return RC(rcExe, rcIndex, rcInserting, rcId, rcOutofrange);
+    rc = AppendName(self, &slot.name, name, namelen);
+    if (rc)
+        return rc;
+    slot.hash = hash;
+    slot.id = (uint32_t)*id;
+
+    if (self->count >= self->limit) {
+        rc = Grow(self);
+        if (rc)
+            return rc;
+        pos = hash & self->mask;
+        dist = 0;
+    }
+    Place(self, slot, pos, dist);
+    ++self->count;
+    *wasInserted = true;
+    return 0;
+}
+
+void NameIndexGetStats(NameIndex const *const self, NameIndexStats *const stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (self != NULL) {
+        stats->count = self->count;
+        stats->capacity = self->mask + 1;
+        stats->lookups = self->lookups;
+        stats->probes = self->probes;
+        stats->bytes = (self->mask + 1) * sizeof(NameIndexSlot) + self->name_end;
+        stats->max_probe = self->max_probe;
+        stats->grown = self->grown;
+    }
+}
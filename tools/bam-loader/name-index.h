@@ -0,0 +1,66 @@
+/* ===========================================================================
+ *
+ *                            PUBLIC DOMAIN NOTICE
+ *               National Center for Biotechnology Information
+ *
+ *  This software/database is a "United States Government Work" under the
+ *  terms of the United States Copyright Act.  It was written as part of
+ *  the author's official duties as a United States Government employee and
+ *  thus cannot be copyrighted.  This software/database is freely available
+ *  to the public for use. The National Library of Medicine and the U.S.
+ *  Government have not placed any restriction on its use or reproduction.
+ *
+ *  Although all reasonable efforts have been taken to ensure the accuracy
+ *  and reliability of the software and data, the NLM and the U.S.
+ *  Government do not and cannot warrant the performance or results that
+ *  may be obtained by using this software or data. The NLM and the U.S.
+ *  Government disclaim all warranties, express or implied, including
+ *  warranties of performance, merchantability or fitness for any particular
+ *  purpose.
+ *
+ *  Please cite the author in any work or product based on this material.
+ *
+ * ===========================================================================
+ *
+ */
+
+#ifndef BAM_LOAD_NAME_INDEX_H_
+#define BAM_LOAD_NAME_INDEX_H_ 1
+
+#include <klib/defs.h>
+
+/* Maps spot names to ids, used instead of a KBTree per read group.
+ * Open addressing with Robin Hood probing; the slots and the names live in
+ * unlinked scratch files that are mapped into memory, so the OS pages them
+ * out to disk instead of the loader running out of memory.
+ * Shared with latf-load ( tools/fastq-loader ).
+ */
+
+typedef struct NameIndex NameIndex;
+
+typedef struct NameIndexStats {
+    uint64_t count;         /* names in the index */
+    uint64_t capacity;      /* slots in the table */
+    uint64_t lookups;
+    uint64_t probes;        /* slots visited by all lookups */
+    uint64_t bytes;         /* scratch bytes used by the table and the names */
+    unsigned max_probe;     /* longest distance of a name from its home slot */
+    unsigned grown;         /* times the table was doubled */
+} NameIndexStats;
+
+#define NAME_INDEX_DEFAULT_LOAD_FACTOR (0.75)
+
+/* path is the prefix of the scratch files, they are removed when opened
+ * the table is doubled once it is filled above load_factor ( 0 or out of
+ * range: NAME_INDEX_DEFAULT_LOAD_FACTOR ) */
+rc_t NameIndexMake(NameIndex **rslt, char const path[], double load_factor);
+
+void NameIndexWhack(NameIndex *self);
+
+/* like KBTreeEntry: if the name is found, *id is set to its id;
+ * if not, the name is inserted with *id as its id */
+rc_t NameIndexEntry(NameIndex *self, uint64_t *id, bool *wasInserted, void const *name, size_t namelen);
+
+void NameIndexGetStats(NameIndex const *self, NameIndexStats *stats);
+
+#endif /* BAM_LOAD_NAME_INDEX_H_ */
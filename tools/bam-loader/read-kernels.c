@@ -0,0 +1,261 @@
+/* ===========================================================================
+ *
+ *                            PUBLIC DOMAIN NOTICE
+ *               National Center for Biotechnology Information
+ *
+ *  This software/database is a "United States Government Work" under the
+ *  terms of the United States Copyright Act.  It was written as part of
+ *  the author's official duties as a United States Government employee and
+ *  thus cannot be copyrighted.  This software/database is freely available
+ *  to the public for use. The National Library of Medicine and the U.S.
+ *  Government have not placed any restriction on its use or reproduction.
+ *
+ *  Although all reasonable efforts have been taken to ensure the accuracy
+ *  and reliability of the software and data, the NLM and the U.S.
+ *  Government do not and cannot warrant the performance or results that
+ *  may be obtained by using this software or data. The NLM and the U.S.
+ *  Government disclaim all warranties, express or implied, including
+ *  warranties of performance, merchantability or fitness for any particular
+ *  purpose.
+ *
+ *  Please cite the author in any work or product based on this material.
+ *
+ * ===========================================================================
+ *
+ */
+
+#include <klib/defs.h>
+
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define HAVE_SSE2_READ_KERNELS 1
+#include <emmintrin.h>
+#endif
+
+#include "read-kernels.h"
+
+static char const complement[256] = {
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 , '.',  0 ,
+        '0', '1', '2', '3',  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 , 'T', 'V', 'G', 'H',  0 ,  0 , 'C',
+        'D',  0 ,  0 , 'M',  0 , 'K', 'N',  0 ,
+         0 ,  0 , 'Y', 'S', 'A', 'A', 'B', 'W',
+         0 , 'R',  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 , 'T', 'V', 'G', 'H',  0 ,  0 , 'C',
+        'D',  0 ,  0 , 'M',  0 , 'K', 'N',  0 ,
+         0 ,  0 , 'Y', 'S', 'A', 'A', 'B', 'W',
+         0 , 'R',  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,
+         0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0 ,  0
+};
+
+void CopyQualityScalar(uint8_t D[], uint8_t const S[], unsigned const L, bool const R)
+{
+    if (R) {
+        unsigned i;
+        unsigned j;
+
+        for (i = 0, j = L - 1; i != L; ++i, --j)
+            D[i] = S[j];
+    }
+    else
+        memmove(D, S, L);
+}
+
+void CopyReadScalar(char D[], char const S[], unsigned const L, bool const R)
+{
+    if (R) {
+        unsigned i;
+        unsigned j;
+
+        for (i = 0, j = L - 1; i != L; ++i, --j)
+            D[i] = complement[((uint8_t const *)S)[j]];
+    }
+    else
+        memmove(D, S, L);
+}
+
+void OffsetQualityScalar(uint8_t D[], uint8_t const S[], unsigned const L, uint8_t const offset)
+{
+    unsigned i;
+
+    for (i = 0; i != L; ++i)
+        D[i] = S[i] - offset;
+}
+
+void QuantizeQualityScalar(uint8_t D[], uint8_t const S[], unsigned const L, QualityBins const *const bins)
+{
+    unsigned i;
+
+    for (i = 0; i != L; ++i)
+        D[i] = bins->lookup[S[i]];
+}
+
+void QualityBinsMake(QualityBins *const self, uint8_t const lookup[256])
+{
+    unsigned runs = 0;
+    unsigned i;
+
+    memmove(self->lookup, lookup, 256);
+    for (i = 0; i != 256; ++i) {
+        if (i == 0 || lookup[i] != lookup[i - 1]) {
+            if (runs == QUALITY_BINS_MAX_RUNS) {
+                runs = 0;
+                break;
+            }
+            self->start[runs] = i;
+            self->value[runs] = lookup[i];
+            ++runs;
+        }
+    }
+    self->runs = runs;
+}
+
+#if HAVE_SSE2_READ_KERNELS
+
+/* SSE2 has no byte shuffle: reverse the dwords, then the words in each
+ * dword, then the bytes in each word */
+static __m128i ReverseBytes(__m128i v)
+{
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+void CopyQuality(uint8_t D[], uint8_t const S[], unsigned const L, bool const R)
+{
+    if (R) {
+        unsigned i = 0;
+
+        for ( ; i + 16 <= L; i += 16) {
+            __m128i const v = _mm_loadu_si128((__m128i const *)&S[L - i - 16]);
+            _mm_storeu_si128((__m128i *)&D[i], ReverseBytes(v));
+        }
+        CopyQualityScalar(&D[i], S, L - i, true);
+    }
+    else
+        memmove(D, S, L);
+}
+
+/* A, C, G, T and N of either case are done 16 at a time: upper-case them,
+ * then A <-> T is xor 0x15 and C <-> G is xor 0x04; a block with anything
+ * else in it goes through the table */
+void CopyRead(char D[], char const S[], unsigned const L, bool const R)
+{
+    if (R) {
+        __m128i const caseMask = _mm_set1_epi8((char)0xDF);
+        __m128i const A = _mm_set1_epi8('A');
+        __m128i const C = _mm_set1_epi8('C');
+        __m128i const G = _mm_set1_epi8('G');
+        __m128i const T = _mm_set1_epi8('T');
+        __m128i const N = _mm_set1_epi8('N');
+        __m128i const AT = _mm_set1_epi8(0x15);
+        __m128i const CG = _mm_set1_epi8(0x04);
+        unsigned i = 0;
+
+        for ( ; i + 16 <= L; i += 16) {
+            __m128i const v = _mm_and_si128(_mm_loadu_si128((__m128i const *)&S[L - i - 16]), caseMask);
+            __m128i const isAT = _mm_or_si128(_mm_cmpeq_epi8(v, A), _mm_cmpeq_epi8(v, T));
+            __m128i const isCG = _mm_or_si128(_mm_cmpeq_epi8(v, C), _mm_cmpeq_epi8(v, G));
+            __m128i const ok = _mm_or_si128(_mm_or_si128(isAT, isCG), _mm_cmpeq_epi8(v, N));
+
+            if (_mm_movemask_epi8(ok) == 0xFFFF) {
+                __m128i const flip = _mm_or_si128(_mm_and_si128(isAT, AT), _mm_and_si128(isCG, CG));
+                _mm_storeu_si128((__m128i *)&D[i], ReverseBytes(_mm_xor_si128(v, flip)));
+            }
+            else
+                CopyReadScalar(&D[i], &S[L - i - 16], 16, true);
+        }
+        CopyReadScalar(&D[i], S, L - i, true);
+    }
+    else
+        memmove(D, S, L);
+}
+
+void OffsetQuality(uint8_t D[], uint8_t const S[], unsigned const L, uint8_t const offset)
+{
+    __m128i const off = _mm_set1_epi8((char)offset);
+    unsigned i = 0;
+
+    for ( ; i + 16 <= L; i += 16) {
+        __m128i const v = _mm_loadu_si128((__m128i const *)&S[i]);
+        _mm_storeu_si128((__m128i *)&D[i], _mm_sub_epi8(v, off));
+    }
+    OffsetQualityScalar(&D[i], &S[i], L - i, offset);
+}
+
+/* the runs are in increasing order of their start, so the last run whose
+ * start is <= the quality holds its value */
+void QuantizeQuality(uint8_t D[], uint8_t const S[], unsigned const L, QualityBins const *const bins)
+{
+    unsigned const runs = bins->runs;
+    unsigned i = 0;
+
+    if (runs != 0) {
+        __m128i start[QUALITY_BINS_MAX_RUNS];
+        __m128i value[QUALITY_BINS_MAX_RUNS];
+        unsigned j;
+
+        for (j = 0; j != runs; ++j) {
+            start[j] = _mm_set1_epi8((char)bins->start[j]);
+            value[j] = _mm_set1_epi8((char)bins->value[j]);
+        }
+        for ( ; i + 16 <= L; i += 16) {
+            __m128i const v = _mm_loadu_si128((__m128i const *)&S[i]);
+            __m128i y = value[0];
+
+            for (j = 1; j != runs; ++j) {
+                __m128i const ge = _mm_cmpeq_epi8(_mm_max_epu8(v, start[j]), v);
+                y = _mm_or_si128(_mm_and_si128(ge, value[j]), _mm_andnot_si128(ge, y));
+            }
+            _mm_storeu_si128((__m128i *)&D[i], y);
+        }
+    }
+    QuantizeQualityScalar(&D[i], &S[i], L - i, bins);
+}
+
+#else
+
+void CopyQuality(uint8_t D[], uint8_t const S[], unsigned const L, bool const R)
+{
+    CopyQualityScalar(D, S, L, R);
+}
+
+void CopyRead(char D[], char const S[], unsigned const L, bool const R)
+{
+    CopyReadScalar(D, S, L, R);
+}
+
+void OffsetQuality(uint8_t D[], uint8_t const S[], unsigned const L, uint8_t const offset)
+{
+    OffsetQualityScalar(D, S, L, offset);
+}
+
+void QuantizeQuality(uint8_t D[], uint8_t const S[], unsigned const L, QualityBins const *const bins)
+{
+    QuantizeQualityScalar(D, S, L, bins);
+}
+
+#endif
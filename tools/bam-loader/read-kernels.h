@@ -0,0 +1,80 @@
+/* ===========================================================================
+ *
+ *                            PUBLIC DOMAIN NOTICE
+ *               National Center for Biotechnology Information
+ *
+ *  This software/database is a "United States Government Work" under the
+ *  terms of the United States Copyright Act.  It was written as part of
+ *  the author's official duties as a United States Government employee and
+ *  thus cannot be copyrighted.  This software/database is freely available
+ *  to the public for use. The National Library of Medicine and the U.S.
+ *  Government have not placed any restriction on its use or reproduction.
+ *
+ *  Although all reasonable efforts have been taken to ensure the accuracy
+ *  and reliability of the software and data, the NLM and the U.S.
+ *  Government do not and cannot warrant the performance or results that
+ *  may be obtained by using this software or data. The NLM and the U.S.
+ *  Government disclaim all warranties, express or implied, including
+ *  warranties of performance, merchantability or fitness for any particular
+ *  purpose.
+ *
+ *  Please cite the author in any work or product based on this material.
+ *
+ * ===========================================================================
+ *
+ */
+
+#ifndef BAM_LOAD_READ_KERNELS_H_
+#define BAM_LOAD_READ_KERNELS_H_ 1
+
+#include <klib/defs.h>
+
+/* The per-base work done on every loaded record: copying ( and reverse-
+ * complementing ) the bases, copying ( and reversing ) the qualities,
+ * removing a quality offset and binning qualities.
+ * Uses SSE2 where the compiler has it; the *Scalar versions are the
+ * byte-at-a-time loops, kept as the reference for tests and benchmarks.
+ * dst and src must not overlap unless they are equal and nothing is
+ * reversed.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* reverse: dst is src reversed */
+void CopyQuality(uint8_t dst[], uint8_t const src[], unsigned len, bool reverse);
+void CopyQualityScalar(uint8_t dst[], uint8_t const src[], unsigned len, bool reverse);
+
+/* reverse: dst is the reverse complement of src; IUPAC codes of either
+ * case are complemented to upper case, '.' and color-space digits are
+ * kept, anything else becomes 0 */
+void CopyRead(char dst[], char const src[], unsigned len, bool reverse);
+void CopyReadScalar(char dst[], char const src[], unsigned len, bool reverse);
+
+/* dst[i] = src[i] - offset, modulo 256 */
+void OffsetQuality(uint8_t dst[], uint8_t const src[], unsigned len, uint8_t offset);
+void OffsetQualityScalar(uint8_t dst[], uint8_t const src[], unsigned len, uint8_t offset);
+
+#define QUALITY_BINS_MAX_RUNS (16)
+
+/* a quantization table, e.g. from a qual-quant spec, in the form the
+ * vector code wants: runs of equal values, found by QualityBinsMake */
+typedef struct QualityBins {
+    uint8_t lookup[256];
+    uint8_t start[QUALITY_BINS_MAX_RUNS];   /* first quality of each run */
+    uint8_t value[QUALITY_BINS_MAX_RUNS];
+    unsigned runs;  /* 0: more than QUALITY_BINS_MAX_RUNS, use lookup */
+} QualityBins;
+
+void QualityBinsMake(QualityBins *self, uint8_t const lookup[256]);
+
+/* dst[i] = bins->lookup[src[i]] */
+void QuantizeQuality(uint8_t dst[], uint8_t const src[], unsigned len, QualityBins const *bins);
+void QuantizeQualityScalar(uint8_t dst[], uint8_t const src[], unsigned len, QualityBins const *bins);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BAM_LOAD_READ_KERNELS_H_ */
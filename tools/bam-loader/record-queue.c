@@ -0,0 +1,359 @@
+/* ===========================================================================
+ *
+ *                            PUBLIC DOMAIN NOTICE
+ *               National Center for Biotechnology Information
+ *
+ *  This software/database is a "United States Government Work" under the
+ *  terms of the United States Copyright Act.  It was written as part of
+ *  the author's official duties as a United States Government employee and
+ *  thus cannot be copyrighted.  This software/database is freely available
+ *  to the public for use. The National Library of Medicine and the U.S.
+ *  Government have not placed any restriction on its use or reproduction.
+ *
+ *  Although all reasonable efforts have been taken to ensure the accuracy
+ *  and reliability of the software and data, the NLM and the U.S.
+ *  Government do not and cannot warrant the performance or results that
+ *  may be obtained by using this software or data. The NLM and the U.S.
+ *  Government disclaim all warranties, express or implied, including
+ *  warranties of performance, merchantability or fitness for any particular
+ *  purpose.
+ *
+ *  Please cite the author in any work or product based on this material.
+ *
+ * ===========================================================================
+ *
+ */
+
+#include <klib/rc.h>
+#include <klib/log.h>
+#include <kapp/main.h>
+#include <kproc/queue.h>
+#include <kproc/thread.h>
+#include <kproc/lock.h>
+#include <kproc/cond.h>
+#include <kproc/timeout.h>
+
+#include <sysalloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "record-queue.h"
+
+#define QUEUE_TIMEOUT (10000) /* 10 seconds */
+
+static bool isTimeout(rc_t const rc)
+{
+    return (int)GetRCObject(rc) == rcTimeout;
+}
+
+static bool isDone(rc_t const rc)
+{
+    return (int)GetRCObject(rc) == rcData && (int)GetRCState(rc) == rcDone;
+}
+
+rc_t RecordTurnInit(RecordTurn *const self)
+{
+    rc_t rc;
+
+    memset(self, 0, sizeof(*self));
+    rc = KLockMake(&self->lock);
+    if (rc == 0)
+        rc = KConditionMake(&self->cond);
+    if (rc)
+        RecordTurnWhack(self);
+    return rc;
+}
+
+void RecordTurnWhack(RecordTurn *const self)
+{
+    KConditionRelease(self->cond);
+    KLockRelease(self->lock);
+    memset(self, 0, sizeof(*self));
+}
+
+static void passTurn(RecordTurn *const self, unsigned const order)
+{
+    KLockAcquire(self->lock);
+    if (self->turn <= order) {
+        self->turn = order + 1;
+        KConditionBroadcast(self->cond);
+    }
+    KLockUnlock(self->lock);
+}
+
+/* returns false if the input was abandoned first */
+static bool waitTurn(RecordQueue const *const self)
+{
+    bool rslt;
+
+    KLockAcquire(self->turn->lock);
+    while (self->turn->turn < self->order && !self->quit)
+        KConditionWait(self->turn->cond, self->turn->lock);
+    rslt = !self->quit;
+    KLockUnlock(self->turn->lock);
+    return rslt;
+}
+
+static bool isTurn(RecordQueue const *const self)
+{
+    bool rslt;
+
+    KLockAcquire(self->turn->lock);
+    rslt = self->turn->turn >= self->order;
+    KLockUnlock(self->turn->lock);
+    return rslt;
+}
+
+static void releaseRecords(RecordQueue const *const self, RecordBlock *const block)
+{
+    unsigned i;
+
+    for (i = block->next; i < block->count; ++i)
+        self->src.release(block->rec[i]);
+    block->next = block->count = 0;
+}
+
+/* waits until the block is pushed or the queue is sealed */
+static rc_t pushBlock(KQueue *const q, RecordBlock *const block)
+{
+    for ( ; ; ) {
+        timeout_t tm;
+        rc_t rc;
+
+        TimeoutInit(&tm, QUEUE_TIMEOUT);
+        rc = KQueuePush(q, block, &tm);
+        if (rc == 0 || !isTimeout(rc))
+            return rc;
+    }
+}
+
+/* prepares the records of the block and hands it to the main thread */
+static rc_t handOver(RecordQueue *const self, RecordBlock *const block)
+{
+    rc_t rc = self->src.prepare(self->src.data, block);
+
+    if (rc == 0 && block->count > 0)
+        rc = pushBlock(self->q, block);
+    if (rc)
+        releaseRecords(self, block);
+    return rc;
+}
+
+static rc_t CC run_reader_thread(const KThread *thread, void *const Self)
+{
+    RecordQueue *const self = Self;
+    rc_t rc = 0;
+    size_t NR = 0;
+    RecordBlock *block = NULL;
+    RecordBlock *pending[RECORD_QUEUE_BLOCKS];  /* read while waiting for the turn */
+    unsigned npending = 0;
+    bool myTurn = false;
+
+    while (rc == 0 && !self->quit) {
+        void *rec = NULL;
+
+        if (block == NULL) {
+            if (!myTurn && (myTurn = isTurn(self)) == false) {
+                /* read ahead as long as there are free blocks */
+                rc = KQueuePop(self->freeq, (void **)&block, NULL);
+                if (rc != 0 && isTimeout(rc)) {
+                    rc = 0;
+                    if (!waitTurn(self))
+                        break;
+                    myTurn = true;
+                }
+            }
+            if (rc == 0 && myTurn) {
+                unsigned i;
+
+                for (i = 0; i < npending && rc == 0; ++i)
+                    rc = handOver(self, pending[i]);
+                for ( ; i < npending; ++i)
+                    releaseRecords(self, pending[i]);
+                npending = 0;
+            }
+            while (rc == 0 && block == NULL) {
+                timeout_t tm;
+
+                TimeoutInit(&tm, QUEUE_TIMEOUT);
+                rc = KQueuePop(self->freeq, (void **)&block, &tm);
+                if (rc != 0 && isTimeout(rc))
+                    rc = 0;
+            }
+            if (rc) break;
+            block->count = 0;
+            block->empty = 0;
+            block->next = 0;
+        }
+        ++NR;
+        rc = self->src.read(self->src.data, &rec);
+        if ((int)GetRCObject(rc) == rcRow && (int)GetRCState(rc) == rcEmpty) {
+            ++block->empty;
+            rc = 0;
+            continue;
+        }
+        if ((int)GetRCObject(rc) == rcRow && (int)GetRCState(rc) == rcNotFound) {
+            /* EOF */
+            rc = 0;
+            --NR;
+            break;
+        }
+        if (rc) break;
+
+        block->rec[block->count++] = rec;
+        if (block->count == RECORD_QUEUE_BLOCK_SIZE) {
+            if (myTurn)
+                rc = handOver(self, block);
+            else
+                pending[npending++] = block;
+            block = NULL;
+        }
+    }
+    if (block != NULL) {
+        /* the records read before the end or an error */
+        pending[npending++] = block;
+        block = NULL;
+    }
+    {
+        unsigned i = 0;
+
+        if (npending > 0 && !self->quit && (myTurn || waitTurn(self))) {
+            for ( ; i < npending; ++i) {
+                rc_t const rc2 = handOver(self, pending[i]);
+                if (rc2) {
+                    if (rc == 0)
+                        rc = rc2;
+                    ++i;
+                    break;
+                }
+            }
+        }
+        /* the input was abandoned or there was an error */
+        for ( ; i < npending; ++i)
+            releaseRecords(self, pending[i]);
+    }
+    if (rc == 0 && !self->quit)
+        passTurn(self->turn, self->order);
+    KQueueSeal(self->q);
+    if (rc) {
+        (void)PLOGERR(klogErr, (klogErr, rc, "reader thread done for '$(file)'", "file=%s", self->name));
+    }
+    else {
+        (void)PLOGMSG(klogInfo, (klogInfo, "reader thread done for '$(file)'; read $(NR) records", "file=%s,NR=%lu", self->name, (unsigned long)NR));
+    }
+    return rc;
+}
+
+rc_t RecordQueueStart(RecordQueue *const self, RecordTurn *const turn, unsigned const order,
+                      RecordSource const *const src, char const name[])
+{
+    rc_t rc = 0;
+    unsigned i;
+
+    if (self->thread != NULL)
+        return 0;
+
+    memset(self, 0, sizeof(*self));
+    self->src = *src;
+    self->turn = turn;
+    self->order = order;
+    self->name = name;
+
+    self->blocks = calloc(RECORD_QUEUE_BLOCKS, sizeof(self->blocks[0]));
+    if (self->blocks == NULL)
+        return RC(rcExe, rcQueue, rcAllocating, rcMemory, rcExhausted);
+
+    rc = KQueueMake(&self->q, RECORD_QUEUE_BLOCKS);
+    if (rc == 0)
+        rc = KQueueMake(&self->freeq, RECORD_QUEUE_BLOCKS);
+    for (i = 0; rc == 0 && i < RECORD_QUEUE_BLOCKS; ++i)
+        rc = KQueuePush(self->freeq, &self->blocks[i], NULL);
+    if (rc == 0)
+        rc = KThreadMake(&self->thread, run_reader_thread, self);
+    return rc;
+}
+
+/* stops the reader thread and releases the records that were not handed out;
+ * returns the reader's rc */
+static rc_t stopReader(RecordQueue *const self)
+{
+    rc_t rc = 0;
+    RecordBlock *block = NULL;
+
+    if (self->thread != NULL && !self->done) {
+        KLockAcquire(self->turn->lock);
+        self->quit = true;
+        KConditionBroadcast(self->turn->cond);
+        KLockUnlock(self->turn->lock);
+
+        KQueueSeal(self->q);
+        KQueueSeal(self->freeq);
+        KThreadWait(self->thread, &rc);
+        self->done = true;
+    }
+    if (self->current) {
+        releaseRecords(self, self->current);
+        self->current = NULL;
+    }
+    while (self->q != NULL && KQueuePop(self->q, (void **)&block, NULL) == 0)
+        releaseRecords(self, block);
+    return rc;
+}
+
+void *RecordQueueNext(RecordQueue *const self, rc_t *const rc)
+{
+    if (*rc == 0 && self->current != NULL) {
+        if (self->current->next < self->current->count) {
+            if ((*rc = Quitting()) == 0)
+                return self->current->rec[self->current->next++]; /* this is the normal return */
+        }
+        else {
+            /* freeq can hold all of the blocks, this does not wait */
+            *rc = KQueuePush(self->freeq, self->current, NULL);
+            self->current = NULL;
+        }
+    }
+    while (*rc == 0 && (*rc = Quitting()) == 0) {
+        RecordBlock *block = NULL;
+        timeout_t tm;
+
+        TimeoutInit(&tm, QUEUE_TIMEOUT);
+        *rc = KQueuePop(self->q, (void **)&block, &tm);
+        if (*rc == 0) {
+            assert(block->count > 0);
+            self->current = block;
+            block->next = 1;
+            return block->rec[0];
+        }
+        if (isTimeout(*rc))
+            *rc = 0;
+        else if (isDone(*rc))
+            (void)LOGMSG(klogDebug, "KQueuePop Done");
+        else
+            (void)PLOGERR(klogWarn, (klogWarn, *rc, "KQueuePop Error", NULL));
+    }
+    {
+        /* the end of the input or an error on either side;
+         * an error of the reader replaces only the end of the input */
+        rc_t const rc2 = stopReader(self);
+
+        if (rc2 != 0 && isDone(*rc))
+            *rc = rc2;
+    }
+    return NULL;
+}
+
+rc_t RecordQueueWhack(RecordQueue *const self)
+{
+    rc_t const rc = stopReader(self);
+
+    KThreadRelease(self->thread);
+    if (self->turn != NULL)
+        passTurn(self->turn, self->order);
+    KQueueRelease(self->freeq);
+    KQueueRelease(self->q);
+    free(self->blocks);
+    memset(self, 0, sizeof(*self));
+    return rc;
+}
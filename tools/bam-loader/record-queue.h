@@ -0,0 +1,103 @@
+/* ===========================================================================
+ *
+ *                            PUBLIC DOMAIN NOTICE
+ *               National Center for Biotechnology Information
+ *
+ *  This software/database is a "United States Government Work" under the
+ *  terms of the United States Copyright Act.  It was written as part of
+ *  the author's official duties as a United States Government employee and
+ *  thus cannot be copyrighted.  This software/database is freely available
+ *  to the public for use. The National Library of Medicine and the U.S.
+ *  Government have not placed any restriction on its use or reproduction.
+ *
+ *  Although all reasonable efforts have been taken to ensure the accuracy
+ *  and reliability of the software and data, the NLM and the U.S.
+ *  Government do not and cannot warrant the performance or results that
+ *  may be obtained by using this software or data. The NLM and the U.S.
+ *  Government disclaim all warranties, express or implied, including
+ *  warranties of performance, merchantability or fitness for any particular
+ *  purpose.
+ *
+ *  Please cite the author in any work or product based on this material.
+ *
+ * ===========================================================================
+ *
+ */
+
+#ifndef BAM_LOAD_RECORD_QUEUE_H_
+#define BAM_LOAD_RECORD_QUEUE_H_ 1
+
+#include <klib/defs.h>
+
+/* Moves the records of an input from its reader thread to the main thread
+ * in blocks, one queue operation per block; used blocks go back to the
+ * reader through a second queue.
+ *
+ * Several inputs can be read at the same time, but their records are
+ * handed out in the order of the inputs: a reader decodes into its blocks
+ * until it is its input's turn, only then are the blocks prepared ( the
+ * names looked up ) and given to the main thread.
+ * Memory is bounded by RECORD_QUEUE_BLOCKS blocks per input being read.
+ */
+
+#define RECORD_QUEUE_BLOCK_SIZE (2048u)
+#define RECORD_QUEUE_BLOCKS (4u)
+
+typedef struct RecordBlock {
+    unsigned count;
+    unsigned empty;         /* empty records skipped while filling the block */
+    unsigned next;          /* next record to hand out, main thread only */
+    void *rec[RECORD_QUEUE_BLOCK_SIZE];
+} RecordBlock;
+
+typedef struct RecordSource {
+    /* reads the next record, called on the reader thread;
+     * ( rcRow, rcEmpty ): an empty record was skipped;
+     * ( rcRow, rcNotFound ): the end of the input */
+    rc_t (CC *read)(void *data, void **rec);
+    /* called on the reader thread in the order of the inputs,
+     * before the block goes to the main thread */
+    rc_t (CC *prepare)(void *data, RecordBlock *block);
+    void (CC *release)(void *rec);
+    void *data;
+} RecordSource;
+
+/* whose turn it is, shared by the queues of all inputs */
+typedef struct RecordTurn {
+    struct KLock *lock;
+    struct KCondition *cond;
+    unsigned turn;          /* order of the input whose blocks are being prepared */
+} RecordTurn;
+
+typedef struct RecordQueue {
+    RecordSource src;
+    RecordTurn *turn;
+    char const *name;       /* of the input, for messages */
+    struct KQueue *q;       /* filled blocks for the main thread */
+    struct KQueue *freeq;   /* used blocks for the reader thread */
+    struct KThread *thread;
+    RecordBlock *blocks;    /* all RECORD_QUEUE_BLOCKS of them */
+    RecordBlock *current;   /* the block the main thread is reading from */
+    unsigned order;         /* position of the input in the load */
+    bool done;              /* the reader thread has been waited for */
+    volatile bool quit;     /* the main thread is done with this input */
+} RecordQueue;
+
+rc_t RecordTurnInit(RecordTurn *self);
+void RecordTurnWhack(RecordTurn *self);
+
+/* starts the reader thread; call on the main thread only, in the order of the inputs */
+rc_t RecordQueueStart(RecordQueue *self, RecordTurn *turn, unsigned order,
+                      RecordSource const *src, char const name[]);
+
+/* the next record, call on the main thread only
+ * returns NULL at the end of the input, or if *rc is or becomes non-zero;
+ * then the reader thread has been stopped and the records not handed out
+ * are released. *rc is only set if it was 0: to the error of the reader
+ * thread, or else to the ( rcData, rcDone ) of the end of the input */
+void *RecordQueueNext(RecordQueue *self, rc_t *rc);
+
+/* stops the reader thread if it is still running; returns its rc */
+rc_t RecordQueueWhack(RecordQueue *self);
+
+#endif /* BAM_LOAD_RECORD_QUEUE_H_ */
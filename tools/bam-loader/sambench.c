@@ -0,0 +1,105 @@
+/* ===========================================================================
+ *
+ *                            PUBLIC DOMAIN NOTICE
+ *               National Center for Biotechnology Information
+ *
+ *  This software/database is a "United States Government Work" under the
+ *  terms of the United States Copyright Act.  It was written as part of
+ *  the author's official duties as a United States Government employee and
+ *  thus cannot be copyrighted.  This software/database is freely available
+ *  to the public for use. The National Library of Medicine and the U.S.
+ *  Government have not placed any restriction on its use or reproduction.
+ *
+ *  Although all reasonable efforts have been taken to ensure the accuracy
+ *  and reliability of the software and data, the NLM and the U.S.
+ *  Government do not and cannot warrant the performance or results that
+ *  may be obtained by using this software or data. The NLM and the U.S.
+ *  Government disclaim all warranties, express or implied, including
+ *  warranties of performance, merchantability or fitness for any particular
+ *  purpose.
+ *
+ *  Please cite the author in any work or product based on this material.
+ *
+ * ===========================================================================
+ *
+ * Measures the throughput of the SAM and BAM record readers in bam.c.
+ *
+ * Generate input with e.g.
+ *   pseudo-aligner coverage=50 length=5000000 > bench.sam
+ * and compare against the same data as BAM:
+ *   sambench bench.sam bench.bam
+ */
+
+#include <kapp/args.h>
+#include <kapp/main.h>
+#include <klib/log.h>
+#include <klib/time.h>
+#include <kfs/directory.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "bam.h"
+
+#include <klib/rc.h>
+
+static rc_t sambench(KDirectory const *const dir, char const path[])
+{
+    BAM_File const *bam = NULL;
+    uint64_t fsize = 0;
+    uint64_t records = 0;
+    uint64_t bases = 0;
+    KTimeMs_t const start = KTimeMsStamp();
+    rc_t rc = KDirectoryFileSize(dir, &fsize, "%s", path);
+
+    if (rc == 0)
+        rc = BAM_FileMake(&bam, NULL, NULL, path);
+    if (rc == 0) {
+        BAM_Alignment const *rec = NULL;
+
+        while ((rc = BAM_FileRead2(bam, &rec)) == 0) {
+            uint32_t readlen = 0;
+
+            BAM_AlignmentGetReadLength(rec, &readlen);
+            bases += readlen;
+            ++records;
+            BAM_AlignmentRelease(rec);
+        }
+        BAM_FileRelease(bam);
+        if (GetRCObject(rc) == rcRow && GetRCState(rc) == rcNotFound)
+            rc = 0;
+    }
+    if (rc == 0) {
+        KTimeMs_t const elapsed = KTimeMsStamp() - start;
+        double const secs = (elapsed ? elapsed : 1) / 1000.0;
+
+        printf("%s: %llu records, %llu bases, %llu bytes in %.3f s; %.1f MB/s, %.0f records/s\n",
+               path, (unsigned long long)records, (unsigned long long)bases, (unsigned long long)fsize, secs,
+               fsize / secs / 1.0e6, records / secs);
+    }
+    else
+        LOGERR(klogErr, rc, path);
+    return rc;
+}
+
+rc_t CC UsageSummary(char const *name)
+{
+    return 0;
+}
+
+rc_t CC Usage(Args const *args)
+{
+    return 0;
+}
+
+rc_t CC KMain(int argc, char *argv[])
+{
+    KDirectory *dir = NULL;
+    rc_t rc = KDirectoryNativeDir(&dir);
+
+    while (rc == 0 && --argc) {
+        rc = sambench(dir, *++argv);
+    }
+    KDirectoryRelease(dir);
+    return rc;
+}
@@ -33,6 +33,9 @@
 #include "lookup_reader.h"
 #include "join.h"
 #include "sorter.h"
+#include "index.h"
+#include "slab_store.h"
+#include "telemetry.h"
 #include "helper.h"
 
 #include <kapp/main.h>
@@ -94,6 +97,21 @@ static const char * detail_usage[] = { "print details", NULL };
 #define OPTION_DETAILS  "details"
 #define ALIAS_DETAILS    "x"
 
+static const char * lookup_fmt_usage[] = { "format of lookup-file ( 4na, 2na, default=4na )", NULL };
+#define OPTION_LOOKUP_FMT "lookup-fmt"
+
+static const char * index_stride_usage[] = { "keys per index-entry ( default=20000 )", NULL };
+#define OPTION_INDEX_STRIDE "index-stride"
+
+static const char * prealloc_usage[] = { "concat the parts of the join in parallel into a preallocated output-file", NULL };
+#define OPTION_PREALLOC "prealloc"
+
+static const char * telemetry_usage[] = { "write throughput, memory and scratch-space as JSON-lines into this file", NULL };
+#define OPTION_TELEMETRY "telemetry"
+
+static const char * inmem_usage[] = { "keep lookup-table in memory ( auto, yes, no, default=auto )", NULL };
+#define OPTION_INMEM    "inmem"
+
 OptDef ToolOptions[] =
 {
     { OPTION_RANGE,     ALIAS_RANGE,     NULL, range_usage,      1, true,   false },
@@ -106,6 +124,11 @@ OptDef ToolOptions[] =
     { OPTION_TEMP,      ALIAS_TEMP,      NULL, temp_usage,       1, true,   false },
     { OPTION_THREADS,   ALIAS_THREADS,   NULL, threads_usage,    1, true,   false },
     { OPTION_INDEX,     ALIAS_INDEX,     NULL, index_usage,      1, true,   false },
+    { OPTION_LOOKUP_FMT, NULL,           NULL, lookup_fmt_usage, 1, true,   false },
+    { OPTION_INDEX_STRIDE, NULL,         NULL, index_stride_usage, 1, true, false },
+    { OPTION_INMEM,     NULL,            NULL, inmem_usage,      1, true,   false },
+    { OPTION_TELEMETRY, NULL,            NULL, telemetry_usage,  1, true,   false },
+    { OPTION_PREALLOC,  NULL,            NULL, prealloc_usage,   1, false,  false },
     { OPTION_PROGRESS,  ALIAS_PROGRESS,  NULL, progress_usage,   1, false,  false },
     { OPTION_DETAILS,   ALIAS_DETAILS,   NULL, detail_usage,     1, false,  false }
 };
@@ -157,7 +180,11 @@ typedef struct fd_ctx
     const char * index_filename;
     const char * temp_path;
     size_t buf_size, mem_limit;
-    uint64_t num_threads;
+    uint64_t num_threads, index_stride;
+    lookup_fmt_t lookup_fmt;
+    inmem_t inmem;
+    struct telemetry * telemetry;
+    bool prealloc;
 } fd_ctx;
 
 
@@ -173,9 +200,12 @@ static void init_sorter_params( const fd_ctx * fd_ctx, sorter_params * sp )
     sp->mem_limit = fd_ctx->mem_limit;
     sp->buf_size = fd_ctx->buf_size;
     sp->cursor_cache = fd_ctx->cmn.cursor_cache;
+    sp->index_stride = fd_ctx->index_stride;
     sp->sort_progress = NULL;
+    sp->telemetry = fd_ctx->telemetry;
     sp->num_threads = 0;
     sp->show_progress = fd_ctx->cmn.show_progress;
+    sp->lookup_fmt = fd_ctx->lookup_fmt;
 }
 
 /* --------------------------------------------------------------------------------------------
@@ -184,7 +214,7 @@ static void init_sorter_params( const fd_ctx * fd_ctx, sorter_params * sp )
     reading SEQ_SPOT_ID, SEQ_READ_ID and RAW_READ
     SEQ_SPOT_ID and SEQ_READ_ID is merged into a 64-bit-key
     RAW_READ is read as 4na-unpacked ( Schema does not provide 4na-packed for this column )
-    these key-pairs are temporarely stored in a KVector until a limit is reached
+    these key-pairs are temporarely stored in slabs of memory until a limit is reached
     after that limit is reached they are writen sorted into the file-system as sub-files
     this repeats until the requested row-range is exhausted ( row_range ... NULL -> all rows )
     These sub-files are than merge-sorted into the final output-file.
@@ -192,6 +222,7 @@ static void init_sorter_params( const fd_ctx * fd_ctx, sorter_params * sp )
     content: [KEY][RAW_READ]
     KEY... 64-bit value as SEQ_SPOT_ID shifted left by 1 bit, zero-bit contains SEQ_READ_ID
     RAW_READ... 16-bit binary-chunk-lenght, followed by n bytes of packed 4na
+    ( with --lookup-fmt 2na: 2na-bases + runs of N, see lookup_fmt_t in helper.h )
 -------------------------------------------------------------------------------------------- */
 static rc_t single_threaded_make_lookup( fd_ctx * fd_ctx )
 {
@@ -226,13 +257,63 @@ static rc_t multi_threaded_make_lookup( fd_ctx * fd_ctx )
    
 -------------------------------------------------------------------------------------------- */
 
+/* --------------------------------------------------------------------------------------------
+    if there is no lookup-file yet and the packed alignments fit into mem-limit x threads,
+    the lookup-table is built in memory and the join reads from it directly.
+    no lookup-file, no sub-files, no merge...
+   -------------------------------------------------------------------------------------------- */
+/* file_estimate: the size of the lookup-file, if the table is not built in memory */
+static rc_t make_lookup_in_memory_if_fits( fd_ctx * fd_ctx, struct slab_store ** store, uint64_t * file_estimate )
+{
+    sorter_params sp;
+    uint64_t row_count, limit, estimate;
+    bool in_memory;
+    rc_t rc;
+
+    *store = NULL;
+    *file_estimate = 0;
+    init_sorter_params( fd_ctx, &sp );
+    sp.num_threads = fd_ctx->num_threads;
+    rc = estimate_lookup_in_memory( &sp, &row_count, &estimate, file_estimate ); /* sorter.c */
+    limit = fd_ctx->mem_limit * ( fd_ctx->num_threads > 1 ? fd_ctx->num_threads : 1 );
+    in_memory = ( fd_ctx->inmem == im_yes || ( fd_ctx->inmem == im_auto && estimate <= limit ) );
+    /* a row-range applies to the SEQUENCE-table, the lookup-table has to cover it completely:
+       it is written into a file, but the file-estimate is still needed for the scratch-space */
+    if ( fd_ctx->cmn.row_range != NULL )
+        in_memory = false;
+    if ( rc == 0 && fd_ctx->cmn.show_details )
+    {
+        KOutMsg( "lookup-estimate : %lu alignments, %lu bytes ( limit %lu )\n", row_count, estimate, limit );
+        KOutMsg( "lookup-table    : %s\n", in_memory ? "in memory" : "file" );
+    }
+    if ( rc == 0 && row_count > 0 && in_memory )
+    {
+        if ( fd_ctx->cmn.show_progress )
+            KOutMsg( "lookup :" );
+        rc = make_lookup_in_memory( &sp, row_count, store ); /* sorter.c */
+    }
+    return rc;
+}
+
+
 static rc_t perform_join( fd_ctx * fd_ctx, format_t fmt )
 {
     rc_t rc = 0;
+    struct slab_store * store = NULL;
+    uint64_t file_estimate = 0;
+    
     if ( !file_exists( fd_ctx->cmn.dir, "%s", fd_ctx->lookup_filename ) )
+        rc = make_lookup_in_memory_if_fits( fd_ctx, &store, &file_estimate ); /* above */
+
+    if ( rc == 0 && store == NULL && !file_exists( fd_ctx->cmn.dir, "%s", fd_ctx->lookup_filename ) )
     {
         const char * temp = fd_ctx->output_filename;
         
+        /* during the merge the sub-files and the lookup-file are on the scratch-path together,
+           only warn if that does not fit: the estimate can be off */
+        if ( file_estimate > 0 )
+            telemetry_check_space( fd_ctx->telemetry, fd_ctx->cmn.dir, fd_ctx->temp_path, 2 * file_estimate ); /* telemetry.c */
+        
         if ( fd_ctx->cmn.show_progress )
             KOutMsg( "lookup :" );
         
@@ -255,10 +336,13 @@ static rc_t perform_join( fd_ctx * fd_ctx, format_t fmt )
         jp.index_filename   = fd_ctx->index_filename;
         jp.output_filename  = fd_ctx->output_filename;
         jp.temp_path        = fd_ctx->temp_path;
+        jp.store            = store;
         jp.join_progress    = NULL;
+        jp.telemetry        = fd_ctx->telemetry;
         jp.buf_size         = fd_ctx->buf_size;
         jp.cur_cache        = fd_ctx->cmn.cursor_cache;
         jp.show_progress    = fd_ctx->cmn.show_progress;
+        jp.prealloc         = fd_ctx->prealloc;
         jp.num_threads      = fd_ctx->num_threads;
         jp.first            = 0;
         jp.count            = 0;
@@ -266,6 +350,7 @@ static rc_t perform_join( fd_ctx * fd_ctx, format_t fmt )
         
         rc = execute_join( &jp ); /* join.c */
     }
+    release_slab_store( store ); /* slab_store.c */
     return rc;
 }
 
@@ -312,6 +397,10 @@ rc_t CC KMain ( int argc, char *argv [] )
             fd_ctx.buf_size = get_size_t_option( args, OPTION_BUFSIZE, 1024 * 1024 );
             fd_ctx.mem_limit = get_size_t_option( args, OPTION_MEM, 1024L * 1024 * 100 );
             fd_ctx.num_threads = get_uint64_t_option( args, OPTION_THREADS, 1 );
+            fd_ctx.lookup_fmt = get_lookup_fmt_t( get_str_option( args, OPTION_LOOKUP_FMT, NULL ) );
+            fd_ctx.index_stride = get_uint64_t_option( args, OPTION_INDEX_STRIDE, DFLT_INDEX_STRIDE );
+            fd_ctx.prealloc = get_bool_option( args, OPTION_PREALLOC );
+            fd_ctx.inmem = get_inmem_t( get_str_option( args, OPTION_INMEM, NULL ) );
 
 			if ( fd_ctx.cmn.show_details )
 			{
@@ -320,6 +409,9 @@ rc_t CC KMain ( int argc, char *argv [] )
 				KOutMsg( "mem-limit    : %ld\n", fd_ctx.mem_limit );
 				KOutMsg( "threadsit    : %d\n", fd_ctx.num_threads );
 				KOutMsg( "scratch-path : '%s'\n", fd_ctx.temp_path );
+				KOutMsg( "lookup-fmt   : %s\n", fd_ctx.lookup_fmt == lft_2na ? "2na" : "4na" );
+				KOutMsg( "index-stride : %lu\n", fd_ctx.index_stride );
+				KOutMsg( "inmem        : %s\n", fd_ctx.inmem == im_yes ? "yes" : fd_ctx.inmem == im_no ? "no" : "auto" );
 			}
 			
             if ( fd_ctx.lookup_filename == NULL )
@@ -351,7 +443,15 @@ rc_t CC KMain ( int argc, char *argv [] )
                 ErrMsg( "KDirectoryNativeDir() -> %R", rc );
             else
             {
-                rc = perform_join( &fd_ctx, fmt );
+                rc = make_telemetry( &fd_ctx.telemetry, fd_ctx.cmn.dir,
+                                     get_str_option( args, OPTION_TELEMETRY, NULL ),
+                                     fd_ctx.mem_limit, fd_ctx.num_threads, TELEMETRY_PROGRESS_MS,
+                                     fd_ctx.cmn.show_details ); /* telemetry.c */
+                if ( rc == 0 )
+                {
+                    rc = perform_join( &fd_ctx, fmt );
+                    release_telemetry( fd_ctx.telemetry );
+                }
 
                 if ( dflt_lookup[ 0 ] != 0 )
                     KDirectoryRemove( fd_ctx.cmn.dir, true, "%s", dflt_lookup );
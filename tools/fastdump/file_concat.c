@@ -0,0 +1,513 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "file_concat.h"
+#include "helper.h"
+
+#include <klib/out.h>
+#include <kfs/file.h>
+#include <kproc/thread.h>
+
+/* 
+    this is in interfaces/cc/XXX/YYY/atomic.h
+    XXX ... the compiler ( cc, gcc, icc, vc++ )
+    YYY ... the architecture ( fat86, i386, noarch, ppc32, x86_64 )
+ */
+#include <atomic.h>
+
+#include <string.h>
+
+#if defined( __linux__ )
+#define HAVE_KERNEL_COPY 1
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+/* how much is handed to the kernel in one call, between the calls Quitting() is checked */
+#define KERNEL_COPY_CHUNK ( 64 * 1024 * 1024 )
+/* the last fallback copies through a buffer of this size */
+#define PWRITE_CHUNK ( 1024 * 1024 )
+
+rc_t CC Quitting();
+
+static rc_t native_path( const KDirectory * dir, const char * name, char * buffer, size_t buflen )
+{
+    rc_t rc = KDirectoryResolvePath( dir, true, buffer, buflen, "%s", name );
+    if ( rc != 0 )
+        ErrMsg( "KDirectoryResolvePath( '%s' ) -> %R", name, rc );
+    return rc;
+}
+
+
+#ifdef HAVE_KERNEL_COPY
+
+typedef enum copy_method { cm_copy_range, cm_sendfile, cm_pwrite } copy_method;
+
+static ssize_t copy_range( int fd_in, loff_t * in_pos, int fd_out, loff_t * out_pos, size_t len )
+{
+#ifdef SYS_copy_file_range
+    /* via syscall(), older glibc's do not have a wrapper for it */
+    return syscall( SYS_copy_file_range, fd_in, in_pos, fd_out, out_pos, len, 0 );
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+static ssize_t send_range( int fd_in, loff_t * in_pos, int fd_out, loff_t * out_pos, size_t len )
+{
+    ssize_t res = -1;
+    if ( lseek( fd_out, *out_pos, SEEK_SET ) >= 0 )
+    {
+        off_t src_pos = *in_pos;
+        res = sendfile( fd_out, fd_in, &src_pos, len );
+        if ( res > 0 )
+        {
+            *in_pos += res;
+            *out_pos += res;
+        }
+    }
+    return res;
+}
+
+
+static ssize_t pwrite_range( int fd_in, loff_t * in_pos, int fd_out, loff_t * out_pos,
+                             size_t len, char * buffer )
+{
+    ssize_t res;
+    if ( len > PWRITE_CHUNK )
+        len = PWRITE_CHUNK;
+    res = pread( fd_in, buffer, len, *in_pos );
+    if ( res > 0 )
+    {
+        ssize_t written = 0;
+        while ( written < res )
+        {
+            ssize_t w = pwrite( fd_out, buffer + written, res - written, *out_pos + written );
+            if ( w < 0 )
+            {
+                if ( errno != EINTR )
+                    return -1;
+            }
+            else
+                written += w;
+        }
+        *in_pos += res;
+        *out_pos += res;
+    }
+    return res;
+}
+
+
+/* the errors that mean: this method does not work for these files, try the next one */
+static bool method_unsupported( int err )
+{
+    return ( err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP || err == EBADF );
+}
+
+
+/* copies the first size bytes of fd_in to fd_out at out_pos, returns 0 or an errno */
+static int kernel_copy( int fd_in, int fd_out, uint64_t out_pos, uint64_t size,
+                        void ( CC * on_bytes )( uint64_t bytes, void * data ), void * data )
+{
+    int err = 0;
+    copy_method method = cm_copy_range;
+    loff_t in = 0, out = out_pos;
+    char * buffer = NULL;
+
+    while ( err == 0 && ( uint64_t )in < size )
+    {
+        if ( Quitting() != 0 )
+            err = EINTR;
+        else
+        {
+            size_t len = ( ( size - in ) > KERNEL_COPY_CHUNK ) ? KERNEL_COPY_CHUNK : ( size_t )( size - in );
+            ssize_t n;
+            switch ( method )
+            {
+                case cm_copy_range : n = copy_range( fd_in, &in, fd_out, &out, len ); break;
+                case cm_sendfile   : n = send_range( fd_in, &in, fd_out, &out, len ); break;
+                default            : n = pwrite_range( fd_in, &in, fd_out, &out, len, buffer ); break;
+            }
+            if ( n > 0 )
+            {
+                if ( on_bytes != NULL )
+                    on_bytes( n, data );
+            }
+            else if ( n == 0 )
+                size = in;  /* the file is shorter than it was, nothing more to copy */
+            else if ( errno == EINTR )
+                ;   /* just try again */
+            else if ( method != cm_pwrite && method_unsupported( errno ) )
+            {
+                method = ( method == cm_copy_range ) ? cm_sendfile : cm_pwrite;
+                if ( method == cm_pwrite )
+                {
+                    buffer = malloc( PWRITE_CHUNK );
+                    if ( buffer == NULL )
+                        err = ENOMEM;
+                }
+            }
+            else
+                err = errno;
+        }
+    }
+    if ( buffer != NULL )
+        free( ( void * ) buffer );
+    return err;
+}
+
+
+/* copies the whole file src into fd_out at out_pos, a missing src is skipped like in concat_files() */
+static rc_t kernel_copy_file( const KDirectory * dir, const char * src, int fd_out, uint64_t out_pos,
+                              uint64_t * copied, void ( CC * on_bytes )( uint64_t bytes, void * data ), void * data )
+{
+    char path[ 4096 ];
+    rc_t rc = native_path( dir, src, path, sizeof path );
+    *copied = 0;
+    if ( rc == 0 )
+    {
+        int fd_in = open( path, O_RDONLY );
+        if ( fd_in >= 0 )
+        {
+            struct stat st;
+            int err = ( fstat( fd_in, &st ) == 0 ) ? 0 : errno;
+            if ( err == 0 )
+                err = kernel_copy( fd_in, fd_out, out_pos, st.st_size, on_bytes, data );
+            if ( err == 0 )
+                *copied = st.st_size;
+            else if ( err == EINTR )
+                rc = RC( rcExe, rcFile, rcCopying, rcTransfer, rcCanceled );
+            else
+            {
+                rc = RC( rcExe, rcFile, rcCopying, rcTransfer, rcIncomplete );
+                ErrMsg( "kernel_copy( '%s' ) -> errno = %d -> %R", src, err, rc );
+            }
+            close( fd_in );
+        }
+    }
+    return rc;
+}
+
+#endif /* HAVE_KERNEL_COPY */
+
+
+rc_t kernel_concat_files( KDirectory * dir, const VNamelist * files, const char * output,
+                          void ( CC * on_bytes )( uint64_t bytes, void * data ), void * data )
+{
+#ifdef HAVE_KERNEL_COPY
+    char path[ 4096 ];
+    int fd_out = -1;
+    rc_t rc = native_path( dir, output, path, sizeof path );
+    if ( rc == 0 )
+        fd_out = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0664 );
+    if ( fd_out < 0 )
+        /* let the buffered copy in concat_files() try it and report the error */
+        rc = SILENT_RC( rcExe, rcFile, rcCopying, rcFunction, rcUnsupported );
+    else
+    {
+        uint32_t count;
+        rc = VNameListCount( files, &count );
+        if ( rc != 0 )
+            ErrMsg( "VNameListCount() -> %R", rc );
+        else
+        {
+            uint32_t idx;
+            uint64_t out_pos = 0;
+            for ( idx = 0; rc == 0 && idx < count; ++idx )
+            {
+                const char * filename;
+                rc = VNameListGet( files, idx, &filename );
+                if ( rc != 0 )
+                    ErrMsg( "VNameListGet( #%d) -> %R", idx, rc );
+                else
+                {
+                    uint64_t copied;
+                    rc = kernel_copy_file( dir, filename, fd_out, out_pos, &copied, on_bytes, data );
+                    out_pos += copied;
+                }
+            }
+        }
+        close( fd_out );
+    }
+    return rc;
+#else
+    return SILENT_RC( rcExe, rcFile, rcCopying, rcFunction, rcUnsupported );
+#endif
+}
+
+
+/* -------------------------------------------------------------------------------------------- */
+
+typedef struct prealloc_ctx
+{
+    KDirectory * dir;
+    const VNamelist * files;
+    KFile * dst;
+    const char * output;
+    uint64_t * offsets;     /* count + 1 entries, the last one is the total size */
+    uint32_t count;
+    size_t buf_size;
+    atomic_t next_file;
+    multi_progress * progress;
+} prealloc_ctx;
+
+
+/* the portable way: through a buffer, every thread writes to its own offsets in dst */
+static rc_t buffered_copy_to( prealloc_ctx * ctx, const char * src_name, uint64_t dst_pos, char * buffer )
+{
+    const struct KFile * src;
+    rc_t rc = 0;
+    rc_t rc1 = KDirectoryOpenFileRead( ctx->dir, &src, "%s", src_name );
+    if ( rc1 == 0 )
+    {
+        uint64_t src_pos = 0;
+        size_t num_read = 1;
+        while ( rc == 0 && num_read > 0 )
+        {
+            rc = Quitting();
+            if ( rc == 0 )
+            {
+                rc = KFileRead( src, src_pos, buffer, ctx->buf_size, &num_read );
+                if ( rc != 0 )
+                    ErrMsg( "buffered_copy_to.KFileRead( '%s' at %lu ) -> %R", src_name, src_pos, rc );
+                else if ( num_read > 0 )
+                {
+                    rc = KFileWriteAll( ctx->dst, dst_pos + src_pos, buffer, num_read, NULL );
+                    if ( rc != 0 )
+                        ErrMsg( "buffered_copy_to.KFileWriteAll( at %lu ) -> %R", dst_pos + src_pos, rc );
+                    src_pos += num_read;
+                }
+            }
+        }
+        KFileRelease( src );
+    }
+    return rc;
+}
+
+
+static rc_t CC prealloc_thread_func( const KThread *self, void *data )
+{
+    prealloc_ctx * ctx = data;
+    rc_t rc = 0;
+    char * buffer = NULL;
+#ifdef HAVE_KERNEL_COPY
+    char path[ 4096 ];
+    int fd_out = -1;
+    if ( native_path( ctx->dir, ctx->output, path, sizeof path ) == 0 )
+        fd_out = open( path, O_WRONLY );
+#endif
+    bool done = false;
+
+    while ( rc == 0 && !done )
+    {
+        uint32_t idx = atomic_read_and_add( &ctx->next_file, 1 );
+        done = ( idx >= ctx->count );
+        if ( !done )
+        {
+            const char * filename;
+            rc = VNameListGet( ctx->files, idx, &filename );
+            if ( rc != 0 )
+                ErrMsg( "VNameListGet( #%d) -> %R", idx, rc );
+#ifdef HAVE_KERNEL_COPY
+            else if ( fd_out >= 0 )
+            {
+                uint64_t copied;
+                rc = kernel_copy_file( ctx->dir, filename, fd_out, ctx->offsets[ idx ], &copied, NULL, NULL );
+            }
+#endif
+            else
+            {
+                if ( buffer == NULL )
+                {
+                    buffer = malloc( ctx->buf_size );
+                    if ( buffer == NULL )
+                    {
+                        rc = RC( rcExe, rcFile, rcCopying, rcMemory, rcExhausted );
+                        ErrMsg( "prealloc_thread_func.malloc( %d ) -> %R", ctx->buf_size, rc );
+                    }
+                }
+                if ( rc == 0 )
+                    rc = buffered_copy_to( ctx, filename, ctx->offsets[ idx ], buffer );
+            }
+            if ( rc == 0 && ctx->progress != NULL )
+                atomic_inc( &ctx->progress->progress_rows );
+        }
+    }
+#ifdef HAVE_KERNEL_COPY
+    if ( fd_out >= 0 )
+        close( fd_out );
+#endif
+    if ( buffer != NULL )
+        free( ( void * ) buffer );
+    return rc;
+}
+
+
+/* offsets[ i ] = sum of the sizes of the files before i */
+static rc_t make_offsets( prealloc_ctx * ctx )
+{
+    rc_t rc = VNameListCount( ctx->files, &ctx->count );
+    if ( rc != 0 )
+        ErrMsg( "VNameListCount() -> %R", rc );
+    else
+    {
+        ctx->offsets = calloc( ctx->count + 1, sizeof * ctx->offsets );
+        if ( ctx->offsets == NULL )
+        {
+            rc = RC( rcExe, rcFile, rcCopying, rcMemory, rcExhausted );
+            ErrMsg( "make_offsets.calloc( %d ) -> %R", ( ctx->count + 1 ) * sizeof * ctx->offsets, rc );
+        }
+        else
+        {
+            uint32_t idx;
+            for ( idx = 0; rc == 0 && idx < ctx->count; ++idx )
+            {
+                const char * filename;
+                rc = VNameListGet( ctx->files, idx, &filename );
+                if ( rc != 0 )
+                    ErrMsg( "VNameListGet( #%d) -> %R", idx, rc );
+                else
+                {
+                    uint64_t size = 0;
+                    if ( KDirectoryFileSize( ctx->dir, &size, "%s", filename ) != 0 )
+                        size = 0;   /* missing part-files are skipped */
+                    ctx->offsets[ idx + 1 ] = ctx->offsets[ idx ] + size;
+                }
+            }
+        }
+    }
+    return rc;
+}
+
+
+rc_t concat_files_prealloc( KDirectory * dir, const VNamelist * files, size_t buf_size,
+                            const char * output, uint32_t num_threads, bool show_progress )
+{
+    prealloc_ctx ctx;
+    rc_t rc;
+
+    memset( &ctx, 0, sizeof ctx );
+    ctx.dir = dir;
+    ctx.files = files;
+    ctx.output = output;
+    ctx.buf_size = buf_size;
+    atomic_set( &ctx.next_file, 0 );
+
+    rc = make_offsets( &ctx ); /* above */
+    if ( rc == 0 )
+    {
+        rc = KDirectoryCreateFile( dir, &ctx.dst, false, 0664, kcmInit, "%s", output );
+        if ( rc != 0 )
+            ErrMsg( "KDirectoryCreateFile( '%s' ) -> %R", output, rc );
+        else
+        {
+            /* the output gets its final size up front, every part has its fixed place in it */
+            rc = KFileSetSize( ctx.dst, ctx.offsets[ ctx.count ] );
+            if ( rc != 0 )
+                ErrMsg( "KFileSetSize( '%s', %lu ) -> %R", output, ctx.offsets[ ctx.count ], rc );
+#ifdef HAVE_KERNEL_COPY
+            if ( rc == 0 && ctx.offsets[ ctx.count ] > 0 )
+            {
+                char path[ 4096 ];
+                if ( native_path( dir, output, path, sizeof path ) == 0 )
+                {
+                    int fd = open( path, O_WRONLY );
+                    if ( fd >= 0 )
+                    {
+                        /* reserve the blocks, if the filesystem can do it; not an error if not */
+                        posix_fallocate( fd, 0, ctx.offsets[ ctx.count ] );
+                        close( fd );
+                    }
+                }
+            }
+#endif
+        }
+    }
+
+    if ( rc == 0 )
+    {
+        KThread * progress_thread = NULL;
+        multi_progress progress;
+
+        if ( show_progress )
+        {
+            init_progress_data( &progress, ctx.count ); /* helper.c */
+            ctx.progress = &progress;
+            rc = start_multi_progress( &progress_thread, &progress ); /* helper.c */
+        }
+        if ( rc == 0 )
+        {
+            if ( num_threads < 2 )
+                rc = prealloc_thread_func( NULL, &ctx );
+            else
+            {
+                uint32_t i;
+                KThread ** threads = calloc( num_threads, sizeof * threads );
+                if ( threads == NULL )
+                {
+                    rc = RC( rcExe, rcFile, rcCopying, rcMemory, rcExhausted );
+                    ErrMsg( "concat_files_prealloc.calloc( %d ) -> %R", num_threads * sizeof * threads, rc );
+                }
+                else
+                {
+                    for ( i = 0; rc == 0 && i < num_threads; ++i )
+                    {
+                        rc = KThreadMake( &threads[ i ], prealloc_thread_func, &ctx );
+                        if ( rc != 0 )
+                            ErrMsg( "KThreadMake( concat #%d ) -> %R", i, rc );
+                    }
+                    for ( i = 0; i < num_threads; ++i )
+                    {
+                        if ( threads[ i ] != NULL )
+                        {
+                            rc_t status = 0;
+                            KThreadWait( threads[ i ], &status );
+                            if ( rc == 0 )
+                                rc = status;
+                            KThreadRelease( threads[ i ] );
+                        }
+                    }
+                    free( ( void * ) threads );
+                }
+            }
+        }
+        if ( show_progress )
+            join_multi_progress( progress_thread, &progress ); /* helper.c */
+    }
+
+    if ( ctx.dst != NULL )
+        KFileRelease( ctx.dst );
+    if ( ctx.offsets != NULL )
+        free( ( void * ) ctx.offsets );
+    return rc;
+}
@@ -0,0 +1,67 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_file_concat_
+#define _h_file_concat_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _h_klib_rc_
+#include <klib/rc.h>
+#endif
+
+#ifndef _h_kfs_directory_
+#include <kfs/directory.h>
+#endif
+
+#ifndef _h_klib_namelist_
+#include <klib/namelist.h>
+#endif
+
+/* --------------------------------------------------------------------------------------------
+    concatenation of the part-files of the join without copying through a user-space buffer:
+    copy_file_range() ( a reflink on filesystems that support it ), then sendfile(),
+    then pread/pwrite on the file-descriptors. Only available on linux, elsewhere
+    kernel_concat_files() returns rcUnsupported and concat_files() in helper.c copies
+    through its buffer as before.
+-------------------------------------------------------------------------------------------- */
+
+/* on_bytes is called after every chunk that was copied, it can be NULL */
+rc_t kernel_concat_files( KDirectory * dir, const VNamelist * files, const char * output,
+                          void ( CC * on_bytes )( uint64_t bytes, void * data ), void * data );
+
+/* the sizes of the part-files are known when the join is done: the output is created in its
+   final size and num_threads threads copy every part-file directly to its offset in it */
+rc_t concat_files_prealloc( KDirectory * dir, const VNamelist * files, size_t buf_size,
+                            const char * output, uint32_t num_threads, bool show_progress );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
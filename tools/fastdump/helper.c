@@ -25,6 +25,8 @@
 */
 
 #include "helper.h"
+#include "simd_4na.h"
+#include "file_concat.h"
 #include <klib/log.h>
 #include <klib/printf.h>
 #include <klib/progressbar.h>
@@ -257,6 +259,39 @@ format_t get_format_t( const char * format )
 }
 
 
+lookup_fmt_t get_lookup_fmt_t( const char * format )
+{
+    lookup_fmt_t res = lft_4na;
+    if ( format != NULL && format[ 0 ] != 0 )
+    {
+        String Format, Fmt2na;
+        StringInitCString( &Format, format );
+        StringInitCString( &Fmt2na, "2na" );
+        if ( 0 == StringCaseCompare ( &Format, &Fmt2na ) )
+            res = lft_2na;
+    }
+    return res;
+}
+
+
+inmem_t get_inmem_t( const char * inmem )
+{
+    inmem_t res = im_auto;
+    if ( inmem != NULL && inmem[ 0 ] != 0 )
+    {
+        String Inmem, Yes, No;
+        StringInitCString( &Inmem, inmem );
+        StringInitCString( &Yes, "yes" );
+        StringInitCString( &No, "no" );
+        if ( 0 == StringCaseCompare ( &Inmem, &Yes ) )
+            res = im_yes;
+        else if ( 0 == StringCaseCompare ( &Inmem, &No ) )
+            res = im_no;
+    }
+    return res;
+}
+
+
 uint64_t make_key( int64_t seq_spot_id, uint32_t seq_read_id )
 {
     uint64_t key = seq_spot_id;
@@ -266,58 +301,207 @@ uint64_t make_key( int64_t seq_spot_id, uint32_t seq_read_id )
 }
 
 
+/* the byte-loops are in simd_4na.c, with sse2/avx2-kernels selected at runtime */
 void pack_4na( const String * unpacked, SBuffer * packed )
 {
-    uint32_t i;
-    char * src = ( char * )unpacked->addr;
-    char * dst = ( char * )packed->S.addr;
+    const uint8_t * src = ( const uint8_t * )unpacked->addr;
+    uint8_t * dst = ( uint8_t * )packed->S.addr;
     uint16_t dna_len = ( unpacked->len & 0xFFFF );
-    uint32_t len = 0;
-    dst[ len++ ] = ( dna_len >> 8 );
-    dst[ len++ ] = ( dna_len & 0xFF );
-    for ( i = 0; i < unpacked->len; ++i )
-    {
-        if ( len < packed->buffer_size )
-        {
-            char base = ( src[ i ] & 0x0F );
-            if ( 0 == ( i & 0x01 ) )
-                dst[ len ] = ( base << 4 );
-            else
-                dst[ len++ ] |= base;
-        }
-    }
-    if ( unpacked->len & 0x01 )
-        len++;
+    size_t n_packed = ( dna_len >> 1 );
+    size_t len = 2;
+    dst[ 0 ] = ( dna_len >> 8 );
+    dst[ 1 ] = ( dna_len & 0xFF );
+    if ( n_packed > packed->buffer_size - len )
+        n_packed = packed->buffer_size - len;
+    pack_4na_bytes( get_simd_level(), src, dst + len, n_packed ); /* simd_4na.c */
+    len += n_packed;
+    if ( ( dna_len & 0x01 ) && n_packed == ( size_t )( dna_len >> 1 ) && len < packed->buffer_size )
+        dst[ len++ ] = ( ( src[ dna_len - 1 ] & 0x0F ) << 4 );
     packed->S.size = packed->S.len = len;
 }
 
 
-static char x4na_to_ASCII[ 16 ] =
+void unpack_4na( const String * packed, SBuffer * unpacked )
+{
+    const uint8_t * src = ( const uint8_t * )packed->addr;
+    char * dst = ( char * )unpacked->S.addr;
+    size_t n_packed = ( packed->len > 2 ) ? packed->len - 2 : 0;
+    uint16_t dna_len = src[ 0 ];
+    dna_len <<= 8;
+    dna_len |= src[ 1 ];
+    if ( n_packed > ( unpacked->buffer_size >> 1 ) )
+        n_packed = ( unpacked->buffer_size >> 1 );
+    unpack_4na_bytes( get_simd_level(), src + 2, dst, n_packed ); /* simd_4na.c */
+    unpacked->S.len = unpacked->S.size = dna_len;
+    if ( ( size_t )dna_len + 2 < unpacked->buffer_size )
+        dst[ dna_len + 2 ] = 0;
+}
+
+
+/* 4na-code ( 1 base per byte ) to 2na, or -1 for everything that is not A/C/G/T */
+static const int8_t x4na_to_2na[ 16 ] =
 {
     /* 0x00 0x01 0x02 0x03 0x04 0x05 0x06 0x07 0x08 0x09 0x0A 0x0B 0x0C 0x0D 0x0E 0x0F */
-       'N', 'A', 'C', 'N', 'G', 'N', 'N', 'N', 'T', 'N', 'N', 'N', 'N', 'N', 'N', 'N'
+        -1,   0,   1,  -1,   2,  -1,  -1,  -1,   3,  -1,  -1,  -1,  -1,  -1,  -1,  -1
 };
 
+static const char x2na_to_ASCII[ 4 ] = { 'A', 'C', 'G', 'T' };
 
-void unpack_4na( const String * packed, SBuffer * unpacked )
+
+static void write_u16( uint8_t * dst, uint16_t value )
+{
+    dst[ 0 ] = ( value >> 8 );
+    dst[ 1 ] = ( value & 0xFF );
+}
+
+
+static uint16_t read_u16( const uint8_t * src )
+{
+    uint16_t res = src[ 0 ];
+    res <<= 8;
+    res |= src[ 1 ];
+    return res;
+}
+
+
+size_t packed_size( lookup_fmt_t lf, const uint8_t * packed )
+{
+    uint16_t dna_len = read_u16( packed );
+    if ( lf == lft_2na )
+    {
+        uint16_t n_runs = read_u16( packed + 2 );
+        if ( n_runs == LOOKUP_2NA_FALLBACK )
+            return 4 + ( ( dna_len + 1 ) >> 1 );
+        return 4 + ( 4 * ( size_t )n_runs ) + ( ( dna_len + 3 ) >> 2 );
+    }
+    return 2 + ( ( dna_len + 1 ) >> 1 );
+}
+
+
+uint64_t packed_size_estimate( lookup_fmt_t lf, uint64_t avg_len )
+{
+    return ( lf == lft_2na ) ? 4 + ( ( avg_len + 3 ) >> 2 ) : 2 + ( ( avg_len + 1 ) >> 1 );
+}
+
+
+/* counts the runs of bases that are not A/C/G/T */
+static uint32_t count_n_runs( const uint8_t * src, uint16_t dna_len )
 {
-    uint32_t i;
-    char * src = ( char * )packed->addr;
+    uint32_t res = 0;
+    uint16_t i;
+    bool in_run = false;
+    for ( i = 0; i < dna_len; ++i )
+    {
+        bool is_n = ( x4na_to_2na[ src[ i ] & 0x0F ] < 0 );
+        if ( is_n && !in_run )
+            res++;
+        in_run = is_n;
+    }
+    return res;
+}
+
+
+void pack_2na( const String * unpacked, SBuffer * packed )
+{
+    const uint8_t * src = ( const uint8_t * )unpacked->addr;
+    uint8_t * dst = ( uint8_t * )packed->S.addr;
+    uint16_t dna_len = ( unpacked->len & 0xFFFF );
+    uint32_t n_runs = count_n_runs( src, dna_len );
+    size_t size_2na = 4 + ( 4 * ( size_t )n_runs ) + ( ( dna_len + 3 ) >> 2 );
+    size_t size_4na = 4 + ( ( dna_len + 1 ) >> 1 );
+
+    if ( size_2na >= size_4na || size_2na > packed->buffer_size )
+    {
+        /* too many ambiguous bases for 2na to pay off ( or no space ): store as 4na behind the header */
+        SBuffer body;
+        body.S.addr = ( char * )dst + 2;
+        body.buffer_size = packed->buffer_size - 2;
+        pack_4na( unpacked, &body );   /* writes DNA-LEN at dst[ 2 ], overwritten by the marker */
+        write_u16( dst, dna_len );
+        write_u16( dst + 2, LOOKUP_2NA_FALLBACK );
+        packed->S.size = packed->S.len = body.S.size + 2;
+    }
+    else
+    {
+        uint8_t * runs = dst + 4;
+        uint8_t * bases = runs + ( 4 * n_runs );
+        uint16_t i, run_start = 0;
+        bool in_run = false;
+
+        write_u16( dst, dna_len );
+        write_u16( dst + 2, ( uint16_t )n_runs );
+        memset( bases, 0, ( dna_len + 3 ) >> 2 );
+        for ( i = 0; i < dna_len; ++i )
+        {
+            int8_t b = x4na_to_2na[ src[ i ] & 0x0F ];
+            if ( b < 0 )
+            {
+                if ( !in_run )
+                    run_start = i;
+                in_run = true;
+            }
+            else
+            {
+                if ( in_run )
+                {
+                    write_u16( runs, run_start );
+                    write_u16( runs + 2, i - run_start );
+                    runs += 4;
+                }
+                in_run = false;
+                bases[ i >> 2 ] |= ( b << ( 6 - ( ( i & 0x03 ) << 1 ) ) );
+            }
+        }
+        if ( in_run )
+        {
+            write_u16( runs, run_start );
+            write_u16( runs + 2, dna_len - run_start );
+        }
+        packed->S.size = packed->S.len = size_2na;
+    }
+}
+
+
+void unpack_2na( const String * packed, SBuffer * unpacked )
+{
+    const uint8_t * src = ( const uint8_t * )packed->addr;
     char * dst = ( char * )unpacked->S.addr;
-    uint32_t dst_idx = 0;
-    uint16_t dna_len = src[ 0 ];
-    dna_len <<= 8;
-    dna_len |= src[ 1 ];
-    for ( i = 2; i < packed->len; ++i )
+    uint16_t dna_len = read_u16( src );
+    uint16_t n_runs = read_u16( src + 2 );
+
+    if ( n_runs == LOOKUP_2NA_FALLBACK )
     {
-        uint8_t packed_byte = src[ i ];
-        if ( dst_idx < unpacked->buffer_size )
-            dst[ dst_idx++ ] = x4na_to_ASCII[ ( packed_byte >> 4 ) & 0x0F ];
-        if ( dst_idx < unpacked->buffer_size )
-            dst[ dst_idx++ ] = x4na_to_ASCII[ packed_byte & 0x0F ];
+        String body;
+        body.addr = packed->addr + 2;
+        body.size = body.len = packed->size - 2;
+        unpack_4na( &body, unpacked );
+        /* the 4na-body starts with the marker, not with DNA-LEN */
+        unpacked->S.len = unpacked->S.size = dna_len;
+    }
+    else
+    {
+        const uint8_t * runs = src + 4;
+        const uint8_t * bases = runs + ( 4 * ( size_t )n_runs );
+        size_t i, n = dna_len;
+        if ( n > unpacked->buffer_size )
+            n = unpacked->buffer_size;
+        for ( i = 0; i < n; ++i )
+            dst[ i ] = x2na_to_ASCII[ ( bases[ i >> 2 ] >> ( 6 - ( ( i & 0x03 ) << 1 ) ) ) & 0x03 ];
+        for ( i = 0; i < n_runs; ++i )
+        {
+            size_t start = read_u16( runs + 4 * i );
+            size_t len = read_u16( runs + 4 * i + 2 );
+            if ( start < n )
+            {
+                if ( start + len > n )
+                    len = n - start;
+                memset( dst + start, 'N', len );
+            }
+        }
+        unpacked->S.len = unpacked->S.size = dna_len;
+        if ( ( size_t )dna_len < unpacked->buffer_size )
+            dst[ dna_len ] = 0;
     }
-    unpacked->S.len = unpacked->S.size = dna_len;
-    dst[ dna_len + 2 ] = 0;
 }
 
 
@@ -373,6 +557,25 @@ typedef struct cf_progress
 
 rc_t CC Quitting();
 
+static void CC advance_cf_progress( uint64_t bytes, void * data )
+{
+    cf_progress * cfp = data;
+    if ( cfp != NULL && cfp->progressbar != NULL )
+    {
+        uint32_t percent;
+        
+        cfp->current_size += bytes;
+        percent = calc_percent( cfp->total_size, cfp->current_size, 2 );
+        if ( percent > cfp->current_percent )
+        {
+            uint32_t i;
+            for ( i = cfp->current_percent + 1; i <= percent; ++i )
+                update_progressbar( cfp->progressbar, i );
+            cfp->current_percent = percent;
+        }
+    }
+}
+
 static rc_t copy_file( KFile * dst, const KFile * src, uint64_t * dst_pos,
                        size_t buf_size, cf_progress * cfp )
 {
@@ -405,20 +608,7 @@ static rc_t copy_file( KFile * dst, const KFile * src, uint64_t * dst_pos,
                     {
                         *dst_pos += num_trans;
                         src_pos += num_trans;
-                        if ( cfp != NULL && cfp->progressbar != NULL )
-                        {
-                            uint32_t percent;
-                            
-                            cfp->current_size += num_trans;
-                            percent = calc_percent( cfp->total_size, cfp->current_size, 2 );
-                            if ( percent > cfp->current_percent )
-                            {
-                                uint32_t i;
-                                for ( i = cfp->current_percent + 1; i <= percent; ++i )
-                                    update_progressbar( cfp->progressbar, i );
-                                cfp->current_percent = percent;
-                            }
-                        }
+                        advance_cf_progress( num_trans, cfp ); /* above */
                     }
                 }
                 else
@@ -459,7 +649,7 @@ static rc_t total_filesize( const KDirectory * dir, const VNamelist * files, uin
     return rc;
 }
 
-rc_t concat_files( KDirectory * dir, const VNamelist * files, size_t buf_size,
+static rc_t buffered_concat_files( KDirectory * dir, const VNamelist * files, size_t buf_size,
                    const char * output, bool show_progress )
 {
     struct KFile * dst;
@@ -538,6 +728,35 @@ rc_t concat_files( KDirectory * dir, const VNamelist * files, size_t buf_size,
     return rc;
 }
 
+/* the kernel copies the part-files if it can ( file_concat.c ), if not they go through our buffer */
+rc_t concat_files( KDirectory * dir, const VNamelist * files, size_t buf_size,
+                   const char * output, bool show_progress )
+{
+    cf_progress cfp;
+    rc_t rc = 0;
+
+    cfp.progressbar = NULL;
+    if ( show_progress )
+    {
+        cfp.current_size = 0;
+        cfp.current_percent = 0;
+        rc = make_progressbar( &cfp.progressbar, 2 );
+        if ( rc == 0 )
+            rc = total_filesize( dir, files, &cfp.total_size );
+    }
+    if ( rc == 0 )
+        rc = kernel_concat_files( dir, files, output, advance_cf_progress, &cfp ); /* file_concat.c */
+    if ( cfp.progressbar != NULL )
+    {
+        destroy_progressbar( cfp.progressbar );
+        if ( GetRCState( rc ) != rcUnsupported )
+            KOutMsg( "\n" );
+    }
+    if ( GetRCState( rc ) == rcUnsupported )
+        rc = buffered_concat_files( dir, files, buf_size, output, show_progress );
+    return rc;
+}
+
 rc_t delete_files( KDirectory * dir, const VNamelist * files )
 {
     uint32_t count;
@@ -81,6 +81,22 @@ typedef struct SBuffer
 
 typedef enum format_t { ft_special, ft_fastq } format_t;
 
+/* --------------------------------------------------------------------------------------------
+    format of the lookup-file:
+    lft_4na ... no file-header, records: [KEY][16-bit DNA-LEN][packed 4na]
+    lft_2na ... file starts with LOOKUP_2NA_MAGIC, records: [KEY][16-bit DNA-LEN][16-bit N-RUNS]
+                N-RUNS x [16-bit START][16-bit LEN] of bases that are not A/C/G/T,
+                followed by the bases as 2na ( 4 bases per byte );
+                N-RUNS == LOOKUP_2NA_FALLBACK means that the bases follow as packed 4na
+-------------------------------------------------------------------------------------------- */
+typedef enum lookup_fmt_t { lft_4na, lft_2na } lookup_fmt_t;
+
+#define LOOKUP_2NA_MAGIC 0x32414E324B4C4446     /* "FDLK2NA2" */
+#define LOOKUP_2NA_FALLBACK 0xFFFF
+
+/* where the join gets the lookup-table from: auto = in memory if the estimate fits the mem-limit */
+typedef enum inmem_t { im_auto, im_yes, im_no } inmem_t;
+
 rc_t ErrMsg( const char * fmt, ... );
 
 rc_t make_SBuffer( SBuffer * buffer, size_t len );
@@ -96,6 +112,8 @@ rc_t make_row_iter( struct num_gen * ranges, int64_t first, uint64_t count,
 rc_t split_string( String * in, String * p0, String * p1, uint32_t ch );
 
 format_t get_format_t( const char * format );
+lookup_fmt_t get_lookup_fmt_t( const char * format );
+inmem_t get_inmem_t( const char * inmem );
 
 struct Args;
 const char * get_str_option( const struct Args *args, const char *name, const char * dflt );
@@ -108,6 +126,15 @@ uint64_t make_key( int64_t seq_spot_id, uint32_t seq_read_id );
 void pack_4na( const String * unpacked, SBuffer * packed );
 void unpack_4na( const String * packed, SBuffer * unpacked );
 
+void pack_2na( const String * unpacked, SBuffer * packed );
+void unpack_2na( const String * packed, SBuffer * unpacked );
+
+/* size of a packed record ( starting with DNA-LEN ) from its first 2 ( 4na ) or 4 ( 2na ) bytes */
+size_t packed_size( lookup_fmt_t lf, const uint8_t * packed );
+
+/* the packed size of a read of avg_len bases, without runs of N */
+uint64_t packed_size_estimate( lookup_fmt_t lf, uint64_t avg_len );
+
 uint64_t calc_percent( uint64_t max, uint64_t value, uint16_t digits );
 
 bool file_exists( const KDirectory * dir, const char * fmt, ... );
@@ -28,6 +28,9 @@
 
 #include <kfs/file.h>
 #include <kfs/buffile.h>
+#include <kfs/mmap.h>
+
+#include <string.h>
 
 typedef struct index_writer
 {
@@ -144,10 +147,23 @@ rc_t make_index_writer( KDirectory * dir, struct index_writer ** writer,
 
 /* ----------------------------------------------------------------------- */
 
+/* -----------------------------------------------------------------------
+    the index-file is small ( 16 bytes per stride ), it is mapped into memory
+    and searched by interpolation: the keys are nearly evenly distributed,
+    so a guess proportional to the key lands very close to the right entry.
+    file-layout: [frequency][key,offset][key,offset]...
+   ----------------------------------------------------------------------- */
+
+typedef struct index_entry
+{
+    uint64_t key, offset;
+} index_entry;
+
 typedef struct index_reader
 {
-    const struct KFile * f;
-    uint64_t frequency, file_size, max_key;
+    const struct KMMap * mm;
+    const index_entry * entries;
+    uint64_t frequency, count, max_key;
 } index_reader;
 
 
@@ -155,20 +171,45 @@ void release_index_reader( struct index_reader * reader )
 {
     if ( reader != NULL )
     {
-        if ( reader->f != NULL ) KFileRelease( reader->f );
+        if ( reader->mm != NULL ) KMMapRelease( reader->mm );
         free( ( void * ) reader );
     }
 }
 
 
-static rc_t read_value( struct index_reader * reader, uint64_t pos, uint64_t * value )
+static rc_t map_index( index_reader * r, const struct KFile * f )
 {
-    size_t num_read;
-    rc_t rc = KFileRead( reader->f, pos, ( void *)value, sizeof *value, &num_read );
+    rc_t rc = KMMapMakeRead( &r->mm, f );
     if ( rc != 0 )
-        ErrMsg( "read_value.KFileRead( at %ld ) -> %R", pos, rc );
-    else if ( num_read != sizeof *value )
-        rc = RC( rcVDB, rcNoTarg, rcReading, rcFormat, rcInvalid );
+        ErrMsg( "KMMapMakeRead() -> %R", rc );
+    else
+    {
+        const void * addr;
+        size_t size;
+        rc = KMMapAddrRead( r->mm, &addr );
+        if ( rc != 0 )
+            ErrMsg( "KMMapAddrRead() -> %R", rc );
+        else
+        {
+            rc = KMMapSize( r->mm, &size );
+            if ( rc != 0 )
+                ErrMsg( "KMMapSize() -> %R", rc );
+            else if ( size < ( sizeof r->frequency ) + ( sizeof *r->entries ) ||
+                      ( ( size - sizeof r->frequency ) % ( sizeof *r->entries ) ) != 0 )
+            {
+                rc = RC( rcVDB, rcNoTarg, rcReading, rcFormat, rcInvalid );
+                ErrMsg( "map_index( size = %lu ) -> %R", size, rc );
+            }
+            else
+            {
+                const uint8_t * p = addr;
+                memmove( &r->frequency, p, sizeof r->frequency );
+                r->entries = ( const index_entry * )( p + sizeof r->frequency );
+                r->count = ( size - sizeof r->frequency ) / ( sizeof *r->entries );
+                r->max_key = r->entries[ r->count - 1 ].key;
+            }
+        }
+    }
     return rc;
 }
 
@@ -187,60 +228,64 @@ rc_t make_index_reader( KDirectory * dir, struct index_reader ** reader,
         ErrMsg( "KDirectoryVOpenFileRead() -> %R", rc );
     else
     {
-        const struct KFile * temp_file;
-        rc = KBufFileMakeRead( &temp_file, f, buf_size );
-        KFileRelease( f );
-        if ( rc != 0 )
+        index_reader * r = calloc( 1, sizeof * r );
+        if ( r == NULL )
         {
-            ErrMsg( "KBufFileMakeRead() -> %R", rc );
+            rc = RC( rcVDB, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+            ErrMsg( "calloc( %d ) -> %R", ( sizeof * r ), rc );
         }
         else
         {
-            index_reader * r = calloc( 1, sizeof * r );
-            if ( r == NULL )
-            {
-                KFileRelease( temp_file );
-                rc = RC( rcVDB, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
-                ErrMsg( "calloc( %d ) -> %R", ( sizeof * r ), rc );
-            }
+            /* the map keeps its own reference to the file */
+            rc = map_index( r, f ); /* above */
+            if ( rc == 0 )
+                *reader = r;
             else
-            {
-                r->f = temp_file;
-                rc = read_value( r, 0, &r->frequency );
-                if ( rc == 0 )
-                    rc = KFileSize( temp_file, &r->file_size );
-
-                if ( rc == 0 )
-                {
-                    get_max_key( r, &r->max_key );
-                    *reader = r;
-                }
-                else
-                    release_index_reader( r );
-            }
+                release_index_reader( r );
         }
+        KFileRelease( f );
     }
     va_end ( args );
     return rc;
 }
 
 
-static uint64_t key_to_pos_guess( const struct index_reader * reader, uint64_t key )
+/* index of the last entry with a key <= key, or 0 if key is smaller than the first key */
+static uint64_t find_entry( const index_reader * reader, uint64_t key )
 {
-    uint64_t chunk_id = ( key / reader->frequency );
-    return ( ( sizeof reader->frequency ) + ( chunk_id * ( 2 * ( sizeof reader->frequency ) ) ) );
-}
+    const index_entry * e = reader->entries;
+    uint64_t lo = 0, hi = reader->count - 1;
+    uint32_t steps = 0;
 
+    if ( key <= e[ lo ].key )
+        return 0;
+    if ( key >= e[ hi ].key )
+        return hi;
 
-static rc_t read_3( const struct index_reader * reader, uint64_t pos, uint64_t * data, size_t to_read )
-{
-    size_t num_read;
-    rc_t rc = KFileRead( reader->f, pos, ( void *)data, to_read, &num_read );
-    if ( rc != 0 )
-        ErrMsg( "read_3.KFileRead( at %ld ) -> %R", pos, rc );
-    else if ( num_read != to_read )
-        rc = RC( rcVDB, rcNoTarg, rcReading, rcFormat, rcInvalid );
-    return rc;
+    /* here: e[ lo ].key < key < e[ hi ].key */
+    while ( hi - lo > 1 )
+    {
+        uint64_t guess;
+        /* interpolate, but fall back to bisection if the keys are skewed */
+        if ( ++steps <= 4 )
+        {
+            double frac = ( double )( key - e[ lo ].key ) / ( double )( e[ hi ].key - e[ lo ].key );
+            guess = lo + ( uint64_t )( frac * ( double )( hi - lo ) );
+        }
+        else
+            guess = lo + ( ( hi - lo ) >> 1 );
+
+        if ( guess <= lo )
+            guess = lo + 1;
+        else if ( guess >= hi )
+            guess = hi - 1;
+
+        if ( e[ guess ].key <= key )
+            lo = guess;
+        else
+            hi = guess;
+    }
+    return lo;
 }
 
 
@@ -255,57 +300,9 @@ rc_t get_nearest_offset( const struct index_reader * reader, uint64_t key_to_fin
     }
     else
     {
-        uint64_t data[ 6 ];
-        /*
-            data[ 0 ] ... key0      data[ 1 ] ... offset0
-            data[ 2 ] ... key1      data[ 3 ] ... offset1
-            data[ 4 ] ... key2      data[ 5 ] ... offset2
-        */
-        uint64_t pos = key_to_pos_guess( reader, key_to_find );
-        bool found = false;
-        while ( rc == 0 && !found && pos < reader->file_size )
-        {        
-            rc = read_3( reader, pos, data, sizeof data );
-            if ( rc == 0 )
-            {
-                if ( key_to_find >= data[ 0 ] && key_to_find < data[ 2 ] )
-                {
-                    /* key_to_find is between key0 and key1 */
-                    found = true;
-                    *key_found = data[ 0 ];
-                    *offset = data[ 1 ];
-                }
-                else if ( key_to_find >= data[ 2 ] && key_to_find < data[ 4 ] )
-                {
-                    /* key_to_find is between key1 and key2 */
-                    found = true;
-                    *key_found = data[ 2 ];
-                    *offset = data[ 3 ];
-                }
-                if ( !found )
-                {
-                    if ( key_to_find < data[ 0 ] )
-                    {
-                        /* key_to_find is smaller than our guess */
-                        if ( pos > sizeof reader->frequency )
-                            pos -= ( 2 * ( sizeof reader->frequency ) );
-                        else
-                        {
-                            found = true;
-                            *key_found = data[ 0 ];
-                            *offset = data[ 1 ];
-                        }
-                    }
-                    else if ( key_to_find > data[ 4 ] )
-                    {
-                        /* key_to_find is bigger than our guess */
-                        pos += ( 2 * ( sizeof reader->frequency ) );
-                    }
-                }
-            }
-        }
-        if ( !found )
-            rc = SILENT_RC( rcVDB, rcNoTarg, rcReading, rcId, rcNotFound );
+        const index_entry * e = &reader->entries[ find_entry( reader, key_to_find ) ];
+        *key_found = e->key;
+        *offset = e->offset;
     }
     return rc;
 }
@@ -317,19 +314,9 @@ rc_t get_max_key( const struct index_reader * reader, uint64_t * max_key )
     if ( reader == NULL || max_key == NULL )
     {
         rc = RC( rcVDB, rcNoTarg, rcReading, rcParam, rcInvalid );
-        ErrMsg( "get_nearest_offset() -> %R", rc );
-    }
-    else if ( reader->max_key > 0 )
-    {
-        *max_key = reader->max_key;
+        ErrMsg( "get_max_key() -> %R", rc );
     }
     else
-    {
-        uint64_t data[ 6 ];
-        uint64_t pos = reader->file_size - ( sizeof data );
-        rc = read_3( reader, pos, data, sizeof data );
-        if ( rc == 0 )
-             *max_key = data[ 4 ];
-    }
+        *max_key = reader->max_key;
     return rc;
-}
\ No newline at end of file
+}
@@ -43,6 +43,9 @@ extern "C" {
 #include <kfs/directory.h>
 #endif
 
+/* every how many keys an entry is written into the index ( --index-stride ) */
+#define DFLT_INDEX_STRIDE 20000
+
 struct index_writer;
 
 void release_index_writer( struct index_writer * writer );
@@ -55,6 +58,7 @@ struct index_reader;
 void release_index_reader( struct index_reader * reader );
 rc_t make_index_reader( KDirectory * dir, struct index_reader ** reader,
                         size_t buf_size, const char * fmt, ... );
+/* key_found / offset of the last index-entry with a key <= key_to_find */
 rc_t get_nearest_offset( const struct index_reader * reader, uint64_t key_to_find,
                    uint64_t * key_found, uint64_t * offset );
 
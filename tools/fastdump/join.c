@@ -30,6 +30,8 @@
 #include "file_printer.h"
 #include "special_iter.h"
 #include "fastq_iter.h"
+#include "file_concat.h"
+#include "telemetry.h"
 #include "helper.h"
 
 #include <klib/out.h>
@@ -38,6 +40,7 @@
 #include <kproc/thread.h>
 
 #include <stdio.h>
+#include <string.h>
 
 typedef struct join
 {
@@ -68,7 +71,10 @@ static rc_t init_join( const join_params * jp, struct join *j, struct index_read
     j->B1.S.addr = NULL;
     j->B2.S.addr = NULL;
     
-    rc = make_lookup_reader( jp->dir, index, &j->lookup, jp->buf_size, "%s", jp->lookup_filename );
+    if ( jp->store != NULL )
+        rc = make_lookup_reader_from_store( jp->store, &j->lookup ); /* lookup_reader.c */
+    else
+        rc = make_lookup_reader( jp->dir, index, &j->lookup, jp->buf_size, "%s", jp->lookup_filename );
     if ( rc == 0 )
     {
         if ( jp->output_filename != NULL )
@@ -115,6 +121,7 @@ static void copy_join_params( join_params * dst, const join_params * src )
     dst->dir                = src->dir;
     dst->accession          = src->accession;
     dst->lookup_filename    = src->lookup_filename;
+    dst->store              = src->store;
     dst->index_filename     = src->index_filename;
     dst->output_filename    = src->output_filename;
     dst->temp_path          = src->temp_path;
@@ -125,6 +132,8 @@ static void copy_join_params( join_params * dst, const join_params * src )
     dst->first              = src->first;
     dst->count              = src->count;
     dst->show_progress      = src->show_progress;
+    dst->prealloc           = src->prealloc;
+    dst->telemetry          = src->telemetry;
     dst->fmt                = src->fmt;
 }
 
@@ -386,7 +395,9 @@ static rc_t extract_row_count_cmn( const join_params * jp, uint64_t * row_count
 
 rc_t CC Quitting();
 
-static rc_t perform_special_join( const join_params * jp, struct index_reader * index )
+/* rows and bytes are what the thread did before, the progress goes to tick */
+static rc_t perform_special_join( const join_params * jp, struct index_reader * index,
+                              uint64_t * rows, uint64_t bytes, telemetry_tick * tick )
 {
     rc_t rc;
     struct special_iter * iter;
@@ -401,6 +412,8 @@ static rc_t perform_special_join( const join_params * jp, struct index_reader *
         if ( rc == 0 )
         {
             special_rec rec;
+            uint64_t n = 0;
+            
             while ( get_from_special_iter( iter, &rec, &rc ) && rc == 0 )
             {
                 rc = Quitting();
@@ -413,8 +426,11 @@ static rc_t perform_special_join( const join_params * jp, struct index_reader *
 
                     if ( jp->join_progress != NULL )
                         atomic_inc( jp->join_progress );
+                    n++;
+                    telemetry_progress( jp->telemetry, tick, *rows + n, bytes ); /* telemetry.c */
                 }
             }
+            *rows += n;
             release_join_ctx( &j );
         }
         else
@@ -427,7 +443,9 @@ static rc_t perform_special_join( const join_params * jp, struct index_reader *
 }
 
 
-static rc_t perform_fastq_join( const join_params * jp, struct index_reader * index )
+/* rows and bytes are what the thread did before, the progress goes to tick */
+static rc_t perform_fastq_join( const join_params * jp, struct index_reader * index,
+                              uint64_t * rows, uint64_t bytes, telemetry_tick * tick )
 {
     rc_t rc;
     struct fastq_iter * iter;
@@ -458,8 +476,10 @@ static rc_t perform_fastq_join( const join_params * jp, struct index_reader * in
                     if ( jp->join_progress != NULL )
                         atomic_inc( jp->join_progress );
                     n++;
+                    telemetry_progress( jp->telemetry, tick, *rows + n, bytes ); /* telemetry.c */
                 }
             }
+            *rows += n;
             release_join_ctx( &j );
         }
         else
@@ -475,13 +495,22 @@ static rc_t perform_fastq_join( const join_params * jp, struct index_reader * in
 
 /* ------------------------------------------------------------------------------------------ */
 
-typedef struct join_thread_data
+/* a slice of the SEQUENCE-table, every one is joined into its own part-file */
+typedef struct join_unit
 {
-    const join_params * jp;
     int64_t first;
     uint64_t count;
-    uint32_t idx;
-} join_thread_data;
+} join_unit;
+
+/* the threads pull the next unit from here, until all are done */
+typedef struct join_queue
+{
+    const join_params * jp;
+    join_unit * units;
+    uint32_t unit_count;
+    atomic_t next_unit;
+    atomic_t next_thread_id;
+} join_queue;
 
 
 static const char * leaf_of( const char * src )
@@ -540,7 +569,13 @@ static rc_t concat_part_files( const join_params * jp, uint32_t count )
                 rc = VNamelistAppend( files, part_file );
         }
         if ( rc == 0 )
-            rc = concat_files( jp->dir, files, jp->buf_size, jp->output_filename, jp->show_progress ); /* helper.c */
+        {
+            if ( jp->prealloc )
+                rc = concat_files_prealloc( jp->dir, files, jp->buf_size, jp->output_filename,
+                                            jp->num_threads, jp->show_progress ); /* file_concat.c */
+            else
+                rc = concat_files( jp->dir, files, jp->buf_size, jp->output_filename, jp->show_progress ); /* helper.c */
+        }
         if ( rc == 0 )
             rc = delete_files( jp->dir, files );
         VNamelistRelease( files );
@@ -548,48 +583,258 @@ static rc_t concat_part_files( const join_params * jp, uint32_t count )
     return rc;
 }
 
-/* ------------------------------------------------------------------------------------------ */
+/* the bytes written into the output-file ( 0 for stdout ) */
+static uint64_t output_size( const join_params * jp )
+{
+    uint64_t res = 0;
+    if ( jp->output_filename == NULL || KDirectoryFileSize( jp->dir, &res, "%s", jp->output_filename ) != 0 )
+        res = 0;
+    return res;
+}
+
+/* ------------------------------------------------------------------------------------------
+    balanced work-units:
+    the cost of joining a row depends on the length of the spot and if it is aligned or not
+    ( aligned reads have to be read from the lookup-file ). Both vary a lot along the table.
+    The rows are cut into COST_SEGMENTS segments, for each the cost is estimated from
+    a sample of SPOT_LEN in the SEQUENCE-table and from the lookup-bytes between the
+    segment-boundaries ( taken from the index ). The units are cut at equal cost.
+    There are more units than threads, a thread that is done takes the next unit.
+   ------------------------------------------------------------------------------------------ */
+
+#define UNITS_PER_THREAD 8
+#define MAX_JOIN_UNITS 1024
+#define MIN_UNIT_ROWS 1000
+#define COST_SEGMENTS 512
+#define SAMPLE_ROWS 8
+
+
+/* spot_len[ i ] ... average SPOT_LEN of the first SAMPLE_ROWS rows of segment i */
+static rc_t sample_spot_len( const join_params * jp, uint64_t row_count, uint64_t seg_rows,
+                             uint32_t segments, uint64_t * spot_len )
+{
+    rc_t rc = 0;
+    size_t buflen = segments * 48;
+    char * row_range = malloc( buflen );
+    if ( row_range == NULL )
+    {
+        rc = RC( rcVDB, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+        ErrMsg( "sample_spot_len.malloc( %d ) -> %R", buflen, rc );
+    }
+    else
+    {
+        uint32_t i;
+        size_t pos = 0;
+        for ( i = 0; rc == 0 && i < segments; ++i )
+        {
+            size_t num_writ;
+            int64_t first = 1 + i * seg_rows;
+            rc = string_printf( &row_range[ pos ], buflen - pos, &num_writ, "%s%ld-%ld",
+                                i > 0 ? "," : "", first, first + SAMPLE_ROWS - 1 );
+            pos += num_writ;
+        }
+        if ( rc == 0 )
+        {
+            cmn_params cmn;
+            struct cmn_iter * iter;
+
+            init_cmn_params( jp, &cmn ); /* above */
+            cmn.row_range = row_range;
+            cmn.show_progress = false;
+            rc = make_cmn_iter( &cmn, "SEQUENCE", &iter ); /* cmn_iter.c */
+            if ( rc == 0 )
+            {
+                uint32_t spot_len_id;
+                rc = cmn_iter_add_column( iter, "SPOT_LEN", &spot_len_id );
+                if ( rc == 0 )
+                    rc = cmn_iter_range( iter, spot_len_id );
+                if ( rc == 0 )
+                {
+                    uint32_t n[ COST_SEGMENTS ];
+                    memset( n, 0, sizeof n );
+                    while ( rc == 0 && cmn_iter_next( iter, &rc ) )
+                    {
+                        uint32_t len;
+                        uint64_t seg = ( cmn_iter_row_id( iter ) - 1 ) / seg_rows;
+                        rc = cmn_read_uint32( iter, spot_len_id, &len );
+                        if ( rc == 0 && seg < segments )
+                        {
+                            spot_len[ seg ] += len;
+                            n[ seg ]++;
+                        }
+                    }
+                    for ( i = 0; i < segments; ++i )
+                        spot_len[ i ] = ( n[ i ] > 0 ) ? spot_len[ i ] / n[ i ] : 0;
+                }
+                destroy_cmn_iter( iter );
+            }
+        }
+        free( ( void * ) row_range );
+    }
+    return rc;
+}
+
+
+/* the byte-offset in the lookup-file where the records of this row start */
+static uint64_t lookup_offset_of_row( const struct index_reader * index, int64_t row )
+{
+    uint64_t key_found, offset = 0;
+    get_nearest_offset( index, ( ( uint64_t )row ) << 1, &key_found, &offset ); /* index.c */
+    return offset;
+}
+
+
+static rc_t make_join_units( const join_params * jp, uint64_t row_count, join_unit ** units, uint32_t * count )
+{
+    rc_t rc = 0;
+    uint32_t n_units = jp->num_threads * UNITS_PER_THREAD;
+    uint32_t segments = COST_SEGMENTS;
+    uint64_t seg_rows, cost[ COST_SEGMENTS + 1 ], spot_len[ COST_SEGMENTS ];
+    join_unit * u;
+
+    if ( n_units > MAX_JOIN_UNITS )
+        n_units = MAX_JOIN_UNITS;
+    if ( n_units > row_count / MIN_UNIT_ROWS )
+        n_units = ( row_count / MIN_UNIT_ROWS );
+    if ( n_units < jp->num_threads )
+        n_units = jp->num_threads;
+    if ( segments > row_count / SAMPLE_ROWS )
+        segments = row_count / SAMPLE_ROWS;
+    if ( segments < 1 )
+        segments = 1;
+    seg_rows = ( row_count + segments - 1 ) / segments;
+
+    u = calloc( n_units, sizeof * u );
+    if ( u == NULL )
+    {
+        rc = RC( rcVDB, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+        ErrMsg( "make_join_units.calloc( %d ) -> %R", n_units * ( sizeof * u ), rc );
+        return rc;
+    }
+
+    /* the cumulative cost at the start of every segment, in bytes to be read */
+    memset( spot_len, 0, sizeof spot_len );
+    if ( sample_spot_len( jp, row_count, seg_rows, segments, spot_len ) != 0 )
+        memset( spot_len, 0, sizeof spot_len );   /* no sample: the rows count equally */
+    {
+        struct index_reader * index = NULL;
+        uint32_t i;
+        uint64_t prev_offset = 0;
+
+        if ( jp->store == NULL && jp->index_filename != NULL &&
+             file_exists( jp->dir, "%s", jp->index_filename ) )
+            make_index_reader( jp->dir, &index, jp->buf_size, "%s", jp->index_filename ); /* index.c */
+        cost[ 0 ] = 0;
+        for ( i = 0; i < segments; ++i )
+        {
+            int64_t next_row = 1 + ( i + 1 ) * seg_rows;
+            uint64_t rows = seg_rows;
+            uint64_t c = rows * ( spot_len[ i ] > 0 ? spot_len[ i ] : 1 );
+            if ( index != NULL )
+            {
+                uint64_t offset = lookup_offset_of_row( index, next_row );
+                if ( offset > prev_offset )
+                    c += ( offset - prev_offset );
+                prev_offset = offset;
+            }
+            cost[ i + 1 ] = cost[ i ] + c;
+        }
+        release_index_reader( index ); /* index.c */
+    }
+
+    /* cut at equal cost: unit k ends where the cumulative cost reaches ( k + 1 ) / n_units */
+    {
+        uint32_t k, seg = 0;
+        int64_t first = 1;
+        uint32_t made = 0;
+        for ( k = 0; k < n_units; ++k )
+        {
+            int64_t end;    /* exclusive */
+            if ( k == n_units - 1 )
+                end = 1 + row_count;
+            else
+            {
+                uint64_t target = ( cost[ segments ] / n_units ) * ( k + 1 );
+                uint64_t in_seg;
+                while ( seg < segments - 1 && cost[ seg + 1 ] < target )
+                    seg++;
+                /* interpolate inside the segment */
+                in_seg = cost[ seg + 1 ] - cost[ seg ];
+                end = 1 + seg * seg_rows;
+                if ( in_seg > 0 && target > cost[ seg ] )
+                    end += ( int64_t )( ( ( double )( target - cost[ seg ] ) / in_seg ) * seg_rows );
+                if ( end > ( int64_t )( 1 + row_count ) )
+                    end = 1 + row_count;
+            }
+            if ( end > first )
+            {
+                u[ made ].first = first;
+                u[ made ].count = end - first;
+                made++;
+                first = end;
+            }
+        }
+        *units = u;
+        *count = made;
+    }
+    return rc;
+}
+
 
 static rc_t CC cmn_thread_func( const KThread *self, void *data )
 {
     rc_t rc = 0;
-    join_thread_data * jtd = data;
-    const join_params * jp = jtd->jp;
+    join_queue * q = data;
+    const join_params * jp = q->jp;
     struct index_reader * index = NULL;
+    uint32_t thread_id = atomic_read_and_add( &q->next_thread_id, 1 );
+    uint64_t rows = 0, bytes = 0;
+    telemetry_tick tick;
     
+    telemetry_tick_init( &tick, "join", thread_id ); /* telemetry.c */
     if ( jp->index_filename != NULL )
     {
         if ( file_exists( jp->dir, "%s", jp->index_filename ) )
             rc = make_index_reader( jp->dir, &index, jp->buf_size, "%s", jp->index_filename ); /* index.c */
     }
 
-    if ( rc == 0 && index != NULL )
+    /* with the lookup-table in memory there is no index, the store is searched directly */
+    if ( rc == 0 && ( index != NULL || jp->store != NULL ) )
     {
-        char part_file[ 4096 ];
-        rc = make_part_filename( jp, part_file, sizeof part_file, jtd->idx ); /* above */
-        if ( rc == 0 )
+        bool done = false;
+        while ( rc == 0 && !done )
         {
-            join_params cjp;
-
-            copy_join_params( &cjp, jp );
-            cjp.num_threads = 0;
-            cjp.first = jtd->first;
-            cjp.count = jtd->count;
-            cjp.output_filename = part_file;
-            cjp.show_progress = false;
-            
-            switch( jp->fmt )
+            uint32_t idx = atomic_read_and_add( &q->next_unit, 1 );
+            done = ( idx >= q->unit_count );
+            if ( !done )
             {
-                case ft_special : rc = perform_special_join( &cjp, index ); break; /* above */
-                case ft_fastq   : rc = perform_fastq_join( &cjp, index ); break; /* above */
-                default : break;
-                
+                char part_file[ 4096 ];
+                rc = make_part_filename( jp, part_file, sizeof part_file, idx ); /* above */
+                if ( rc == 0 )
+                {
+                    join_params cjp;
+
+                    copy_join_params( &cjp, jp );
+                    cjp.num_threads = 0;
+                    cjp.first = q->units[ idx ].first;
+                    cjp.count = q->units[ idx ].count;
+                    cjp.output_filename = part_file;
+                    cjp.show_progress = false;
+                    
+                    switch( jp->fmt )
+                    {
+                        case ft_special : rc = perform_special_join( &cjp, index, &rows, bytes, &tick ); break; /* above */
+                        case ft_fastq   : rc = perform_fastq_join( &cjp, index, &rows, bytes, &tick ); break; /* above */
+                        default : break;
+                    }
+                    bytes += output_size( &cjp ); /* above */
+                }
             }
         }
         release_index_reader( index ); /* index.c */    
     }
-    
-    free( ( void * ) data );
+    if ( rc == 0 )
+        telemetry_stage( jp->telemetry, "join", thread_id, rows, bytes, tick.start ); /* telemetry.c */
     return rc;
 }
 
@@ -604,12 +849,18 @@ rc_t execute_join( const join_params * jp )
     if ( jp->num_threads < 2 )
     {
         /* on the main thread */
+        uint64_t rows = 0;
+        telemetry_tick tick;
+
+        telemetry_tick_init( &tick, "join", 0 ); /* telemetry.c */
         switch( jp->fmt )
         {
-            case ft_special : rc = perform_special_join( jp, NULL ); break; /* above */
-            case ft_fastq   : rc = perform_fastq_join( jp, NULL ); break; /* above */
+            case ft_special : rc = perform_special_join( jp, NULL, &rows, 0, &tick ); break; /* above */
+            case ft_fastq   : rc = perform_fastq_join( jp, NULL, &rows, 0, &tick ); break; /* above */
             default : break;
         }
+        if ( rc == 0 )
+            telemetry_stage( jp->telemetry, "join", 0, rows, output_size( jp ), tick.start ); /* telemetry.c */
     }
     else
     {
@@ -618,33 +869,30 @@ rc_t execute_join( const join_params * jp )
         if ( rc == 0 && row_count > 0 )
         {
             Vector threads;
-            int64_t first = 1;
-            uint64_t i, per_thread = ( row_count / jp->num_threads ) + 1;
+            uint64_t i;
             KThread * progress_thread = NULL;
             multi_progress progress;
+            join_queue q;
 
-            init_progress_data( &progress, row_count ); /* helper.c */
-            VectorInit( &threads, 0, jp->num_threads );
-            
-            if ( jp->show_progress )
-            {
-                join_params * nc_jp = ( join_params * )jp;
-                nc_jp->join_progress = &progress.progress_rows;
-                rc = start_multi_progress( &progress_thread, &progress ); /* helper.c */
-            }
-            for ( i = 0; rc == 0 && i < jp->num_threads; ++i )
+            q.jp = jp;
+            atomic_set( &q.next_unit, 0 );
+            atomic_set( &q.next_thread_id, 0 );
+            rc = make_join_units( jp, row_count, &q.units, &q.unit_count ); /* above */
+            if ( rc == 0 )
             {
-                join_thread_data * jtd = calloc( 1, sizeof * jtd );
-                if ( jtd != NULL )
+                init_progress_data( &progress, row_count ); /* helper.c */
+                VectorInit( &threads, 0, jp->num_threads );
+                
+                if ( jp->show_progress )
+                {
+                    join_params * nc_jp = ( join_params * )jp;
+                    nc_jp->join_progress = &progress.progress_rows;
+                    rc = start_multi_progress( &progress_thread, &progress ); /* helper.c */
+                }
+                for ( i = 0; rc == 0 && i < jp->num_threads; ++i )
                 {
                     KThread * thread;
-                    
-                    jtd->jp = jp;
-                    jtd->first = first;
-                    jtd->count = per_thread;
-                    jtd->idx = i;
-
-                    rc = KThreadMake( &thread, cmn_thread_func, jtd );
+                    rc = KThreadMake( &thread, cmn_thread_func, &q );
                     if ( rc != 0 )
                         ErrMsg( "KThreadMake( fastq/special #%d ) -> %R", i, rc );
                     else
@@ -653,17 +901,24 @@ rc_t execute_join( const join_params * jp )
                         if ( rc != 0 )
                             ErrMsg( "VectorAppend( sort-thread #%d ) -> %R", i, rc );
                     }
-                    first += per_thread;
                 }
+                
+                join_and_release_threads( &threads ); /* helper.c */
+                join_multi_progress( progress_thread, &progress ); /* helper.c */
+                
+                if ( jp->show_progress )
+                    KOutMsg( "concat :" );
+                
+                /* the part-files are numbered by unit, that keeps them in row-order */
+                if ( rc == 0 )
+                {
+                    KTimeMs_t start = KTimeMsStamp();
+                    rc = concat_part_files( jp, q.unit_count ); /* above */
+                    if ( rc == 0 )
+                        telemetry_stage( jp->telemetry, "concat", 0, q.unit_count, output_size( jp ), start );
+                }
+                free( ( void * ) q.units );
             }
-            
-            join_and_release_threads( &threads ); /* helper.c */
-            join_multi_progress( progress_thread, &progress ); /* helper.c */
-            
-            if ( jp->show_progress )
-                KOutMsg( "concat :" );
-            
-            rc = concat_part_files( jp, jp->num_threads ); /* above */
         }
     }
     return rc;
@@ -59,11 +59,14 @@ typedef struct join_params
     const char * index_filename;
     const char * output_filename;
     const char * temp_path;
+    const struct slab_store * store;    /* if not NULL: the lookup-table in memory */
     atomic_t   * join_progress;
+    struct telemetry * telemetry;       /* can be NULL */
     size_t buf_size, cur_cache, num_threads;
     int64_t first;
     uint64_t count;
     bool show_progress;
+    bool prealloc;  /* copy the part-files in parallel into the preallocated output */
     format_t fmt;
 } join_params;
 
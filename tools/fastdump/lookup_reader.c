@@ -26,6 +26,7 @@
 
 #include "lookup_reader.h"
 #include "helper.h"
+#include "slab_store.h"
 
 #include <klib/printf.h>
 #include <kfs/file.h>
@@ -38,8 +39,10 @@ typedef struct lookup_reader
 {
     const struct KFile * f;
     const struct index_reader * index;
+    const struct slab_store * store;    /* instead of f, if the lookup-table is in memory */
     SBuffer buf;
-    uint64_t pos;
+    uint64_t pos, data_start;
+    lookup_fmt_t lf;
 } lookup_reader;
 
 
@@ -54,6 +57,36 @@ void release_lookup_reader( struct lookup_reader * reader )
 }
 
 
+/* a 2na-lookup-file starts with a magic number, a 4na-lookup-file directly with the first key */
+static rc_t detect_lookup_fmt( struct lookup_reader * reader )
+{
+    uint64_t magic = 0;
+    size_t num_read;
+    rc_t rc = KFileRead( reader->f, 0, &magic, sizeof magic, &num_read );
+    if ( rc != 0 )
+        ErrMsg( "detect_lookup_fmt.KFileRead( at 0, to_read %u ) -> %R", sizeof magic, rc );
+    else if ( num_read == sizeof magic && magic == LOOKUP_2NA_MAGIC )
+    {
+        reader->lf = lft_2na;
+        reader->data_start = sizeof magic;
+    }
+    else
+    {
+        reader->lf = lft_4na;
+        reader->data_start = 0;
+    }
+    reader->pos = reader->data_start;
+    return rc;
+}
+
+
+/* how many bytes are in front of the packed bases: KEY + DNA-LEN ( + N-RUNS ) */
+static size_t record_header_size( const struct lookup_reader * reader )
+{
+    return ( reader->lf == lft_2na ) ? 12 : 10;
+}
+
+
 rc_t make_lookup_reader( const KDirectory *dir, const struct index_reader * index,
                          struct lookup_reader ** reader, size_t buf_size, const char * fmt, ... )
 {
@@ -96,7 +129,9 @@ rc_t make_lookup_reader( const KDirectory *dir, const struct index_reader * inde
             {
                 r->f = temp_file;
                 r->index = index;
-                rc = make_SBuffer( &r->buf, 4096 );
+                rc = detect_lookup_fmt( r ); /* above */
+                if ( rc == 0 )
+                    rc = make_SBuffer( &r->buf, 4096 );
                 if ( rc == 0 )
                     *reader = r;
                 else
@@ -109,16 +144,49 @@ rc_t make_lookup_reader( const KDirectory *dir, const struct index_reader * inde
 }
 
 
+rc_t make_lookup_reader_from_store( const struct slab_store * store, struct lookup_reader ** reader )
+{
+    rc_t rc = 0;
+    if ( store == NULL || reader == NULL )
+    {
+        rc = RC( rcVDB, rcNoTarg, rcConstructing, rcParam, rcInvalid );
+        ErrMsg( "make_lookup_reader_from_store() -> %R", rc );
+    }
+    else
+    {
+        lookup_reader * r = calloc( 1, sizeof * r );
+        if ( r == NULL )
+        {
+            rc = RC( rcVDB, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+            ErrMsg( "make_lookup_reader_from_store.calloc( %d ) -> %R", ( sizeof * r ), rc );
+        }
+        else
+        {
+            /* for the in-memory table pos is the index of the next entry in the store */
+            r->store = store;
+            r->lf = slab_store_fmt( store ); /* slab_store.c */
+            rc = make_SBuffer( &r->buf, 4096 );
+            if ( rc == 0 )
+                *reader = r;
+            else
+                release_lookup_reader( r );
+        }
+    }
+    return rc;
+}
+
+
 static rc_t read_key_and_len( struct lookup_reader * reader, uint64_t pos, uint64_t *key, size_t *len )
 {
     size_t num_read;
-    char buffer[ 10 ];
-    rc_t rc = KFileRead( reader->f, pos, buffer, sizeof buffer, &num_read );
+    uint8_t buffer[ 12 ];
+    size_t to_read = record_header_size( reader );
+    rc_t rc = KFileRead( reader->f, pos, buffer, to_read, &num_read );
     if ( rc != 0 )
     {
-        ErrMsg( "read_key_and_len.KFileRead( at %ld, to_read %u ) -> %R", pos, sizeof buffer, rc );
+        ErrMsg( "read_key_and_len.KFileRead( at %ld, to_read %u ) -> %R", pos, to_read, rc );
     }
-    else if ( num_read != sizeof buffer )
+    else if ( num_read != to_read )
     {
         if ( num_read == 0 )
             rc = SILENT_RC( rcVDB, rcNoTarg, rcReading, rcId, rcNotFound );
@@ -127,14 +195,8 @@ static rc_t read_key_and_len( struct lookup_reader * reader, uint64_t pos, uint6
     }
     else
     {
-        uint16_t dna_len;
-        size_t packed_len;
         memmove( key, buffer, sizeof *key );
-        dna_len = buffer[ 8 ];
-        dna_len <<= 8;
-        dna_len |= buffer[ 9 ];
-        packed_len = ( dna_len & 1 ) ? ( dna_len + 1 ) >> 1 : dna_len >> 1;
-        *len = ( ( sizeof *key ) + ( sizeof dna_len ) + packed_len );
+        *len = ( sizeof *key ) + packed_size( reader->lf, &buffer[ 8 ] ); /* helper.c */
     }
     return rc;
 }
@@ -148,6 +210,7 @@ static bool keys_equal( uint64_t key1, uint64_t key2 )
     return res;
 }
 
+/* on return offset is the position of the first record with a key >= key_to_find */
 static rc_t loop_until_key_found( struct lookup_reader * reader, uint64_t key_to_find,
         uint64_t *key_found , uint64_t *offset )
 {
@@ -158,11 +221,10 @@ static rc_t loop_until_key_found( struct lookup_reader * reader, uint64_t key_to
     {
         size_t found_len;
         rc = read_key_and_len( reader, curr, key_found, &found_len );
-        if ( keys_equal( key_to_find, *key_found ) )
-        {
+        if ( rc != 0 )
+            done = true;
+        else if ( keys_equal( key_to_find, *key_found ) )
             done = true;
-            *offset = curr;
-        }
         else if ( key_to_find > *key_found )
             curr += found_len;
         else
@@ -171,6 +233,7 @@ static rc_t loop_until_key_found( struct lookup_reader * reader, uint64_t key_to
             rc = SILENT_RC( rcVDB, rcNoTarg, rcReading, rcId, rcNotFound );
         }
     }
+    *offset = curr;
     return rc;
 }
 
@@ -178,7 +241,7 @@ static rc_t loop_until_key_found( struct lookup_reader * reader, uint64_t key_to
 static rc_t full_table_seek( struct lookup_reader * reader, uint64_t key_to_find, uint64_t * key_found )
 {
     /* we have no index! search the whole thing... */
-    uint64_t offset = 0;
+    uint64_t offset = reader->data_start;
     rc_t rc = loop_until_key_found( reader, key_to_find, key_found, &offset );
     if ( rc == 0 )
     {
@@ -194,46 +257,46 @@ static rc_t full_table_seek( struct lookup_reader * reader, uint64_t key_to_find
 }
 
 
+/* -----------------------------------------------------------------------------------------
+    with an index the seek lands at most one index-stride in front of the key,
+    from there the records are scanned. If the key is not in the lookup-table ( for instance
+    the row is unaligned ) the reader is left at the next bigger key, that is where the join
+    continues anyway. No fallback to a full-table-seek is needed.
+   ----------------------------------------------------------------------------------------- */
 static rc_t indexed_seek( struct lookup_reader * reader, uint64_t key_to_find, uint64_t * key_found, bool exactly )
 {
-    /* we have a index! find set pos to the found offset */
     uint64_t offset = 0;
-    uint64_t max_key;
-    rc_t rc = get_max_key( reader->index, &max_key );
+    rc_t rc = get_nearest_offset( reader->index, key_to_find, key_found, &offset ); /* in index.c */
     if ( rc == 0 )
     {
-        if ( key_to_find > max_key )
-            rc = RC( rcVDB, rcNoTarg, rcReading, rcId, rcTooBig );
-        else
-        {
-            rc = get_nearest_offset( reader->index, key_to_find, key_found, &offset ); /* in index.c */
-            if ( rc == 0 )
-            {
-                if ( keys_equal( key_to_find, *key_found ) )
-                    reader->pos = offset;
-                else
-                {
-                    if ( exactly )
-                    {
-                        rc = loop_until_key_found( reader, key_to_find, key_found, &offset );
-                        if ( rc == 0 )
-                        {
-                            if ( keys_equal( key_to_find, *key_found ) )
-                                reader->pos = offset;
-                            else
-                                rc = RC( rcVDB, rcNoTarg, rcReading, rcId, rcNotFound );
-                        }
-                        else
-                            rc = RC( rcVDB, rcNoTarg, rcReading, rcId, rcNotFound );
-                    }
-                    else
-                    {
-                        reader->pos = offset;
-                        rc = RC( rcVDB, rcNoTarg, rcReading, rcId, rcNotFound );
-                    }
-                }
-            }
-        }
+        /* the first index-entry points to offset 0, that is the file-header in 2na */
+        if ( offset < reader->data_start )
+            offset = reader->data_start;
+        if ( !keys_equal( key_to_find, *key_found ) || offset == reader->data_start )
+            rc = loop_until_key_found( reader, key_to_find, key_found, &offset );
+        reader->pos = offset;
+        if ( rc == 0 && !keys_equal( key_to_find, *key_found ) )
+            rc = SILENT_RC( rcVDB, rcNoTarg, rcReading, rcId, rcNotFound );
+        if ( rc != 0 && exactly && GetRCState( rc ) != rcNotFound )
+            ErrMsg( "seek_lookup_reader( key: %ld ) -> %R", key_to_find, rc );
+    }
+    return rc;
+}
+
+
+static rc_t store_seek( struct lookup_reader * reader, uint64_t key_to_find, uint64_t * key_found, bool exactly )
+{
+    rc_t rc = 0;
+    String packed;
+    uint64_t idx = slab_store_lower_bound( reader->store, key_to_find ); /* slab_store.c */
+    reader->pos = idx;
+    if ( !slab_store_get( reader->store, idx, key_found, &packed ) )
+        rc = RC( rcVDB, rcNoTarg, rcReading, rcId, rcTooBig );
+    else if ( !keys_equal( key_to_find, *key_found ) )
+    {
+        rc = RC( rcVDB, rcNoTarg, rcReading, rcId, rcNotFound );
+        if ( exactly )
+            ErrMsg( "seek_lookup_reader( key: %ld ) -> %R", key_to_find, rc );
     }
     return rc;
 }
@@ -247,14 +310,12 @@ rc_t seek_lookup_reader( struct lookup_reader * reader, uint64_t key_to_find, ui
         rc = RC( rcVDB, rcNoTarg, rcReading, rcParam, rcInvalid );
         ErrMsg( "seek_lookup_reader() -> %R", rc );
     }
+    else if ( reader->store != NULL )
+        rc = store_seek( reader, key_to_find, key_found, exactly );
     else
     {
         if ( reader->index != NULL )
-        {
             rc = indexed_seek( reader, key_to_find, key_found, exactly );
-            if ( rc != 0 )
-                rc = full_table_seek( reader, key_to_find, key_found );
-        }
         else
             rc = full_table_seek( reader, key_to_find, key_found );
     }
@@ -271,47 +332,58 @@ rc_t get_packed_and_key_from_lookup_reader( struct lookup_reader * reader,
         rc = RC( rcVDB, rcNoTarg, rcReading, rcParam, rcInvalid );
         ErrMsg( "get_packed_and_key_from_lookup_reader() -> %R", rc );
     }
+    else if ( reader->store != NULL )
+    {
+        String packed;
+        if ( !slab_store_get( reader->store, reader->pos, key, &packed ) )
+            rc = SILENT_RC( rcVDB, rcNoTarg, rcReading, rcId, rcNotFound );
+        else
+        {
+            size_t to_copy = packed.size;
+            if ( to_copy > packed_bases->buffer_size )
+                to_copy = packed_bases->buffer_size;
+            memmove( ( char * )packed_bases->S.addr, packed.addr, to_copy );
+            packed_bases->S.len = packed_bases->S.size = to_copy;
+            reader->pos++;
+        }
+    }
     else
     {
         size_t num_read;
-        char buffer1[ 10 ];
-        rc = KFileRead( reader->f, reader->pos, buffer1, sizeof buffer1, &num_read );
+        uint8_t buffer1[ 12 ];
+        size_t hdr_size = record_header_size( reader );
+        rc = KFileRead( reader->f, reader->pos, buffer1, hdr_size, &num_read );
         if ( rc != 0 )
-            ErrMsg( "KFileRead( at %ld, to_read %u ) -> %R", reader->pos, sizeof buffer1, rc );
-        else if ( num_read != sizeof buffer1 )
+            ErrMsg( "KFileRead( at %ld, to_read %u ) -> %R", reader->pos, hdr_size, rc );
+        else if ( num_read != hdr_size )
             rc = SILENT_RC( rcVDB, rcNoTarg, rcReading, rcFormat, rcInvalid );
         else
         {
-            uint16_t dna_len;
-            size_t to_read;
+            /* DNA-LEN ( and N-RUNS ) are copied into packed_bases too */
+            size_t len_size = hdr_size - ( sizeof *key );
+            size_t rec_size = packed_size( reader->lf, &buffer1[ 8 ] ); /* helper.c */
+            size_t to_read = rec_size - len_size;
             char * dst = ( char * )packed_bases->S.addr;
-            
+
             memmove( key, buffer1, sizeof *key );
+            memmove( dst, &buffer1[ 8 ], len_size );
+            dst += len_size;
+            if ( to_read > ( packed_bases->buffer_size - len_size ) )
+                to_read = ( packed_bases->buffer_size - len_size );
 
-            dna_len = buffer1[ 8 ];
-            dna_len <<= 8;
-            dna_len |= buffer1[ 9 ];
-            dst[ 0 ] = buffer1[ 8 ];
-            dst[ 1 ] = buffer1[ 9 ];
-            dst += 2;
-            to_read = ( dna_len & 1 ) ? ( dna_len + 1 ) >> 1 : dna_len >> 1;
-            if ( to_read > ( packed_bases->buffer_size - 2 ) )
-                to_read = ( packed_bases->buffer_size - 2 );
-            if ( rc == 0 )
+            rc = KFileRead( reader->f, reader->pos + hdr_size, dst, to_read, &num_read );
+            if ( rc != 0 )
+                ErrMsg( "KFileRead( at %ld, to_read %u ) -> %R", reader->pos + hdr_size, to_read, rc );
+            else if ( num_read != to_read )
             {
-                rc = KFileRead( reader->f, reader->pos + 10, dst, to_read, &num_read );
-                if ( rc != 0 )
-                    ErrMsg( "KFileRead( at %ld, to_read %u ) -> %R", reader->pos + 10, to_read, rc );
-                else if ( num_read != to_read )
-                {
-                    rc = RC( rcVDB, rcNoTarg, rcReading, rcFormat, rcInvalid );
-                    ErrMsg( "KFileRead( %ld ) %d vs %d -> %R", reader->pos + 10, num_read, to_read, rc );
-                }
-                else
-                {
-                    packed_bases->S.len = packed_bases->S.size = num_read + 2;
-                    reader->pos += ( num_read + 10 );
-                }
+                rc = RC( rcVDB, rcNoTarg, rcReading, rcFormat, rcInvalid );
+                ErrMsg( "KFileRead( %ld ) %d vs %d -> %R", reader->pos + hdr_size, num_read, to_read, rc );
+            }
+            else
+            {
+                packed_bases->S.len = packed_bases->S.size = num_read + len_size;
+                /* skip the whole record, even if it did not fit into packed_bases */
+                reader->pos += ( ( sizeof *key ) + rec_size );
             }
         }
     }
@@ -332,12 +404,44 @@ rc_t get_packed_from_lookup_reader( struct lookup_reader * reader,
 }
 
 
+/* the in-memory table can be unpacked in place, without copying the packed record first */
+static rc_t get_bases_from_store( struct lookup_reader * reader,
+                        int64_t * seq_spot_id, uint32_t * seq_read_id, SBuffer * bases )
+{
+    rc_t rc = 0;
+    uint64_t key;
+    String packed;
+    if ( !slab_store_get( reader->store, reader->pos, &key, &packed ) )
+        rc = SILENT_RC( rcVDB, rcNoTarg, rcReading, rcId, rcNotFound );
+    else
+    {
+        *seq_spot_id = key >> 1;
+        *seq_read_id = key & 1 ? 2 : 1;
+        if ( reader->lf == lft_2na )
+            unpack_2na( &packed, bases );
+        else
+            unpack_4na( &packed, bases );
+        reader->pos++;
+    }
+    return rc;
+}
+
+
 rc_t get_bases_from_lookup_reader( struct lookup_reader * reader,
                         int64_t * seq_spot_id, uint32_t * seq_read_id, SBuffer * bases )
 {
-    rc_t rc = get_packed_from_lookup_reader( reader, seq_spot_id, seq_read_id, &reader->buf );
+    rc_t rc;
+    if ( reader != NULL && reader->store != NULL )
+        return get_bases_from_store( reader, seq_spot_id, seq_read_id, bases );
+
+    rc = get_packed_from_lookup_reader( reader, seq_spot_id, seq_read_id, &reader->buf );
     if ( rc == 0 )
-        unpack_4na( &reader->buf.S, bases );
+    {
+        if ( reader->lf == lft_2na )
+            unpack_2na( &reader->buf.S, bases );
+        else
+            unpack_4na( &reader->buf.S, bases );
+    }
     return rc;
 }
 
@@ -55,6 +55,11 @@ void release_lookup_reader( struct lookup_reader * reader );
 rc_t make_lookup_reader( const KDirectory *dir, const struct index_reader * index,
                          struct lookup_reader ** reader, size_t buf_size, const char * fmt, ... );
 
+struct slab_store;
+
+/* reads from a sorted slab_store instead of a lookup-file ( fastdump --inmem ) */
+rc_t make_lookup_reader_from_store( const struct slab_store * store, struct lookup_reader ** reader );
+
 rc_t seek_lookup_reader( struct lookup_reader * reader, uint64_t key, uint64_t * key_found, bool exactly );
 
 rc_t get_packed_and_key_from_lookup_reader( struct lookup_reader * reader,
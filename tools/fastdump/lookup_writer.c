@@ -36,6 +36,7 @@ typedef struct lookup_writer
     struct index_writer * idx;
     SBuffer buf;
     uint64_t pos;
+    lookup_fmt_t lf;
 } lookup_writer;
 
 
@@ -50,9 +51,31 @@ void release_lookup_writer( struct lookup_writer * writer )
 }
 
 
+static rc_t write_lookup_header( struct lookup_writer * writer )
+{
+    rc_t rc = 0;
+    if ( writer->lf == lft_2na )
+    {
+        uint64_t magic = LOOKUP_2NA_MAGIC;
+        size_t num_writ;
+        rc = KFileWrite( writer->f, writer->pos, &magic, sizeof magic, &num_writ );
+        if ( rc != 0 )
+            ErrMsg( "KFileWrite( magic ) -> %R", rc );
+        else if ( num_writ != sizeof magic )
+        {
+            rc = RC( rcVDB, rcNoTarg, rcWriting, rcFormat, rcInvalid );
+            ErrMsg( "KFileWrite( magic ) -> %R", rc );
+        }
+        else
+            writer->pos += num_writ;
+    }
+    return rc;
+}
+
+
 rc_t make_lookup_writer( KDirectory *dir, struct index_writer * idx,
                          struct lookup_writer ** writer, size_t buf_size,
-                         const char * fmt, ... )
+                         lookup_fmt_t lf, const char * fmt, ... )
 {
     rc_t rc;
     struct KFile * f;
@@ -83,7 +106,10 @@ rc_t make_lookup_writer( KDirectory *dir, struct index_writer * idx,
             {
                 w->f = temp_file;
                 w->idx = idx;
-                rc = make_SBuffer( &w->buf, 4096 );
+                w->lf = lf;
+                rc = write_lookup_header( w ); /* above */
+                if ( rc == 0 )
+                    rc = make_SBuffer( &w->buf, 4096 );
                 if ( rc == 0 )
                     *writer = w;
                 else
@@ -99,7 +125,10 @@ rc_t make_lookup_writer( KDirectory *dir, struct index_writer * idx,
 rc_t write_unpacked_to_lookup_writer( struct lookup_writer * writer,
             int64_t seq_spot_id, uint32_t seq_read_id, const String * bases_as_unpacked_4na )
 {
-    pack_4na( bases_as_unpacked_4na, &writer->buf );
+    if ( writer->lf == lft_2na )
+        pack_2na( bases_as_unpacked_4na, &writer->buf );
+    else
+        pack_4na( bases_as_unpacked_4na, &writer->buf );
     return write_packed_to_lookup_writer( writer, make_key( seq_spot_id, seq_read_id ), &writer->buf.S );
 }
 
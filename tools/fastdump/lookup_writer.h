@@ -47,12 +47,16 @@ extern "C" {
 #include "index.h"
 #endif
 
+#ifndef _h_helper_
+#include "helper.h"
+#endif
+
 struct lookup_writer;
 
 void release_lookup_writer( struct lookup_writer * writer );
 
 rc_t make_lookup_writer( KDirectory *dir, struct index_writer * idx, struct lookup_writer ** writer,
-                         size_t buf_size, const char * fmt, ... );
+                         size_t buf_size, lookup_fmt_t lf, const char * fmt, ... );
 
 rc_t write_unpacked_to_lookup_writer( struct lookup_writer * writer,
             int64_t seq_spot_id, uint32_t seq_read_id, const String * bases_as_unpacked_4na );
@@ -27,8 +27,11 @@
 #include "lookup_reader.h"
 #include "lookup_writer.h"
 #include "index.h"
+#include "telemetry.h"
 #include "helper.h"
 
+#include <klib/time.h>
+
 typedef struct merge_src
 {
     struct lookup_reader * reader;
@@ -42,8 +45,11 @@ typedef struct merge_sorter
 {
     const merge_sorter_params * params;
     merge_src * src_list;
+    merge_src ** heap;          /* min-heap of the sources that still have data, ordered by key */
+    uint32_t heap_count;
     struct lookup_writer * dst;
     struct index_writer * idx;
+    uint64_t records, bytes;
 } merge_sorter;
 
 
@@ -64,6 +70,8 @@ void release_merge_sorter( struct merge_sorter *ms )
             }
             free( ( void * ) ms->src_list );
         }
+        if ( ms->heap != NULL )
+            free( ( void * ) ms->heap );
 
         free( ( void * ) ms );
     }
@@ -83,12 +91,13 @@ rc_t make_merge_sorter( struct merge_sorter ** ms, const merge_sorter_params * p
     {
         if ( params->index_filename != NULL )
             rc = make_index_writer( params->dir, &m->idx, params->buf_size,
-                        20000, "%s", params->index_filename );
+                        params->index_stride > 0 ? params->index_stride : DFLT_INDEX_STRIDE,
+                        "%s", params->index_filename );
 
         if ( rc == 0 )
         {
             rc = make_lookup_writer( params->dir, m->idx, &m->dst, params->buf_size,
-                        "%s", params->output_filename );
+                        params->lookup_fmt, "%s", params->output_filename );
             if ( rc == 0 )
             {
                 m->src_list = calloc( params->count, sizeof * m->src_list );
@@ -100,7 +109,14 @@ rc_t make_merge_sorter( struct merge_sorter ** ms, const merge_sorter_params * p
                 else
                 {
                     m->params = params;
-                    *ms = m;
+                    m->heap = calloc( params->count, sizeof * m->heap );
+                    if ( m->heap == NULL )
+                    {
+                        rc = RC( rcVDB, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+                        ErrMsg( "calloc( %d ) -> %R", ( ( sizeof * m->heap ) * params->count ), rc );
+                    }
+                    else
+                        *ms = m;
                 }
             }
         }
@@ -134,40 +150,93 @@ rc_t add_merge_sorter_src( struct merge_sorter *ms, const char * filename, uint3
 }
 
 
-static merge_src * get_min_merge_src( merge_src * src, uint32_t count )
+/* ------------------------------------------------------------------------------------------
+    the sources are kept in a binary min-heap ( by key ),
+    picking the next record costs O( log N ) instead of a scan over all N sources
+   ------------------------------------------------------------------------------------------ */
+static void heap_sift_up( merge_src ** heap, uint32_t idx )
+{
+    merge_src * item = heap[ idx ];
+    while ( idx > 0 )
+    {
+        uint32_t parent = ( idx - 1 ) >> 1;
+        if ( heap[ parent ]->key <= item->key )
+            break;
+        heap[ idx ] = heap[ parent ];
+        idx = parent;
+    }
+    heap[ idx ] = item;
+}
+
+
+static void heap_sift_down( merge_src ** heap, uint32_t count, uint32_t idx )
+{
+    merge_src * item = heap[ idx ];
+    uint32_t child = ( idx << 1 ) + 1;
+    while ( child < count )
+    {
+        if ( child + 1 < count && heap[ child + 1 ]->key < heap[ child ]->key )
+            child++;
+        if ( item->key <= heap[ child ]->key )
+            break;
+        heap[ idx ] = heap[ child ];
+        idx = child;
+        child = ( idx << 1 ) + 1;
+    }
+    heap[ idx ] = item;
+}
+
+
+static void build_heap( struct merge_sorter *ms )
 {
-    merge_src * res = NULL;
     uint32_t i;
-    for ( i = 0; i < count; ++i )
+    ms->heap_count = 0;
+    for ( i = 0; i < ms->params->count; ++i )
     {
-        merge_src * item = &src[ i ];
-        if ( item->rc == 0 )
+        merge_src * item = &ms->src_list[ i ];
+        if ( item->reader != NULL && item->rc == 0 )
         {
-            if ( res == NULL )
-                res = item;
-            else if ( item->key < res->key )
-                res = item;
+            ms->heap[ ms->heap_count ] = item;
+            heap_sift_up( ms->heap, ms->heap_count++ );
         }
     }
-    return res;
-} 
+}
+
 
 rc_t CC Quitting();
 
 rc_t run_merge_sorter( struct merge_sorter *ms )
 {
     rc_t rc = 0;
-    merge_src * to_write = get_min_merge_src( ms->src_list, ms->params->count );
-    while( rc == 0 && to_write != NULL )
+    telemetry_tick tick;
+
+    telemetry_tick_init( &tick, "merge", ms->params->thread_id ); /* telemetry.c */
+    build_heap( ms );
+    while( rc == 0 && ms->heap_count > 0 )
     {
         rc = Quitting();
         if ( rc == 0 )
         {
+            merge_src * to_write = ms->heap[ 0 ];
             rc = write_packed_to_lookup_writer( ms->dst, to_write->key, &to_write->packed_bases.S );
             if ( rc == 0 )
+            {
+                ms->records++;
+                ms->bytes += ( ( sizeof to_write->key ) + to_write->packed_bases.S.size );
+                telemetry_progress( ms->params->telemetry, &tick, ms->records, ms->bytes ); /* telemetry.c */
                 to_write->rc = get_packed_and_key_from_lookup_reader( to_write->reader, &to_write->key, &to_write->packed_bases );
-            to_write = get_min_merge_src( ms->src_list, ms->params->count );
+                if ( to_write->rc != 0 )
+                {
+                    /* this source is exhausted, replace it with the last one in the heap */
+                    ms->heap[ 0 ] = ms->heap[ --ms->heap_count ];
+                }
+                if ( ms->heap_count > 0 )
+                    heap_sift_down( ms->heap, ms->heap_count, 0 );
+            }
         }
     }
+    if ( rc == 0 )
+        telemetry_stage( ms->params->telemetry, "merge", ms->params->thread_id,
+                         ms->records, ms->bytes, tick.start ); /* telemetry.c */
     return rc;
 }
@@ -39,6 +39,10 @@ extern "C" {
 #include <kfs/directory.h>
 #endif
 
+#ifndef _h_helper_
+#include "helper.h"
+#endif
+
 struct merge_sorter;
 
 typedef struct merge_sorter_params
@@ -48,8 +52,16 @@ typedef struct merge_sorter_params
     const char * index_filename;
     uint32_t count;
     size_t buf_size;
+    uint64_t index_stride;
+    lookup_fmt_t lookup_fmt;
+    struct telemetry * telemetry;   /* reports records and bytes merged, can be NULL */
+    uint32_t thread_id;             /* of the worker that merges, for the telemetry */
 } merge_sorter_params;
 
+/* how many sources one merge-sorter reads from at the same time,
+   more sub-files than that are merged in multiple levels */
+#define MAX_MERGE_FANIN 32
+
 
 rc_t make_merge_sorter( struct merge_sorter ** ms, const merge_sorter_params * params );
 
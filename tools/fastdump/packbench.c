@@ -0,0 +1,126 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+/* --------------------------------------------------------------------------------------------
+    measures the 4na pack/unpack-kernels of simd_4na.c for all simd-levels the cpu supports
+    and read-lengths from 36 to 30000 bases:
+
+    packbench [ megabases ]    ... how many bases each kernel packs/unpacks per length ( default=256 )
+-------------------------------------------------------------------------------------------- */
+
+#include <kapp/args.h>
+#include <kapp/main.h>
+#include <klib/log.h>
+#include <klib/rc.h>
+#include <klib/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "simd_4na.h"
+
+static const size_t read_lengths[] = { 36, 50, 75, 100, 101, 150, 151, 250, 300, 1000, 5000, 30000 };
+#define NUM_LENGTHS ( sizeof read_lengths / sizeof read_lengths[ 0 ] )
+#define MAX_LEN 30000
+
+static double mb_per_sec( uint64_t bases, KTimeMs_t start )
+{
+    KTimeMs_t elapsed = KTimeMsStamp() - start;
+    return bases / ( ( elapsed > 0 ? elapsed : 1 ) / 1000.0 ) / ( 1024 * 1024 );
+}
+
+static void bench_level( simd_level level, const uint8_t * bases, uint8_t * packed, char * ascii,
+                         uint64_t total )
+{
+    size_t i;
+    for ( i = 0; i < NUM_LENGTHS; ++i )
+    {
+        size_t n_packed = read_lengths[ i ] >> 1;
+        uint64_t done;
+        KTimeMs_t start;
+        double pack, unpack;
+
+        start = KTimeMsStamp();
+        for ( done = 0; done < total; done += 2 * n_packed )
+            pack_4na_bytes( level, bases, packed, n_packed );
+        pack = mb_per_sec( done, start );
+
+        start = KTimeMsStamp();
+        for ( done = 0; done < total; done += 2 * n_packed )
+            unpack_4na_bytes( level, packed, ascii, n_packed );
+        unpack = mb_per_sec( done, start );
+
+        printf( "%-6s len=%5u  pack %8.1f MB/s  unpack %8.1f MB/s\n",
+                simd_level_name( level ), ( unsigned )read_lengths[ i ], pack, unpack );
+    }
+}
+
+static rc_t packbench( uint64_t total )
+{
+    static const uint8_t codes[] = { 1, 2, 4, 8, 15, 0, 1, 2, 4, 8, 1, 2, 4, 8, 3, 5 };
+    uint8_t * bases = malloc( MAX_LEN );
+    uint8_t * packed = malloc( MAX_LEN );
+    char * ascii = malloc( MAX_LEN );
+    int level;
+    size_t i;
+
+    if ( bases == NULL || packed == NULL || ascii == NULL )
+    {
+        rc_t rc = RC( rcExe, rcBuffer, rcAllocating, rcMemory, rcExhausted );
+        free( bases ); free( packed ); free( ascii );
+        LOGERR( klogErr, rc, "out of memory" );
+        return rc;
+    }
+    srand( 4711 );
+    for ( i = 0; i < MAX_LEN; ++i )
+        bases[ i ] = codes[ rand() & 0x0F ];
+
+    printf( "cpu supports: %s, %llu bases per length\n",
+            simd_level_name( get_simd_level() ), ( unsigned long long )total );
+    for ( level = simd_scalar; level <= ( int )get_simd_level(); ++level )
+        bench_level( ( simd_level )level, bases, packed, ascii, total );
+
+    free( bases );
+    free( packed );
+    free( ascii );
+    return 0;
+}
+
+rc_t CC UsageSummary( const char * progname )
+{
+    return 0;
+}
+
+rc_t CC Usage( const Args * args )
+{
+    return 0;
+}
+
+rc_t CC KMain( int argc, char *argv [] )
+{
+    uint64_t megabases = ( argc > 1 ) ? strtoul( argv[ 1 ], NULL, 0 ) : 0;
+    return packbench( ( megabases > 0 ? megabases : 256 ) * 1000000 );
+}
@@ -0,0 +1,250 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "simd_4na.h"
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+static const char x4na_to_ASCII[ 16 ] =
+{
+    /* 0x00 0x01 0x02 0x03 0x04 0x05 0x06 0x07 0x08 0x09 0x0A 0x0B 0x0C 0x0D 0x0E 0x0F */
+       'N', 'A', 'C', 'N', 'G', 'N', 'N', 'N', 'T', 'N', 'N', 'N', 'N', 'N', 'N', 'N'
+};
+
+
+static void pack_4na_scalar( const uint8_t * src, uint8_t * dst, size_t n_packed )
+{
+    size_t i;
+    for ( i = 0; i < n_packed; ++i )
+        dst[ i ] = ( uint8_t )( ( ( src[ 2 * i ] & 0x0F ) << 4 ) | ( src[ 2 * i + 1 ] & 0x0F ) );
+}
+
+
+static void unpack_4na_scalar( const uint8_t * src, char * dst, size_t n_packed )
+{
+    size_t i;
+    for ( i = 0; i < n_packed; ++i )
+    {
+        dst[ 2 * i ]     = x4na_to_ASCII[ ( src[ i ] >> 4 ) & 0x0F ];
+        dst[ 2 * i + 1 ] = x4na_to_ASCII[ src[ i ] & 0x0F ];
+    }
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+/* --------------------------------------------------------------------------------------------
+    SSE2: 32 bases -> 16 packed bytes per iteration
+    every 16-bit lane holds 2 bases: the 1st one in the low byte, the 2nd one in the high byte
+-------------------------------------------------------------------------------------------- */
+__attribute__( ( target( "sse2" ) ) )
+static __m128i pack_lanes_sse2( __m128i v )
+{
+    const __m128i nibbles = _mm_set1_epi8( 0x0F );
+    const __m128i low_byte = _mm_set1_epi16( 0x00FF );
+    __m128i m = _mm_and_si128( v, nibbles );
+    __m128i first = _mm_slli_epi16( _mm_and_si128( m, low_byte ), 4 );
+    __m128i second = _mm_srli_epi16( m, 8 );
+    return _mm_or_si128( first, second );
+}
+
+__attribute__( ( target( "sse2" ) ) )
+static size_t pack_4na_sse2( const uint8_t * src, uint8_t * dst, size_t n_packed )
+{
+    size_t i = 0;
+    for ( ; i + 16 <= n_packed; i += 16 )
+    {
+        __m128i a = _mm_loadu_si128( ( const __m128i * )( src + 2 * i ) );
+        __m128i b = _mm_loadu_si128( ( const __m128i * )( src + 2 * i + 16 ) );
+        __m128i r = _mm_packus_epi16( pack_lanes_sse2( a ), pack_lanes_sse2( b ) );
+        _mm_storeu_si128( ( __m128i * )( dst + i ), r );
+    }
+    return i;
+}
+
+/* SSE2 has no byte-shuffle, the 5 valid 4na-codes are selected by compare */
+__attribute__( ( target( "sse2" ) ) )
+static __m128i select_base_sse2( __m128i codes, __m128i res, int code, char base )
+{
+    __m128i m = _mm_cmpeq_epi8( codes, _mm_set1_epi8( ( char )code ) );
+    return _mm_or_si128( _mm_and_si128( m, _mm_set1_epi8( base ) ), _mm_andnot_si128( m, res ) );
+}
+
+__attribute__( ( target( "sse2" ) ) )
+static __m128i to_ascii_sse2( __m128i codes )
+{
+    __m128i res = _mm_set1_epi8( 'N' );
+    res = select_base_sse2( codes, res, 1, 'A' );
+    res = select_base_sse2( codes, res, 2, 'C' );
+    res = select_base_sse2( codes, res, 4, 'G' );
+    res = select_base_sse2( codes, res, 8, 'T' );
+    return res;
+}
+
+__attribute__( ( target( "sse2" ) ) )
+static size_t unpack_4na_sse2( const uint8_t * src, char * dst, size_t n_packed )
+{
+    const __m128i nibbles = _mm_set1_epi8( 0x0F );
+    size_t i = 0;
+    for ( ; i + 16 <= n_packed; i += 16 )
+    {
+        __m128i p = _mm_loadu_si128( ( const __m128i * )( src + i ) );
+        __m128i hi = _mm_and_si128( _mm_srli_epi16( p, 4 ), nibbles );
+        __m128i lo = _mm_and_si128( p, nibbles );
+        _mm_storeu_si128( ( __m128i * )( dst + 2 * i ), to_ascii_sse2( _mm_unpacklo_epi8( hi, lo ) ) );
+        _mm_storeu_si128( ( __m128i * )( dst + 2 * i + 16 ), to_ascii_sse2( _mm_unpackhi_epi8( hi, lo ) ) );
+    }
+    return i;
+}
+
+/* --------------------------------------------------------------------------------------------
+    AVX2: 64 bases -> 32 packed bytes / 32 packed bytes -> 64 ASCII-bases per iteration
+    the pack/unpack-instructions work per 128-bit lane, the lanes have to be reordered
+-------------------------------------------------------------------------------------------- */
+__attribute__( ( target( "avx2" ) ) )
+static __m256i pack_lanes_avx2( __m256i v )
+{
+    const __m256i nibbles = _mm256_set1_epi8( 0x0F );
+    const __m256i low_byte = _mm256_set1_epi16( 0x00FF );
+    __m256i m = _mm256_and_si256( v, nibbles );
+    __m256i first = _mm256_slli_epi16( _mm256_and_si256( m, low_byte ), 4 );
+    __m256i second = _mm256_srli_epi16( m, 8 );
+    return _mm256_or_si256( first, second );
+}
+
+__attribute__( ( target( "avx2" ) ) )
+static size_t pack_4na_avx2( const uint8_t * src, uint8_t * dst, size_t n_packed )
+{
+    size_t i = 0;
+    for ( ; i + 32 <= n_packed; i += 32 )
+    {
+        __m256i a = _mm256_loadu_si256( ( const __m256i * )( src + 2 * i ) );
+        __m256i b = _mm256_loadu_si256( ( const __m256i * )( src + 2 * i + 32 ) );
+        __m256i r = _mm256_packus_epi16( pack_lanes_avx2( a ), pack_lanes_avx2( b ) );
+        /* packus interleaves the lanes of a and b: a0 b0 a1 b1 -> a0 a1 b0 b1 */
+        r = _mm256_permute4x64_epi64( r, 0xD8 );
+        _mm256_storeu_si256( ( __m256i * )( dst + i ), r );
+    }
+    return i;
+}
+
+__attribute__( ( target( "avx2" ) ) )
+static size_t unpack_4na_avx2( const uint8_t * src, char * dst, size_t n_packed )
+{
+    const __m256i nibbles = _mm256_set1_epi8( 0x0F );
+    const __m256i table = _mm256_broadcastsi128_si256(
+                            _mm_loadu_si128( ( const __m128i * )x4na_to_ASCII ) );
+    size_t i = 0;
+    for ( ; i + 32 <= n_packed; i += 32 )
+    {
+        __m256i p = _mm256_loadu_si256( ( const __m256i * )( src + i ) );
+        __m256i hi = _mm256_and_si256( _mm256_srli_epi16( p, 4 ), nibbles );
+        __m256i lo = _mm256_and_si256( p, nibbles );
+        __m256i u0 = _mm256_unpacklo_epi8( hi, lo );   /* bytes 0..7  | 16..23 */
+        __m256i u1 = _mm256_unpackhi_epi8( hi, lo );   /* bytes 8..15 | 24..31 */
+        __m256i r0 = _mm256_permute2x128_si256( u0, u1, 0x20 );
+        __m256i r1 = _mm256_permute2x128_si256( u0, u1, 0x31 );
+        _mm256_storeu_si256( ( __m256i * )( dst + 2 * i ), _mm256_shuffle_epi8( table, r0 ) );
+        _mm256_storeu_si256( ( __m256i * )( dst + 2 * i + 32 ), _mm256_shuffle_epi8( table, r1 ) );
+    }
+    return i;
+}
+
+static simd_level detect_simd_level( void )
+{
+    simd_level res = simd_scalar;
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "avx2" ) )
+        res = simd_avx2;
+    else if ( __builtin_cpu_supports( "sse2" ) )
+        res = simd_sse2;
+    return res;
+}
+
+#else
+
+static simd_level detect_simd_level( void )
+{
+    return simd_scalar;
+}
+
+#endif
+
+
+simd_level get_simd_level( void )
+{
+    /* racing threads all detect the same value, no lock needed */
+    static int level = -1;
+    if ( level < 0 )
+        level = detect_simd_level();
+    return ( simd_level )level;
+}
+
+
+const char * simd_level_name( simd_level level )
+{
+    switch ( level )
+    {
+        case simd_sse2 : return "sse2";
+        case simd_avx2 : return "avx2";
+        default : return "scalar";
+    }
+}
+
+
+void pack_4na_bytes( simd_level level, const uint8_t * src, uint8_t * dst, size_t n_packed )
+{
+    size_t done = 0;
+#ifdef HAVE_X86_KERNELS
+    switch ( level )
+    {
+        case simd_avx2 : done = pack_4na_avx2( src, dst, n_packed );
+                         /* fall through: the sse2-kernel takes the next 16 bytes */
+        case simd_sse2 : done += pack_4na_sse2( src + 2 * done, dst + done, n_packed - done ); break;
+        default : break;
+    }
+#endif
+    pack_4na_scalar( src + 2 * done, dst + done, n_packed - done );
+}
+
+
+void unpack_4na_bytes( simd_level level, const uint8_t * src, char * dst, size_t n_packed )
+{
+    size_t done = 0;
+#ifdef HAVE_X86_KERNELS
+    switch ( level )
+    {
+        case simd_avx2 : done = unpack_4na_avx2( src, dst, n_packed );
+                         /* fall through: the sse2-kernel takes the next 16 bytes */
+        case simd_sse2 : done += unpack_4na_sse2( src + done, dst + 2 * done, n_packed - done ); break;
+        default : break;
+    }
+#endif
+    unpack_4na_scalar( src + done, dst + 2 * done, n_packed - done );
+}
@@ -0,0 +1,62 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_simd_4na_
+#define _h_simd_4na_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* --------------------------------------------------------------------------------------------
+    kernels to pack 4na ( 1 base per byte ) into packed 4na ( 2 bases per byte )
+    and to unpack packed 4na into ASCII, used by pack_4na() and unpack_4na() in helper.c
+
+    the kernels only handle whole bytes of packed 4na, the 16-bit length-header and
+    an odd last base are handled by the caller.
+-------------------------------------------------------------------------------------------- */
+
+typedef enum simd_level { simd_scalar = 0, simd_sse2, simd_avx2 } simd_level;
+
+/* the best level the cpu supports, detected once */
+simd_level get_simd_level( void );
+
+const char * simd_level_name( simd_level level );
+
+/* dst[ i ] = ( src[ 2 * i ] << 4 ) | src[ 2 * i + 1 ] for i in 0 ... n_packed - 1 */
+void pack_4na_bytes( simd_level level, const uint8_t * src, uint8_t * dst, size_t n_packed );
+
+/* writes 2 * n_packed ASCII-bases into dst */
+void unpack_4na_bytes( simd_level level, const uint8_t * src, char * dst, size_t n_packed );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,432 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "slab_store.h"
+#include "helper.h"
+
+#include <klib/sort.h>
+
+#include <string.h>
+
+/* DNA-LEN + N-RUNS + the longest possible read as 4na */
+#define MAX_2NA_RECORD ( 4 + ( 0x10000 >> 1 ) )
+
+typedef struct slab_entry
+{
+    uint64_t key;
+    const char * rec;
+} slab_entry;
+
+
+typedef struct slab_store
+{
+    char ** slabs;
+    slab_entry * entries;
+    SBuffer scratch;
+    lookup_fmt_t lf;
+    size_t slab_size, used_in_curr;
+    uint32_t slab_count, slab_capacity, curr_slab;
+    uint64_t entry_count, entry_capacity;
+} slab_store;
+
+
+void release_slab_store( struct slab_store * store )
+{
+    if ( store != NULL )
+    {
+        if ( store->slabs != NULL )
+        {
+            uint32_t i;
+            for ( i = 0; i < store->slab_count; ++i )
+                free( ( void * ) store->slabs[ i ] );
+            free( ( void * ) store->slabs );
+        }
+        if ( store->entries != NULL )
+            free( ( void * ) store->entries );
+        release_SBuffer( &store->scratch );
+        free( ( void * ) store );
+    }
+}
+
+
+rc_t make_slab_store( struct slab_store ** store, size_t slab_size, lookup_fmt_t lf )
+{
+    rc_t rc = 0;
+    slab_store * s = calloc( 1, sizeof * s );
+    if ( s == NULL )
+    {
+        rc = RC( rcVDB, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+        ErrMsg( "calloc( %d ) -> %R", ( sizeof * s ), rc );
+    }
+    else
+    {
+        s->slab_size = slab_size;
+        s->lf = lf;
+        if ( lf == lft_2na )
+            rc = make_SBuffer( &s->scratch, MAX_2NA_RECORD ); /* helper.c */
+        if ( rc == 0 )
+            *store = s;
+        else
+            release_slab_store( s );
+    }
+    return rc;
+}
+
+
+/* makes room for one more slab, either by reusing an already allocated one or by a new one */
+static rc_t next_slab( slab_store * store )
+{
+    rc_t rc = 0;
+    uint32_t next = ( store->slab_count == 0 ) ? 0 : store->curr_slab + 1;
+    if ( next >= store->slab_count )
+    {
+        char * slab;
+        if ( store->slab_count >= store->slab_capacity )
+        {
+            uint32_t new_capacity = ( store->slab_capacity == 0 ) ? 16 : store->slab_capacity * 2;
+            char ** tmp = realloc( store->slabs, new_capacity * ( sizeof * tmp ) );
+            if ( tmp == NULL )
+            {
+                rc = RC( rcVDB, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+                ErrMsg( "realloc( %d ) -> %R", new_capacity * ( sizeof * tmp ), rc );
+            }
+            else
+            {
+                store->slabs = tmp;
+                store->slab_capacity = new_capacity;
+            }
+        }
+        if ( rc == 0 )
+        {
+            slab = malloc( store->slab_size );
+            if ( slab == NULL )
+            {
+                rc = RC( rcVDB, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+                ErrMsg( "malloc( %d ) -> %R", store->slab_size, rc );
+            }
+            else
+                store->slabs[ store->slab_count++ ] = slab;
+        }
+    }
+    if ( rc == 0 )
+    {
+        store->curr_slab = next;
+        store->used_in_curr = 0;
+    }
+    return rc;
+}
+
+
+static rc_t grow_entries( slab_store * store, uint64_t new_capacity )
+{
+    rc_t rc = 0;
+    slab_entry * tmp = realloc( store->entries, new_capacity * ( sizeof * tmp ) );
+    if ( tmp == NULL )
+    {
+        rc = RC( rcVDB, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+        ErrMsg( "realloc( %lu ) -> %R", new_capacity * ( sizeof * tmp ), rc );
+    }
+    else
+    {
+        store->entries = tmp;
+        store->entry_capacity = new_capacity;
+    }
+    return rc;
+}
+
+
+static rc_t add_entry( slab_store * store, uint64_t key, const char * rec )
+{
+    rc_t rc = 0;
+    if ( store->entry_count >= store->entry_capacity )
+        rc = grow_entries( store, ( store->entry_capacity == 0 ) ? 4096 : store->entry_capacity * 2 );
+    if ( rc == 0 )
+    {
+        slab_entry * e = &store->entries[ store->entry_count++ ];
+        e->key = key;
+        e->rec = rec;
+    }
+    return rc;
+}
+
+
+/* reserves rec_size bytes in the current slab, starts a new slab if needed */
+static char * reserve_rec( slab_store * store, size_t rec_size, rc_t * rc )
+{
+    char * res = NULL;
+    if ( rec_size > store->slab_size )
+    {
+        *rc = RC( rcVDB, rcNoTarg, rcInserting, rcParam, rcInvalid );
+        ErrMsg( "slab_store_add( %d bytes ) -> %R", rec_size, *rc );
+    }
+    else
+    {
+        *rc = 0;
+        if ( store->slab_count == 0 || store->used_in_curr + rec_size > store->slab_size )
+            *rc = next_slab( store );
+        if ( *rc == 0 )
+            res = store->slabs[ store->curr_slab ] + store->used_in_curr;
+    }
+    return res;
+}
+
+
+rc_t slab_store_add( struct slab_store * store, uint64_t key, const String * unpacked )
+{
+    rc_t rc = 0;
+    if ( store == NULL )
+    {
+        rc = RC( rcVDB, rcNoTarg, rcInserting, rcParam, rcInvalid );
+        ErrMsg( "slab_store_add() -> %R", rc );
+    }
+    else if ( store->lf == lft_2na )
+    {
+        /* the size of a 2na-record is only known after packing it */
+        char * rec;
+        pack_2na( unpacked, &store->scratch );     /* helper.c */
+        rec = reserve_rec( store, store->scratch.S.size, &rc );
+        if ( rc == 0 )
+        {
+            memmove( rec, store->scratch.S.addr, store->scratch.S.size );
+            rc = add_entry( store, key, rec );
+            if ( rc == 0 )
+                store->used_in_curr += store->scratch.S.size;
+        }
+    }
+    else
+    {
+        uint16_t dna_len = ( unpacked->len & 0xFFFF );
+        size_t rec_size = 2 + ( ( dna_len + 1 ) >> 1 );
+        char * rec = reserve_rec( store, rec_size, &rc );
+        if ( rc == 0 )
+        {
+            SBuffer dst;
+
+            /* pack_4na() writes into the SBuffer, let it write into the slab directly */
+            dst.S.addr = rec;
+            dst.S.size = dst.S.len = 0;
+            dst.buffer_size = rec_size;
+            pack_4na( unpacked, &dst );     /* helper.c */
+
+            rc = add_entry( store, key, rec );
+            if ( rc == 0 )
+                store->used_in_curr += rec_size;
+        }
+    }
+    return rc;
+}
+
+
+uint64_t slab_store_bytes( const struct slab_store * store )
+{
+    uint64_t res = 0;
+    if ( store != NULL )
+        res = ( ( uint64_t )store->slab_count * store->slab_size ) +
+              ( store->entry_capacity * sizeof( slab_entry ) );
+    return res;
+}
+
+
+uint64_t slab_store_bytes_used( const struct slab_store * store )
+{
+    uint64_t res = 0;
+    if ( store != NULL && store->slab_count > 0 )
+        res = ( ( uint64_t )store->curr_slab * store->slab_size ) + store->used_in_curr +
+              ( store->entry_count * sizeof( slab_entry ) );
+    return res;
+}
+
+
+uint64_t slab_store_count( const struct slab_store * store )
+{
+    return ( store != NULL ) ? store->entry_count : 0;
+}
+
+
+static int64_t CC cmp_slab_entry( const void * a, const void * b, void * data )
+{
+    const slab_entry * ea = a;
+    const slab_entry * eb = b;
+    if ( ea->key < eb->key ) return -1;
+    return ( ea->key > eb->key ) ? 1 : 0;
+}
+
+
+void slab_store_sort( struct slab_store * store )
+{
+    if ( store != NULL && store->entry_count > 1 )
+        ksort( store->entries, store->entry_count, sizeof( slab_entry ), cmp_slab_entry, NULL );
+}
+
+
+rc_t slab_store_visit_sorted( struct slab_store * store,
+        rc_t ( CC * f )( uint64_t key, const String * packed, void * data ), void * data )
+{
+    rc_t rc = 0;
+    if ( store == NULL || f == NULL )
+    {
+        rc = RC( rcVDB, rcNoTarg, rcReading, rcParam, rcInvalid );
+        ErrMsg( "slab_store_visit_sorted() -> %R", rc );
+    }
+    else
+    {
+        uint64_t i;
+        slab_store_sort( store );
+        for ( i = 0; rc == 0 && i < store->entry_count; ++i )
+        {
+            uint64_t key;
+            String packed;
+            slab_store_get( store, i, &key, &packed );
+            rc = f( key, &packed, data );
+        }
+    }
+    return rc;
+}
+
+
+rc_t slab_store_reserve( struct slab_store * store, uint64_t count )
+{
+    rc_t rc = 0;
+    if ( store == NULL )
+        rc = RC( rcVDB, rcNoTarg, rcConstructing, rcParam, rcInvalid );
+    else if ( count > store->entry_capacity )
+        rc = grow_entries( store, count );
+    return rc;
+}
+
+
+rc_t slab_store_absorb( struct slab_store * dst, struct slab_store * src )
+{
+    rc_t rc = 0;
+    if ( dst == NULL || src == NULL || dst->lf != src->lf )
+    {
+        rc = RC( rcVDB, rcNoTarg, rcConstructing, rcParam, rcInvalid );
+        ErrMsg( "slab_store_absorb() -> %R", rc );
+    }
+    else
+    {
+        if ( dst->entry_count + src->entry_count > dst->entry_capacity )
+            rc = grow_entries( dst, dst->entry_count + src->entry_count );
+        if ( rc == 0 && dst->slab_count + src->slab_count > dst->slab_capacity )
+        {
+            uint32_t new_capacity = dst->slab_count + src->slab_count;
+            char ** tmp = realloc( dst->slabs, new_capacity * ( sizeof * tmp ) );
+            if ( tmp == NULL )
+            {
+                rc = RC( rcVDB, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+                ErrMsg( "realloc( %d ) -> %R", new_capacity * ( sizeof * tmp ), rc );
+            }
+            else
+            {
+                dst->slabs = tmp;
+                dst->slab_capacity = new_capacity;
+            }
+        }
+        if ( rc == 0 && src->slab_count > 0 )
+        {
+            /* the slabs change owner, further adds to dst have to start a fresh slab */
+            memmove( &dst->entries[ dst->entry_count ], src->entries, src->entry_count * sizeof( slab_entry ) );
+            dst->entry_count += src->entry_count;
+            memmove( &dst->slabs[ dst->slab_count ], src->slabs, src->slab_count * ( sizeof * src->slabs ) );
+            dst->slab_count += src->slab_count;
+            dst->curr_slab = dst->slab_count - 1;
+            dst->used_in_curr = dst->slab_size;
+            src->slab_count = 0;
+            src->entry_count = 0;
+            src->curr_slab = 0;
+            src->used_in_curr = 0;
+            /* do not keep the copied keys around until src is released */
+            free( ( void * ) src->entries );
+            src->entries = NULL;
+            src->entry_capacity = 0;
+        }
+    }
+    return rc;
+}
+
+
+uint64_t slab_store_lower_bound( const struct slab_store * store, uint64_t key )
+{
+    uint64_t lo = 0, hi = ( store != NULL ) ? store->entry_count : 0;
+    while ( lo < hi )
+    {
+        uint64_t mid = lo + ( ( hi - lo ) >> 1 );
+        if ( store->entries[ mid ].key < key )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+
+bool slab_store_get( const struct slab_store * store, uint64_t idx, uint64_t * key, String * packed )
+{
+    bool res = ( store != NULL && idx < store->entry_count );
+    if ( res )
+    {
+        const slab_entry * e = &store->entries[ idx ];
+        *key = e->key;
+        packed->addr = e->rec;
+        packed->size = packed->len = packed_size( store->lf, ( const uint8_t * )e->rec ); /* helper.c */
+    }
+    return res;
+}
+
+
+lookup_fmt_t slab_store_fmt( const struct slab_store * store )
+{
+    return ( store != NULL ) ? store->lf : lft_4na;
+}
+
+
+uint64_t slab_store_estimate( lookup_fmt_t lf, uint64_t count, uint64_t avg_len, size_t slab_size )
+{
+    uint64_t rec_size = packed_size_estimate( lf, avg_len ); /* helper.c */
+    uint64_t slab_bytes = count * rec_size;
+    /* a slab is not filled up to the last byte, and the last slab is half empty on average */
+    slab_bytes += ( slab_bytes / slab_size + 1 ) * rec_size + slab_size;
+    return slab_bytes + count * sizeof( slab_entry );
+}
+
+
+uint64_t slab_store_absorb_estimate( uint64_t count )
+{
+    /* growing the key-array of dst copies it, while the key-arrays of the stores not yet absorbed
+       still exist: at the last absorb that adds up to all keys a second time */
+    return count * sizeof( slab_entry );
+}
+
+
+void clear_slab_store( struct slab_store * store )
+{
+    if ( store != NULL )
+    {
+        store->entry_count = 0;
+        store->curr_slab = 0;
+        store->used_in_curr = 0;
+    }
+}
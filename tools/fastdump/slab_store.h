@@ -0,0 +1,104 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_slab_store_
+#define _h_slab_store_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _h_klib_rc_
+#include <klib/rc.h>
+#endif
+
+#ifndef _h_klib_text_
+#include <klib/text.h>
+#endif
+
+#ifndef _h_helper_
+#include "helper.h"
+#endif
+
+/* --------------------------------------------------------------------------------------------
+    in-memory store for the lookup-records of one sorter:
+    the records ( 16-bit dna-length + packed 4na or 2na ) are appended into fixed-size slabs,
+    a separate array of ( key, record-ptr ) pairs is sorted by key before writing.
+    clearing the store keeps the slabs allocated to be reused for the next batch.
+-------------------------------------------------------------------------------------------- */
+
+struct slab_store;
+
+rc_t make_slab_store( struct slab_store ** store, size_t slab_size, lookup_fmt_t lf );
+void release_slab_store( struct slab_store * store );
+
+/* packs the unpacked 4na-bases into the slab, in the format of the lookup-file */
+rc_t slab_store_add( struct slab_store * store, uint64_t key, const String * unpacked );
+
+/* number of bytes allocated by the store ( slabs and key-array ) */
+uint64_t slab_store_bytes( const struct slab_store * store );
+
+/* number of bytes in use by the entries since the last clear: the filled slabs and the keys,
+   the allocated bytes stay the same after a clear */
+uint64_t slab_store_bytes_used( const struct slab_store * store );
+uint64_t slab_store_count( const struct slab_store * store );
+
+/* sorts the entries by key and calls f for each of them in ascending order */
+rc_t slab_store_visit_sorted( struct slab_store * store,
+        rc_t ( CC * f )( uint64_t key, const String * packed, void * data ), void * data );
+
+/* --------------------------------------------------------------------------------------------
+    the store as an in-memory lookup-table ( see make_lookup_in_memory() in sorter.c )
+-------------------------------------------------------------------------------------------- */
+
+void slab_store_sort( struct slab_store * store );
+
+/* allocates the key-array for count entries up front */
+rc_t slab_store_reserve( struct slab_store * store, uint64_t count );
+
+/* moves all slabs and entries of src into dst, src is empty afterwards and has freed its key-array */
+rc_t slab_store_absorb( struct slab_store * dst, struct slab_store * src );
+
+/* on a sorted store: index of the first entry with a key >= key */
+uint64_t slab_store_lower_bound( const struct slab_store * store, uint64_t key );
+
+bool slab_store_get( const struct slab_store * store, uint64_t idx, uint64_t * key, String * packed );
+
+lookup_fmt_t slab_store_fmt( const struct slab_store * store );
+
+/* bytes the store will allocate for count records of avg_len bases */
+uint64_t slab_store_estimate( lookup_fmt_t lf, uint64_t count, uint64_t avg_len, size_t slab_size );
+
+/* bytes needed on top of the stores while absorbing stores of count entries in total into one */
+uint64_t slab_store_absorb_estimate( uint64_t count );
+
+void clear_slab_store( struct slab_store * store );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
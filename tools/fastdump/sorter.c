@@ -28,6 +28,9 @@
 #include "lookup_writer.h"
 #include "lookup_reader.h"
 #include "merge_sorter.h"
+#include "slab_store.h"
+#include "index.h"
+#include "telemetry.h"
 #include "helper.h"
 
 #include <klib/vector.h>
@@ -46,46 +49,57 @@
 typedef struct sorter
 {
     sorter_params params;
-    KVector * store;
-    SBuffer buf;
-    uint64_t bytes_in_store;
+    struct slab_store * store;
     uint32_t sub_file_id;
 } sorter;
 
+#define MAX_SLAB_SIZE ( 4 * 1024 * 1024 )
+#define MIN_SLAB_SIZE ( 64 * 1024 )
+
+/* the slabs should be small compared to the mem-limit, to not overshoot it by much */
+static size_t slab_size_for( size_t mem_limit )
+{
+    size_t res = MAX_SLAB_SIZE;
+    if ( mem_limit > 0 )
+    {
+        res = mem_limit / 16;
+        if ( res > MAX_SLAB_SIZE )
+            res = MAX_SLAB_SIZE;
+        else if ( res < MIN_SLAB_SIZE )
+            res = MIN_SLAB_SIZE;
+    }
+    return res;
+}
+
 
 static void release_sorter( struct sorter * sorter )
 {
     if ( sorter != NULL )
     {
-        release_SBuffer( &sorter->buf );
         if ( sorter->params.src != NULL )
             destroy_raw_read_iter( sorter->params.src );
-        if ( sorter->store != NULL )
-            KVectorRelease( sorter->store );
+        release_slab_store( sorter->store );
     }
 }
 
 static rc_t init_sorter( struct sorter * sorter, const sorter_params * params )
 {
-    rc_t rc = KVectorMake( &sorter->store );
-    if ( rc != 0 )
-        ErrMsg( "KVectorMake() -> %R", rc );
-    else
+    rc_t rc = make_slab_store( &sorter->store, slab_size_for( params->mem_limit ), /* slab_store.c */
+                               params->lookup_fmt );
+    if ( rc == 0 )
     {
-        rc = make_SBuffer( &sorter->buf, 4096 );
-        if ( rc == 0 )
-        {
-            sorter->params.dir = params->dir;
-            sorter->params.output_filename = params->output_filename;
-            sorter->params.index_filename = NULL;
-            sorter->params.temp_path = params->temp_path;
-            sorter->params.src = params->src;
-            sorter->params.buf_size = params->buf_size;
-            sorter->params.mem_limit = params->mem_limit;
-            sorter->params.prefix = params->prefix;
-            sorter->bytes_in_store = 0;
-            sorter->sub_file_id = 0;
-        }
+        sorter->params.dir = params->dir;
+        sorter->params.output_filename = params->output_filename;
+        sorter->params.index_filename = params->index_filename;
+        sorter->params.index_stride = params->index_stride;
+        sorter->params.temp_path = params->temp_path;
+        sorter->params.src = params->src;
+        sorter->params.buf_size = params->buf_size;
+        sorter->params.mem_limit = params->mem_limit;
+        sorter->params.prefix = params->prefix;
+        sorter->params.lookup_fmt = params->lookup_fmt;
+        sorter->params.telemetry = params->telemetry;
+        sorter->sub_file_id = 0;
     }
     return rc;
 }
@@ -159,23 +173,21 @@ static rc_t make_dst_filename( const sorter_params * params, char * buffer, size
 }
 
 
-static rc_t CC on_store_entry( uint64_t key, const void *value, void *user_data )
+static rc_t CC on_store_entry( uint64_t key, const String * packed, void *user_data )
 {
-    const String * bases = value;
     struct lookup_writer * writer = user_data;
-    rc_t rc = write_packed_to_lookup_writer( writer, key, bases );
-    StringWhack( bases );
-    return rc;
+    return write_packed_to_lookup_writer( writer, key, packed );
 }
 
 
 static rc_t save_store( struct sorter * sorter )
 {
     rc_t rc = 0;
-    if ( sorter->bytes_in_store > 0 )
+    if ( slab_store_count( sorter->store ) > 0 )
     {
         char buffer[ 4096 ];
         struct lookup_writer * writer;
+        struct index_writer * idx = NULL;
         
         if ( sorter->params.mem_limit > 0 )
         {
@@ -184,72 +196,53 @@ static rc_t save_store( struct sorter * sorter )
                 sorter->sub_file_id++;
         }
         else
+        {
+            /* without a mem-limit there is no merge-step, the index is written right here */
             rc = make_dst_filename( &sorter->params, buffer, sizeof buffer );
+            if ( rc == 0 && sorter->params.prefix == 0 && sorter->params.index_filename != NULL )
+                rc = make_index_writer( sorter->params.dir, &idx, sorter->params.buf_size,
+                        sorter->params.index_stride > 0 ? sorter->params.index_stride : DFLT_INDEX_STRIDE,
+                        "%s", sorter->params.index_filename ); /* index.c */
+        }
 
         if ( rc == 0 )
-            rc = make_lookup_writer( sorter->params.dir, NULL, &writer, sorter->params.buf_size, "%s", buffer );
+            rc = make_lookup_writer( sorter->params.dir, idx, &writer, sorter->params.buf_size,
+                                     sorter->params.lookup_fmt, "%s", buffer );
         
         if ( rc == 0 )
         {
-            rc = KVectorVisitPtr( sorter->store, false, on_store_entry, writer );
+            rc = slab_store_visit_sorted( sorter->store, on_store_entry, writer ); /* slab_store.c */
             release_lookup_writer( writer );
         }
+        release_index_writer( idx ); /* index.c */
         if ( rc == 0 )
-        {
-            sorter->bytes_in_store = 0;
-            rc = KVectorRelease( sorter->store );
-            if ( rc != 0 )
-                ErrMsg( "KVectorRelease() -> %R", rc );
-            else
-            {
-                sorter->store = NULL;
-                rc = KVectorMake( &sorter->store );
-                if ( rc != 0 )
-                    ErrMsg( "KVectorMake() -> %R", rc );
-            }
-        }
+            clear_slab_store( sorter->store ); /* the slabs are kept for the next batch */
     }
     return rc;
 }
 
 
-static rc_t write_to_sorter( struct sorter * sorter, int64_t seq_spot_id, uint32_t seq_read_id,
+rc_t write_to_sorter( struct sorter * sorter, int64_t seq_spot_id, uint32_t seq_read_id,
         const String * unpacked_bases )
 {
-    /* we write it to the store...*/
-    rc_t rc;
-    const String * to_store;    
-    pack_4na( unpacked_bases, &sorter->buf );
-    rc = StringCopy( &to_store, &sorter->buf.S );
-    if ( rc != 0 )
-        ErrMsg( "StringCopy() -> %R", rc );
-    else
-    {
-        uint64_t key = make_key( seq_spot_id, seq_read_id );
-        rc = KVectorSetPtr( sorter->store, key, (const void *)to_store );
-        if ( rc != 0 )
-            ErrMsg( "KVectorSetPtr() -> %R", rc );
-        else
-        {
-            size_t item_size = ( sizeof key ) + ( sizeof *to_store ) + to_store->size;
-            sorter->bytes_in_store += item_size;
-        }
-    }
-    
+    /* we write it to the store... ( packed into the current slab ) */
+    uint64_t key = make_key( seq_spot_id, seq_read_id );
+    rc_t rc = slab_store_add( sorter->store, key, unpacked_bases ); /* slab_store.c */
+    /* the slabs stay allocated after a save, only what is in use counts */
     if ( rc == 0 &&
          sorter->params.mem_limit > 0 &&
-         sorter->bytes_in_store >= sorter->params.mem_limit )
+         slab_store_bytes_used( sorter->store ) >= sorter->params.mem_limit )
         rc = save_store( sorter );
     return rc;
 }
 
 
-static rc_t delete_sub_files( const sorter_params * params, uint32_t count )
+static rc_t delete_sub_files( const sorter_params * params, uint32_t first, uint32_t count )
 {
     rc_t rc = 0;
     char buffer[ 4096 ];
     uint32_t i;
-    for ( i = 0; rc == 0 && i < count; ++ i )
+    for ( i = first; rc == 0 && i < first + count; ++ i )
     {
         rc = make_subfilename( params, i, buffer, sizeof buffer );
         if ( rc == 0 )
@@ -261,45 +254,125 @@ static rc_t delete_sub_files( const sorter_params * params, uint32_t count )
 }
 
 
+/* merge the sub-files first ... first + count - 1 into output, delete them afterwards */
+static rc_t merge_sub_files( const sorter_params * params, uint32_t first, uint32_t count,
+                             const char * output_filename, const char * index_filename )
+{
+    merge_sorter_params msp;
+    struct merge_sorter * ms;
+    rc_t rc;
+
+    msp.dir = params->dir;
+    msp.output_filename = output_filename;
+    msp.index_filename = index_filename;
+    msp.count = count;
+    msp.buf_size = params->buf_size;
+    msp.index_stride = params->index_stride;
+    msp.lookup_fmt = params->lookup_fmt;
+    msp.telemetry = params->telemetry;
+    msp.thread_id = params->prefix;     /* the sorter-thread merging its own sub-files */
+
+    rc = make_merge_sorter( &ms, &msp );
+    if ( rc == 0 )
+    {
+        uint32_t i;
+        for ( i = 0; rc == 0 && i < count; ++i )
+        {
+            char buffer[ 4096 ];
+            rc = make_subfilename( params, first + i, buffer, sizeof buffer );
+            if ( rc == 0 )
+                rc = add_merge_sorter_src( ms, buffer, i );
+        }
+        if ( rc == 0 )
+            rc = run_merge_sorter( ms );
+
+        release_merge_sorter( ms );
+    }
+
+    if ( rc == 0 )
+        rc = delete_sub_files( params, first, count );
+    return rc;
+}
+
+
+/* ------------------------------------------------------------------------------------------
+    if there are more sub-files than MAX_MERGE_FANIN, the oldest MAX_MERGE_FANIN sub-files
+    are merged into a new sub-file ( with the next free id ), until the remaining
+    sub-files can be merged into the destination in one pass
+   ------------------------------------------------------------------------------------------ */
 static rc_t final_merge_sort( const sorter_params * params, uint32_t count )
 {
     rc_t rc = 0;
-    if ( count > 0 )
+    uint32_t first = 0;
+    uint32_t next_id = count;
+    char buffer[ 4096 ];
+
+    while ( rc == 0 && ( next_id - first ) > MAX_MERGE_FANIN )
     {
-        char buffer[ 4096 ];
-        rc = make_dst_filename( params, buffer, sizeof buffer );
+        rc = make_subfilename( params, next_id, buffer, sizeof buffer );
+        if ( rc == 0 )
+            rc = merge_sub_files( params, first, MAX_MERGE_FANIN, buffer, NULL );
         if ( rc == 0 )
         {
-            merge_sorter_params msp;
-            struct merge_sorter * ms;
-            uint32_t i;
-            
-            msp.dir = params->dir;
-            msp.output_filename = buffer;
-            msp.index_filename = params->index_filename;
-            msp.count = count;
-            msp.buf_size = params->buf_size;
-            
-            rc = make_merge_sorter( &ms, &msp );
-            for ( i = 0; rc == 0 && i < count; ++i )
-            {
-                char buffer2[ 4096 ];
-                rc = make_subfilename( params, i, buffer2, sizeof buffer2 );
-                if ( rc == 0 )
-                    rc = add_merge_sorter_src( ms, buffer2, i );
-            }
-            if ( rc == 0 )
-                rc = run_merge_sorter( ms );
-                
-            release_merge_sorter( ms );
+            first += MAX_MERGE_FANIN;
+            next_id++;
         }
+    }
+
+    if ( rc == 0 && next_id > first )
+    {
+        rc = make_dst_filename( params, buffer, sizeof buffer );
+        if ( rc == 0 )
+            rc = merge_sub_files( params, first, next_id - first, buffer, params->index_filename );
+    }
+    return rc;
+}
 
+rc_t make_sorter( struct sorter ** sorter, const sorter_params * params )
+{
+    rc_t rc = 0;
+    struct sorter * s = calloc( 1, sizeof * s );
+    if ( s == NULL )
+    {
+        rc = RC( rcVDB, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+        ErrMsg( "calloc( %d ) -> %R", ( sizeof * s ), rc );
+    }
+    else
+    {
+        rc = init_sorter( s, params );
         if ( rc == 0 )
-            rc = delete_sub_files( params, count );
+            *sorter = s;
+        else
+            free( ( void * ) s );
+    }
+    return rc;
+}
+
+
+void destroy_sorter( struct sorter * sorter )
+{
+    if ( sorter != NULL )
+    {
+        release_sorter( sorter );
+        free( ( void * ) sorter );
     }
+}
+
+
+rc_t finish_sorter( struct sorter * sorter )
+{
+    rc_t rc = save_store( sorter );
+    if ( rc == 0 && sorter->params.mem_limit > 0 )
+        rc = final_merge_sort( &sorter->params, sorter->sub_file_id );
     return rc;
 }
 
+
+uint32_t sorter_sub_file_count( const struct sorter * sorter )
+{
+    return ( sorter != NULL ) ? sorter->sub_file_id : 0;
+}
+
 rc_t CC Quitting();
 
 rc_t run_sorter( const sorter_params * params )
@@ -309,6 +382,10 @@ rc_t run_sorter( const sorter_params * params )
     if ( rc == 0 )
     {
         raw_read_rec rec;
+        uint64_t records = 0, bytes = 0;
+        telemetry_tick tick;
+
+        telemetry_tick_init( &tick, "sort", params->prefix ); /* telemetry.c */
         while ( rc == 0 && get_from_raw_read_iter( sorter.params.src, &rec, &rc ) )
         {
             rc = Quitting();
@@ -317,11 +394,16 @@ rc_t run_sorter( const sorter_params * params )
                 rc = write_to_sorter( &sorter, rec.seq_spot_id, rec.seq_read_id, &rec.raw_read );
                 if ( rc == 0 && params->sort_progress != NULL )
                     atomic_inc( params->sort_progress );
+                records++;
+                bytes += rec.raw_read.len;
+                telemetry_progress( params->telemetry, &tick, records, bytes ); /* telemetry.c */
             }
         }
         
         if ( rc == 0 )
             rc = save_store( &sorter );
+        if ( rc == 0 )
+            telemetry_stage( params->telemetry, "sort", params->prefix, records, bytes, tick.start ); /* telemetry.c */
 
         if ( rc == 0 && sorter.params.mem_limit > 0 )
             rc = final_merge_sort( params, sorter.sub_file_id );
@@ -347,6 +429,7 @@ static uint64_t find_out_row_count( const sorter_params * params )
     cp.count = 0;
     cp.cursor_cache = params->cursor_cache;
     cp.show_progress = false;
+    cp.show_details = false;
 
     rc = make_raw_read_iter( &cp, &iter );
     if ( rc == 0 )
@@ -418,6 +501,10 @@ static rc_t merge_pool_files( const sorter_params * params )
     msp.index_filename = params->index_filename;
     msp.count = params->num_threads;
     msp.buf_size = params->buf_size;
+    msp.index_stride = params->index_stride;
+    msp.lookup_fmt = params->lookup_fmt;
+    msp.telemetry = params->telemetry;
+    msp.thread_id = 0;                  /* the main-thread */
 
     rc = make_merge_sorter( &ms, &msp );
     if ( rc == 0 )
@@ -452,6 +539,9 @@ static void init_sorter_params( sorter_params * dst, const sorter_params * param
     dst->prefix = prefix;
     dst->mem_limit = params->mem_limit;
     dst->buf_size = params->buf_size;
+    dst->index_stride = params->index_stride;
+    dst->telemetry = params->telemetry;
+    dst->lookup_fmt = params->lookup_fmt;
 }
 
 static void init_cmn_params( cmn_params * dst, const sorter_params * params, uint64_t row_count )
@@ -536,3 +626,216 @@ rc_t run_sorter_pool( const sorter_params * params )
     }
     return rc;
 }
+
+/* --------------------------------------------------------------------------------------------
+    in-memory lookup-table:
+    if the packed alignments fit into memory, the lookup-table is not written to disk at all.
+    every thread fills its own slab_store for a slice of the PRIMARY_ALIGNMENT-table, then the
+    stores are combined into one and sorted. the join reads from it via lookup_reader.c
+   -------------------------------------------------------------------------------------------- */
+
+#define ESTIMATE_SAMPLE_ROWS 10000
+
+rc_t estimate_lookup_in_memory( const sorter_params * params, uint64_t * row_count, uint64_t * estimate,
+                                uint64_t * file_estimate )
+{
+    struct raw_read_iter * iter;
+    cmn_params cp;
+    rc_t rc;
+
+    cp.dir = params->dir;
+    cp.acc = params->acc;
+    cp.row_range = NULL;
+    cp.first = 1;
+    cp.count = ESTIMATE_SAMPLE_ROWS;
+    cp.cursor_cache = params->cursor_cache;
+    cp.show_progress = false;
+    cp.show_details = false;
+
+    *row_count = 0;
+    *estimate = 0;
+    *file_estimate = 0;
+    rc = make_raw_read_iter( &cp, &iter );
+    if ( rc == 0 )
+    {
+        raw_read_rec rec;
+        uint64_t sampled = 0, bases = 0;
+        while ( rc == 0 && get_from_raw_read_iter( iter, &rec, &rc ) )
+        {
+            sampled++;
+            bases += rec.raw_read.len;
+        }
+        if ( rc == 0 )
+        {
+            /* the sample only sizes the average record, the iterator over it only knows
+               about the sampled rows: the row-count comes from one over the whole table */
+            *row_count = find_out_row_count( params );
+            if ( sampled > 0 )
+            {
+                uint64_t avg_len = ( bases + sampled - 1 ) / sampled;
+                *estimate = slab_store_estimate( params->lookup_fmt, *row_count,
+                                avg_len, slab_size_for( params->mem_limit ) );
+                /* a record of the lookup-file is the key and the packed bases */
+                *file_estimate = *row_count * ( sizeof( uint64_t ) + packed_size_estimate( params->lookup_fmt, avg_len ) );
+                /* the stores of the threads are combined into one at the end */
+                if ( params->num_threads > 1 )
+                    *estimate += slab_store_absorb_estimate( *row_count );
+            }
+        }
+        destroy_raw_read_iter( iter );
+    }
+    return rc;
+}
+
+
+typedef struct inmem_slice
+{
+    const sorter_params * params;
+    uint32_t id;
+    cmn_params cp;
+    struct slab_store * store;
+} inmem_slice;
+
+
+static rc_t fill_slice( inmem_slice * slice, uint32_t slice_id )
+{
+    struct raw_read_iter * iter;
+    telemetry_tick tick;
+    rc_t rc;
+
+    telemetry_tick_init( &tick, "inmem", slice_id ); /* telemetry.c */
+    rc = make_raw_read_iter( &slice->cp, &iter );
+    if ( rc == 0 )
+    {
+        raw_read_rec rec;
+        uint64_t records = 0, bytes = 0;
+        while ( rc == 0 && get_from_raw_read_iter( iter, &rec, &rc ) )
+        {
+            rc = Quitting();
+            if ( rc == 0 )
+            {
+                uint64_t key = make_key( rec.seq_spot_id, rec.seq_read_id );
+                rc = slab_store_add( slice->store, key, &rec.raw_read ); /* slab_store.c */
+                if ( rc == 0 && slice->params->sort_progress != NULL )
+                    atomic_inc( slice->params->sort_progress );
+                records++;
+                bytes += rec.raw_read.len;
+                telemetry_progress( slice->params->telemetry, &tick, records, bytes ); /* telemetry.c */
+            }
+        }
+        if ( rc == 0 )
+            telemetry_stage( slice->params->telemetry, "inmem", slice_id,
+                             slab_store_count( slice->store ), bytes, tick.start ); /* telemetry.c */
+        destroy_raw_read_iter( iter );
+    }
+    return rc;
+}
+
+
+static rc_t CC inmem_thread_func( const KThread *self, void *data )
+{
+    inmem_slice * slice = data;
+    return fill_slice( slice, slice->id );
+}
+
+
+rc_t make_lookup_in_memory( const sorter_params * params, uint64_t row_count, struct slab_store ** store )
+{
+    rc_t rc = 0;
+    uint32_t i, n = ( params->num_threads > 1 ) ? params->num_threads : 1;
+    size_t slab_size = slab_size_for( params->mem_limit );
+    inmem_slice * slices = calloc( n, sizeof * slices );
+    if ( slices == NULL )
+    {
+        rc = RC( rcVDB, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+        ErrMsg( "make_lookup_in_memory.calloc( %d ) -> %R", n * ( sizeof * slices ), rc );
+    }
+    else
+    {
+        KThread ** threads = calloc( n, sizeof * threads );
+        uint64_t per_slice = ( row_count / n ) + 1;
+        KThread * progress_thread = NULL;
+        multi_progress progress;
+
+        if ( threads == NULL )
+        {
+            rc = RC( rcVDB, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+            ErrMsg( "make_lookup_in_memory.calloc( %d ) -> %R", n * ( sizeof * threads ), rc );
+        }
+
+        init_progress_data( &progress, row_count );
+        if ( rc == 0 && params->show_progress )
+        {
+            sorter_params * nc_params = ( sorter_params * )params;
+            nc_params->sort_progress = &progress.progress_rows;
+            rc = start_multi_progress( &progress_thread, &progress );
+        }
+
+        for ( i = 0; rc == 0 && i < n; ++i )
+        {
+            inmem_slice * slice = &slices[ i ];
+            slice->params = params;
+            slice->id = i;
+            slice->cp.dir = params->dir;
+            slice->cp.acc = params->acc;
+            slice->cp.row_range = NULL;
+            slice->cp.first = 1 + ( i * per_slice );
+            slice->cp.count = per_slice;
+            slice->cp.cursor_cache = params->cursor_cache;
+            slice->cp.show_progress = false;
+            slice->cp.show_details = false;
+            rc = make_slab_store( &slice->store, slab_size, params->lookup_fmt ); /* slab_store.c */
+            if ( rc == 0 && n > 1 )
+            {
+                rc = KThreadMake( &threads[ i ], inmem_thread_func, slice );
+                if ( rc != 0 )
+                    ErrMsg( "KThreadMake( inmem-thread #%d ) -> %R", i, rc );
+            }
+        }
+
+        if ( n == 1 )
+        {
+            if ( rc == 0 )
+                rc = fill_slice( &slices[ 0 ], 0 );
+        }
+        else if ( threads != NULL )
+        {
+            /* wait for every thread that was started, even if starting another one failed */
+            for ( i = 0; i < n; ++i )
+            {
+                if ( threads[ i ] != NULL )
+                {
+                    rc_t status = 0;
+                    rc_t rc1 = KThreadWait( threads[ i ], &status );
+                    if ( rc == 0 )
+                        rc = ( rc1 != 0 ) ? rc1 : status;
+                    KThreadRelease( threads[ i ] );
+                }
+            }
+        }
+        join_multi_progress( progress_thread, &progress );
+
+        /* the first store takes over the records of all others, one at a time:
+           each one is released right away to keep the peak down */
+        for ( i = 1; rc == 0 && i < n; ++i )
+        {
+            rc = slab_store_absorb( slices[ 0 ].store, slices[ i ].store ); /* slab_store.c */
+            release_slab_store( slices[ i ].store );
+            slices[ i ].store = NULL;
+        }
+
+        if ( rc == 0 )
+        {
+            slab_store_sort( slices[ 0 ].store ); /* slab_store.c */
+            *store = slices[ 0 ].store;
+            slices[ 0 ].store = NULL;
+        }
+
+        for ( i = 0; i < n; ++i )
+            release_slab_store( slices[ i ].store );
+        if ( threads != NULL )
+            free( ( void * ) threads );
+        free( ( void * ) slices );
+    }
+    return rc;
+}
@@ -51,6 +51,10 @@ extern "C" {
 #include "raw_read_iter.h"
 #endif
 
+#ifndef _h_helper_
+#include "helper.h"
+#endif
+
 
 typedef struct sorter_params
 {
@@ -61,13 +65,40 @@ typedef struct sorter_params
     const char * temp_path;
     struct raw_read_iter * src;
     size_t buf_size, mem_limit, prefix, num_threads, cursor_cache;
+    uint64_t index_stride;
     atomic_t * sort_progress;
+    struct telemetry * telemetry;
+    lookup_fmt_t lookup_fmt;
     bool show_progress;
 } sorter_params;
 
 rc_t run_sorter( const sorter_params * params );
 rc_t run_sorter_pool( const sorter_params * params );
 
+/* one sorter fed record by record instead of from params->src, as run_sorter() does it:
+   with a mem_limit the store is saved into a sub-file whenever its entries reach the limit,
+   finish_sorter() saves the rest and merges the sub-files into the destination */
+struct sorter;
+
+rc_t make_sorter( struct sorter ** sorter, const sorter_params * params );
+void destroy_sorter( struct sorter * sorter );
+rc_t write_to_sorter( struct sorter * sorter, int64_t seq_spot_id, uint32_t seq_read_id,
+        const String * unpacked_bases );
+rc_t finish_sorter( struct sorter * sorter );
+
+/* the number of sub-files saved so far */
+uint32_t sorter_sub_file_count( const struct sorter * sorter );
+
+struct slab_store;
+
+/* row_count of the PRIMARY_ALIGNMENT-table, the bytes an in-memory lookup-table would need
+   and the size of a lookup-file */
+rc_t estimate_lookup_in_memory( const sorter_params * params, uint64_t * row_count, uint64_t * estimate,
+                                uint64_t * file_estimate );
+
+/* builds the sorted lookup-table in memory, using params->num_threads threads */
+rc_t make_lookup_in_memory( const sorter_params * params, uint64_t row_count, struct slab_store ** store );
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,277 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "telemetry.h"
+#include "helper.h"
+
+#include <klib/out.h>
+#include <klib/printf.h>
+#include <kfs/file.h>
+#include <kproc/lock.h>
+
+#if defined( __linux__ ) || defined( __APPLE__ )
+#define HAVE_POSIX_STATS 1
+#include <sys/resource.h>
+#include <sys/statvfs.h>
+#endif
+
+typedef struct telemetry
+{
+    KFile * json;           /* NULL if no JSON-lines are requested */
+    KLock * lock;           /* the threads report concurrently */
+    uint64_t json_pos;
+    KTimeMs_t created;
+    size_t mem_limit;
+    uint64_t num_threads;
+    uint32_t progress_ms;
+    bool show_details;
+} telemetry;
+
+
+uint64_t peak_rss( void )
+{
+    uint64_t res = 0;
+#ifdef HAVE_POSIX_STATS
+    struct rusage ru;
+    if ( getrusage( RUSAGE_SELF, &ru ) == 0 )
+    {
+#if defined( __APPLE__ )
+        res = ru.ru_maxrss;             /* bytes on mac */
+#else
+        res = ( uint64_t )ru.ru_maxrss * 1024;   /* kilobytes on linux */
+#endif
+    }
+#endif
+    return res;
+}
+
+
+void release_telemetry( struct telemetry * t )
+{
+    if ( t != NULL )
+    {
+        if ( t->json != NULL ) KFileRelease( t->json );
+        if ( t->lock != NULL ) KLockRelease( t->lock );
+        free( ( void * ) t );
+    }
+}
+
+
+rc_t make_telemetry( struct telemetry ** t, KDirectory * dir, const char * json_filename,
+                     size_t mem_limit, uint64_t num_threads, uint32_t progress_ms,
+                     bool show_details )
+{
+    rc_t rc = 0;
+    telemetry * tm = calloc( 1, sizeof * tm );
+    if ( tm == NULL )
+    {
+        rc = RC( rcVDB, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+        ErrMsg( "make_telemetry.calloc( %d ) -> %R", ( sizeof * tm ), rc );
+    }
+    else
+    {
+        tm->created = KTimeMsStamp();
+        tm->mem_limit = mem_limit;
+        tm->num_threads = ( num_threads > 0 ) ? num_threads : 1;
+        tm->progress_ms = progress_ms;
+        tm->show_details = show_details;
+        rc = KLockMake( &tm->lock );
+        if ( rc != 0 )
+            ErrMsg( "make_telemetry.KLockMake() -> %R", rc );
+        else if ( json_filename != NULL )
+        {
+            rc = KDirectoryCreateFile( dir, &tm->json, false, 0664, kcmInit, "%s", json_filename );
+            if ( rc != 0 )
+                ErrMsg( "make_telemetry.KDirectoryCreateFile( '%s' ) -> %R", json_filename, rc );
+        }
+        if ( rc == 0 )
+            *t = tm;
+        else
+            release_telemetry( tm );
+    }
+    return rc;
+}
+
+
+/* appends one line to the JSON-file, under the lock */
+static void write_json_line( telemetry * t, const char * fmt, ... )
+{
+    if ( t->json != NULL )
+    {
+        char buffer[ 1024 ];
+        size_t num_writ;
+        rc_t rc;
+        va_list args;
+
+        va_start( args, fmt );
+        rc = string_vprintf( buffer, sizeof buffer - 1, &num_writ, fmt, args );
+        va_end( args );
+        if ( rc == 0 )
+        {
+            buffer[ num_writ++ ] = '\n';
+            KLockAcquire( t->lock );
+            rc = KFileWriteAll( t->json, t->json_pos, buffer, num_writ, NULL );
+            if ( rc == 0 )
+                t->json_pos += num_writ;
+            KLockUnlock( t->lock );
+        }
+    }
+}
+
+
+/* running: the stage is not done yet, the numbers are what it did so far */
+static void report( telemetry * t, const char * stage, uint32_t thread_id,
+                    uint64_t records, uint64_t bytes, KTimeMs_t start, KTimeMs_t now, bool running )
+{
+    KTimeMs_t elapsed = now - start;
+    uint64_t rec_per_sec = ( elapsed > 0 ) ? ( records * 1000 ) / elapsed : records;
+    uint64_t bytes_per_sec = ( elapsed > 0 ) ? ( bytes * 1000 ) / elapsed : bytes;
+    uint64_t rss = peak_rss();
+
+    if ( t->show_details )
+    {
+        KLockAcquire( t->lock );
+        KOutMsg( "%-6s : #%u, %lu records, %lu bytes in %lu ms ( %lu rec/s, %lu MB/s ), peak-rss %lu MB",
+                 stage, thread_id, records, bytes, elapsed, rec_per_sec, bytes_per_sec >> 20, rss >> 20 );
+        if ( t->mem_limit > 0 )
+            KOutMsg( " of %lu MB x %lu", t->mem_limit >> 20, t->num_threads );
+        KOutMsg( running ? " ...\n" : "\n" );
+        KLockUnlock( t->lock );
+    }
+    write_json_line( t, "{\"t\":%lu,\"stage\":\"%s\",\"thread\":%u,\"running\":%s,\"records\":%lu,\"bytes\":%lu,"
+                        "\"ms\":%lu,\"rec_per_s\":%lu,\"bytes_per_s\":%lu,\"peak_rss\":%lu,"
+                        "\"mem_limit\":%lu,\"threads\":%lu}",
+                     now - t->created, stage, thread_id, running ? "true" : "false", records, bytes,
+                     elapsed, rec_per_sec, bytes_per_sec, rss,
+                     t->mem_limit, t->num_threads );
+}
+
+
+void telemetry_stage( struct telemetry * t, const char * stage, uint32_t thread_id,
+                      uint64_t records, uint64_t bytes, KTimeMs_t start )
+{
+    if ( t != NULL )
+        report( t, stage, thread_id, records, bytes, start, KTimeMsStamp(), false );
+}
+
+
+void telemetry_tick_init( telemetry_tick * tick, const char * stage, uint32_t thread_id )
+{
+    tick->stage = stage;
+    tick->thread_id = thread_id;
+    tick->start = tick->last = KTimeMsStamp();
+    tick->checked = 0;
+}
+
+
+void telemetry_progress( struct telemetry * t, telemetry_tick * tick, uint64_t records, uint64_t bytes )
+{
+    if ( t != NULL && t->progress_ms > 0 && records - tick->checked >= TELEMETRY_CHECK_RECORDS )
+    {
+        KTimeMs_t now = KTimeMsStamp();
+        tick->checked = records;
+        if ( now - tick->last >= t->progress_ms )
+        {
+            tick->last = now;
+            report( t, tick->stage, tick->thread_id, records, bytes, tick->start, now, true );
+        }
+    }
+}
+
+
+/* copies s into dst as the content of a JSON-string, truncated to fit */
+static void json_escape( const char * s, char * dst, size_t dst_size )
+{
+    size_t i = 0;
+    for ( ; *s != 0 && i + 7 < dst_size; ++s )
+    {
+        unsigned char c = *s;
+        if ( c == '"' || c == '\\' )
+        {
+            dst[ i++ ] = '\\';
+            dst[ i++ ] = c;
+        }
+        else if ( c < 0x20 )
+        {
+            static const char hex[] = "0123456789abcdef";
+            dst[ i++ ] = '\\';
+            dst[ i++ ] = 'u';
+            dst[ i++ ] = '0';
+            dst[ i++ ] = '0';
+            dst[ i++ ] = hex[ c >> 4 ];
+            dst[ i++ ] = hex[ c & 0x0F ];
+        }
+        else
+            dst[ i++ ] = c;
+    }
+    dst[ i ] = 0;
+}
+
+
+/* free bytes on the filesystem of path, false if that cannot be found out */
+static bool free_space( const KDirectory * dir, const char * path, uint64_t * avail )
+{
+    bool res = false;
+#ifdef HAVE_POSIX_STATS
+    char native[ 4096 ];
+    if ( KDirectoryResolvePath( dir, true, native, sizeof native, "%s", path ) == 0 )
+    {
+        struct statvfs st;
+        if ( statvfs( native, &st ) == 0 )
+        {
+            *avail = ( uint64_t )st.f_bavail * st.f_frsize;
+            res = true;
+        }
+    }
+#endif
+    return res;
+}
+
+
+bool telemetry_check_space( struct telemetry * t, const KDirectory * dir, const char * path,
+                            uint64_t needed )
+{
+    bool res = true;
+    uint64_t avail = 0;
+    if ( path == NULL )
+        path = ".";
+    if ( free_space( dir, path, &avail ) )
+    {
+        res = ( avail >= needed );
+        if ( !res )
+            ErrMsg( "scratch-space on '%s': %lu bytes free, but about %lu bytes needed", path, avail, needed );
+        if ( t != NULL )
+        {
+            char escaped[ 512 ];
+            if ( t->show_details )
+                KOutMsg( "scratch : %lu MB free on '%s', about %lu MB needed\n", avail >> 20, path, needed >> 20 );
+            json_escape( path, escaped, sizeof escaped );
+            write_json_line( t, "{\"t\":%lu,\"stage\":\"scratch\",\"path\":\"%s\",\"free\":%lu,\"needed\":%lu}",
+                             KTimeMsStamp() - t->created, escaped, avail, needed );
+        }
+    }
+    return res;
+}
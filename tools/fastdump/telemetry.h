@@ -0,0 +1,99 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_telemetry_
+#define _h_telemetry_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _h_klib_rc_
+#include <klib/rc.h>
+#endif
+
+#ifndef _h_klib_time_
+#include <klib/time.h>
+#endif
+
+#ifndef _h_kfs_directory_
+#include <kfs/directory.h>
+#endif
+
+/* --------------------------------------------------------------------------------------------
+    what the stages of fastdump did and what they used:
+    records/s and bytes/s for every stage and thread, peak RSS against the mem-limit
+    and free space on the scratch-path against the projected need.
+    Printed with --details, written as JSON-lines into the file given with --telemetry.
+    All functions accept a NULL telemetry and do nothing then.
+-------------------------------------------------------------------------------------------- */
+
+struct telemetry;
+
+/* a running stage reports what it did so far every progress_ms ( 0 = only at the end ) */
+#define TELEMETRY_PROGRESS_MS 10000
+
+rc_t make_telemetry( struct telemetry ** t, KDirectory * dir, const char * json_filename,
+                     size_t mem_limit, uint64_t num_threads, uint32_t progress_ms,
+                     bool show_details );
+void release_telemetry( struct telemetry * t );
+
+/* a thread ( or the main-thread with thread_id 0 ) of a stage is done, it was started at start */
+void telemetry_stage( struct telemetry * t, const char * stage, uint32_t thread_id,
+                      uint64_t records, uint64_t bytes, KTimeMs_t start );
+
+/* the progress of one thread of a running stage */
+typedef struct telemetry_tick
+{
+    const char * stage;
+    uint32_t thread_id;
+    KTimeMs_t start;        /* of the stage */
+    KTimeMs_t last;         /* of the last report */
+    uint64_t checked;       /* records at the last look at the clock */
+} telemetry_tick;
+
+/* the clock is read only every that many records */
+#define TELEMETRY_CHECK_RECORDS 4096
+
+void telemetry_tick_init( telemetry_tick * tick, const char * stage, uint32_t thread_id );
+
+/* reports records and bytes so far if the progress-interval has passed since the last report,
+   cheap enough to be called for every record */
+void telemetry_progress( struct telemetry * t, telemetry_tick * tick, uint64_t records, uint64_t bytes );
+
+/* checks the free space at path ( NULL = current directory ) against needed bytes,
+   returns false if it is certain that there is not enough */
+bool telemetry_check_space( struct telemetry * t, const KDirectory * dir, const char * path,
+                            uint64_t needed );
+
+/* the maximum resident set size of the process so far, 0 if not known */
+uint64_t peak_rss( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -36,8 +36,6 @@
 #include <klib/printf.h>
 #include <klib/status.h>
 
-#include <kdb/btree.h>
-
 #include <kapp/progressbar.h>
 #include <kapp/main.h>
 
@@ -55,6 +53,7 @@
 #include "sequence-writer.h"
 #include "common-writer.h"
 #include "common-reader-priv.h"
+#include "../bam-loader/name-index.h"
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -90,35 +89,43 @@ typedef struct FragmentInfo {
 #include "mmarray.c"
 #undef MMA_ELEM_T
 
-rc_t OpenKBTree(const CommonWriterSettings* settings, struct KBTree **const rslt, size_t const n, size_t const max)
+static rc_t OpenNameIndex(const CommonWriterSettings* settings, NameIndex **const rslt, size_t const n)
 {
-    size_t const cacheSize = (((settings->cache_size - (settings->cache_size / 2) - (settings->cache_size / 8)) / max)
-                            + 0xFFFFF) & ~((size_t)0xFFFFF);
-    KFile *file = NULL;
-    KDirectory *dir;
-    char fname[4096];
-    rc_t rc;
+    char path[4096];
+    rc_t rc = string_printf(path, sizeof(path), NULL, "%s/key2id.%u.%u", settings->tmpfs, settings->pid, n);
 
-    rc = KDirectoryNativeDir(&dir);
-    if (rc)
-        return rc;
-
-    rc = string_printf(fname, sizeof(fname), NULL, "%s/key2id.%u.%u", settings->tmpfs, settings->pid, n); if (rc) return rc;
-    STSMSG(1, ("Path for scratch files: %s\n", fname));
-    rc = KDirectoryCreateFile(dir, &file, true, 0600, kcmInit, "%s", fname);
-    KDirectoryRemove(dir, 0, "%s", fname);
-    KDirectoryRelease(dir);
     if (rc == 0) {
-        rc = KBTreeMakeUpdate(rslt, file, cacheSize,
-                              false, kbtOpaqueKey,
-                              1, 255, sizeof ( uint32_t ),
-                              NULL
-                              );
-        KFileRelease(file);
+        STSMSG(1, ("Path for scratch files: %s\n", path));
+        rc = NameIndexMake(rslt, path, NAME_INDEX_DEFAULT_LOAD_FACTOR);
     }
     return rc;
 }
 
+static void LogNameIndexStats(SpotAssembler const *const ctx)
+{
+    uint64_t names = 0;
+    uint64_t lookups = 0;
+    uint64_t probes = 0;
+    uint64_t bytes = 0;
+    unsigned max_probe = 0;
+    size_t i;
+
+    for (i = 0; i != ctx->key2id_count; ++i) {
+        NameIndexStats stats;
+
+        NameIndexGetStats(ctx->key2id[i], &stats);
+        names += stats.count;
+        lookups += stats.lookups;
+        probes += stats.probes;
+        bytes += stats.bytes;
+        if (max_probe < stats.max_probe)
+            max_probe = stats.max_probe;
+    }
+    (void)PLOGMSG(klogInfo, (klogInfo, "key2id: $(names) names in $(indices) indices, $(bytes) bytes, $(probes) slots per lookup, longest probe $(max)",
+                             "names=%lu,indices=%u,bytes=%lu,probes=%.2f,max=%u",
+                             names, (unsigned)ctx->key2id_count, bytes, lookups ? (double)probes / lookups : 0.0, max_probe));
+}
+
 rc_t GetKeyIDOld(const CommonWriterSettings* settings, SpotAssembler* const ctx, uint64_t *const rslt, bool *const wasInserted, char const key[], char const name[], size_t const namelen)
 {
     size_t const keylen = strlen(key);
@@ -126,14 +133,14 @@ rc_t GetKeyIDOld(const CommonWriterSettings* settings, SpotAssembler* const ctx,
     uint64_t tmpKey;
 
     if (ctx->key2id_count == 0) {
-        rc = OpenKBTree(settings, &ctx->key2id[0], 1, 1);
+        rc = OpenNameIndex(settings, &ctx->key2id[0], 1);
         if (rc) return rc;
         ctx->key2id_count = 1;
     }
     if (keylen == 0 || memcmp(key, name, keylen) == 0) {
         /* qname starts with read group; no append */
         tmpKey = ctx->idCount[0];
-        rc = KBTreeEntry(ctx->key2id[0], &tmpKey, wasInserted, name, namelen);
+        rc = NameIndexEntry(ctx->key2id[0], &tmpKey, wasInserted, name, namelen);
     }
     else {
         char sbuf[4096];
@@ -151,7 +158,7 @@ rc_t GetKeyIDOld(const CommonWriterSettings* settings, SpotAssembler* const ctx,
         rc = string_printf(buf, bsize, &actsize, "%s\t%.*s", key, (int)namelen, name);
 
         tmpKey = ctx->idCount[0];
-        rc = KBTreeEntry(ctx->key2id[0], &tmpKey, wasInserted, buf, actsize);
+        rc = NameIndexEntry(ctx->key2id[0], &tmpKey, wasInserted, buf, actsize);
         if (hbuf)
             free(hbuf);
     }
@@ -262,8 +269,8 @@ rc_t GetKeyID(CommonWriterSettings *const settings,
         }
         if (ctx->key2id_count < ctx->key2id_max) {
             size_t const name_max = ctx->key2id_name_max + keylen + 1;
-            KBTree *tree;
-            rc_t rc = OpenKBTree(settings, &tree, ctx->key2id_count + 1, 1); /* ctx->key2id_max); */
+            NameIndex *tree;
+            rc_t rc = OpenNameIndex(settings, &tree, ctx->key2id_count + 1);
 
             if (rc) return rc;
 
@@ -306,7 +313,7 @@ rc_t GetKeyID(CommonWriterSettings *const settings,
             }
         GET_ID:
             tmpKey = ctx->idCount[f];
-            rc = KBTreeEntry(ctx->key2id[f], &tmpKey, wasInserted, name, namelen);
+            rc = NameIndexEntry(ctx->key2id[f], &tmpKey, wasInserted, name, namelen);
             if (rc == 0) {
                 *rslt = (((uint64_t)f) << 32) | tmpKey;
                 if (*wasInserted)
@@ -1611,9 +1618,9 @@ rc_t CommonWriterComplete(CommonWriter* self, bool quitting, uint64_t maxDistanc
     rc_t rc=0;
     /*** No longer need memory for key2id ***/
     size_t i;
+    LogNameIndexStats(&self->ctx);
     for (i = 0; i != self->ctx.key2id_count; ++i) {
-        KBTreeDropBacking(self->ctx.key2id[i]);
-        KBTreeRelease(self->ctx.key2id[i]);
+        NameIndexWhack(self->ctx.key2id[i]);
         self->ctx.key2id[i] = NULL;
     }
     free(self->ctx.key2id_names);
@@ -31,7 +31,7 @@
 struct VDBManager;
 struct VDatabase;
 struct KMemBank;
-struct KBTree;
+struct NameIndex;
 struct KLoadProgressbar;
 struct ReaderFile;
 struct CommonWriter;
@@ -115,7 +115,7 @@ typedef struct CommonWriterSettings
 
 typedef struct SpotAssembler {
     const struct KLoadProgressbar *progress[4];
-    struct KBTree *key2id[NUM_ID_SPACES];
+    struct NameIndex *key2id[NUM_ID_SPACES];
     char *key2id_names;
     struct MMArray *id2value;
     int64_t spotId;
@@ -0,0 +1,593 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "bam_index.h"
+#include "bgzf_out.h"
+
+#include <klib/log.h>
+#include <kfs/file.h>
+#include <sysalloc.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BAI_MIN_SHIFT 14
+#define BAI_DEPTH 5
+#define NO_OFFSET ( ( uint64_t )-1 )
+
+typedef struct bam_chunk
+{
+    uint64_t beg;
+    uint64_t end;
+} bam_chunk;
+
+
+typedef struct bam_bin
+{
+    uint32_t bin;
+    uint32_t count;
+    uint32_t capacity;
+    bam_chunk * chunk;
+} bam_bin;
+
+
+typedef struct bam_ref_index
+{
+    bam_bin * bin;
+    uint32_t bin_count;
+    uint32_t bin_capacity;
+    uint64_t * linear;          /* offset of the first record overlapping each window */
+    uint32_t linear_count;      /* up to the last window a record reaches */
+    uint32_t linear_capacity;
+    uint64_t off_beg;           /* first record of this reference */
+    uint64_t off_end;           /* behind the last record of this reference */
+    uint64_t mapped;
+    uint64_t unmapped;
+    bool seen;
+} bam_ref_index;
+
+
+struct bam_index
+{
+    bam_ref_index * ref;
+    int32_t * slot;             /* where a bin of the current reference is in ref->bin, -1 if not there yet */
+    uint32_t ref_count;
+    uint32_t bin_count;         /* how many bins min_shift and depth give */
+    uint32_t min_shift;
+    uint32_t depth;
+    int32_t last_ref;
+    int64_t last_pos;
+    uint64_t no_coor;           /* unplaced records */
+    bool csi;
+    bool unsorted;
+    bool tail;                  /* unplaced records have started */
+};
+
+
+uint32_t bam_reg2bin( int64_t beg, int64_t end, uint32_t min_shift, uint32_t depth )
+{
+    uint32_t l = depth, s = min_shift, t = ( ( 1u << ( depth * 3 ) ) - 1 ) / 7;
+    for ( --end; l > 0; --l, s += 3, t -= 1u << ( l * 3 ) )
+    {
+        if ( ( beg >> s ) == ( end >> s ) )
+            return t + ( uint32_t )( beg >> s );
+    }
+    return 0;
+}
+
+
+/* the window of the first position a bin covers */
+static uint64_t bin_first_window( uint32_t bin, uint32_t depth )
+{
+    uint32_t l = 0, b;
+    for ( b = bin; b > 0; b = ( b - 1 ) >> 3 )
+        l++;
+    return ( uint64_t )( bin - ( ( 1u << ( l * 3 ) ) - 1 ) / 7 ) << ( ( depth - l ) * 3 );
+}
+
+
+void bam_index_release( bam_index * self )
+{
+    if ( self != NULL )
+    {
+        uint32_t idx, b;
+        for ( idx = 0; idx < self->ref_count; ++idx )
+        {
+            bam_ref_index * r = &self->ref[ idx ];
+            for ( b = 0; b < r->bin_count; ++b )
+                free( r->bin[ b ].chunk );
+            free( r->bin );
+            free( r->linear );
+        }
+        free( self->ref );
+        free( self->slot );
+        free( self );
+    }
+}
+
+
+rc_t bam_index_make( bam_index ** self, enum bam_index_kind kind,
+                     uint32_t ref_count, const uint64_t * ref_len )
+{
+    rc_t rc = 0;
+    uint64_t max_len = 0;
+    uint32_t idx, depth = BAI_DEPTH;
+    bam_index * o;
+
+    for ( idx = 0; idx < ref_count; ++idx )
+    {
+        if ( ref_len[ idx ] > max_len )
+            max_len = ref_len[ idx ];
+    }
+    if ( kind == bik_csi )
+    {
+        /* as many levels as the longest reference needs */
+        uint64_t s = 1ull << BAI_MIN_SHIFT;
+        for ( depth = 0, max_len += 256; max_len > s; s <<= 3 )
+            depth++;
+    }
+    else if ( max_len > ( 1ull << 29 ) )
+    {
+        rc = RC( rcExe, rcIndex, rcConstructing, rcRange, rcExcessive );
+        LOGERR( klogErr, rc, "reference too long for a BAI-index, use CSI instead" );
+        return rc;
+    }
+
+    o = calloc( 1, sizeof *o );
+    if ( o == NULL )
+        return RC( rcExe, rcIndex, rcConstructing, rcMemory, rcExhausted );
+    o->ref_count = ref_count;
+    o->min_shift = BAI_MIN_SHIFT;
+    o->depth = depth;
+    o->bin_count = ( ( 1u << ( 3 * ( depth + 1 ) ) ) - 1 ) / 7;
+    o->csi = ( kind == bik_csi );
+    o->last_ref = -1;
+    o->ref = calloc( ref_count + 1, sizeof o->ref[ 0 ] );
+    o->slot = malloc( o->bin_count * sizeof o->slot[ 0 ] );
+    if ( o->ref == NULL || o->slot == NULL )
+    {
+        bam_index_release( o );
+        return RC( rcExe, rcIndex, rcConstructing, rcMemory, rcExhausted );
+    }
+    memset( o->slot, 0xFF, o->bin_count * sizeof o->slot[ 0 ] );
+    *self = o;
+    return rc;
+}
+
+
+static rc_t new_bin( bam_ref_index * r, uint32_t bin, int32_t * s )
+{
+    if ( r->bin_count == r->bin_capacity )
+    {
+        uint32_t new_capacity = r->bin_capacity ? r->bin_capacity * 2 : 64;
+        bam_bin * tmp = realloc( r->bin, new_capacity * sizeof tmp[ 0 ] );
+        if ( tmp == NULL )
+            return RC( rcExe, rcIndex, rcInserting, rcMemory, rcExhausted );
+        r->bin = tmp;
+        r->bin_capacity = new_capacity;
+    }
+    *s = r->bin_count++;
+    memset( &r->bin[ *s ], 0, sizeof r->bin[ *s ] );
+    r->bin[ *s ].bin = bin;
+    return 0;
+}
+
+
+static rc_t append_chunk( bam_bin * b, uint64_t beg, uint64_t end )
+{
+    /* a record starting in the block the last chunk of the bin ends in extends that chunk */
+    if ( b->count > 0 && ( b->chunk[ b->count - 1 ].end >> 16 ) == ( beg >> 16 ) )
+    {
+        b->chunk[ b->count - 1 ].end = end;
+        return 0;
+    }
+    if ( b->count == b->capacity )
+    {
+        uint32_t new_capacity = b->capacity ? b->capacity * 2 : 2;
+        bam_chunk * tmp = realloc( b->chunk, new_capacity * sizeof tmp[ 0 ] );
+        if ( tmp == NULL )
+            return RC( rcExe, rcIndex, rcInserting, rcMemory, rcExhausted );
+        b->chunk = tmp;
+        b->capacity = new_capacity;
+    }
+    b->chunk[ b->count ].beg = beg;
+    b->chunk[ b->count ].end = end;
+    b->count++;
+    return 0;
+}
+
+
+static rc_t add_chunk( bam_index * self, bam_ref_index * r, uint32_t bin, uint64_t beg, uint64_t end )
+{
+    rc_t rc = 0;
+    int32_t s = self->slot[ bin ];
+    if ( s < 0 )
+    {
+        rc = new_bin( r, bin, &s );
+        if ( rc == 0 )
+            self->slot[ bin ] = s;
+    }
+    if ( rc == 0 )
+        rc = append_chunk( &r->bin[ s ], beg, end );
+    return rc;
+}
+
+
+static rc_t reserve_linear( bam_ref_index * r, uint32_t window )
+{
+    if ( window >= r->linear_capacity )
+    {
+        uint32_t w, new_capacity = r->linear_capacity ? r->linear_capacity * 2 : 1024;
+        uint64_t * tmp;
+        if ( new_capacity <= window )
+            new_capacity = window + 1;
+        tmp = realloc( r->linear, new_capacity * sizeof tmp[ 0 ] );
+        if ( tmp == NULL )
+            return RC( rcExe, rcIndex, rcInserting, rcMemory, rcExhausted );
+        for ( w = r->linear_capacity; w < new_capacity; ++w )
+            tmp[ w ] = NO_OFFSET;
+        r->linear = tmp;
+        r->linear_capacity = new_capacity;
+    }
+    return 0;
+}
+
+
+static rc_t add_linear( bam_ref_index * r, int64_t beg, int64_t end, uint64_t off, uint32_t min_shift )
+{
+    uint32_t w, first = ( uint32_t )( beg >> min_shift ), last = ( uint32_t )( ( end - 1 ) >> min_shift );
+    rc_t rc = reserve_linear( r, last );
+    if ( rc != 0 )
+        return rc;
+    if ( last >= r->linear_count )
+        r->linear_count = last + 1;
+    /* the records come sorted, the first one to reach a window has the smallest offset */
+    for ( w = first; w <= last; ++w )
+    {
+        if ( r->linear[ w ] == NO_OFFSET )
+            r->linear[ w ] = off;
+    }
+    return 0;
+}
+
+
+/* a reference that is finished already: the windows up to window are filled like finish_ref() does */
+static rc_t extend_linear( bam_ref_index * r, uint32_t window )
+{
+    rc_t rc = 0;
+    if ( window >= r->linear_count )
+    {
+        uint64_t prev = ( r->linear_count > 0 ) ? r->linear[ r->linear_count - 1 ] : r->off_beg;
+        rc = reserve_linear( r, window );
+        if ( rc == 0 )
+        {
+            uint32_t w;
+            for ( w = r->linear_count; w <= window; ++w )
+                r->linear[ w ] = prev;
+            r->linear_count = window + 1;
+        }
+    }
+    return rc;
+}
+
+
+static void finish_ref( bam_index * self, bam_ref_index * r )
+{
+    uint32_t idx;
+    uint64_t prev = r->off_beg;
+
+    for ( idx = 0; idx < r->bin_count; ++idx )
+        self->slot[ r->bin[ idx ].bin ] = -1;
+
+    /* empty windows get the offset of the window before */
+    for ( idx = 0; idx < r->linear_count; ++idx )
+    {
+        if ( r->linear[ idx ] == NO_OFFSET )
+            r->linear[ idx ] = prev;
+        else
+            prev = r->linear[ idx ];
+    }
+}
+
+
+/* a placed but unmapped mate printed after its reference is done ( sam-dump prints half-aligned
+   mates at the end ): its chunk goes into the bin of its position behind the chunks already there,
+   a reader looking at that position still finds it */
+static rc_t add_late_unmapped( bam_index * self, int32_t ref_id, int64_t beg,
+                               uint64_t voff_beg, uint64_t voff_end )
+{
+    rc_t rc = 0;
+    bam_ref_index * r = &self->ref[ ref_id ];
+    uint32_t bin = bam_reg2bin( beg, beg + 1, self->min_shift, self->depth );
+
+    if ( ref_id == self->last_ref )
+    {
+        rc = add_chunk( self, r, bin, voff_beg, voff_end );
+        if ( rc == 0 )
+            rc = add_linear( r, beg, beg + 1, voff_beg, self->min_shift );
+    }
+    else
+    {
+        int32_t s;
+        if ( !r->seen )
+        {
+            r->seen = true;
+            r->off_beg = voff_beg;
+        }
+        for ( s = 0; s < ( int32_t )r->bin_count && r->bin[ s ].bin != bin; ++s ) { }
+        if ( s == ( int32_t )r->bin_count )
+            rc = new_bin( r, bin, &s );
+        if ( rc == 0 )
+            rc = append_chunk( &r->bin[ s ], voff_beg, voff_end );
+        if ( rc == 0 )
+            rc = extend_linear( r, ( uint32_t )( beg >> self->min_shift ) );
+    }
+    if ( rc == 0 )
+    {
+        r->off_end = voff_end;
+        r->unmapped++;
+    }
+    return rc;
+}
+
+
+rc_t bam_index_push( bam_index * self, int32_t ref_id, int64_t beg, int64_t end, bool mapped,
+                     uint64_t voff_beg, uint64_t voff_end )
+{
+    rc_t rc;
+    bam_ref_index * r;
+    bool in_order;
+
+    if ( self->unsorted )
+        return 0;
+    if ( ref_id < 0 || beg < 0 )
+    {
+        self->no_coor++;
+        self->tail = true;
+        return 0;
+    }
+    if ( ( uint32_t )ref_id >= self->ref_count )
+        return RC( rcExe, rcIndex, rcInserting, rcId, rcOutofrange );
+
+    r = &self->ref[ ref_id ];
+    if ( ref_id == self->last_ref )
+        in_order = !self->tail && beg >= self->last_pos;
+    else
+        in_order = !self->tail && !r->seen;
+    if ( !in_order )
+    {
+        if ( !mapped )
+            return add_late_unmapped( self, ref_id, beg, voff_beg, voff_end );
+        self->unsorted = true;
+        return 0;
+    }
+
+    if ( ref_id != self->last_ref )
+    {
+        if ( self->last_ref >= 0 )
+            finish_ref( self, &self->ref[ self->last_ref ] );
+        self->last_ref = ref_id;
+        r->seen = true;
+        r->off_beg = voff_beg;
+    }
+    self->last_pos = beg;
+    if ( end <= beg )
+        end = beg + 1;
+
+    rc = add_chunk( self, r, bam_reg2bin( beg, end, self->min_shift, self->depth ), voff_beg, voff_end );
+    if ( rc == 0 )
+        rc = add_linear( r, beg, end, voff_beg, self->min_shift );
+    if ( rc == 0 )
+    {
+        r->off_end = voff_end;
+        if ( mapped )
+            r->mapped++;
+        else
+            r->unmapped++;
+    }
+    return rc;
+}
+
+
+bool bam_index_sorted( const bam_index * self )
+{
+    return !self->unsorted;
+}
+
+
+/* ---------------------------------------------------------------------------------------------- */
+
+typedef struct index_writer
+{
+    struct KFile * dst;
+    bgzf_out * bgzf;            /* CSI is BGZF-compressed, BAI is not */
+    const bgzf_out * bam;       /* to translate the offsets */
+    uint64_t pos;
+    uint32_t len;
+    uint8_t buffer[ 64 * 1024 ];
+} index_writer;
+
+
+static rc_t iw_flush( index_writer * w )
+{
+    rc_t rc = 0;
+    if ( w->len > 0 )
+    {
+        if ( w->bgzf != NULL )
+            rc = bgzf_out_write( w->bgzf, w->buffer, w->len );
+        else
+        {
+            size_t num_writ;
+            rc = KFileWriteAll( w->dst, w->pos, w->buffer, w->len, &num_writ );
+            if ( rc == 0 && num_writ != w->len )
+                rc = RC( rcExe, rcFile, rcWriting, rcTransfer, rcIncomplete );
+            w->pos += w->len;
+        }
+        w->len = 0;
+    }
+    return rc;
+}
+
+
+static rc_t iw_put( index_writer * w, const void * data, uint32_t len )
+{
+    rc_t rc = 0;
+    if ( w->len + len > sizeof w->buffer )
+        rc = iw_flush( w );
+    if ( rc == 0 )
+    {
+        memmove( &w->buffer[ w->len ], data, len );
+        w->len += len;
+    }
+    return rc;
+}
+
+
+static rc_t iw_u32( index_writer * w, uint32_t value )
+{
+    uint8_t b[ 4 ];
+    b[ 0 ] = value & 0xFF;
+    b[ 1 ] = ( value >> 8 ) & 0xFF;
+    b[ 2 ] = ( value >> 16 ) & 0xFF;
+    b[ 3 ] = ( value >> 24 ) & 0xFF;
+    return iw_put( w, b, sizeof b );
+}
+
+
+static rc_t iw_u64( index_writer * w, uint64_t value )
+{
+    rc_t rc = iw_u32( w, ( uint32_t )value );
+    if ( rc == 0 )
+        rc = iw_u32( w, ( uint32_t )( value >> 32 ) );
+    return rc;
+}
+
+
+static rc_t iw_voff( index_writer * w, uint64_t pending )
+{
+    return iw_u64( w, bgzf_out_voffset( w->bam, pending ) );
+}
+
+
+static rc_t write_ref( bam_index * self, index_writer * w, const bam_ref_index * r )
+{
+    uint32_t b, c;
+    rc_t rc = iw_u32( w, r->bin_count + ( r->seen ? 1 : 0 ) );
+    for ( b = 0; rc == 0 && b < r->bin_count; ++b )
+    {
+        const bam_bin * bin = &r->bin[ b ];
+        rc = iw_u32( w, bin->bin );
+        if ( rc == 0 && self->csi )
+        {
+            uint64_t first = bin_first_window( bin->bin, self->depth );
+            rc = ( first < r->linear_count ) ? iw_voff( w, r->linear[ first ] ) : iw_u64( w, 0 );
+        }
+        if ( rc == 0 )
+            rc = iw_u32( w, bin->count );
+        for ( c = 0; rc == 0 && c < bin->count; ++c )
+        {
+            rc = iw_voff( w, bin->chunk[ c ].beg );
+            if ( rc == 0 )
+                rc = iw_voff( w, bin->chunk[ c ].end );
+        }
+    }
+
+    /* the pseudo-bin with the extent of the reference and the record-counts */
+    if ( rc == 0 && r->seen )
+    {
+        rc = iw_u32( w, self->bin_count + 1 );
+        if ( rc == 0 && self->csi )
+            rc = iw_u64( w, 0 );
+        if ( rc == 0 )
+            rc = iw_u32( w, 2 );
+        if ( rc == 0 )
+            rc = iw_voff( w, r->off_beg );
+        if ( rc == 0 )
+            rc = iw_voff( w, r->off_end );
+        if ( rc == 0 )
+            rc = iw_u64( w, r->mapped );
+        if ( rc == 0 )
+            rc = iw_u64( w, r->unmapped );
+    }
+
+    if ( rc == 0 && !self->csi )
+    {
+        rc = iw_u32( w, r->linear_count );
+        for ( c = 0; rc == 0 && c < r->linear_count; ++c )
+            rc = iw_voff( w, r->linear[ c ] );
+    }
+    return rc;
+}
+
+
+rc_t bam_index_write( bam_index * self, struct KFile * dst, const struct bgzf_out * bam )
+{
+    rc_t rc = 0;
+    uint32_t idx;
+    index_writer * w = calloc( 1, sizeof *w );
+    if ( w == NULL )
+        return RC( rcExe, rcIndex, rcWriting, rcMemory, rcExhausted );
+
+    w->dst = dst;
+    w->bam = bam;
+    if ( self->last_ref >= 0 )
+    {
+        finish_ref( self, &self->ref[ self->last_ref ] );
+        self->last_ref = -1;
+    }
+
+    if ( self->csi )
+    {
+        rc = bgzf_out_make( &w->bgzf, dst, 0, 0 );
+        if ( rc == 0 )
+            rc = iw_put( w, "CSI\1", 4 );
+        if ( rc == 0 )
+            rc = iw_u32( w, self->min_shift );
+        if ( rc == 0 )
+            rc = iw_u32( w, self->depth );
+        if ( rc == 0 )
+            rc = iw_u32( w, 0 );    /* no auxiliary data */
+    }
+    else
+        rc = iw_put( w, "BAI\1", 4 );
+
+    if ( rc == 0 )
+        rc = iw_u32( w, self->ref_count );
+    for ( idx = 0; rc == 0 && idx < self->ref_count; ++idx )
+        rc = write_ref( self, w, &self->ref[ idx ] );
+    if ( rc == 0 )
+        rc = iw_u64( w, self->no_coor );
+    if ( rc == 0 )
+        rc = iw_flush( w );
+    if ( rc == 0 && w->bgzf != NULL )
+        rc = bgzf_out_finish( w->bgzf );
+    if ( rc != 0 )
+        LOGERR( klogErr, rc, "cannot write BAM-index" );
+
+    bgzf_out_release( w->bgzf );
+    free( w );
+    return rc;
+}
@@ -0,0 +1,75 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_bam_index_
+#define _h_bam_index_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <klib/rc.h>
+
+struct KFile;
+struct bgzf_out;
+
+enum bam_index_kind
+{
+    bik_none = 0,
+    bik_bai,        /* 16k windows, 6 levels, references up to 512M */
+    bik_csi         /* levels sized to the longest reference, BGZF-compressed */
+};
+
+/* the BAI/CSI index of a BAM-file, built while the records are written:
+   bins, chunks and the linear index of every reference, the records have to come sorted
+   by position and each reference in one piece. Placed but unmapped records out of that order
+   ( sam-dump prints half-aligned mates at the end ) are added to the bin of their position,
+   a mapped record out of order makes the index unusable ( bam_index_sorted() ) */
+
+typedef struct bam_index bam_index;
+
+rc_t bam_index_make( bam_index ** self, enum bam_index_kind kind,
+                     uint32_t ref_count, const uint64_t * ref_len );
+void bam_index_release( bam_index * self );
+
+/* beg/end are the 0-based range the record covers on the reference,
+   voff_beg/voff_end the pending positions from bgzf_out_tell() around the record */
+rc_t bam_index_push( bam_index * self, int32_t ref_id, int64_t beg, int64_t end, bool mapped,
+                     uint64_t voff_beg, uint64_t voff_end );
+
+bool bam_index_sorted( const bam_index * self );
+
+/* after bgzf_out_finish() of the BAM-file */
+rc_t bam_index_write( bam_index * self, struct KFile * dst, const struct bgzf_out * bam );
+
+/* the bin of the range [ beg, end ) */
+uint32_t bam_reg2bin( int64_t beg, int64_t end, uint32_t min_shift, uint32_t depth );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
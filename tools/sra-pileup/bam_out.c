@@ -0,0 +1,258 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "bam_out.h"
+#include "bam_rec.h"
+#include "bgzf_out.h"
+#include "out_buf.h"
+
+#include <klib/log.h>
+#include <kfs/file.h>
+#include <sysalloc.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+struct bam_out
+{
+    bgzf_out * bgzf;
+    bam_index * index;
+    bam_ref_dict refs;
+    out_buf header;         /* the SAM-header until the first record */
+    out_buf partial;        /* the beginning of a line not finished by the last write */
+    out_buf rec;            /* the record being encoded */
+    enum bam_index_kind index_kind;
+    bool header_done;
+};
+
+
+void bam_out_release( bam_out * self )
+{
+    if ( self != NULL )
+    {
+        bgzf_out_release( self->bgzf );
+        bam_index_release( self->index );
+        bam_ref_dict_release( &self->refs );
+        out_buf_release( &self->header );
+        out_buf_release( &self->partial );
+        out_buf_release( &self->rec );
+        free( self );
+    }
+}
+
+
+rc_t bam_out_make( bam_out ** self, struct KFile * dst, enum bam_index_kind kind, uint32_t threads )
+{
+    rc_t rc;
+    bam_out * o = calloc( 1, sizeof *o );
+    if ( o == NULL )
+        return RC( rcExe, rcFile, rcConstructing, rcMemory, rcExhausted );
+
+    o->index_kind = kind;
+    bam_ref_dict_init( &o->refs );
+    out_buf_init( &o->header, NULL, 0 );
+    out_buf_init( &o->partial, NULL, 0 );
+    out_buf_init( &o->rec, NULL, 0 );
+    rc = bgzf_out_make( &o->bgzf, dst, 0, threads );
+    if ( rc == 0 )
+        *self = o;
+    else
+        bam_out_release( o );
+    return rc;
+}
+
+
+/* the header goes into a block of its own, the first record starts a new one */
+static rc_t write_header( bam_out * self )
+{
+    rc_t rc = bam_ref_dict_seal( &self->refs );
+    if ( rc == 0 )
+        rc = bam_header_encode( &self->refs, self->header.data, self->header.len, &self->rec );
+    if ( rc == 0 )
+        rc = bgzf_out_write( self->bgzf, self->rec.data, self->rec.len );
+    if ( rc == 0 )
+        rc = bgzf_out_keep_together( self->bgzf, BGZF_BLOCK_DATA );
+    if ( rc == 0 && self->index_kind != bik_none )
+        rc = bam_index_make( &self->index, self->index_kind, self->refs.count, self->refs.len );
+    self->rec.len = 0;
+    self->header.len = 0;
+    self->header_done = true;
+    return rc;
+}
+
+
+rc_t bam_out_end_header( bam_out * self )
+{
+    return self->header_done ? 0 : write_header( self );
+}
+
+
+const struct bam_ref_dict * bam_out_refs( const bam_out * self )
+{
+    return &self->refs;
+}
+
+
+static rc_t put_record( bam_out * self, const char * rec, size_t len, const bam_rec_info * info )
+{
+    uint64_t voff_beg;
+    rc_t rc = bgzf_out_keep_together( self->bgzf, len );
+    voff_beg = bgzf_out_tell( self->bgzf );
+    if ( rc == 0 )
+        rc = bgzf_out_write( self->bgzf, rec, len );
+    if ( rc == 0 && self->index != NULL )
+        rc = bam_index_push( self->index, info->ref_id, info->beg, info->end, info->mapped,
+                             voff_beg, bgzf_out_tell( self->bgzf ) );
+    return rc;
+}
+
+
+rc_t bam_out_records( bam_out * self, const char * data, size_t len )
+{
+    rc_t rc = 0;
+    size_t at = 0;
+
+    /* the SAM-text printed before has to be complete lines, else the order is lost */
+    if ( self->partial.len > 0 )
+    {
+        rc = RC( rcExe, rcFile, rcWriting, rcData, rcUnexpected );
+        (void)LOGERR( klogInt, rc, "binary BAM-record in the middle of a SAM-line" );
+        return rc;
+    }
+    rc = bam_out_end_header( self );
+    while ( rc == 0 && at < len )
+    {
+        bam_rec_info info;
+        const uint8_t * rec = ( const uint8_t * )&data[ at ];
+        size_t rec_len = 0;
+        if ( len - at >= 4 )    /* block_size */
+            rec_len = 4 + ( size_t )( rec[ 0 ] | ( rec[ 1 ] << 8 ) | ( rec[ 2 ] << 16 ) | ( ( uint32_t )rec[ 3 ] << 24 ) );
+        if ( rec_len == 0 || rec_len > len - at || !bam_rec_info_of( rec, rec_len, &info ) )
+        {
+            rc = RC( rcExe, rcFile, rcWriting, rcData, rcInsufficient );
+            (void)LOGERR( klogInt, rc, "truncated binary BAM-record" );
+        }
+        else
+        {
+            rc = put_record( self, &data[ at ], rec_len, &info );
+            at += rec_len;
+        }
+    }
+    return rc;
+}
+
+
+static rc_t on_line( bam_out * self, const char * line, size_t len )
+{
+    rc_t rc = 0;
+    bam_rec_info info;
+
+    if ( len == 0 )
+        return 0;
+    if ( !self->header_done )
+    {
+        if ( line[ 0 ] == '@' )
+        {
+            rc = bam_ref_dict_add_line( &self->refs, line, len );
+            if ( rc == 0 )
+                rc = out_buf_mem( &self->header, line, len );
+            if ( rc == 0 )
+                rc = out_buf_char( &self->header, '\n' );
+            return rc;
+        }
+        rc = write_header( self );
+    }
+
+    self->rec.len = 0;
+    if ( rc == 0 )
+        rc = bam_rec_encode( &self->refs, line, len, &self->rec, &info );
+    if ( rc == 0 )
+        rc = put_record( self, self->rec.data, self->rec.len, &info );
+    return rc;
+}
+
+
+rc_t bam_out_write( bam_out * self, const char * text, size_t len )
+{
+    rc_t rc = 0;
+    const char * end = text + len;
+
+    /* complete the line started by an earlier write */
+    if ( self->partial.len > 0 )
+    {
+        const char * lf = memchr( text, '\n', len );
+        if ( lf == NULL )
+            return out_buf_mem( &self->partial, text, len );
+        rc = out_buf_mem( &self->partial, text, lf - text );
+        if ( rc == 0 )
+            rc = on_line( self, self->partial.data, self->partial.len );
+        self->partial.len = 0;
+        text = lf + 1;
+    }
+
+    while ( rc == 0 && text < end )
+    {
+        const char * lf = memchr( text, '\n', end - text );
+        if ( lf == NULL )
+        {
+            rc = out_buf_mem( &self->partial, text, end - text );
+            break;
+        }
+        rc = on_line( self, text, lf - text );
+        text = lf + 1;
+    }
+    return rc;
+}
+
+
+rc_t bam_out_finish( bam_out * self )
+{
+    rc_t rc = 0;
+    if ( self->partial.len > 0 )
+    {
+        rc = on_line( self, self->partial.data, self->partial.len );
+        self->partial.len = 0;
+    }
+    if ( rc == 0 && !self->header_done )
+        rc = write_header( self );
+    if ( rc == 0 )
+        rc = bgzf_out_finish( self->bgzf );
+    if ( rc == 0 && self->index != NULL && !bam_index_sorted( self->index ) )
+        (void)LOGMSG( klogWarn, "the output is not sorted by position, no index written" );
+    return rc;
+}
+
+
+bool bam_out_indexed( const bam_out * self )
+{
+    return ( self->index != NULL && bam_index_sorted( self->index ) );
+}
+
+
+rc_t bam_out_write_index( bam_out * self, struct KFile * dst )
+{
+    return bam_index_write( self->index, dst, self->bgzf );
+}
@@ -0,0 +1,72 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_bam_out_
+#define _h_bam_out_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <klib/rc.h>
+#include "bam_index.h"
+
+struct KFile;
+
+/* the BAM-file sam-dump writes: the header-lines are collected as SAM-text until the
+   first record, the records come either as binary BAM-records encoded by the printers or
+   as SAM-lines encoded here, they are BGZF-compressed by a pool of threads and optionally
+   indexed in the same pass */
+
+typedef struct bam_out bam_out;
+
+rc_t bam_out_make( bam_out ** self, struct KFile * dst, enum bam_index_kind kind, uint32_t threads );
+void bam_out_release( bam_out * self );
+
+/* any part of the SAM-text, lines can be split over calls */
+rc_t bam_out_write( bam_out * self, const char * text, size_t len );
+
+/* no more header-lines: writes the header, after that bam_out_refs() can be used */
+rc_t bam_out_end_header( bam_out * self );
+
+/* the references of the header, to encode records with, does not change any more */
+const struct bam_ref_dict * bam_out_refs( const bam_out * self );
+
+/* whole binary records ( made with bam_rec_begin() ... bam_rec_end() ), one after the other */
+rc_t bam_out_records( bam_out * self, const char * data, size_t len );
+
+/* writes what is left and the EOF-marker */
+rc_t bam_out_finish( bam_out * self );
+
+/* after bam_out_finish(): if an index was requested and the records came in order */
+bool bam_out_indexed( const bam_out * self );
+rc_t bam_out_write_index( bam_out * self, struct KFile * dst );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
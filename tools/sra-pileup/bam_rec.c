@@ -0,0 +1,722 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "bam_rec.h"
+#include "bam_index.h"
+
+#include <klib/log.h>
+#include <klib/sort.h>
+#include <sysalloc.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SAM_FIELDS 11
+#define BAM_FIXED_SIZE 36   /* block_size and the fixed part of a record */
+
+/* 4-bit base codes of "=ACMGRSVTWYHKDBN" plus one, zero means N */
+static const uint8_t seq_code[ 256 ] =
+{
+    [ '=' ] = 1,
+    [ 'A' ] = 2, [ 'C' ] = 3, [ 'M' ] = 4, [ 'G' ] = 5, [ 'R' ] = 6, [ 'S' ] = 7, [ 'V' ] = 8,
+    [ 'T' ] = 9, [ 'W' ] = 10, [ 'Y' ] = 11, [ 'H' ] = 12, [ 'K' ] = 13, [ 'D' ] = 14, [ 'B' ] = 15,
+    [ 'a' ] = 2, [ 'c' ] = 3, [ 'm' ] = 4, [ 'g' ] = 5, [ 'r' ] = 6, [ 's' ] = 7, [ 'v' ] = 8,
+    [ 't' ] = 9, [ 'w' ] = 10, [ 'y' ] = 11, [ 'h' ] = 12, [ 'k' ] = 13, [ 'd' ] = 14, [ 'b' ] = 15
+};
+
+/* cigar-operation codes plus one, zero means invalid */
+static const uint8_t cigar_code[ 256 ] =
+{
+    [ 'M' ] = 1, [ 'I' ] = 2, [ 'D' ] = 3, [ 'N' ] = 4, [ 'S' ] = 5,
+    [ 'H' ] = 6, [ 'P' ] = 7, [ '=' ] = 8, [ 'X' ] = 9
+};
+
+
+static rc_t bad_sam( const char * what )
+{
+    rc_t rc = RC( rcExe, rcData, rcConverting, rcFormat, rcInvalid );
+    (void)PLOGERR( klogErr, ( klogErr, rc, "cannot convert SAM-line into BAM-record: invalid $(f)", "f=%s", what ) );
+    return rc;
+}
+
+
+static uint8_t * put_u16( uint8_t * p, uint32_t value )
+{
+    p[ 0 ] = value & 0xFF;
+    p[ 1 ] = ( value >> 8 ) & 0xFF;
+    return p + 2;
+}
+
+
+static uint8_t * put_u32( uint8_t * p, uint32_t value )
+{
+    return put_u16( put_u16( p, value ), value >> 16 );
+}
+
+
+static rc_t append( out_buf * dst, const void * data, size_t len )
+{
+    return out_buf_mem( dst, data, len );
+}
+
+
+static rc_t append_u32( out_buf * dst, uint32_t value )
+{
+    uint8_t b[ 4 ];
+    put_u32( b, value );
+    return append( dst, b, sizeof b );
+}
+
+
+static bool parse_i64( const char * s, size_t len, int64_t * value )
+{
+    size_t i = 0;
+    uint64_t v = 0;
+    bool neg = false;
+
+    if ( len > 0 && ( s[ 0 ] == '-' || s[ 0 ] == '+' ) )
+    {
+        neg = ( s[ 0 ] == '-' );
+        i = 1;
+    }
+    if ( i == len || len - i > 18 )
+        return false;
+    for ( ; i < len; ++i )
+    {
+        if ( s[ i ] < '0' || s[ i ] > '9' )
+            return false;
+        v = v * 10 + ( s[ i ] - '0' );
+    }
+    *value = neg ? -( int64_t )v : ( int64_t )v;
+    return true;
+}
+
+
+static bool parse_float( const char * s, size_t len, float * value )
+{
+    char buffer[ 64 ];
+    char * endp;
+    if ( len == 0 || len >= sizeof buffer )
+        return false;
+    memmove( buffer, s, len );
+    buffer[ len ] = 0;
+    *value = ( float )strtod( buffer, &endp );
+    return ( *endp == 0 );
+}
+
+
+static uint32_t float_bits( float value )
+{
+    uint32_t bits;
+    memmove( &bits, &value, sizeof bits );
+    return bits;
+}
+
+
+/* ---------------------------------------------------------------------------------------------- */
+
+
+void bam_ref_dict_init( bam_ref_dict * self )
+{
+    memset( self, 0, sizeof *self );
+}
+
+
+void bam_ref_dict_release( bam_ref_dict * self )
+{
+    uint32_t idx;
+    for ( idx = 0; idx < self->count; ++idx )
+        free( self->name[ idx ] );
+    free( self->name );
+    free( self->len );
+    free( self->sorted );
+    bam_ref_dict_init( self );
+}
+
+
+rc_t bam_ref_dict_add_line( bam_ref_dict * self, const char * line, size_t len )
+{
+    const char * sn = NULL;
+    size_t sn_len = 0, idx = 4;
+    int64_t ln = 0;
+
+    if ( len < 4 || memcmp( line, "@SQ\t", 4 ) != 0 )
+        return 0;
+
+    while ( idx < len )
+    {
+        const char * f = &line[ idx ];
+        const char * tab = memchr( f, '\t', len - idx );
+        size_t f_len = ( tab != NULL ) ? ( size_t )( tab - f ) : len - idx;
+
+        if ( f_len > 3 && f[ 2 ] == ':' )
+        {
+            if ( f[ 0 ] == 'S' && f[ 1 ] == 'N' )
+            {
+                sn = &f[ 3 ];
+                sn_len = f_len - 3;
+            }
+            else if ( f[ 0 ] == 'L' && f[ 1 ] == 'N' && !parse_i64( &f[ 3 ], f_len - 3, &ln ) )
+                return bad_sam( "LN in @SQ-line" );
+        }
+        idx += f_len + 1;
+    }
+    if ( sn == NULL )
+        return bad_sam( "@SQ-line without SN" );
+
+    if ( self->count == self->capacity )
+    {
+        uint32_t new_capacity = self->capacity ? self->capacity * 2 : 64;
+        char ** name = realloc( self->name, new_capacity * sizeof name[ 0 ] );
+        uint64_t * lens;
+        if ( name == NULL )
+            return RC( rcExe, rcData, rcInserting, rcMemory, rcExhausted );
+        self->name = name;
+        lens = realloc( self->len, new_capacity * sizeof lens[ 0 ] );
+        if ( lens == NULL )
+            return RC( rcExe, rcData, rcInserting, rcMemory, rcExhausted );
+        self->len = lens;
+        self->capacity = new_capacity;
+    }
+    self->name[ self->count ] = malloc( sn_len + 1 );
+    if ( self->name[ self->count ] == NULL )
+        return RC( rcExe, rcData, rcInserting, rcMemory, rcExhausted );
+    memmove( self->name[ self->count ], sn, sn_len );
+    self->name[ self->count ][ sn_len ] = 0;
+    self->len[ self->count ] = ( ln > 0 ) ? ( uint64_t )ln : 0;
+    self->count++;
+    return 0;
+}
+
+
+static int64_t CC cmp_ref_idx( const void * a, const void * b, void * data )
+{
+    const bam_ref_dict * self = data;
+    return strcmp( self->name[ *( const uint32_t * )a ], self->name[ *( const uint32_t * )b ] );
+}
+
+
+rc_t bam_ref_dict_seal( bam_ref_dict * self )
+{
+    uint32_t idx;
+    free( self->sorted );
+    self->sorted = malloc( ( self->count + 1 ) * sizeof self->sorted[ 0 ] );
+    if ( self->sorted == NULL )
+        return RC( rcExe, rcData, rcInserting, rcMemory, rcExhausted );
+    for ( idx = 0; idx < self->count; ++idx )
+        self->sorted[ idx ] = idx;
+    if ( self->count > 1 )
+        ksort( self->sorted, self->count, sizeof self->sorted[ 0 ], cmp_ref_idx, self );
+    return 0;
+}
+
+
+/* compares a zero-terminated name with name/len in the order of strcmp() */
+static int cmp_name( const char * a, const char * name, size_t len )
+{
+    size_t i;
+    for ( i = 0; i < len; ++i )
+    {
+        if ( a[ i ] != name[ i ] || a[ i ] == 0 )
+            return ( int )( uint8_t )a[ i ] - ( int )( uint8_t )name[ i ];
+    }
+    return ( a[ len ] == 0 ) ? 0 : 1;
+}
+
+
+int32_t bam_ref_dict_find( const bam_ref_dict * self, const char * name, size_t len )
+{
+    uint32_t lo = 0, hi = self->count;
+    if ( hi == 0 || self->sorted == NULL )
+        return -1;
+    while ( lo < hi )
+    {
+        uint32_t mid = ( lo + hi ) / 2;
+        int cmp = cmp_name( self->name[ self->sorted[ mid ] ], name, len );
+        if ( cmp == 0 )
+            return self->sorted[ mid ];
+        if ( cmp < 0 )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return -1;
+}
+
+
+rc_t bam_header_encode( const bam_ref_dict * refs, const char * text, size_t len, out_buf * dst )
+{
+    uint32_t idx;
+    rc_t rc = append( dst, "BAM\1", 4 );
+    if ( rc == 0 )
+        rc = append_u32( dst, ( uint32_t )len );
+    if ( rc == 0 && len > 0 )
+        rc = append( dst, text, len );
+    if ( rc == 0 )
+        rc = append_u32( dst, refs->count );
+    for ( idx = 0; rc == 0 && idx < refs->count; ++idx )
+    {
+        size_t name_len = strlen( refs->name[ idx ] ) + 1;
+        rc = append_u32( dst, ( uint32_t )name_len );
+        if ( rc == 0 )
+            rc = append( dst, refs->name[ idx ], name_len );
+        if ( rc == 0 )
+            rc = append_u32( dst, ( uint32_t )refs->len[ idx ] );
+    }
+    return rc;
+}
+
+
+/* ---------------------------------------------------------------------------------------------- */
+
+
+int32_t bam_ref_id( const bam_ref_dict * self, const char * name, size_t len, bool * missing )
+{
+    int32_t res = -1;
+    if ( len != 1 || name[ 0 ] != '*' )
+    {
+        res = bam_ref_dict_find( self, name, len );
+        if ( res < 0 )
+        {
+            rc_t rc = RC( rcExe, rcData, rcConverting, rcName, rcNotFound );
+            (void)PLOGERR( klogErr, ( klogErr, rc, "reference '$(r)' is not in the header", "r=%.*s", ( int )len, name ) );
+            *missing = true;
+        }
+    }
+    return res;
+}
+
+
+/* integers take the smallest type that holds them */
+rc_t bam_tag_i( out_buf * dst, const char * tag, int64_t v )
+{
+    uint8_t b[ 7 ];
+    size_t len = 3;
+    b[ 0 ] = tag[ 0 ];
+    b[ 1 ] = tag[ 1 ];
+    if ( v < 0 )
+    {
+        if ( v >= -128 )        { b[ 2 ] = 'c'; b[ 3 ] = ( uint8_t )v; len = 4; }
+        else if ( v >= -32768 ) { b[ 2 ] = 's'; put_u16( &b[ 3 ], ( uint32_t )v ); len = 5; }
+        else if ( v >= -2147483647LL - 1 ) { b[ 2 ] = 'i'; put_u32( &b[ 3 ], ( uint32_t )v ); len = 7; }
+    }
+    else
+    {
+        if ( v <= 0xFF )        { b[ 2 ] = 'C'; b[ 3 ] = ( uint8_t )v; len = 4; }
+        else if ( v <= 0xFFFF ) { b[ 2 ] = 'S'; put_u16( &b[ 3 ], ( uint32_t )v ); len = 5; }
+        else if ( v <= 0xFFFFFFFFLL ) { b[ 2 ] = 'I'; put_u32( &b[ 3 ], ( uint32_t )v ); len = 7; }
+    }
+    if ( len == 3 )
+        return bad_sam( "integer tag" );
+    return append( dst, b, len );
+}
+
+
+rc_t bam_tag_A( out_buf * dst, const char * tag, char value )
+{
+    uint8_t b[ 4 ];
+    b[ 0 ] = tag[ 0 ];
+    b[ 1 ] = tag[ 1 ];
+    b[ 2 ] = 'A';
+    b[ 3 ] = value;
+    return append( dst, b, sizeof b );
+}
+
+
+static rc_t string_tag( out_buf * dst, const char * tag, char type, const char * value, size_t len )
+{
+    uint8_t b[ 3 ];
+    rc_t rc;
+    b[ 0 ] = tag[ 0 ];
+    b[ 1 ] = tag[ 1 ];
+    b[ 2 ] = type;
+    rc = append( dst, b, sizeof b );
+    if ( rc == 0 && len > 0 )
+        rc = append( dst, value, len );
+    if ( rc == 0 )
+        rc = out_buf_char( dst, 0 );
+    return rc;
+}
+
+
+rc_t bam_tag_Z( out_buf * dst, const char * tag, const char * value, size_t len )
+{
+    return string_tag( dst, tag, 'Z', value, len );
+}
+
+
+static rc_t encode_array_tag( out_buf * dst, const char * tag, const char * value, size_t len )
+{
+    rc_t rc = 0;
+    uint8_t b[ 8 ];
+    uint32_t count = 0, size;
+    size_t idx;
+
+    if ( len == 0 )
+        return bad_sam( "array tag" );
+    switch ( value[ 0 ] )
+    {
+        case 'c' : case 'C' : size = 1; break;
+        case 's' : case 'S' : size = 2; break;
+        case 'i' : case 'I' : case 'f' : size = 4; break;
+        default  : return bad_sam( "array tag type" );
+    }
+    for ( idx = 1; idx < len; ++idx )
+    {
+        if ( value[ idx ] == ',' )
+            count++;
+    }
+    b[ 0 ] = tag[ 0 ];
+    b[ 1 ] = tag[ 1 ];
+    b[ 2 ] = 'B';
+    b[ 3 ] = value[ 0 ];
+    put_u32( &b[ 4 ], count );
+    rc = append( dst, b, 8 );
+
+    idx = 1;
+    while ( rc == 0 && idx < len )
+    {
+        const char * e = &value[ idx + 1 ];
+        const char * comma = memchr( e, ',', len - idx - 1 );
+        size_t e_len = ( comma != NULL ) ? ( size_t )( comma - e ) : len - idx - 1;
+        uint32_t bits;
+
+        if ( value[ 0 ] == 'f' )
+        {
+            float f;
+            if ( !parse_float( e, e_len, &f ) )
+                return bad_sam( "array tag value" );
+            bits = float_bits( f );
+        }
+        else
+        {
+            int64_t v;
+            if ( !parse_i64( e, e_len, &v ) )
+                return bad_sam( "array tag value" );
+            bits = ( uint32_t )v;
+        }
+        put_u32( b, bits );
+        rc = append( dst, b, size );
+        idx += e_len + 1;
+    }
+    return rc;
+}
+
+
+static rc_t encode_tag( out_buf * dst, const char * t, size_t len )
+{
+    const char * value = &t[ 5 ];
+    size_t value_len = len - 5;
+
+    if ( len < 5 || t[ 2 ] != ':' || t[ 4 ] != ':' )
+        return bad_sam( "optional field" );
+
+    switch ( t[ 3 ] )
+    {
+        case 'A' :
+            if ( value_len != 1 )
+                return bad_sam( "character tag" );
+            return bam_tag_A( dst, t, value[ 0 ] );
+
+        case 'i' :
+            {
+                int64_t v;
+                if ( !parse_i64( value, value_len, &v ) )
+                    return bad_sam( "integer tag" );
+                return bam_tag_i( dst, t, v );
+            }
+
+        case 'f' :
+            {
+                float f;
+                uint8_t b[ 7 ];
+                if ( !parse_float( value, value_len, &f ) )
+                    return bad_sam( "float tag" );
+                b[ 0 ] = t[ 0 ];
+                b[ 1 ] = t[ 1 ];
+                b[ 2 ] = 'f';
+                put_u32( &b[ 3 ], float_bits( f ) );
+                return append( dst, b, 7 );
+            }
+
+        case 'Z' :
+        case 'H' :
+            return string_tag( dst, t, t[ 3 ], value, value_len );
+
+        case 'B' :
+            return encode_array_tag( dst, t, value, value_len );
+    }
+    return bad_sam( "optional field type" );
+}
+
+
+rc_t bam_tags_text( out_buf * dst, const char * text, size_t len )
+{
+    rc_t rc = 0;
+    size_t at = 0;
+    while ( rc == 0 && at < len )
+    {
+        const char * t = &text[ at ];
+        const char * tab = memchr( t, '\t', len - at );
+        size_t t_len = ( tab != NULL ) ? ( size_t )( tab - t ) : len - at;
+        if ( t_len > 0 )
+            rc = encode_tag( dst, t, t_len );
+        at += t_len + 1;
+    }
+    return rc;
+}
+
+
+static bool is_star( const char * s, size_t len )
+{
+    return ( s == NULL || len == 0 || ( len == 1 && s[ 0 ] == '*' ) );
+}
+
+
+rc_t bam_rec_begin( out_buf * dst, const bam_rec_fields * f )
+{
+    uint32_t n_cigar = 0, l_seq, idx;
+    bool no_cigar = is_star( f->cigar, f->cigar_len );
+    bool no_qual = is_star( f->qual, f->qual_len );
+    uint8_t * p;
+    rc_t rc;
+
+    if ( f->qname_len == 0 || f->qname_len > 254 )
+        return bad_sam( "QNAME" );
+    if ( f->flag < 0 || f->flag > 0xFFFF )
+        return bad_sam( "FLAG" );
+    if ( f->pos < -1 || f->pos >= 0x7FFFFFFF )
+        return bad_sam( "POS" );
+    if ( f->mapq < 0 || f->mapq > 255 )
+        return bad_sam( "MAPQ" );
+    if ( f->pnext < -1 || f->pnext >= 0x7FFFFFFF )
+        return bad_sam( "PNEXT" );
+    if ( f->tlen < -2147483647LL - 1 || f->tlen > 0x7FFFFFFF )
+        return bad_sam( "TLEN" );
+    if ( !no_cigar )
+    {
+        for ( idx = 0; idx < f->cigar_len; ++idx )
+        {
+            if ( f->cigar[ idx ] < '0' || f->cigar[ idx ] > '9' )
+                n_cigar++;
+        }
+        if ( n_cigar > 0xFFFF )
+            return bad_sam( "CIGAR ( too many operations )" );
+    }
+    l_seq = is_star( f->seq, f->seq_len ) ? 0 : ( uint32_t )f->seq_len;
+    if ( !no_qual && f->qual_len != l_seq )
+        return bad_sam( "QUAL ( length differs from SEQ )" );
+
+    rc = out_buf_reserve( dst, BAM_FIXED_SIZE + f->qname_len + 1 + 4 * n_cigar + ( l_seq + 1 ) / 2 + l_seq,
+                          ( char ** )&p );
+    if ( rc != 0 )
+        return rc;
+
+    /* the fixed part, block_size and bin are filled in by bam_rec_end() */
+    p = put_u32( p, 0 );
+    p = put_u32( p, ( uint32_t )f->ref_id );
+    p = put_u32( p, ( uint32_t )f->pos );
+    *p++ = ( uint8_t )( f->qname_len + 1 );
+    *p++ = ( uint8_t )f->mapq;
+    p = put_u16( p, 0 );
+    p = put_u16( p, n_cigar );
+    p = put_u16( p, ( uint32_t )f->flag );
+    p = put_u32( p, l_seq );
+    p = put_u32( p, ( uint32_t )f->next_ref_id );
+    p = put_u32( p, ( uint32_t )f->pnext );
+    p = put_u32( p, ( uint32_t )f->tlen );
+
+    memmove( p, f->qname, f->qname_len );
+    p += f->qname_len;
+    *p++ = 0;
+
+    if ( n_cigar > 0 )
+    {
+        uint32_t n = 0;
+        for ( idx = 0; idx < f->cigar_len; ++idx )
+        {
+            uint8_t c = f->cigar[ idx ];
+            if ( c >= '0' && c <= '9' )
+            {
+                n = n * 10 + ( c - '0' );
+                if ( n > 0x0FFFFFFF )
+                    return bad_sam( "CIGAR ( operation too long )" );
+            }
+            else if ( cigar_code[ c ] == 0 )
+                return bad_sam( "CIGAR" );
+            else
+            {
+                p = put_u32( p, ( n << 4 ) | ( cigar_code[ c ] - 1 ) );
+                n = 0;
+            }
+        }
+    }
+
+    for ( idx = 0; idx + 1 < l_seq; idx += 2 )
+    {
+        uint8_t hi = seq_code[ ( uint8_t )f->seq[ idx ] ];
+        uint8_t lo = seq_code[ ( uint8_t )f->seq[ idx + 1 ] ];
+        *p++ = ( ( hi ? hi - 1 : 15 ) << 4 ) | ( lo ? lo - 1 : 15 );
+    }
+    if ( idx < l_seq )
+    {
+        uint8_t hi = seq_code[ ( uint8_t )f->seq[ idx ] ];
+        *p++ = ( hi ? hi - 1 : 15 ) << 4;
+    }
+
+    if ( !no_qual )
+    {
+        for ( idx = 0; idx < l_seq; ++idx )
+        {
+            uint8_t q = f->qual[ idx ];
+            if ( q < 33 )
+                return bad_sam( "QUAL" );
+            *p++ = q - 33;
+        }
+    }
+    else
+    {
+        memset( p, 0xFF, l_seq );
+        p += l_seq;
+    }
+    out_buf_commit( dst, p - ( uint8_t * )&dst->data[ dst->len ] );
+    return 0;
+}
+
+
+static uint32_t get_u32( const uint8_t * p )
+{
+    return p[ 0 ] | ( p[ 1 ] << 8 ) | ( p[ 2 ] << 16 ) | ( ( uint32_t )p[ 3 ] << 24 );
+}
+
+
+static uint32_t get_u16( const uint8_t * p )
+{
+    return p[ 0 ] | ( p[ 1 ] << 8 );
+}
+
+
+bool bam_rec_info_of( const uint8_t * rec, size_t len, bam_rec_info * info )
+{
+    uint32_t n_cigar, idx, ref_span = 0;
+    const uint8_t * cigar;
+    int32_t pos;
+    bool mapped;
+
+    if ( len < BAM_FIXED_SIZE )
+        return false;
+    n_cigar = get_u16( rec + 16 );
+    cigar = rec + BAM_FIXED_SIZE + rec[ 12 ];
+    if ( len < ( size_t )( cigar - rec ) + 4 * n_cigar )
+        return false;
+    for ( idx = 0; idx < n_cigar; ++idx )
+    {
+        uint32_t op = get_u32( cigar + 4 * idx );
+        /* M, D, N, = and X consume the reference */
+        switch ( op & 0x0F )
+        {
+            case 0 : case 2 : case 3 : case 7 : case 8 : ref_span += op >> 4; break;
+        }
+    }
+    pos = ( int32_t )get_u32( rec + 8 );
+    mapped = ( ( get_u16( rec + 18 ) & 0x4 ) == 0 );
+
+    info->ref_id = ( int32_t )get_u32( rec + 4 );
+    info->beg = pos;
+    info->end = ( pos < 0 ) ? 0 : ( int64_t )pos + ( ( mapped && ref_span > 0 ) ? ref_span : 1 );
+    info->mapped = mapped && info->ref_id >= 0 && pos >= 0;
+    return true;
+}
+
+
+rc_t bam_rec_end( out_buf * dst, size_t start, bam_rec_info * info )
+{
+    uint8_t * p = ( uint8_t * )&dst->data[ start ];
+    size_t len = dst->len - start;
+
+    put_u32( p, ( uint32_t )( len - 4 ) );
+    if ( !bam_rec_info_of( p, len, info ) )
+        return bad_sam( "record ( truncated )" );
+    put_u16( p + 14, ( info->beg < 0 ) ? 4680 : bam_reg2bin( info->beg, info->end, 14, 5 ) );
+    return 0;
+}
+
+
+rc_t bam_rec_encode( const bam_ref_dict * refs, const char * line, size_t len, out_buf * dst, bam_rec_info * info )
+{
+    struct { const char * p; size_t len; } f[ SAM_FIELDS ];
+    bam_rec_fields rf;
+    size_t start = dst->len, at = 0;
+    uint32_t idx;
+    bool missing = false;
+    rc_t rc;
+
+    for ( idx = 0; idx < SAM_FIELDS; ++idx )
+    {
+        const char * tab;
+        if ( at > len || ( at == len && idx > 0 ) )
+            return bad_sam( "number of fields" );
+        f[ idx ].p = &line[ at ];
+        tab = memchr( f[ idx ].p, '\t', len - at );
+        f[ idx ].len = ( tab != NULL ) ? ( size_t )( tab - f[ idx ].p ) : len - at;
+        at += f[ idx ].len + 1;
+    }
+
+    rf.qname = f[ 0 ].p;
+    rf.qname_len = f[ 0 ].len;
+    if ( !parse_i64( f[ 1 ].p, f[ 1 ].len, &rf.flag ) )
+        return bad_sam( "FLAG" );
+    rf.ref_id = bam_ref_id( refs, f[ 2 ].p, f[ 2 ].len, &missing );
+    if ( !parse_i64( f[ 3 ].p, f[ 3 ].len, &rf.pos ) || rf.pos < 0 )
+        return bad_sam( "POS" );
+    if ( !parse_i64( f[ 4 ].p, f[ 4 ].len, &rf.mapq ) )
+        return bad_sam( "MAPQ" );
+    rf.cigar = f[ 5 ].p;
+    rf.cigar_len = f[ 5 ].len;
+    if ( f[ 6 ].len == 1 && f[ 6 ].p[ 0 ] == '=' )
+        rf.next_ref_id = rf.ref_id;
+    else
+        rf.next_ref_id = bam_ref_id( refs, f[ 6 ].p, f[ 6 ].len, &missing );
+    if ( missing )
+        return RC( rcExe, rcData, rcConverting, rcName, rcNotFound );
+    if ( !parse_i64( f[ 7 ].p, f[ 7 ].len, &rf.pnext ) || rf.pnext < 0 )
+        return bad_sam( "PNEXT" );
+    if ( !parse_i64( f[ 8 ].p, f[ 8 ].len, &rf.tlen ) )
+        return bad_sam( "TLEN" );
+    rf.seq = f[ 9 ].p;
+    rf.seq_len = f[ 9 ].len;
+    rf.qual = f[ 10 ].p;
+    rf.qual_len = f[ 10 ].len;
+    rf.pos -= 1;
+    rf.pnext -= 1;
+
+    rc = bam_rec_begin( dst, &rf );
+    if ( rc == 0 && at < len )
+        rc = bam_tags_text( dst, &line[ at ], len - at );
+    if ( rc == 0 )
+        rc = bam_rec_end( dst, start, info );
+    return rc;
+}
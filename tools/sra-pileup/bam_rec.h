@@ -0,0 +1,114 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_bam_rec_
+#define _h_bam_rec_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <klib/rc.h>
+#include "out_buf.h"
+
+/* the references of a BAM-file as the @SQ-lines of the SAM-header list them */
+typedef struct bam_ref_dict
+{
+    char ** name;
+    uint64_t * len;
+    uint32_t * sorted;      /* index into name/len in the order of the names */
+    uint32_t count;
+    uint32_t capacity;
+} bam_ref_dict;
+
+void bam_ref_dict_init( bam_ref_dict * self );
+void bam_ref_dict_release( bam_ref_dict * self );
+
+/* picks SN and LN out of @SQ-lines, other lines are ignored */
+rc_t bam_ref_dict_add_line( bam_ref_dict * self, const char * line, size_t len );
+
+/* after the last line is added */
+rc_t bam_ref_dict_seal( bam_ref_dict * self );
+
+/* -1 if the name is not there, can be called from many threads after bam_ref_dict_seal() */
+int32_t bam_ref_dict_find( const bam_ref_dict * self, const char * name, size_t len );
+
+/* -1 for "*", logs an error and sets *missing if the name is not there */
+int32_t bam_ref_id( const bam_ref_dict * self, const char * name, size_t len, bool * missing );
+
+/* the BAM-header: magic, SAM-text and the reference-list */
+rc_t bam_header_encode( const bam_ref_dict * refs, const char * text, size_t len, out_buf * dst );
+
+/* what the index needs to know about an encoded record */
+typedef struct bam_rec_info
+{
+    int32_t ref_id;
+    int64_t beg;            /* 0-based, -1 if not placed */
+    int64_t end;            /* behind the last reference-base the alignment covers */
+    bool mapped;
+} bam_rec_info;
+
+/* the fields of a record as the printers have them, strings are not 0-terminated */
+typedef struct bam_rec_fields
+{
+    const char * qname;
+    const char * cigar;     /* as text, NULL or "*" for none */
+    const char * seq;       /* as text, NULL, empty or "*" for none */
+    const char * qual;      /* phred + 33 as text, NULL or "*" for none */
+    size_t qname_len;
+    size_t cigar_len;
+    size_t seq_len;
+    size_t qual_len;
+    int64_t flag;
+    int64_t pos;            /* 0-based, -1 if not placed */
+    int64_t mapq;
+    int64_t pnext;          /* 0-based, -1 if not placed */
+    int64_t tlen;
+    int32_t ref_id;         /* -1 if not placed */
+    int32_t next_ref_id;
+} bam_rec_fields;
+
+/* a record is built as bam_rec_begin(), the optional fields with bam_tag_...(), bam_rec_end();
+   dst can hold records before it, start is dst->len before bam_rec_begin() */
+rc_t bam_rec_begin( out_buf * dst, const bam_rec_fields * f );
+rc_t bam_tag_A( out_buf * dst, const char * tag, char value );
+rc_t bam_tag_i( out_buf * dst, const char * tag, int64_t value );
+rc_t bam_tag_Z( out_buf * dst, const char * tag, const char * value, size_t len );
+/* optional fields as SAM-text ( TAG:TYPE:VALUE separated by tabs, empty ones are skipped ) */
+rc_t bam_tags_text( out_buf * dst, const char * text, size_t len );
+rc_t bam_rec_end( out_buf * dst, size_t start, bam_rec_info * info );
+
+/* the info of a complete record, false if it is truncated */
+bool bam_rec_info_of( const uint8_t * rec, size_t len, bam_rec_info * info );
+
+/* appends one SAM-line ( without the line-feed ) as a BAM-record to dst */
+rc_t bam_rec_encode( const bam_ref_dict * refs, const char * line, size_t len, out_buf * dst, bam_rec_info * info );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
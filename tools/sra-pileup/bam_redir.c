@@ -0,0 +1,122 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "bam_redir.h"
+#include "bam_out.h"
+
+#include <klib/log.h>
+#include <kfs/directory.h>
+#include <sysalloc.h>
+
+static rc_t CC bam_redir_callback( void * self, const char * buffer, size_t bufsize, size_t * num_writ )
+{
+    bam_redir * redir = ( bam_redir * )self;
+    rc_t rc = bam_out_write( redir->bam, buffer, bufsize );
+    *num_writ = ( rc == 0 ) ? bufsize : 0;
+    return rc;
+}
+
+
+rc_t init_bam_redir( bam_redir * self, const char * filename, enum bam_index_kind index, uint32_t threads )
+{
+    rc_t rc;
+
+    self->org_writer = NULL;
+    self->kfile = NULL;
+    self->bam = NULL;
+    self->filename = filename;
+    self->index = index;
+
+    if ( filename != NULL )
+    {
+        KDirectory *dir;
+        rc = KDirectoryNativeDir( &dir );
+        if ( rc != 0 )
+            LOGERR( klogInt, rc, "KDirectoryNativeDir() failed" );
+        else
+        {
+            rc = KDirectoryCreateFile ( dir, &self->kfile, false, 0664, kcmInit, "%s", filename );
+            KDirectoryRelease( dir );
+        }
+    }
+    else
+        rc = KFileMakeStdOut ( &self->kfile );
+
+    if ( rc == 0 )
+        rc = bam_out_make( &self->bam, self->kfile, index, threads );
+
+    if ( rc == 0 )
+    {
+        self->org_writer = KOutWriterGet();
+        self->org_data = KOutDataGet();
+        rc = KOutHandlerSet( bam_redir_callback, self );
+        if ( rc != 0 )
+            LOGERR( klogInt, rc, "KOutHandlerSet() failed" );
+    }
+    return rc;
+}
+
+
+rc_t finish_bam_redir( bam_redir * self )
+{
+    rc_t rc = bam_out_finish( self->bam );
+    if ( rc == 0 && self->index != bik_none && self->filename != NULL && bam_out_indexed( self->bam ) )
+    {
+        KDirectory *dir;
+        rc = KDirectoryNativeDir( &dir );
+        if ( rc != 0 )
+            LOGERR( klogInt, rc, "KDirectoryNativeDir() failed" );
+        else
+        {
+            KFile * index_file;
+            rc = KDirectoryCreateFile ( dir, &index_file, false, 0664, kcmInit, "%s.%s",
+                                        self->filename, ( self->index == bik_csi ) ? "csi" : "bai" );
+            if ( rc != 0 )
+                LOGERR( klogErr, rc, "cannot create BAM-index file" );
+            else
+            {
+                rc = bam_out_write_index( self->bam, index_file );
+                KFileRelease( index_file );
+            }
+            KDirectoryRelease( dir );
+        }
+    }
+    return rc;
+}
+
+
+void release_bam_redir( bam_redir * self )
+{
+    if( self->org_writer != NULL )
+    {
+        KOutHandlerSet( self->org_writer, self->org_data );
+    }
+    self->org_writer = NULL;
+    bam_out_release( self->bam );
+    self->bam = NULL;
+    KFileRelease( self->kfile );
+    self->kfile = NULL;
+}
@@ -0,0 +1,63 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_bam_redir_
+#define _h_bam_redir_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <klib/out.h>
+#include <klib/rc.h>
+#include <kfs/file.h>
+
+#include "bam_index.h"
+
+/* like out_redir, but everything printed into KOut is SAM-text turned into BAM */
+typedef struct bam_redir
+{
+    KWrtWriter org_writer;
+    void* org_data;
+    KFile* kfile;
+    struct bam_out * bam;
+    const char * filename;          /* the index is written next to it */
+    enum bam_index_kind index;
+} bam_redir;
+
+
+rc_t init_bam_redir( bam_redir * self, const char * filename, enum bam_index_kind index, uint32_t threads );
+
+/* completes the BAM-file and writes the index as filename.bai or filename.csi */
+rc_t finish_bam_redir( bam_redir * self );
+
+void release_bam_redir( bam_redir * self );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
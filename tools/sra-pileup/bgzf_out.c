@@ -0,0 +1,450 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "bgzf_out.h"
+
+#include <klib/log.h>
+#include <kfs/file.h>
+#include <kproc/thread.h>
+#include <kproc/lock.h>
+#include <kproc/cond.h>
+#include <sysalloc.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#define BGZF_BLOCK_MAX 0x10000
+#define BGZF_HEADER_SIZE 18     /* gzip-header with the BC extra-field */
+#define BGZF_FOOTER_SIZE 8      /* CRC32 and ISIZE */
+#define BGZF_BLOCKS_PER_THREAD 4
+
+typedef struct bgzf_block
+{
+    rc_t rc;
+    uint32_t len;               /* uncompressed bytes in data */
+    uint32_t zlen;              /* the complete compressed block in zdata */
+    bool done;                  /* compressed, guarded by the lock */
+    uint8_t data[ BGZF_BLOCK_DATA ];
+    uint8_t zdata[ BGZF_BLOCK_MAX ];
+} bgzf_block;
+
+
+typedef struct bgzf_worker
+{
+    bgzf_out * out;
+    KThread * thread;
+    z_stream zs;
+    bool zs_init;
+} bgzf_worker;
+
+
+struct bgzf_out
+{
+    struct KFile * dst;
+    uint64_t pos;               /* where the next compressed block goes */
+    uint64_t * block_pos;       /* the file-position of every block written so far */
+    uint64_t block_pos_count;
+    uint64_t block_pos_capacity;
+    bgzf_block * block;         /* ring, indexed by block-number */
+    bgzf_worker * worker;
+    KLock * lock;
+    KCondition * queued;        /* a block was queued or the workers have to quit */
+    KCondition * compressed;    /* a block was compressed */
+    uint64_t filled;            /* blocks queued, this is the number of the block being filled */
+    uint64_t taken;             /* blocks taken by a worker */
+    uint64_t written;           /* blocks written into the file */
+    uint32_t blocks;
+    uint32_t workers;
+    bool quitting;
+    z_stream zs;                /* to compress on the calling thread if there are no workers */
+    bool zs_init;
+};
+
+
+static const uint8_t bgzf_eof[ 28 ] =
+{
+    31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0,
+    27, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+
+static void put_le16( uint8_t * dst, uint32_t value )
+{
+    dst[ 0 ] = value & 0xFF;
+    dst[ 1 ] = ( value >> 8 ) & 0xFF;
+}
+
+
+static void put_le32( uint8_t * dst, uint32_t value )
+{
+    put_le16( dst, value );
+    put_le16( dst + 2, value >> 16 );
+}
+
+
+static rc_t init_deflate( z_stream * zs )
+{
+    memset( zs, 0, sizeof *zs );
+    /* raw deflate, the gzip-header is written by compress_block() */
+    switch ( deflateInit2( zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY ) )
+    {
+        case Z_OK         : return 0;
+        case Z_MEM_ERROR  : return RC( rcExe, rcFile, rcConstructing, rcMemory, rcExhausted );
+        default           : return RC( rcExe, rcFile, rcConstructing, rcNoObj, rcUnexpected );
+    }
+}
+
+
+static rc_t compress_block( bgzf_block * b, z_stream * zs )
+{
+    static const uint8_t header[ 16 ] = { 31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0 };
+    rc_t rc = 0;
+    int zr;
+
+    memmove( b->zdata, header, sizeof header );
+    zs->next_in = b->data;
+    zs->avail_in = b->len;
+    zs->next_out = &b->zdata[ BGZF_HEADER_SIZE ];
+    zs->avail_out = BGZF_BLOCK_MAX - BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE;
+
+    zr = deflate( zs, Z_FINISH );
+    if ( zr != Z_STREAM_END )
+        rc = RC( rcExe, rcFile, rcWriting, rcBuffer, rcInsufficient );
+    else
+    {
+        uint32_t zlen = BGZF_HEADER_SIZE + ( uint32_t )zs->total_out + BGZF_FOOTER_SIZE;
+        put_le16( &b->zdata[ 16 ], zlen - 1 );
+        put_le32( &b->zdata[ zlen - 8 ], crc32( crc32( 0, NULL, 0 ), b->data, b->len ) );
+        put_le32( &b->zdata[ zlen - 4 ], b->len );
+        b->zlen = zlen;
+    }
+    deflateReset( zs );
+    return rc;
+}
+
+
+static rc_t CC bgzf_worker_main( const KThread * thread, void * data )
+{
+    bgzf_worker * self = data;
+    bgzf_out * out = self->out;
+
+    KLockAcquire( out->lock );
+    while ( !out->quitting )
+    {
+        if ( out->taken == out->filled )
+            KConditionWait( out->queued, out->lock );
+        else
+        {
+            bgzf_block * b = &out->block[ out->taken++ % out->blocks ];
+            rc_t rc;
+
+            KLockUnlock( out->lock );
+            rc = compress_block( b, &self->zs );
+            KLockAcquire( out->lock );
+
+            b->rc = rc;
+            b->done = true;
+            KConditionSignal( out->compressed );
+        }
+    }
+    KLockUnlock( out->lock );
+    return 0;
+}
+
+
+static rc_t add_block_pos( bgzf_out * self )
+{
+    if ( self->block_pos_count == self->block_pos_capacity )
+    {
+        uint64_t new_capacity = self->block_pos_capacity ? self->block_pos_capacity * 2 : 1024;
+        uint64_t * tmp = realloc( self->block_pos, new_capacity * sizeof tmp[ 0 ] );
+        if ( tmp == NULL )
+            return RC( rcExe, rcFile, rcWriting, rcMemory, rcExhausted );
+        self->block_pos = tmp;
+        self->block_pos_capacity = new_capacity;
+    }
+    self->block_pos[ self->block_pos_count++ ] = self->pos;
+    return 0;
+}
+
+
+static rc_t write_raw( bgzf_out * self, const void * data, size_t len )
+{
+    size_t num_writ;
+    rc_t rc = KFileWriteAll( self->dst, self->pos, data, len, &num_writ );
+    if ( rc == 0 && num_writ != len )
+        rc = RC( rcExe, rcFile, rcWriting, rcTransfer, rcIncomplete );
+    if ( rc != 0 )
+        LOGERR( klogErr, rc, "cannot write BGZF-block" );
+    else
+        self->pos += len;
+    return rc;
+}
+
+
+static bool oldest_done( bgzf_out * self )
+{
+    bool res;
+    KLockAcquire( self->lock );
+    res = ( self->written < self->filled && self->block[ self->written % self->blocks ].done );
+    KLockUnlock( self->lock );
+    return res;
+}
+
+
+/* waits for the oldest queued block and writes it into the file */
+static rc_t write_oldest( bgzf_out * self )
+{
+    bgzf_block * b = &self->block[ self->written % self->blocks ];
+    rc_t rc;
+
+    if ( self->workers > 0 )
+    {
+        KLockAcquire( self->lock );
+        while ( !b->done )
+            KConditionWait( self->compressed, self->lock );
+        KLockUnlock( self->lock );
+    }
+
+    rc = b->rc;
+    if ( rc != 0 )
+        LOGERR( klogErr, rc, "cannot compress BGZF-block" );
+    if ( rc == 0 )
+        rc = add_block_pos( self );
+    if ( rc == 0 )
+        rc = write_raw( self, b->zdata, b->zlen );
+
+    b->done = false;
+    b->len = 0;
+    self->written++;
+    return rc;
+}
+
+
+static rc_t queue_block( bgzf_out * self )
+{
+    rc_t rc = 0;
+    bgzf_block * b = &self->block[ self->filled % self->blocks ];
+
+    if ( self->workers == 0 )
+    {
+        b->rc = compress_block( b, &self->zs );
+        b->done = true;
+        self->filled++;
+        return write_oldest( self );
+    }
+
+    KLockAcquire( self->lock );
+    self->filled++;
+    KConditionSignal( self->queued );
+    KLockUnlock( self->lock );
+
+    /* the next block to be filled has to be free, write what is already compressed on the way */
+    while ( rc == 0 && ( self->filled - self->written == self->blocks || oldest_done( self ) ) )
+        rc = write_oldest( self );
+    return rc;
+}
+
+
+static void stop_workers( bgzf_out * self )
+{
+    uint32_t idx;
+
+    if ( self->queued != NULL )
+    {
+        KLockAcquire( self->lock );
+        self->quitting = true;
+        KConditionBroadcast( self->queued );
+        KLockUnlock( self->lock );
+    }
+    for ( idx = 0; idx < self->workers; ++idx )
+    {
+        bgzf_worker * w = &self->worker[ idx ];
+        if ( w->thread != NULL )
+        {
+            KThreadWait( w->thread, NULL );
+            KThreadRelease( w->thread );
+            w->thread = NULL;
+        }
+    }
+}
+
+
+void bgzf_out_release( bgzf_out * self )
+{
+    if ( self != NULL )
+    {
+        uint32_t idx;
+
+        if ( self->worker != NULL )
+        {
+            stop_workers( self );
+            for ( idx = 0; idx < self->workers; ++idx )
+            {
+                if ( self->worker[ idx ].zs_init )
+                    deflateEnd( &self->worker[ idx ].zs );
+            }
+        }
+        if ( self->zs_init )
+            deflateEnd( &self->zs );
+        KConditionRelease( self->compressed );
+        KConditionRelease( self->queued );
+        KLockRelease( self->lock );
+        free( self->worker );
+        free( self->block );
+        free( self->block_pos );
+        free( self );
+    }
+}
+
+
+rc_t bgzf_out_make( bgzf_out ** self, struct KFile * dst, uint64_t pos, uint32_t threads )
+{
+    rc_t rc = 0;
+    uint32_t idx;
+    bgzf_out * o = calloc( 1, sizeof *o );
+    if ( o == NULL )
+        rc = RC( rcExe, rcFile, rcConstructing, rcMemory, rcExhausted );
+    else
+    {
+        o->dst = dst;
+        o->pos = pos;
+        o->blocks = ( threads > 0 ) ? threads * BGZF_BLOCKS_PER_THREAD : 1;
+        o->block = calloc( o->blocks, sizeof o->block[ 0 ] );
+        if ( o->block == NULL )
+            rc = RC( rcExe, rcFile, rcConstructing, rcMemory, rcExhausted );
+        else if ( threads == 0 )
+        {
+            rc = init_deflate( &o->zs );
+            o->zs_init = ( rc == 0 );
+        }
+        else
+        {
+            o->worker = calloc( threads, sizeof o->worker[ 0 ] );
+            if ( o->worker == NULL )
+                rc = RC( rcExe, rcFile, rcConstructing, rcMemory, rcExhausted );
+            else
+            {
+                o->workers = threads;
+                rc = KLockMake( &o->lock );
+                if ( rc == 0 )
+                    rc = KConditionMake( &o->queued );
+                if ( rc == 0 )
+                    rc = KConditionMake( &o->compressed );
+                if ( rc != 0 )
+                    LOGERR( klogInt, rc, "cannot make lock for BGZF-compression" );
+            }
+            for ( idx = 0; rc == 0 && idx < o->workers; ++idx )
+            {
+                bgzf_worker * w = &o->worker[ idx ];
+                w->out = o;
+                rc = init_deflate( &w->zs );
+                w->zs_init = ( rc == 0 );
+                if ( rc == 0 )
+                {
+                    rc = KThreadMake( &w->thread, bgzf_worker_main, w );
+                    if ( rc != 0 )
+                        LOGERR( klogInt, rc, "KThreadMake() failed" );
+                }
+            }
+        }
+        if ( rc == 0 )
+            *self = o;
+        else
+            bgzf_out_release( o );
+    }
+    return rc;
+}
+
+
+rc_t bgzf_out_write( bgzf_out * self, const void * data, size_t len )
+{
+    rc_t rc = 0;
+    const uint8_t * src = data;
+    while ( rc == 0 && len > 0 )
+    {
+        bgzf_block * b = &self->block[ self->filled % self->blocks ];
+        size_t n = BGZF_BLOCK_DATA - b->len;
+        if ( n > len )
+            n = len;
+        memmove( &b->data[ b->len ], src, n );
+        b->len += n;
+        src += n;
+        len -= n;
+        if ( b->len == BGZF_BLOCK_DATA )
+            rc = queue_block( self );
+    }
+    return rc;
+}
+
+
+rc_t bgzf_out_keep_together( bgzf_out * self, size_t len )
+{
+    const bgzf_block * b = &self->block[ self->filled % self->blocks ];
+    if ( b->len > 0 && b->len + len > BGZF_BLOCK_DATA )
+        return queue_block( self );
+    return 0;
+}
+
+
+uint64_t bgzf_out_tell( const bgzf_out * self )
+{
+    return ( self->filled << 16 ) | self->block[ self->filled % self->blocks ].len;
+}
+
+
+rc_t bgzf_out_finish( bgzf_out * self )
+{
+    rc_t rc = 0;
+    if ( self->block[ self->filled % self->blocks ].len > 0 )
+        rc = queue_block( self );
+    while ( rc == 0 && self->written < self->filled )
+        rc = write_oldest( self );
+    /* positions pointing behind the last record refer to the EOF-marker */
+    if ( rc == 0 )
+        rc = add_block_pos( self );
+    if ( rc == 0 )
+        rc = write_raw( self, bgzf_eof, sizeof bgzf_eof );
+    if ( self->worker != NULL )
+        stop_workers( self );
+    return rc;
+}
+
+
+uint64_t bgzf_out_voffset( const bgzf_out * self, uint64_t pending )
+{
+    uint64_t block = pending >> 16;
+    if ( block >= self->block_pos_count )
+        return self->pos << 16;
+    return ( self->block_pos[ block ] << 16 ) | ( pending & 0xFFFF );
+}
+
+
+uint64_t bgzf_out_pos( const bgzf_out * self )
+{
+    return self->pos;
+}
@@ -0,0 +1,70 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_bgzf_out_
+#define _h_bgzf_out_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <klib/rc.h>
+
+struct KFile;
+
+/* writes data as BGZF-blocks into a file, the blocks are compressed by a pool of threads
+   ( or on the calling thread if there are none ) and written in order.
+   positions handed out by bgzf_out_tell() are pending: block-number << 16 | offset,
+   bgzf_out_voffset() turns them into BGZF virtual file-offsets after bgzf_out_finish() */
+
+#define BGZF_BLOCK_DATA 0xff00  /* uncompressed bytes per block, the deflate worst case still fits 64k */
+
+typedef struct bgzf_out bgzf_out;
+
+rc_t bgzf_out_make( bgzf_out ** self, struct KFile * dst, uint64_t pos, uint32_t threads );
+void bgzf_out_release( bgzf_out * self );
+
+rc_t bgzf_out_write( bgzf_out * self, const void * data, size_t len );
+
+/* starts a new block if the current one has no room for len bytes, records smaller than a block
+   do not straddle blocks that way */
+rc_t bgzf_out_keep_together( bgzf_out * self, size_t len );
+
+uint64_t bgzf_out_tell( const bgzf_out * self );
+
+/* compresses what is left, writes the EOF-marker and waits for the workers */
+rc_t bgzf_out_finish( bgzf_out * self );
+
+uint64_t bgzf_out_voffset( const bgzf_out * self, uint64_t pending );
+
+/* the position in the file behind the EOF-marker */
+uint64_t bgzf_out_pos( const bgzf_out * self );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
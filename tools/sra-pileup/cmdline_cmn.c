@@ -54,6 +54,9 @@ const char * ref_usage[] = { "Filter by position on genome.",
                              "\"from\" and \"to\" are 1-based coordinates",
                              NULL };
 
+const char * ref_file_usage[] = { "Filter by the regions in this BED-file",
+                                  "(name, 0-based start, exclusive end)", NULL };
+
 const char * outf_usage[] = { "Output will be written to this file",
                               "instead of std-out", NULL };
 
@@ -98,6 +101,7 @@ OptDef CommonOptions[] =
 {
     /*name,           alias,         hfkt, usage-help,    maxcount, needs value, required */
     { OPTION_REF,     ALIAS_REF,     NULL, ref_usage,     0,        true,        false },
+    { OPTION_REF_FILE, NULL,         NULL, ref_file_usage, 0,       true,        false },
     { OPTION_OUTF,    ALIAS_OUTF,    NULL, outf_usage,    1,        true,        false },
     { OPTION_TABLE,   ALIAS_TABLE,   NULL, table_usage,   1,        true,        false },
     { OPTION_GZIP,    ALIAS_GZIP,    NULL, gzip_usage,    1,        false,       false },
@@ -203,6 +207,7 @@ rc_t get_common_options( Args * args, common_options *opts )
 void print_common_helplines( void )
 {
     HelpOptionLine ( ALIAS_REF, OPTION_REF, "name[:from-to]", ref_usage );
+    HelpOptionLine ( NULL, OPTION_REF_FILE, "file", ref_file_usage );
     HelpOptionLine ( ALIAS_OUTF, OPTION_OUTF, "output-file", outf_usage );
     HelpOptionLine ( ALIAS_TABLE, OPTION_TABLE, "shortcut", table_usage );
     HelpOptionLine ( ALIAS_BZIP, OPTION_BZIP, NULL, bzip_usage );
@@ -266,6 +271,27 @@ rc_t init_ref_regions( BSTree * tree, Args * args )
                 rc = parse_and_add_region( tree, s );
         }
     }
+    if ( rc == 0 )
+    {
+        rc = ArgsOptionCount( args, OPTION_REF_FILE, &count );
+        if ( rc != 0 )
+        {
+            LOGERR( klogInt, rc, "ArgsOptionCount() failed" );
+        }
+        else
+        {
+            uint32_t i;
+            for ( i = 0; i < count && rc == 0; ++i )
+            {
+                const char * s;
+                rc = ArgsOptionValue( args, OPTION_REF_FILE, i, (const void **)&s );
+                if ( rc != 0 )
+                    LOGERR( klogInt, rc, "ArgsOptionValue() failed" );
+                else
+                    rc = add_regions_from_file( tree, s ); /* ref_regions.c */
+            }
+        }
+    }
     return rc;
 }
 
@@ -59,6 +59,8 @@ extern "C" {
 #define OPTION_REF     "aligned-region"
 #define ALIAS_REF      "r"
 
+#define OPTION_REF_FILE "regions-file"
+
 typedef uint8_t align_tab_select;
 enum { primary_ats = 1, secondary_ats = 2, evidence_ats = 4 };
 
@@ -81,7 +83,7 @@ rc_t get_common_options( Args * args, common_options *opts );
 OptDef * CommonOptions_ptr( void );
 size_t CommonOptions_count( void );
 
-/* get ref-ranges from the command-line and iterate them... */
+/* get ref-ranges from the command-line and from region-files, and iterate them... */
 rc_t init_ref_regions( BSTree * regions, Args * args );
 
 rc_t foreach_argument( Args * args, KDirectory *dir, bool div_by_spotgrp, bool * empty,
@@ -25,6 +25,7 @@
 */
 
 #include "dyn_string.h"
+#include "out_buf.h"
 #include <klib/text.h>
 #include <klib/printf.h>
 #include <klib/out.h>
@@ -156,6 +157,42 @@ rc_t add_dyn_string_2_dyn_string( struct dyn_string *self, struct dyn_string *ot
 }
 
 
+/* appends other and a newline, the buffer grows by doubling because
+   this collects a lot of lines */
+rc_t add_line_2_dyn_string( struct dyn_string *self, struct dyn_string *other )
+{
+    rc_t rc = 0;
+    size_t size = other->data_len;
+    size_t needed = self->data_len + size + 2;
+    if ( needed > self->allocated )
+    {
+        size_t new_size = self->allocated * 2;
+        rc = expand_dyn_string( self, new_size > needed ? new_size : needed );
+    }
+    if ( rc == 0 )
+    {
+        memmove( &(self->data[ self->data_len ]), other->data, size );
+        self->data_len += size;
+        self->data[ self->data_len++ ] = '\n';
+        self->data[ self->data_len ] = 0;
+    }
+    return rc;
+}
+
+
+/* decimal, without going through the printf-engine */
+rc_t add_uint_2_dyn_string( struct dyn_string *self, uint64_t value )
+{
+    rc_t rc = expand_dyn_string( self, self->data_len + 21 );
+    if ( rc == 0 )
+    {
+        self->data_len += fmt_u64( &(self->data[ self->data_len ]), value );
+        self->data[ self->data_len ] = 0;
+    }
+    return rc;
+}
+
+
 rc_t print_2_dyn_string( struct dyn_string * self, const char *fmt, ... )
 {
     rc_t rc = 0;
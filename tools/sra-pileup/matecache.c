@@ -25,8 +25,452 @@
 */
 
 #include "matecache.h"
+#include "perf_log.h"
+#include <kfs/directory.h>
+#include <kfs/file.h>
+#include <kfs/mmap.h>
 #include <sysalloc.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MC_NIL 0xFFFFFFFF
+#define MC_MIN_NODES 4096
+#define MC_MIN_SLOTS 4096
+
+
+/* =========================================================================================== */
+
+static uint64_t mc_hash( int64_t key )
+{
+    uint64_t h = ( uint64_t )key * 0x9E3779B97F4A7C15ULL;
+    return h ^ ( h >> 29 );
+}
+
+
+static const char * mc_spill_dir( void )
+{
+    const char * tmp = getenv( "TMPDIR" );
+    if ( tmp == NULL || tmp[ 0 ] == 0 )
+        tmp = "/tmp";
+    return tmp;
+}
+
+
+/* the spill-files are created in $TMPDIR ( and unlinked at once where that is possible ),
+   the pages are written to disk instead of being kept in anonymous memory */
+static rc_t mc_segment_spill( matecache * const self, mc_segment * seg, size_t size )
+{
+    KDirectory * dir;
+    rc_t rc = KDirectoryNativeDir( &dir );
+    if ( rc != 0 )
+        (void)LOGERR( klogErr, rc, "cannot access native directory" );
+    else
+    {
+        /* the caches of the worker-threads count for themselves, a name in use is skipped */
+        const char * tmp = mc_spill_dir();
+        do
+        {
+            seg->file_no = ++self->file_no;
+            rc = KDirectoryCreateFile( dir, &seg->file, true, 0600, kcmCreate,
+                                       "%s/sam-dump-mc.%u", tmp, seg->file_no );
+        } while ( rc != 0 && GetRCState( rc ) == rcExists );
+        if ( rc != 0 )
+        {
+            seg->file = NULL;
+            (void)PLOGERR( klogErr, ( klogErr, rc, "cannot create mate-cache spill-file '$(d)/sam-dump-mc.$(n)'",
+                                      "d=%s,n=%u", tmp, seg->file_no ) );
+        }
+        else
+        {
+#if ! WINDOWS
+            KDirectoryRemove( dir, false, "%s/sam-dump-mc.%u", tmp, seg->file_no );
+#endif
+            rc = KFileSetSize( seg->file, size );
+            if ( rc != 0 )
+                (void)LOGERR( klogErr, rc, "cannot resize mate-cache spill-file" );
+            else
+            {
+                rc = KMMapMakeRgnUpdate( &seg->mm, seg->file, 0, size );
+                if ( rc == 0 )
+                {
+                    rc = KMMapAddrUpdate( seg->mm, &seg->base );
+                    if ( rc != 0 )
+                        KMMapRelease( seg->mm );
+                }
+                if ( rc != 0 )
+                {
+                    seg->mm = NULL;
+                    seg->base = NULL;
+                    (void)LOGERR( klogErr, rc, "cannot map mate-cache spill-file" );
+                }
+                else
+                    seg->size = size;
+            }
+            if ( rc != 0 )
+            {
+                KFileRelease( seg->file );
+                seg->file = NULL;
+#if WINDOWS
+                KDirectoryRemove( dir, false, "%s/sam-dump-mc.%u", tmp, seg->file_no );
+#endif
+            }
+        }
+        KDirectoryRelease( dir );
+    }
+    return rc;
+}
+
+
+/* a zeroed segment, from the heap as long as the memory-limit allows it */
+static rc_t mc_segment_make( matecache * const self, mc_segment * seg, size_t size )
+{
+    rc_t rc = 0;
+    seg->base = NULL;
+    seg->size = 0;
+    seg->file = NULL;
+    seg->mm = NULL;
+    if ( self->mem_used + size <= self->mem_limit )
+    {
+        seg->base = calloc( 1, size );
+        if ( seg->base == NULL )
+        {
+            rc = RC( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+            (void)LOGERR( klogErr, rc, "cannot allocate mate-cache table" );
+        }
+        else
+        {
+            seg->size = size;
+            self->mem_used += size;
+        }
+    }
+    else
+    {
+        rc = mc_segment_spill( self, seg, size );
+        if ( rc == 0 )
+        {
+            self->spills++;
+            self->spilled += size;
+        }
+    }
+    return rc;
+}
+
+
+static void mc_segment_release( matecache * const self, mc_segment * seg )
+{
+    if ( seg->base != NULL )
+    {
+        if ( seg->file == NULL )
+        {
+            free( seg->base );
+            self->mem_used -= seg->size;
+        }
+        else
+        {
+            KMMapRelease( seg->mm );
+            KFileRelease( seg->file );
+#if WINDOWS
+            {
+                KDirectory * dir;
+                if ( KDirectoryNativeDir( &dir ) == 0 )
+                {
+                    KDirectoryRemove( dir, false, "%s/sam-dump-mc.%u", mc_spill_dir(), seg->file_no );
+                    KDirectoryRelease( dir );
+                }
+            }
+#endif
+        }
+    }
+    seg->base = NULL;
+    seg->size = 0;
+    seg->file = NULL;
+    seg->mm = NULL;
+}
+
+
+/* =========================================================================================== */
+
+static void same_ref_reset( same_ref_cache * c )
+{
+    c->used = 0;
+    c->free_list = MC_NIL;
+    c->lru_head = MC_NIL;
+    c->lru_tail = MC_NIL;
+    if ( c->bucket != NULL )
+        memset( c->bucket, 0xFF, c->allocated * sizeof c->bucket[ 0 ] );
+}
+
+
+static void same_ref_release( matecache * const self, same_ref_cache * c )
+{
+    if ( c->node != NULL )
+    {
+        free( c->node );
+        free( c->bucket );
+        self->mem_used -= ( uint64_t )c->allocated * ( sizeof c->node[ 0 ] + sizeof c->bucket[ 0 ] );
+    }
+    c->node = NULL;
+    c->bucket = NULL;
+    c->allocated = 0;
+}
+
+
+/* one bucket per node, the number of nodes is a power of 2 */
+static uint32_t * same_ref_bucket( const same_ref_cache * c, int64_t key )
+{
+    return &c->bucket[ mc_hash( key ) & ( c->allocated - 1 ) ];
+}
+
+
+static void same_ref_lru_append( same_ref_cache * c, uint32_t idx )
+{
+    same_ref_node * n = &c->node[ idx ];
+    n->lru_prev = c->lru_tail;
+    n->lru_next = MC_NIL;
+    if ( c->lru_tail != MC_NIL )
+        c->node[ c->lru_tail ].lru_next = idx;
+    else
+        c->lru_head = idx;
+    c->lru_tail = idx;
+}
+
+
+static void same_ref_lru_remove( same_ref_cache * c, uint32_t idx )
+{
+    same_ref_node * n = &c->node[ idx ];
+    if ( n->lru_prev != MC_NIL )
+        c->node[ n->lru_prev ].lru_next = n->lru_next;
+    else
+        c->lru_head = n->lru_next;
+    if ( n->lru_next != MC_NIL )
+        c->node[ n->lru_next ].lru_prev = n->lru_prev;
+    else
+        c->lru_tail = n->lru_prev;
+}
+
+
+static void same_ref_link( same_ref_cache * c, uint32_t idx )
+{
+    same_ref_node * n = &c->node[ idx ];
+    uint32_t * b = same_ref_bucket( c, n->key );
+    n->hash_next = *b;
+    *b = idx;
+    same_ref_lru_append( c, idx );
+}
+
+
+static void same_ref_unlink( same_ref_cache * c, uint32_t idx )
+{
+    same_ref_node * n = &c->node[ idx ];
+    uint32_t * b = same_ref_bucket( c, n->key );
+    while ( *b != idx )
+        b = &c->node[ *b ].hash_next;
+    *b = n->hash_next;
+    same_ref_lru_remove( c, idx );
+}
+
+
+/* a hit makes the node the most recently used one */
+static void same_ref_touch( same_ref_cache * c, uint32_t idx )
+{
+    if ( c->lru_tail != idx )
+    {
+        same_ref_lru_remove( c, idx );
+        same_ref_lru_append( c, idx );
+    }
+}
+
+
+static uint32_t same_ref_find( const same_ref_cache * c, int64_t key )
+{
+    uint32_t idx = MC_NIL;
+    if ( c->allocated > 0 )
+    {
+        idx = *same_ref_bucket( c, key );
+        while ( idx != MC_NIL && c->node[ idx ].key != key )
+            idx = c->node[ idx ].hash_next;
+    }
+    return idx;
+}
+
+
+static void same_ref_free( same_ref_cache * c, uint32_t idx )
+{
+    same_ref_unlink( c, idx );
+    c->node[ idx ].hash_next = c->free_list;
+    c->free_list = idx;
+}
+
+
+/* doubles the node-pool and rehashes the nodes in LRU-order, this keeps the LRU-chain intact */
+static rc_t same_ref_grow( matecache * const self, same_ref_cache * c )
+{
+    rc_t rc = 0;
+    uint32_t new_allocated = ( c->allocated == 0 ) ? MC_MIN_NODES : c->allocated * 2;
+    uint64_t grow_by = ( uint64_t )( new_allocated - c->allocated ) * ( sizeof c->node[ 0 ] + sizeof c->bucket[ 0 ] );
+    same_ref_node * node = realloc( c->node, new_allocated * sizeof node[ 0 ] );
+    if ( node == NULL )
+        rc = RC( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+    else
+    {
+        uint32_t * bucket;
+        c->node = node;
+        bucket = realloc( c->bucket, new_allocated * sizeof bucket[ 0 ] );
+        if ( bucket == NULL )
+            rc = RC( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+        else
+        {
+            uint32_t idx = c->lru_head;
+            c->bucket = bucket;
+            c->allocated = new_allocated;
+            self->mem_used += grow_by;
+            memset( c->bucket, 0xFF, c->allocated * sizeof c->bucket[ 0 ] );
+            while ( idx != MC_NIL )
+            {
+                uint32_t * b = same_ref_bucket( c, c->node[ idx ].key );
+                c->node[ idx ].hash_next = *b;
+                *b = idx;
+                idx = c->node[ idx ].lru_next;
+            }
+        }
+    }
+    if ( rc != 0 )
+        (void)LOGERR( klogErr, rc, "cannot grow same-ref-cache" );
+    return rc;
+}
+
+
+/* =========================================================================================== */
+
+static unaligned_entry * unaligned_slots( const unaligned_table * t )
+{
+    return t->seg.base;
+}
+
+
+static unaligned_entry * unaligned_probe( const unaligned_table * t, int64_t key )
+{
+    unaligned_entry * e = unaligned_slots( t );
+    uint64_t mask = t->slots - 1;
+    uint64_t idx = mc_hash( key ) & mask;
+    while ( e[ idx ].key != 0 && e[ idx ].key != key )
+        idx = ( idx + 1 ) & mask;
+    return &e[ idx ];
+}
+
+
+static rc_t unaligned_rehash( matecache * const self, unaligned_table * t, uint64_t count, uint64_t new_slots )
+{
+    unaligned_table n;
+    rc_t rc = mc_segment_make( self, &n.seg, new_slots * sizeof( unaligned_entry ) );
+    if ( rc == 0 )
+    {
+        const unaligned_entry * e = unaligned_slots( t );
+        uint64_t idx, limit = t->sorted ? count : t->slots;
+        n.slots = new_slots;
+        n.sorted = false;
+        for ( idx = 0; idx < limit; ++idx )
+        {
+            if ( e[ idx ].key != 0 )
+                *unaligned_probe( &n, e[ idx ].key ) = e[ idx ];
+        }
+        mc_segment_release( self, &t->seg );
+        *t = n;
+    }
+    return rc;
+}
+
+
+static int CC cmp_unaligned_entry( const void * a, const void * b )
+{
+    const unaligned_entry * ea = a;
+    const unaligned_entry * eb = b;
+    if ( ea->key < eb->key ) return -1;
+    return ( ea->key > eb->key ) ? 1 : 0;
+}
+
+
+/* the entries are visited in the order of the alignment-ids */
+static void unaligned_sort( unaligned_table * t, uint64_t count )
+{
+    if ( !t->sorted && t->slots > 0 )
+    {
+        unaligned_entry * e = unaligned_slots( t );
+        uint64_t src, dst = 0;
+        for ( src = 0; src < t->slots; ++src )
+        {
+            if ( e[ src ].key != 0 )
+                e[ dst++ ] = e[ src ];
+        }
+        memset( &e[ dst ], 0, ( t->slots - dst ) * sizeof e[ 0 ] );
+        qsort( e, count, sizeof e[ 0 ], cmp_unaligned_entry );
+        t->sorted = true;
+    }
+}
+
+
+static const unaligned_entry * unaligned_find( const unaligned_table * t, uint64_t count, int64_t key )
+{
+    const unaligned_entry * res = NULL;
+    if ( t->slots == 0 || key == 0 )
+        return res;
+    if ( t->sorted )
+    {
+        unaligned_entry k;
+        k.key = key;
+        res = bsearch( &k, unaligned_slots( t ), count, sizeof k, cmp_unaligned_entry );
+    }
+    else
+    {
+        res = unaligned_probe( t, key );
+        if ( res->key == 0 )
+            res = NULL;
+    }
+    return res;
+}
+
+
+static rc_t unaligned_set( matecache * const self, matecache_per_file * mcpf,
+                           int64_t key, uint64_t ref_pos_and_ref_idx, int64_t seq_id, bool * inserted )
+{
+    rc_t rc = 0;
+    unaligned_table * t = &mcpf->unaligned;
+    uint64_t count = mcpf->stat_unaligned.count;
+
+    *inserted = false;
+    if ( key == 0 )
+        return RC( rcApp, rcNoTarg, rcInserting, rcParam, rcInvalid );
+
+    /* keep the load below 3/4, a sorted table becomes a hash-table again */
+    if ( t->slots == 0 )
+        rc = unaligned_rehash( self, t, 0, MC_MIN_SLOTS );
+    else if ( t->sorted || ( count + 1 ) * 4 > t->slots * 3 )
+    {
+        uint64_t new_slots = t->slots;
+        while ( ( count + 1 ) * 4 > new_slots * 3 )
+            new_slots *= 2;
+        rc = unaligned_rehash( self, t, count, new_slots );
+    }
+
+    if ( rc == 0 )
+    {
+        unaligned_entry * e = unaligned_probe( t, key );
+        if ( e->key == 0 )
+        {
+            e->key = key;
+            *inserted = true;
+        }
+        e->ref_pos_and_ref_idx = ref_pos_and_ref_idx;
+        e->seq_id = seq_id;
+    }
+    else
+        (void)LOGERR( klogErr, rc, "cannot grow unaligned-cache" );
+    return rc;
+}
+
+
+/* =========================================================================================== */
 
 void release_matecache( matecache * const self )
 {
@@ -37,15 +481,8 @@ void release_matecache( matecache * const self )
             uint32_t idx;
             for ( idx = 0; idx < self->count; ++idx )
             {
-                if ( self->per_file[ idx ].same_ref_64 != NULL )
-                    KVectorRelease( self->per_file[ idx ].same_ref_64 );
-                if ( self->per_file[ idx ].same_ref_16 != NULL )
-                    KVectorRelease( self->per_file[ idx ].same_ref_16 );
-
-                if ( self->per_file[ idx ].unaligned_64_a != NULL )
-                    KVectorRelease( self->per_file[ idx ].unaligned_64_a );
-                if ( self->per_file[ idx ].unaligned_64_b != NULL )
-                    KVectorRelease( self->per_file[ idx ].unaligned_64_b );
+                same_ref_release( self, &self->per_file[ idx ].same_ref );
+                mc_segment_release( self, &self->per_file[ idx ].unaligned.seg );
             }
             free( self->per_file );
         }
@@ -54,7 +491,7 @@ void release_matecache( matecache * const self )
 }
 
 
-rc_t make_matecache( matecache **self, uint32_t count )
+rc_t make_matecache( matecache **self, uint32_t count, uint64_t mem_limit, uint32_t row_gap )
 {
     rc_t rc = 0;
 
@@ -68,6 +505,8 @@ rc_t make_matecache( matecache **self, uint32_t count )
     else
     {
         mc->count = count;
+        mc->mem_limit = mem_limit;
+        mc->row_gap = row_gap;
         mc->per_file = calloc( sizeof *(mc->per_file), count );
         if ( mc->per_file == NULL )
         {
@@ -76,33 +515,19 @@ rc_t make_matecache( matecache **self, uint32_t count )
         }
         else
         {
+            /* the same-ref caches share one half of the limit, the unaligned tables use what is left */
+            uint64_t capacity = ( mem_limit / 2 ) / ( count > 0 ? count : 1 ) /
+                                ( sizeof( same_ref_node ) + sizeof( uint32_t ) );
             uint32_t idx;
-            for ( idx = 0; idx < count && rc == 0; ++idx )
+            for ( idx = 0; idx < count; ++idx )
             {
-                rc = KVectorMake( &( mc->per_file[ idx ].same_ref_64 ) );
-                if ( rc != 0 )
-                    (void)LOGERR( klogErr, rc, "cannot create KVector (same-ref) U64" );
-                else
-                {
-                    rc = KVectorMake( &( mc->per_file[ idx ].same_ref_16 ) );
-                    if ( rc != 0 )
-                        (void)LOGERR( klogErr, rc, "cannot create KVector (same-ref) U16" );
-                    else
-                    {
-                        rc = KVectorMake( &( mc->per_file[ idx ].unaligned_64_a ) );
-                        if ( rc != 0 )
-                            (void)LOGERR( klogErr, rc, "cannot create KVector (unaligned a) U64" );
-                        else
-                        {
-                            rc = KVectorMake( &( mc->per_file[ idx ].unaligned_64_b ) );
-                            if ( rc != 0 )
-                                (void)LOGERR( klogErr, rc, "cannot create KVector (unaligned b) U64" );
-                        }
-                    }
-                }
+                same_ref_cache * c = &mc->per_file[ idx ].same_ref;
+                c->capacity = ( capacity > 0x40000000 ) ? 0x40000000 : ( uint32_t )capacity;
+                if ( c->capacity < MC_MIN_NODES )
+                    c->capacity = MC_MIN_NODES;
+                same_ref_reset( c );
             }
-            if ( rc == 0 )
-                *self = mc;
+            *self = mc;
         }
         if ( rc != 0 )
             release_matecache( mc );
@@ -155,11 +580,11 @@ static rc_t matecache_check( const matecache * const self, uint32_t db_idx, mate
     else if ( db_idx < self->count )
     {
         *mcpf = &self->per_file[ db_idx ];
-        if ( mcpf == NULL )
-        {
-            rc = RC( rcApp, rcNoTarg, rcAccessing, rcParam, rcInvalid );
-            (void)LOGERR( klogErr, rc, "cannot insert into same-ref-cache" );
-        }
+    }
+    else
+    {
+        rc = RC( rcApp, rcNoTarg, rcAccessing, rcParam, rcInvalid );
+        (void)LOGERR( klogErr, rc, "cannot insert into same-ref-cache" );
     }
     return rc;
 }
@@ -172,23 +597,64 @@ rc_t matecache_insert_same_ref( matecache * const self,
     rc_t rc = matecache_check( self, db_idx, &mcpf );
     if ( rc == 0 )
     {
+        same_ref_cache * c = &mcpf->same_ref;
         uint64_t ref_pos_and_tlen = ref_pos;
+        uint32_t idx = same_ref_find( c, key );
         ref_pos_and_tlen <<= 32;
         ref_pos_and_tlen |= tlen;
-        rc = KVectorSetU64( mcpf->same_ref_64, key, ref_pos_and_tlen );
-        if ( rc != 0 )
-            (void)LOGERR( klogErr, rc, "cannot insert into KVector (same-ref) U64" );
+
+        if ( idx != MC_NIL )
+            same_ref_unlink( c, idx );
         else
         {
-            rc = KVectorSetU16( mcpf->same_ref_16, key, flags );
-            if ( rc != 0 )
-                (void)LOGERR( klogErr, rc, "cannot insert into KVector (same-ref) U16" );
+            /* the alignments come in the order of their position, the rows too:
+               the mates of entries this far behind the new one will not come any more */
+            if ( self->row_gap > 0 )
+            {
+                while ( c->lru_head != MC_NIL && c->node[ c->lru_head ].key + self->row_gap < key )
+                {
+                    same_ref_free( c, c->lru_head );
+                    mcpf->stat_same_ref.count--;
+                    mcpf->stat_same_ref.evictions++;
+                }
+            }
+            if ( c->free_list != MC_NIL )
+            {
+                idx = c->free_list;
+                c->free_list = c->node[ idx ].hash_next;
+            }
+            else
+            {
+                if ( c->used == c->allocated && c->allocated < c->capacity )
+                    rc = same_ref_grow( self, c );
+                if ( rc == 0 )
+                {
+                    if ( c->used < c->allocated )
+                        idx = c->used++;
+                    else
+                    {
+                        /* the pool is full: give up the least recently used entry */
+                        idx = c->lru_head;
+                        same_ref_unlink( c, idx );
+                        mcpf->stat_same_ref.count--;
+                        mcpf->stat_same_ref.evictions++;
+                    }
+                }
+            }
+            if ( rc == 0 )
+            {
+                mcpf->stat_same_ref.count++;
+                if ( mcpf->stat_same_ref.count > mcpf->maxcount_same_ref )
+                    mcpf->maxcount_same_ref = mcpf->stat_same_ref.count;
+            }
         }
         if ( rc == 0 )
         {
-            mcpf->stat_same_ref.count++;
-            if ( mcpf->stat_same_ref.count > mcpf->maxcount_same_ref )
-                mcpf->maxcount_same_ref = mcpf->stat_same_ref.count;
+            same_ref_node * n = &c->node[ idx ];
+            n->key = key;
+            n->ref_pos_and_tlen = ref_pos_and_tlen;
+            n->flags = flags;
+            same_ref_link( c, idx );
             mcpf->stat_same_ref.inserts++;
         }
     }
@@ -203,30 +669,18 @@ rc_t matecache_lookup_same_ref( const matecache * const self, uint32_t db_idx, i
     rc_t rc = matecache_check( self, db_idx, &mcpf );
     if ( rc == 0 )
     {
-        uint64_t value64;
+        uint32_t idx = same_ref_find( &mcpf->same_ref, key );
         mcpf->stat_same_ref.lookups++;
-        rc = KVectorGetU64( mcpf->same_ref_64, key, &value64 );
-        if ( rc != 0 )
-        {
-            if ( GetRCState( rc ) != rcNotFound )
-                (void)LOGERR( klogErr, rc, "cannot retrieve value (same-ref) U64" );
-        }
+        if ( idx == MC_NIL )
+            rc = RC( rcApp, rcNoTarg, rcAccessing, rcItem, rcNotFound );
         else
         {
-            uint16_t value16;
-            rc = KVectorGetU16( mcpf->same_ref_16, key, &value16 );
-            if ( rc != 0 )
-            {
-                if ( GetRCState( rc ) != rcNotFound )
-                    (void)LOGERR( klogErr, rc, "cannot retrieve value (same-ref) U16" );
-            }
-            else
-            {
-                *ref_pos = ( value64 >> 32 );
-                *tlen = ( value64 & 0xFFFFFFFF );
-                *flags = value16;
-                mcpf->stat_same_ref.finds++;
-            }
+            const same_ref_node * n = &mcpf->same_ref.node[ idx ];
+            same_ref_touch( &mcpf->same_ref, idx );
+            *ref_pos = ( n->ref_pos_and_tlen >> 32 );
+            *tlen = ( n->ref_pos_and_tlen & 0xFFFFFFFF );
+            *flags = n->flags;
+            mcpf->stat_same_ref.finds++;
         }
     }
     return rc;
@@ -239,43 +693,12 @@ rc_t matecache_remove_same_ref( matecache * const self, uint32_t db_idx, int64_t
     rc_t rc = matecache_check( self, db_idx, &mcpf );
     if ( rc == 0 )
     {
-        rc = KVectorUnset( mcpf->same_ref_64, key );
-        if ( rc != 0 )
-            (void)LOGERR( klogErr, rc, "cannot remove from same-ref-cache (64bit)" );
-        else
+        uint32_t idx = same_ref_find( &mcpf->same_ref, key );
+        if ( idx != MC_NIL )
         {
-            rc = KVectorUnset( mcpf->same_ref_16, key );
-            if ( rc != 0 )
-                (void)LOGERR( klogErr, rc, "cannot remove from same-ref-cache (16bit)" );
-        }
-        if ( rc == 0 && mcpf->stat_same_ref.count > 0 )
-            mcpf->stat_same_ref.count--;
-    }
-    return rc;
-}
-
-
-static rc_t matecache_clear_same_ref_per_file( matecache_per_file * const mcpf )
-{
-    rc_t rc = KVectorRelease( mcpf->same_ref_64 );
-    if ( rc != 0 )
-        (void)LOGERR( klogErr, rc, "cannot release same-ref-cache (64bit)" );
-    else
-    {
-        rc = KVectorRelease( mcpf->same_ref_16 );
-        if ( rc != 0 )
-            (void)LOGERR( klogErr, rc, "cannot release same-ref-cache (16bit)" );
-        else
-        {
-            rc = KVectorMake( &mcpf->same_ref_64 );
-            if ( rc != 0 )
-                (void)LOGERR( klogErr, rc, "cannot make same-ref-cache (64bit)" );
-            else
-            {
-                rc = KVectorMake( &mcpf->same_ref_16 );
-                if ( rc != 0 )
-                    (void)LOGERR( klogErr, rc, "cannot make same-ref-cache (16bit)" );
-            }
+            same_ref_free( &mcpf->same_ref, idx );
+            if ( mcpf->stat_same_ref.count > 0 )
+                mcpf->stat_same_ref.count--;
         }
     }
     return rc;
@@ -293,9 +716,10 @@ rc_t matecache_clear_same_ref( matecache * const self )
     else
     {
         uint32_t idx;
-        for ( idx = 0; idx < self->count && rc == 0; ++idx )
+        for ( idx = 0; idx < self->count; ++idx )
         {
-            rc = matecache_clear_same_ref_per_file( &self->per_file[ idx ] );
+            same_ref_reset( &self->per_file[ idx ].same_ref );
+            self->per_file[ idx ].stat_same_ref.count = 0;
         }
         self->flashes++;
    }
@@ -325,6 +749,8 @@ rc_t matecache_report( const matecache * const self )
                 rc = KOutMsg( "matecache[ %u ].lookups = %,lu\n", idx, self->per_file[ idx ].stat_same_ref.lookups );
             if ( rc == 0 )
                 rc = KOutMsg( "matecache[ %u ].finds = %,lu\n", idx, self->per_file[ idx ].stat_same_ref.finds );
+            if ( rc == 0 )
+                rc = KOutMsg( "matecache[ %u ].evictions = %,lu\n", idx, self->per_file[ idx ].stat_same_ref.evictions );
             if ( rc == 0 )
                 rc = KOutMsg( "unaligned:\n" );
             if ( rc == 0 )
@@ -335,12 +761,42 @@ rc_t matecache_report( const matecache * const self )
                 rc = KOutMsg( "matecache[ %u ].finds = %,lu\n", idx, self->per_file[ idx ].stat_unaligned.finds );
         }
         if ( rc == 0 )
-            rc = KOutMsg( "matecache.flashes = %,lu\n", idx, self->flashes );
+            rc = KOutMsg( "matecache.flashes = %,u\n", self->flashes );
+        if ( rc == 0 )
+            rc = KOutMsg( "matecache.memory = %,lu of %,lu bytes\n", self->mem_used, self->mem_limit );
+        if ( rc == 0 )
+            rc = KOutMsg( "matecache.spills = %,lu ( %,lu bytes )\n", self->spills, self->spilled );
     }
     return rc;
 }
 
 
+void matecache_perf_log( const matecache * const self, struct perf_log * pl )
+{
+    if ( self != NULL && pl != NULL )
+    {
+        uint32_t idx;
+        perf_log_start_section( pl, "mate-cache" );
+        for ( idx = 0; idx < self->count; ++idx )
+        {
+            const matecache_per_file * mcpf = &self->per_file[ idx ];
+            const matecache_stat * s = &mcpf->stat_same_ref;
+            perf_log_counter( pl, "same-ref.hits", s->finds );
+            perf_log_counter( pl, "same-ref.misses", s->lookups - s->finds );
+            perf_log_counter( pl, "same-ref.evictions", s->evictions );
+            perf_log_counter( pl, "same-ref.maxcount", mcpf->maxcount_same_ref );
+            s = &mcpf->stat_unaligned;
+            perf_log_counter( pl, "unaligned.hits", s->finds );
+            perf_log_counter( pl, "unaligned.misses", s->lookups - s->finds );
+            perf_log_counter( pl, "unaligned.count", s->count );
+        }
+        perf_log_counter( pl, "spills", self->spills );
+        perf_log_counter( pl, "spilled-bytes", self->spilled );
+        perf_log_end_section( pl );
+    }
+}
+
+
 rc_t matecache_insert_unaligned( matecache * const self,
         uint32_t db_idx, int64_t key, INSDC_coord_zero ref_pos, uint32_t ref_idx, int64_t seq_id )
 {
@@ -348,21 +804,15 @@ rc_t matecache_insert_unaligned( matecache * const self,
     rc_t rc = matecache_check( self, db_idx, &mcpf );
     if ( rc == 0 )
     {
+        bool inserted;
         uint64_t ref_pos_and_ref_idx = ref_pos;
         ref_pos_and_ref_idx <<= 32;
         ref_pos_and_ref_idx |= ref_idx;
-        rc = KVectorSetU64( mcpf->unaligned_64_a, key, ref_pos_and_ref_idx );
-        if ( rc != 0 )
-            (void)LOGERR( klogErr, rc, "cannot insert into KVector (unaligned a) U64" );
-        else
-        {
-            rc = KVectorSetU64( mcpf->unaligned_64_b, key, seq_id );
-            if ( rc != 0 )
-                (void)LOGERR( klogErr, rc, "cannot insert into KVector (unaligned b) U64" );
-        }
+        rc = unaligned_set( self, mcpf, key, ref_pos_and_ref_idx, seq_id, &inserted );
         if ( rc == 0 )
         {
-            mcpf->stat_unaligned.count++;
+            if ( inserted )
+                mcpf->stat_unaligned.count++;
             mcpf->stat_unaligned.inserts++;
         }
     }
@@ -377,47 +827,48 @@ rc_t matecache_lookup_unaligned( const matecache * const self, uint32_t db_idx,
     rc_t rc = matecache_check( self, db_idx, &mcpf );
     if ( rc == 0 )
     {
-        uint64_t value64_a;
+        const unaligned_entry * e = unaligned_find( &mcpf->unaligned, mcpf->stat_unaligned.count, key );
         mcpf->stat_unaligned.lookups++;
-        rc = KVectorGetU64( mcpf->unaligned_64_a, key, &value64_a );
-        if ( rc != 0 )
-        {
-            if ( GetRCState( rc ) != rcNotFound )
-                (void)LOGERR( klogErr, rc, "cannot retrieve value (unaligned a) U64" );
-        }
+        if ( e == NULL )
+            rc = RC( rcApp, rcNoTarg, rcAccessing, rcItem, rcNotFound );
         else
         {
-            uint64_t value64_b;
-            rc = KVectorGetU64( mcpf->unaligned_64_b, key, &value64_b );
-            if ( rc != 0 )
-            {
-                if ( GetRCState( rc ) != rcNotFound )
-                    (void)LOGERR( klogErr, rc, "cannot retrieve value (unaligned b) U64" );
-            }
-            else
-            {
-                *seq_id = ( int64_t )value64_b;
-                *ref_pos = ( value64_a >> 32 );
-                *ref_idx = ( value64_a & 0xFFFFFFFF );
-                mcpf->stat_unaligned.finds++;
-            }
+            *seq_id = e->seq_id;
+            *ref_pos = ( e->ref_pos_and_ref_idx >> 32 );
+            *ref_idx = ( e->ref_pos_and_ref_idx & 0xFFFFFFFF );
+            mcpf->stat_unaligned.finds++;
         }
     }
     return rc;
 }
 
 
-typedef struct visit_ctx
+rc_t matecache_merge_unaligned( matecache * const self, const matecache * const other )
 {
-    rc_t ( CC * f ) ( int64_t seq_id, int64_t al_id, void * user_data );
-    void * user_data;
-} visit_ctx;
-
-
-static rc_t CC on_seq_id( uint64_t key, int64_t value, void *user_data )
-{
-    visit_ctx * vctx = user_data;
-    return vctx->f( value, ( int64_t )key, vctx->user_data );
+    rc_t rc = 0;
+    uint32_t idx;
+    for ( idx = 0; idx < self->count && idx < other->count && rc == 0; ++idx )
+    {
+        matecache_per_file * dst = &self->per_file[ idx ];
+        const matecache_per_file * src = &other->per_file[ idx ];
+        const unaligned_entry * e = unaligned_slots( &src->unaligned );
+        uint64_t slot, limit = src->unaligned.sorted ? src->stat_unaligned.count : src->unaligned.slots;
+        for ( slot = 0; slot < limit && rc == 0; ++slot )
+        {
+            if ( e[ slot ].key != 0 )
+            {
+                bool inserted;
+                rc = unaligned_set( self, dst, e[ slot ].key, e[ slot ].ref_pos_and_ref_idx, e[ slot ].seq_id, &inserted );
+                if ( rc == 0 && inserted )
+                    dst->stat_unaligned.count++;
+            }
+        }
+        if ( rc != 0 )
+            (void)LOGERR( klogErr, rc, "cannot merge unaligned-cache" );
+        else
+            dst->stat_unaligned.inserts += src->stat_unaligned.inserts;
+    }
+    return rc;
 }
 
 
@@ -430,10 +881,12 @@ rc_t foreach_unaligned_entry( const matecache * const self,
     rc_t rc = matecache_check( self, db_idx, &mcpf );
     if ( rc == 0 )
     {
-        visit_ctx vctx;
-        vctx.f = f;
-        vctx.user_data = user_data;
-        rc = KVectorVisitI64 ( mcpf->unaligned_64_b, false, on_seq_id, &vctx );
+        const unaligned_entry * e;
+        uint64_t idx, count = mcpf->stat_unaligned.count;
+        unaligned_sort( &mcpf->unaligned, count );
+        e = unaligned_slots( &mcpf->unaligned );
+        for ( idx = 0; idx < count && rc == 0; ++idx )
+            rc = f( e[ idx ].seq_id, e[ idx ].key, user_data );
     }
     return rc;
 }
@@ -41,22 +41,79 @@ extern "C" {
 
 #include <insdc/sra.h>
 
+struct perf_log;
+struct KFile;
+struct KMMap;
+
 typedef struct matecache_stat
 {
     uint64_t count;
     uint64_t lookups;
     uint64_t finds;
     uint64_t inserts;
+    uint64_t evictions;
 } matecache_stat;
 
 
-typedef struct matecache_per_file
+/* a memory-segment, either from the heap or mapped from a temp-file */
+typedef struct mc_segment
+{
+    void * base;
+    size_t size;
+    struct KFile * file;    /* NULL for a heap-segment */
+    struct KMMap * mm;
+    uint32_t file_no;       /* the name of the temp-file */
+} mc_segment;
+
+
+/* the aligned mates on the same reference: a pool of nodes, hashed by alignment-id and
+   chained in LRU-order, the least recently used node is given up if the pool is full */
+typedef struct same_ref_node
 {
-    KVector *same_ref_64;   /* ref-pos and ref-idx */
-    KVector *same_ref_16;   /* flags */
+    int64_t key;
+    uint64_t ref_pos_and_tlen;
+    uint32_t hash_next;
+    uint32_t lru_prev;
+    uint32_t lru_next;
+    uint16_t flags;
+} same_ref_node;
+
 
-    KVector *unaligned_64_a;  /* ref-pos and ref-idx */
-    KVector *unaligned_64_b;  /* seq_spot_id */
+typedef struct same_ref_cache
+{
+    same_ref_node * node;
+    uint32_t * bucket;
+    uint32_t allocated;     /* nodes allocated, grows up to capacity */
+    uint32_t capacity;      /* nodes allowed by the memory-limit */
+    uint32_t used;          /* nodes handed out since the last clear */
+    uint32_t free_list;     /* removed nodes, chained by hash_next */
+    uint32_t lru_head;      /* least recently used */
+    uint32_t lru_tail;      /* most recently used */
+} same_ref_cache;
+
+
+/* the half aligned mates: an open-addressed table, that is never evicted,
+   it moves into a spill-segment if the memory-limit is exhausted */
+typedef struct unaligned_entry
+{
+    int64_t key;        /* 0 ... empty slot */
+    uint64_t ref_pos_and_ref_idx;
+    int64_t seq_id;
+} unaligned_entry;
+
+
+typedef struct unaligned_table
+{
+    mc_segment seg;
+    uint64_t slots;     /* power of 2 */
+    bool sorted;        /* the entries are packed and sorted by key for foreach_unaligned_entry() */
+} unaligned_table;
+
+
+typedef struct matecache_per_file
+{
+    same_ref_cache same_ref;
+    unaligned_table unaligned;
 
     matecache_stat stat_same_ref;
     matecache_stat stat_unaligned;
@@ -69,12 +126,21 @@ typedef struct matecache
     matecache_per_file *per_file;
     uint32_t count;
     uint32_t flashes;
+
+    uint64_t mem_limit;     /* for all nodes and tables in memory */
+    uint64_t mem_used;
+    uint32_t row_gap;       /* same-ref entries this many rows behind the newest are evicted */
+    uint64_t spills;        /* how many segments went into spill-files */
+    uint64_t spilled;       /* how many bytes */
+    uint32_t file_no;       /* the last spill-file created */
 } matecache;
 
 
 /* general cache functions */
 
-rc_t make_matecache( matecache **self, uint32_t count );
+/* mem_limit ... bytes, half of it can be used by the same-ref caches
+   row_gap ..... mates farther apart than this many rows are not kept in the same-ref cache, 0 = no limit */
+rc_t make_matecache( matecache **self, uint32_t count, uint64_t mem_limit, uint32_t row_gap );
 
 void release_matecache( matecache * const self );
 
@@ -82,6 +148,9 @@ rc_t matecache_clear_same_ref( matecache * const self );
 
 rc_t matecache_report( const matecache * const self );
 
+/* writes the hit/miss/eviction/spill counters into the timing-log */
+void matecache_perf_log( const matecache * const self, struct perf_log * pl );
+
 
 /* cache functions for aligned mates on the same reference */
 
@@ -110,10 +179,16 @@ rc_t matecache_insert_unaligned( matecache * const self,
 rc_t matecache_lookup_unaligned( const matecache * const self, uint32_t db_idx, int64_t key,
                                  INSDC_coord_zero * const ref_pos, uint32_t * const ref_idx, int64_t * const seq_id );
 
+/* takes over the entries about half aligned mates another cache has collected */
+rc_t matecache_merge_unaligned( matecache * const self, const matecache * const other );
+
 rc_t foreach_unaligned_entry( const matecache * const self,
                               uint32_t db_idx,
                               rc_t ( CC * f ) ( int64_t seq_id, int64_t al_id, void * user_data ),
                               void * user_data );
 
+#ifdef __cplusplus
+}
+#endif
 
 #endif
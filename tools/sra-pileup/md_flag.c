@@ -157,14 +157,14 @@ void free_cigar_t( struct cigar_t * c )
 }
 
 
-static rc_t kout_delete( int count, int *match_count,
-						 const uint8_t * ref, const INSDC_coord_len ref_len, int *ref_idx )
+static rc_t md_delete( out_buf * line, int count, int *match_count,
+					   const uint8_t * ref, const INSDC_coord_len ref_len, int *ref_idx )
 {
 	rc_t rc = 0;
 	
 	if ( *match_count > 0 )
 	{
-		rc = KOutMsg( "%d", *match_count );
+		rc = out_buf_u64( line, *match_count );
 		*match_count = 0;
 	}
 	
@@ -172,7 +172,9 @@ static rc_t kout_delete( int count, int *match_count,
 	{
 		if ( ( *ref_idx + count ) < ref_len )
 		{
-			rc = KOutMsg( "^%.*s", count, &(ref[ *ref_idx ] ) );
+			rc = out_buf_char( line, '^' );
+			if ( rc == 0 )
+				rc = out_buf_mem( line, ( const char * )&(ref[ *ref_idx ] ), count );
 			(*ref_idx) += count;
 		}
 		else
@@ -182,9 +184,9 @@ static rc_t kout_delete( int count, int *match_count,
 }
 
 
-static rc_t kout_match( int count, int *match_count,
-						const char * read, size_t read_len, int *read_idx,
-						const uint8_t *ref, const INSDC_coord_len ref_len, int *ref_idx )
+static rc_t md_match( out_buf * line, int count, int *match_count,
+					  const char * read, size_t read_len, int *read_idx,
+					  const uint8_t *ref, const INSDC_coord_len ref_len, int *ref_idx )
 {
 	rc_t rc = 0;
 	int i;
@@ -198,7 +200,9 @@ static rc_t kout_match( int count, int *match_count,
 			}
 			else
 			{
-				rc = KOutMsg( "%d%c", *match_count, ref[ *ref_idx ] );
+				rc = out_buf_u64( line, *match_count );
+				if ( rc == 0 )
+					rc = out_buf_char( line, ref[ *ref_idx ] );
 				*match_count = 0;
 			}
 			(*ref_idx)++;
@@ -210,16 +214,17 @@ static rc_t kout_match( int count, int *match_count,
 }
 
 
-static rc_t kout_tag( const struct cigar_t * c,
-					  const char * read,
-					  const size_t read_len,
-					  const uint8_t * ref,
-					  const INSDC_coord_len ref_len )
+static rc_t md_tag( out_buf * line,
+					const struct cigar_t * c,
+					const char * read,
+					const size_t read_len,
+					const uint8_t * ref,
+					const INSDC_coord_len ref_len )
 {
 	rc_t rc = 0;
 	if ( c != NULL && read != NULL && read_len > 0 && ref != NULL && ref_len > 0 )
 	{
-		rc = KOutMsg( "\tMD:Z:" );
+		rc = out_buf_mem( line, "\tMD:Z:", 6 );
 		if ( rc == 0 )
 		{
 			int read_idx = 0;
@@ -231,15 +236,15 @@ static rc_t kout_tag( const struct cigar_t * c,
 				int count = c->count[ cigar_idx ];
 				switch ( c->op[ cigar_idx ] )
 				{
-					case 'D' : rc = kout_delete( count, &match_count, ref, ref_len, &ref_idx ); break;
+					case 'D' : rc = md_delete( line, count, &match_count, ref, ref_len, &ref_idx ); break;
 					
 					case 'I' : read_idx += count; break;
 
-					case 'M' : rc = kout_match( count, &match_count, read, read_len, &read_idx, ref, ref_len, &ref_idx ); break;
+					case 'M' : rc = md_match( line, count, &match_count, read, read_len, &read_idx, ref, ref_len, &ref_idx ); break;
 				}
 			}
 			if ( rc == 0 && match_count > 0 )
-				rc = KOutMsg( "%d", match_count );
+				rc = out_buf_u64( line, match_count );
 		}
 	}
 	else
@@ -248,12 +253,13 @@ static rc_t kout_tag( const struct cigar_t * c,
 }
 
 
-rc_t kout_md_tag_from_cigar_string( const char * cigar_str,
-									const size_t cigar_len,
-									const char * read,
-									const size_t read_len,
-									const uint8_t * ref,
-									const INSDC_coord_len ref_len )
+rc_t md_tag_from_cigar_string( out_buf * line,
+							   const char * cigar_str,
+							   const size_t cigar_len,
+							   const char * read,
+							   const size_t read_len,
+							   const uint8_t * ref,
+							   const INSDC_coord_len ref_len )
 {
 	rc_t rc = 0;
 	struct cigar_t * cigar = make_cigar_t( cigar_str, cigar_len );
@@ -261,7 +267,7 @@ rc_t kout_md_tag_from_cigar_string( const char * cigar_str,
 		rc = RC( rcExe, rcNoTarg, rcAllocating, rcItem, rcIncomplete );
 	else
 	{
-		rc = kout_tag( cigar, read, read_len, ref, ref_len );
+		rc = md_tag( line, cigar, read, read_len, ref, ref_len );
 		free_cigar_t( cigar );
 	}
 	return rc;
@@ -34,12 +34,16 @@ extern "C" {
 #include <klib/rc.h>
 #include <insdc/insdc.h>
 
-rc_t kout_md_tag_from_cigar_string( const char * cigar_str,
-									const size_t cigar_len,
-									const char * read,
-									const size_t read_len,
-									const uint8_t * ref,
-									const INSDC_coord_len ref_len );
+#include "out_buf.h"
+
+/* appends the MD-tag ( with its leading tab ) to the SAM-line */
+rc_t md_tag_from_cigar_string( out_buf * line,
+							   const char * cigar_str,
+							   const size_t cigar_len,
+							   const char * read,
+							   const size_t read_len,
+							   const uint8_t * ref,
+							   const INSDC_coord_len ref_len );
 
 #ifdef __cplusplus
 }
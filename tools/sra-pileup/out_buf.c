@@ -0,0 +1,226 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "out_buf.h"
+#include <klib/out.h>
+#include <sysalloc.h>
+#include <string.h>
+
+static const char digit_pairs[ 201 ] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const uint64_t powers_of_10[ 20 ] =
+{
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+
+static uint32_t count_digits( uint64_t value )
+{
+#if defined( __GNUC__ )
+    /* log10 from the bit-length ( 1233 / 4096 ~ log10(2) ), corrected by one compare */
+    uint64_t v = value | 1;
+    uint32_t t = ( ( 64 - __builtin_clzll( v ) ) * 1233 ) >> 12;
+    return t + 1 - ( v < powers_of_10[ t ] );
+#else
+    uint32_t n = 1;
+    while ( n < 20 && value >= powers_of_10[ n ] ) ++n;
+    return n;
+#endif
+}
+
+
+uint32_t fmt_u64( char * dst, uint64_t value )
+{
+    uint32_t n = count_digits( value );
+    char * p = dst + n;
+    while ( value >= 100 )
+    {
+        uint32_t i = ( uint32_t )( value % 100 ) * 2;
+        value /= 100;
+        *--p = digit_pairs[ i + 1 ];
+        *--p = digit_pairs[ i ];
+    }
+    if ( value >= 10 )
+    {
+        uint32_t i = ( uint32_t )value * 2;
+        *--p = digit_pairs[ i + 1 ];
+        *--p = digit_pairs[ i ];
+    }
+    else
+        *--p = ( char )( '0' + value );
+    return n;
+}
+
+
+uint32_t fmt_i64( char * dst, int64_t value )
+{
+    if ( value < 0 )
+    {
+        *dst = '-';
+        return fmt_u64( dst + 1, 0 - ( uint64_t )value ) + 1;
+    }
+    return fmt_u64( dst, value );
+}
+
+
+void out_buf_init( out_buf * self, char * buffer, size_t size )
+{
+    self->data = buffer;
+    self->fixed = buffer;
+    self->size = ( buffer != NULL ) ? size : 0;
+    self->len = 0;
+}
+
+
+void out_buf_release( out_buf * self )
+{
+    if ( self->data != self->fixed )
+        free( self->data );
+    self->data = NULL;
+    self->size = 0;
+    self->len = 0;
+}
+
+
+rc_t out_buf_reserve( out_buf * self, size_t needed, char ** dst )
+{
+    rc_t rc = 0;
+    if ( self->len + needed > self->size )
+    {
+        size_t new_size = self->size * 2;
+        char * tmp;
+        if ( new_size < self->len + needed )
+            new_size = self->len + needed;
+        if ( new_size < 1024 )
+            new_size = 1024;
+        if ( self->data == self->fixed )
+        {
+            tmp = malloc( new_size );
+            if ( tmp != NULL && self->len > 0 )
+                memmove( tmp, self->data, self->len );
+        }
+        else
+            tmp = realloc( self->data, new_size );
+
+        if ( tmp == NULL )
+            rc = RC( rcApp, rcNoTarg, rcWriting, rcMemory, rcExhausted );
+        else
+        {
+            self->data = tmp;
+            self->size = new_size;
+        }
+    }
+    if ( dst != NULL )
+        *dst = ( rc == 0 ) ? self->data + self->len : NULL;
+    return rc;
+}
+
+
+void out_buf_commit( out_buf * self, size_t written )
+{
+    self->len += written;
+}
+
+
+rc_t out_buf_char( out_buf * self, char c )
+{
+    rc_t rc = 0;
+    if ( self->len == self->size )
+        rc = out_buf_reserve( self, 1, NULL );
+    if ( rc == 0 )
+        self->data[ self->len++ ] = c;
+    return rc;
+}
+
+
+rc_t out_buf_mem( out_buf * self, const char * s, size_t len )
+{
+    char * dst;
+    rc_t rc = out_buf_reserve( self, len, &dst );
+    if ( rc == 0 )
+    {
+        memmove( dst, s, len );
+        self->len += len;
+    }
+    return rc;
+}
+
+
+rc_t out_buf_str( out_buf * self, const char * s )
+{
+    return out_buf_mem( self, s, strlen( s ) );
+}
+
+
+rc_t out_buf_u64( out_buf * self, uint64_t value )
+{
+    char * dst;
+    rc_t rc = out_buf_reserve( self, 20, &dst );
+    if ( rc == 0 )
+        self->len += fmt_u64( dst, value );
+    return rc;
+}
+
+
+rc_t out_buf_i64( out_buf * self, int64_t value )
+{
+    char * dst;
+    rc_t rc = out_buf_reserve( self, 21, &dst );
+    if ( rc == 0 )
+        self->len += fmt_i64( dst, value );
+    return rc;
+}
+
+
+rc_t out_buf_flush( out_buf * self )
+{
+    rc_t rc = 0;
+    if ( self->len > 0 )
+    {
+        /* straight into the handler KOutMsg() would end up in, like dump_quality() does */
+        KWrtHandler * handler = KOutHandlerGet ();
+        if ( handler != NULL && handler->writer != NULL )
+        {
+            size_t num_writ;
+            rc = ( * handler->writer ) ( handler->data, self->data, self->len, &num_writ );
+        }
+        self->len = 0;
+    }
+    return rc;
+}
@@ -0,0 +1,70 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_out_buf_
+#define _h_out_buf_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <klib/rc.h>
+
+/* an append-only output line: typed appends instead of KOutMsg()-formatting,
+   written with one call into the KOut-handler by out_buf_flush() */
+typedef struct out_buf
+{
+    char * data;
+    size_t len;
+    size_t size;
+    char * fixed;       /* the caller-provided buffer, data moves to the heap if it outgrows it */
+} out_buf;
+
+void out_buf_init( out_buf * self, char * buffer, size_t size );
+void out_buf_release( out_buf * self );
+
+/* makes room for needed more bytes, *dst points behind the data, out_buf_commit() adds what was written */
+rc_t out_buf_reserve( out_buf * self, size_t needed, char ** dst );
+void out_buf_commit( out_buf * self, size_t written );
+
+rc_t out_buf_char( out_buf * self, char c );
+rc_t out_buf_mem( out_buf * self, const char * s, size_t len );
+rc_t out_buf_str( out_buf * self, const char * s );
+rc_t out_buf_u64( out_buf * self, uint64_t value );
+rc_t out_buf_i64( out_buf * self, int64_t value );
+
+/* writes the data into the KOut-handler and empties the buffer */
+rc_t out_buf_flush( out_buf * self );
+
+/* decimal digits without terminating zero, dst has to have room for 20 / 21 chars */
+uint32_t fmt_u64( char * dst, uint64_t value );
+uint32_t fmt_i64( char * dst, int64_t value );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
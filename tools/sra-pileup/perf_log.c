@@ -270,4 +270,11 @@ void perf_log_line( struct perf_log * pl, uint64_t pos )
             pl->chunk_start = chunk_end;
         }
     }
-}
\ No newline at end of file
+}
+
+
+void perf_log_counter( struct perf_log * pl, const char * name, uint64_t value )
+{
+    if ( pl != NULL )
+        perf_log_write( pl, "%s = %lu\n", value_or_unknown( name ), value );
+}
@@ -45,6 +45,8 @@ void perf_log_end_sub_section( struct perf_log * pl );
 
 void perf_log_line( struct perf_log * pl, uint64_t pos );
 
+void perf_log_counter( struct perf_log * pl, const char * name, uint64_t value );
+
 #ifdef __cplusplus
 }
 #endif
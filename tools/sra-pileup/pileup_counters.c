@@ -28,6 +28,7 @@
 
 #include "ref_walker_0.h"
 #include "4na_ascii.h"
+#include "out_buf.h"
 
 static uint32_t percent( uint32_t v1, uint32_t v2 )
 {
@@ -143,6 +144,7 @@ static void count_indel_fragment( BSTree * fragments, const INSDC_4na_bin *bases
 
 typedef struct walk_fragment_ctx
 {
+    out_buf * line;
     rc_t rc;
     uint32_t n;
 } walk_fragment_ctx;
@@ -154,18 +156,24 @@ static void CC on_fragment( BSTNode *n, void *data )
     const indel_fragment * fragment = ( const indel_fragment * )n;
     if ( wctx->rc == 0 )
     {
-        if ( wctx->n == 0 )
-            wctx->rc = KOutMsg( "%u-%.*s", fragment->count, fragment->len, fragment->bases );
-        else
-            wctx->rc = KOutMsg( "|%u-%.*s", fragment->count, fragment->len, fragment->bases );
+        /* "count-bases", separated by '|' */
+        if ( wctx->n > 0 )
+            wctx->rc = out_buf_char( wctx->line, '|' );
+        if ( wctx->rc == 0 )
+            wctx->rc = out_buf_u64( wctx->line, fragment->count );
+        if ( wctx->rc == 0 )
+            wctx->rc = out_buf_char( wctx->line, '-' );
+        if ( wctx->rc == 0 )
+            wctx->rc = out_buf_mem( wctx->line, fragment->bases, fragment->len );
         wctx->n++;
     }
 }
 
 
-static rc_t print_fragments( BSTree * fragments )
+static rc_t print_fragments( out_buf * line, BSTree * fragments )
 {
     walk_fragment_ctx wctx;
+    wctx.line = line;
     wctx.rc = 0;
     wctx.n = 0;
     BSTreeForEach ( fragments, false, on_fragment, &wctx );
@@ -271,45 +279,80 @@ static rc_t print_counter_line( const char * ref_name,
                                 pileup_counters * counters )
 {
     char c = _4na_to_ascii( ref_base, false );
+    static const char mismatch_suffix[ 4 ][ 3 ] = { "-A", "-C", "-G", "-T" };
+    char buffer[ 4096 ];
+    out_buf line;
+    uint32_t i;
+    rc_t rc;
 
-    rc_t rc = KOutMsg( "%s\t%u\t%c\t%u\t", ref_name, ref_pos + 1, c, depth );
+    /* "ref_name pos base depth" */
+    out_buf_init( &line, buffer, sizeof buffer );
+    rc = out_buf_str( &line, ref_name );
+    if ( rc == 0 )
+        rc = out_buf_char( &line, '\t' );
+    if ( rc == 0 )
+        rc = out_buf_u64( &line, ( uint32_t )( ref_pos + 1 ) );
+    if ( rc == 0 )
+        rc = out_buf_char( &line, '\t' );
+    if ( rc == 0 )
+        rc = out_buf_char( &line, c );
+    if ( rc == 0 )
+        rc = out_buf_char( &line, '\t' );
+    if ( rc == 0 )
+        rc = out_buf_u64( &line, depth );
+    if ( rc == 0 )
+        rc = out_buf_char( &line, '\t' );
 
     if ( rc == 0 && counters->matches > 0 )
-        rc = KOutMsg( "%u", counters->matches );
-
-    if ( rc == 0 /* && counters->mismatches[ 0 ] > 0 */ )
-        rc = KOutMsg( "\t%u-A", counters->mismatches[ 0 ] );
+        rc = out_buf_u64( &line, counters->matches );
 
-    if ( rc == 0 /* && counters->mismatches[ 1 ] > 0 */ )
-        rc = KOutMsg( "\t%u-C", counters->mismatches[ 1 ] );
-
-    if ( rc == 0 /* && counters->mismatches[ 2 ] > 0 */ )
-        rc = KOutMsg( "\t%u-G", counters->mismatches[ 2 ] );
-
-    if ( rc == 0 /* && counters->mismatches[ 3 ] > 0 */ )
-        rc = KOutMsg( "\t%u-T", counters->mismatches[ 3 ] );
+    for ( i = 0; rc == 0 && i < 4; ++i )
+    {
+        rc = out_buf_char( &line, '\t' );
+        if ( rc == 0 )
+            rc = out_buf_u64( &line, counters->mismatches[ i ] );
+        if ( rc == 0 )
+            rc = out_buf_mem( &line, mismatch_suffix[ i ], 2 );
+    }
 
     if ( rc == 0 )
-        rc = KOutMsg( "\tI:" );
+        rc = out_buf_mem( &line, "\tI:", 3 );
     if ( rc == 0 )
-        rc = print_fragments( &(counters->insert_fragments) );
+        rc = print_fragments( &line, &(counters->insert_fragments) );
 
     if ( rc == 0 )
-        rc = KOutMsg( "\tD:" );
+        rc = out_buf_mem( &line, "\tD:", 3 );
     if ( rc == 0 )
-        rc = print_fragments( &(counters->delete_fragments) );
+        rc = print_fragments( &line, &(counters->delete_fragments) );
 
     if ( rc == 0 )
-        rc = KOutMsg( "\t%u%%", percent( counters->forward, counters->reverse ) );
+    {
+        rc = out_buf_char( &line, '\t' );
+        if ( rc == 0 )
+            rc = out_buf_u64( &line, percent( counters->forward, counters->reverse ) );
+        if ( rc == 0 )
+            rc = out_buf_char( &line, '%' );
+    }
 
     if ( rc == 0 && counters->starting > 0 )
-        rc = KOutMsg( "\tS%u", counters->starting );
+    {
+        rc = out_buf_mem( &line, "\tS", 2 );
+        if ( rc == 0 )
+            rc = out_buf_u64( &line, counters->starting );
+    }
 
     if ( rc == 0 && counters->ending > 0 )
-        rc = KOutMsg( "\tE%u", counters->ending );
+    {
+        rc = out_buf_mem( &line, "\tE", 2 );
+        if ( rc == 0 )
+            rc = out_buf_u64( &line, counters->ending );
+    }
 
     if ( rc == 0 )
-        rc = KOutMsg( "\n" );
+        rc = out_buf_char( &line, '\n' );
+    if ( rc == 0 )
+        rc = out_buf_flush( &line );
+    out_buf_release( &line );
 
     free_fragments( &(counters->insert_fragments) );
     free_fragments( &(counters->delete_fragments) );
@@ -385,7 +428,28 @@ static rc_t print_mismatches_line( const char * ref_name,
                                     counters->mismatches[ 3 ];
 	if ( total_mismatches * 100 >= min_mismatch_percent * depth) 
         {
-                rc = KOutMsg( "%s\t%u\t%u\t%u\n", ref_name, ref_pos + 1, depth, total_mismatches );
+                char buffer[ 1024 ];
+                out_buf line;
+
+                out_buf_init( &line, buffer, sizeof buffer );
+                rc = out_buf_str( &line, ref_name );
+                if ( rc == 0 )
+                    rc = out_buf_char( &line, '\t' );
+                if ( rc == 0 )
+                    rc = out_buf_u64( &line, ( uint32_t )( ref_pos + 1 ) );
+                if ( rc == 0 )
+                    rc = out_buf_char( &line, '\t' );
+                if ( rc == 0 )
+                    rc = out_buf_u64( &line, depth );
+                if ( rc == 0 )
+                    rc = out_buf_char( &line, '\t' );
+                if ( rc == 0 )
+                    rc = out_buf_u64( &line, total_mismatches );
+                if ( rc == 0 )
+                    rc = out_buf_char( &line, '\n' );
+                if ( rc == 0 )
+                    rc = out_buf_flush( &line );
+                out_buf_release( &line );
         }
     }
     
@@ -34,6 +34,8 @@ extern "C" {
 #include "ref_regions.h"
 #include "cmdline_cmn.h"
 
+struct dyn_string;
+
 typedef struct pileup_options
 {
     common_options cmn;     /* from cmdline_cmn.h */
@@ -48,10 +50,13 @@ typedef struct pileup_options
     uint32_t minmapq;
     uint32_t min_mismatch;
     uint32_t merge_dist;
+    uint32_t threads;       /* > 1: walk shards of the references in parallel */
+    uint32_t shard_size;
     uint32_t source_table;
     uint32_t function;  /* sra_pileup_samtools, sra_pileup_counters, sra_pileup_stat, 
                            sra_pileup_report_ref, sra_pileup_report_ref_ext, sra_pileup_debug, etc */
     struct skiplist * skiplist;     /* from ref_regions.h */
+    struct dyn_string * out;        /* if not NULL: lines are collected here instead of printed */
 } pileup_options;
 
 
@@ -25,10 +25,10 @@
 */
 
 #include <klib/out.h>
-#include <klib/sort.h>
 
 #include "ref_walker_0.h"
 #include "4na_ascii.h"
+#include "tlen_hist.h"
 
 static uint32_t percent( uint32_t v1, uint32_t v2 )
 {
@@ -80,7 +80,7 @@ static rc_t realloc_tlen_array( tlen_array * a, uint32_t new_depth )
     if ( new_depth > a->capacity )
     {
         void * p = realloc( a->values, ( sizeof ( a->values[ 0 ] ) ) * new_depth );
-        if ( a->values == NULL )
+        if ( p == NULL )
             rc = RC ( rcApp, rcArgv, rcAccessing, rcMemory, rcExhausted );
         else
         {
@@ -128,6 +128,7 @@ typedef struct strand
     tlen_array tlen_w;          /* tlen accumulater for all alignmnts starting/ending in window ending at current position */
     tlen_array tlen_l;          /* array holding the length of all position-slices in the window */
     tlen_array zeros;
+    tlen_hist tlen_h;           /* the values of tlen_w ordered, for the percentiles */
 } strand;
 
 
@@ -145,6 +146,8 @@ static rc_t prepare_strand( strand * strand, uint32_t initial_size )
         rc = init_tlen_array( &strand->tlen_l, initial_size );
     if ( rc == 0 )
         rc = init_tlen_array( &strand->zeros, initial_size );
+    if ( rc == 0 )
+        rc = tlen_hist_init( &strand->tlen_h );
     if ( rc == 0 )
     {
         strand->window_size = 0;
@@ -170,6 +173,7 @@ static void finish_strand( strand * strand )
     finish_tlen_array( &strand->tlen_w );
     finish_tlen_array( &strand->tlen_l );
     finish_tlen_array( &strand->zeros );
+    tlen_hist_finish( &strand->tlen_h );
 }
 
 
@@ -203,7 +207,13 @@ static void on_new_ref_position_strand( strand * strand )
 
     if ( strand->window_size >= strand->window_max )
     {
-        uint32_t to_remove = strand->tlen_l.values[ 0 ];
+        uint32_t i, to_remove = strand->tlen_l.values[ 0 ];
+
+        /* tlen_w is in the order the values came in: the oldest slice is at the front */
+        if ( to_remove > strand->tlen_w.members )
+            to_remove = strand->tlen_w.members;
+        for ( i = 0; i < to_remove; ++i )
+            tlen_hist_remove( &strand->tlen_h, strand->tlen_w.values[ i ] );
         remove_from_tlen_array( &strand->tlen_w, to_remove );
         remove_from_tlen_array( &strand->tlen_l, 1 );
 
@@ -218,21 +228,23 @@ static void on_new_ref_position_strand( strand * strand )
 }
 
 
-static uint32_t medium( tlen_array * a )
+static uint32_t medium( const tlen_hist * h )
 {
-    if ( a->members == 0 )
+    uint32_t n = tlen_hist_count( h );
+    if ( n == 0 )
         return 0;
     else
-        return a->values[ a->members >> 1 ];
+        return tlen_hist_kth( h, n >> 1 );
 }
 
 
-static uint32_t percentil( tlen_array * a, uint32_t p )
+static uint32_t percentil( const tlen_hist * h, uint32_t p )
 {
-    if ( a->members == 0 )
+    uint32_t n = tlen_hist_count( h );
+    if ( n == 0 )
         return 0;
     else
-        return a->values[ ( a->members * p ) / 100 ];
+        return tlen_hist_kth( h, ( n * p ) / 100 );
 }
 
 
@@ -252,6 +264,8 @@ static rc_t CC walk_stat_enter_ref_window( walk_data * data )
     counters->pos.tlen_l.members = 0;
     counters->neg.tlen_w.members = 0;
     counters->neg.tlen_l.members = 0;
+    tlen_hist_clear( &counters->pos.tlen_h );
+    tlen_hist_clear( &counters->neg.tlen_h );
     return 0;
 }
 
@@ -287,17 +301,14 @@ static rc_t CC walk_stat_exit_ref_pos( walk_data * data )
     /* TLEN-Statistic for sliding window, only starting/ending placements */
     if ( rc == 0 )
     {
-        tlen_array * a = &counters->pos.tlen_w;
-        if ( a->members > 1 )
-            ksort_uint32_t ( a->values, a->members );
-
-        rc = KOutMsg( "%u\t%u\t%u\t%u\t", a->zeros, percentil( a, 10 ), medium( a ), percentil( a, 90 ) );
+        strand * s = &counters->pos;
+        rc = KOutMsg( "%u\t%u\t%u\t%u\t", s->tlen_w.zeros,
+                      percentil( &s->tlen_h, 10 ), medium( &s->tlen_h ), percentil( &s->tlen_h, 90 ) );
         if ( rc == 0 )
         {
-            a = &counters->neg.tlen_w;
-            if ( a->members > 1 )
-                ksort_uint32_t ( a->values, a->members );
-            rc = KOutMsg( "%u\t%u\t%u\t%u\t", a->zeros, percentil( a, 10 ), medium( a ), percentil( a, 90 ) );
+            s = &counters->neg;
+            rc = KOutMsg( "%u\t%u\t%u\t%u\t", s->tlen_w.zeros,
+                          percentil( &s->tlen_h, 10 ), medium( &s->tlen_h ), percentil( &s->tlen_h, 90 ) );
         }
     }
 
@@ -315,12 +326,16 @@ static rc_t CC walk_stat_exit_ref_pos( walk_data * data )
 }
 
 
-static void walk_strand_placement( strand * strand, int32_t tlen, INSDC_coord_len seq_len )
+static rc_t walk_strand_placement( strand * strand, int32_t tlen, INSDC_coord_len seq_len )
 {
+    rc_t rc = 0;
     tlen_array * a;
     uint32_t value =  ( tlen < 0 ) ? -tlen : tlen;
     if ( add_tlen_to_array( &strand->tlen_w, value ) )
+    {
         a = &strand->tlen_l;
+        rc = tlen_hist_insert( &strand->tlen_h, value );
+    }
     else
         a = &strand->zeros;
     a->values[ a->members - 1 ]++;
@@ -330,11 +345,13 @@ static void walk_strand_placement( strand * strand, int32_t tlen, INSDC_coord_le
         strand->seq_len_accu += seq_len;
         strand->seq_len_accu_count++;
     }
+    return rc;
 }
 
 
 static rc_t CC walk_stat_placement( walk_data * data )
 {
+    rc_t rc = 0;
     int32_t state = data->state;
     if ( ( state & align_iter_invalid ) != align_iter_invalid )
     {
@@ -346,11 +363,11 @@ static rc_t CC walk_stat_placement( walk_data * data )
 
         /* for TLEN-statistic on starting/ending placements at this pos */
         if ( ( ( state & align_iter_last ) == align_iter_last )&&( reverse ) )
-            walk_strand_placement( strand, data->xrec->tlen, data->rec->len );
+            rc = walk_strand_placement( strand, data->xrec->tlen, data->rec->len );
         else if ( ( ( state & align_iter_first ) == align_iter_first )&&( !reverse ) )
-            walk_strand_placement( strand, data->xrec->tlen, data->rec->len );
+            rc = walk_strand_placement( strand, data->xrec->tlen, data->rec->len );
     }
-    return 0;
+    return rc;
 }
 
 
@@ -29,6 +29,7 @@
 
 #include "pileup_options.h"
 #include "dyn_string.h"
+#include "out_buf.h"
 #include "ref_walker.h"
 #include "4na_ascii.h"
 
@@ -178,17 +179,39 @@ static rc_t CC pileup_v2_enter_ref_pos( ref_walker_data * rwd )
 static rc_t CC pileup_v2_exit_ref_pos( ref_walker_data * rwd )
 {
     pileup_v2_ctx * ctx = rwd->data;
-    rc_t rc = KOutMsg( "%s\t%u\t%c\t%u\t", rwd->ref_name, rwd->pos + 1, rwd->ascii_ref_base, rwd->depth );
+    char buffer[ 4096 ];
+    out_buf line;
+    rc_t rc;
+
+    out_buf_init( &line, buffer, sizeof buffer );
+    rc = out_buf_str( &line, rwd->ref_name );
+    if ( rc == 0 )
+        rc = out_buf_char( &line, '\t' );
+    if ( rc == 0 )
+        rc = out_buf_u64( &line, ( uint32_t )( rwd->pos + 1 ) );
+    if ( rc == 0 )
+        rc = out_buf_char( &line, '\t' );
+    if ( rc == 0 )
+        rc = out_buf_char( &line, rwd->ascii_ref_base );
+    if ( rc == 0 )
+        rc = out_buf_char( &line, '\t' );
     if ( rc == 0 )
-        rc = print_dyn_string( ctx->bases );
+        rc = out_buf_u64( &line, rwd->depth );
+    if ( rc == 0 )
+        rc = out_buf_char( &line, '\t' );
+    if ( rc == 0 )
+        rc = out_buf_mem( &line, dyn_string_char( ctx->bases, 0 ), dyn_string_len( ctx->bases ) );
     if ( rc == 0 && ctx->print_qual )
     {
-        rc = KOutMsg( "\t" );
+        rc = out_buf_char( &line, '\t' );
         if ( rc == 0 )
-            rc = print_dyn_string( ctx->qual );
+            rc = out_buf_mem( &line, dyn_string_char( ctx->qual, 0 ), dyn_string_len( ctx->qual ) );
     }
     if ( rc == 0 )
-        rc = KOutMsg( "\n" );
+        rc = out_buf_char( &line, '\n' );
+    if ( rc == 0 )
+        rc = out_buf_flush( &line );
+    out_buf_release( &line );
     return rc;
 }
 
@@ -256,7 +279,9 @@ static rc_t CC pileup_v2_alignment( ref_walker_data * rwd )
         {
             uint32_t i, n = rwd->ins_bases_count;
             
-            rc = print_2_dyn_string( ctx->bases, "+%u", rwd->ins_bases_count );
+            rc = add_char_2_dyn_string( ctx->bases, '+' );
+            if ( rc == 0 )
+                rc = add_uint_2_dyn_string( ctx->bases, n );
             for ( i = 0; i < n && rc == 0; ++i )
                 rc = add_char_2_dyn_string( ctx->bases, _4na_to_ascii( rwd->ins_bases[ i ], rwd->reverse ) );
         }
@@ -264,7 +289,9 @@ static rc_t CC pileup_v2_alignment( ref_walker_data * rwd )
         if ( rc == 0 && rwd->del && rwd->del_bases_count > 0 && rwd->del_bases != NULL )
         {
             uint32_t i, n = rwd->del_bases_count;
-            rc = print_2_dyn_string( ctx->bases, "-%u", n );
+            rc = add_char_2_dyn_string( ctx->bases, '-' );
+            if ( rc == 0 )
+                rc = add_uint_2_dyn_string( ctx->bases, n );
             for ( i = 0; i < n && rc == 0; ++i )
                 rc = add_char_2_dyn_string( ctx->bases, _4na_to_ascii( rwd->del_bases[ i ], rwd->reverse ) );
         }
@@ -31,6 +31,8 @@
 #include <klib/vector.h>
 #include <klib/container.h>
 
+#include "region_file.h"
+
 #include <stdlib.h>
 
 #include <os-native.h>
@@ -159,10 +161,12 @@ static struct reference_region * make_reference_region( const char *name )
 }
 
 
-static int64_t CC cmp_range_wrapper( const void *item, const void *n )
-{   return cmp_range( item, n ); }
+static int64_t CC cmp_range_reorder( const void **item, const void **n, void *data )
+{   return cmp_range( *item, *n ); }
 
 
+/* the ranges are appended unsorted, check_ref_regions() sorts them once:
+   a sorted insert per range is quadratic for region-files with many thousand ranges */
 static rc_t add_ref_region_range( struct reference_region * self, const uint64_t start, const uint64_t end )
 {
     rc_t rc = 0;
@@ -171,9 +175,9 @@ static rc_t add_ref_region_range( struct reference_region * self, const uint64_t
         rc = RC( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
     else
     {
-        rc = VectorInsert ( &self->ranges, r, NULL, cmp_range_wrapper );
+        rc = VectorAppend ( &self->ranges, NULL, r );
         if ( rc != 0 )
-            free( r );
+            free_range( r );
     }
     return rc;
 }
@@ -283,73 +287,72 @@ static void free_reference_region( struct reference_region * self )
 }
 
 
+/* the merged ranges have been moved to the front, drop the rest from the end of the vector */
+static void truncate_ranges( struct reference_region * self, uint32_t n )
+{
+    uint32_t count = VectorLength( &self->ranges );
+    while ( count > n )
+    {
+        void * r;
+        VectorRemove ( &self->ranges, --count, &r );
+    }
+}
+
+
+/* the ranges are sorted: one pass merges them, removing each merged range from the middle of the vector
+   would make it quadratic */
 static void merge_overlapping_ranges( struct reference_region * self )
 {
     uint32_t n = VectorLength( &self->ranges );
-    uint32_t i = 0;
+    uint32_t i, dst = 0;
     struct reference_range * a = NULL;
-    while ( i < n )
+    for ( i = 0; i < n; ++i )
     {
         struct reference_range * b = VectorGet ( &self->ranges, i );
-        bool remove = false;
-        if ( a != NULL )
+        if ( a != NULL && range_overlapp( a, b ) )
         {
-            remove = range_overlapp( a, b );
-            if ( remove )
-            {
-                struct reference_range * r;
+            if ( b->end > a->end )
                 a->end = b->end;
-                VectorRemove ( &self->ranges, i, (void**)&r );
-                free( r );
-                n--;
-            }
+            free_range( b );
         }
-        if ( !remove )
+        else
         {
+            void * prior;
+            VectorSwap ( &self->ranges, dst++, b, &prior );
             a = b;
-            ++i;
         }
     }
+    truncate_ranges( self, dst );
 }
 
 
 static void merge_close_ranges_and_create_filter( struct reference_region * self, uint64_t merge_diff )
 {
     uint32_t n = VectorLength( &self->ranges );
-    uint32_t i = 0;
+    uint32_t i, dst = 0;
     struct reference_range * a = NULL;
-    while ( i < n )
+    for ( i = 0; i < n; ++i )
     {
         struct reference_range * b = VectorGet ( &self->ranges, i );
-        bool remove = false;
-        if ( a != NULL )
+        /* get the distance between a and b */
+        if ( a != NULL && range_distance( a, b ) < merge_diff )
         {
-            /* get the distance between a and b */
-            uint64_t d = range_distance( a, b );
-            remove = ( d < merge_diff );
-            if ( remove )
-            {
-                struct reference_range * r;
-
-                /* add the gap to the skip-vector of a */
-                struct skip_range * sr = make_skip_range( a->end + 1, b->start - 1 );
-                VectorAppend ( &( a->skip ), NULL, sr );
+            /* add the gap to the skip-vector of a */
+            struct skip_range * sr = make_skip_range( a->end + 1, b->start - 1 );
+            VectorAppend ( &( a->skip ), NULL, sr );
 
-                /* expand a to merge with b */
-                a->end = b->end;
-
-                /* remove b */
-                VectorRemove ( &self->ranges, i, (void**)&r );
-                free( r );
-                n--;
-            }
+            /* expand a to merge with b */
+            a->end = b->end;
+            free_range( b );
         }
-        if ( !remove )
+        else
         {
+            void * prior;
+            VectorSwap ( &self->ranges, dst++, b, &prior );
             a = b;
-            ++i;
         }
     }
+    truncate_ranges( self, dst );
 }
 
 
@@ -411,6 +414,19 @@ rc_t parse_and_add_region( BSTree * regions, const char * s )
 }
 
 
+static rc_t CC on_file_region( const char * name, uint64_t start, uint64_t end, void * data )
+{
+    /* BED: 0-based start, exclusive end ---> 1-based, inclusive */
+    return add_region( data, name, start + 1, end );
+}
+
+
+rc_t add_regions_from_file( BSTree * regions, const char * filename )
+{
+    return foreach_region_in_file( filename, on_file_region, regions ); /* region_file.c */
+}
+
+
 /* =========================================================================================== */
 
 
@@ -451,6 +467,7 @@ static void CC check_refrange_wrapper( BSTNode *n, void *data )
 {
     struct reference_region * rr = ( struct reference_region * )n;
     uint64_t * merge_diff = data;
+    VectorReorder ( &rr->ranges, cmp_range_reorder, NULL );
     merge_overlapping_ranges( rr );
     if ( *merge_diff > 0 )
         merge_close_ranges_and_create_filter( rr, *merge_diff );
@@ -608,9 +625,9 @@ struct skiplist_ref_node
 {
     BSTNode node;
     const char * name;
-    int32_t current_id;
-    const struct skip_range * current_skip_range;
-    Vector skip_ranges;     /* holds skip_range structs */
+    uint32_t current_id;
+    uint32_t count;
+    struct skip_range * skip_ranges;    /* sorted array, searched binary if the position jumps */
 } skiplist_ref_node;
 
 
@@ -648,10 +665,22 @@ static struct skiplist_ref_node * make_skiplist_ref_node( const struct reference
     struct skiplist_ref_node * res = calloc( 1, sizeof *res );
     if ( res != NULL )
     {
-        uint32_t i, n = VectorLength( &r->ranges );
+        uint32_t i, n = VectorLength( &r->ranges ), total = 0;
+        for ( i = 0; i < n; ++i )
+        {
+            const struct reference_range * rr = VectorGet ( &( r->ranges ), i );
+            total += VectorLength( &rr->skip );
+        }
         res->name = string_dup_measure ( r->name, NULL );
-        VectorInit ( &res->skip_ranges, 0, 5 );
-        /* walk the ranges-Vector of the reference-region */
+        res->skip_ranges = ( total > 0 ) ? calloc( total, sizeof res->skip_ranges[ 0 ] ) : NULL;
+        if ( res->name == NULL || ( total > 0 && res->skip_ranges == NULL ) )
+        {
+            free( ( void * ) res->name );
+            free( res->skip_ranges );
+            free( res );
+            return NULL;
+        }
+        /* walk the ranges-Vector of the reference-region, they and their skip-ranges are sorted */
         for ( i = 0; i < n; ++i )
         {
             const struct reference_range * rr = VectorGet ( &( r->ranges ), i );
@@ -661,15 +690,10 @@ static struct skiplist_ref_node * make_skiplist_ref_node( const struct reference
             {
                 const struct skip_range * sr = VectorGet ( &( rr->skip ), j );
                 if ( sr != NULL )
-                {
-                    struct skip_range * csr = make_skip_range( sr->start, sr->end );
-                    if ( csr != NULL )
-                        VectorAppend ( &( res->skip_ranges ), NULL, csr );
-                }
+                    res->skip_ranges[ res->count++ ] = *sr;
             }
         }
         res->current_id = 0;
-        res->current_skip_range = VectorGet ( &( res->skip_ranges ), 0 );
     }
     return res;
 }
@@ -729,7 +753,7 @@ static void CC release_skiplist_entry( BSTNode * n, void * data )
 {
     struct skiplist_ref_node * node = ( struct skiplist_ref_node * )n;
     if ( node->name != NULL ) free( ( void * ) node->name );
-    VectorWhack ( &node->skip_ranges, release_skip, NULL );     /* wrapper callback reused from above */
+    free( node->skip_ranges );
     free( ( void * ) node );
 }
 
@@ -764,15 +788,28 @@ void skiplist_enter_ref( struct skiplist * list, const char * name )
             struct skiplist_ref_node * cur_node = ( struct skiplist_ref_node * )BSTreeFind ( &( list->nodes ), name, pchar_vs_srn_cmp );
             list->current = cur_node;
 			if ( cur_node != NULL )
-			{
 				cur_node->current_id = 0;
-				cur_node->current_skip_range = VectorGet ( &( cur_node->skip_ranges ), 0 );
-			}
         }
     }
 }
 
 
+/* the index of the first skip-range that does not end before pos */
+static uint32_t find_skip_range( const struct skiplist_ref_node * node, uint64_t pos )
+{
+    uint32_t lo = 0, hi = node->count;
+    while ( lo < hi )
+    {
+        uint32_t mid = lo + ( hi - lo ) / 2;
+        if ( node->skip_ranges[ mid ].end < pos )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+
 bool skiplist_is_skip_position( struct skiplist * list, uint64_t pos )
 {
     if ( list != NULL )
@@ -780,14 +817,17 @@ bool skiplist_is_skip_position( struct skiplist * list, uint64_t pos )
         struct skiplist_ref_node * cur_node = list->current;
         if ( cur_node != NULL )
         {
-            const struct skip_range * curr_skip_range = cur_node->current_skip_range;
-            if ( curr_skip_range != NULL )
+            uint32_t id = cur_node->current_id;
+            /* the walk usually moves forward one position at a time and stays in the current skip-range,
+               if it jumped ( shards, regions without alignments ) search the skip-range again */
+            if ( ( id < cur_node->count && pos > cur_node->skip_ranges[ id ].end ) ||
+                 ( id > 0 && pos <= cur_node->skip_ranges[ id - 1 ].end ) )
             {
-                if ( pos < curr_skip_range->start ) return false;
-                if ( pos <= curr_skip_range->end ) return true;
-                cur_node->current_id++;
-                cur_node->current_skip_range = VectorGet ( &( cur_node->skip_ranges ), cur_node->current_id );
+                id = find_skip_range( cur_node, pos );
+                cur_node->current_id = id;
             }
+            if ( id < cur_node->count )
+                return ( pos >= cur_node->skip_ranges[ id ].start );
         }
     }
     return false;
@@ -797,7 +837,7 @@ bool skiplist_is_skip_position( struct skiplist * list, uint64_t pos )
 static void CC skiplist_report_cb( BSTNode *n, void *data )
 {
     const struct skiplist_ref_node * node = ( const struct skiplist_ref_node * )n;
-    uint32_t nr = VectorLength( &( node->skip_ranges ) );
+    uint32_t nr = node->count;
 
     KOutMsg( "\n-[%s]:\n", node->name );
     if ( n == 0 )
@@ -807,7 +847,7 @@ static void CC skiplist_report_cb( BSTNode *n, void *data )
         uint32_t i;
         for ( i = 0; i < nr; ++i )
         {
-            const struct skip_range * sr = ( const struct skip_range * ) VectorGet ( &( node->skip_ranges ), i );
+            const struct skip_range * sr = &node->skip_ranges[ i ];
             KOutMsg( "  %u ... %u\n", sr->start, sr->end );
         }
     }
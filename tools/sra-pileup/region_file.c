@@ -0,0 +1,164 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "region_file.h"
+
+#include <klib/text.h>
+#include <klib/log.h>
+#include <klib/namelist.h>
+#include <kfs/directory.h>
+#include <kfs/file.h>
+#include <kfs/filetools.h>
+
+#include <os-native.h>
+#include <sysalloc.h>
+#include <strtol.h>
+
+static bool is_blank( char c )
+{
+    return ( c == ' ' || c == '\t' || c == '\r' );
+}
+
+
+static bool starts_with( const char * line, size_t len, const char * word )
+{
+    size_t wlen = string_size( word );
+    return ( len >= wlen && string_cmp( line, wlen, word, wlen, ( uint32_t )wlen ) == 0 );
+}
+
+
+/* cuts the next tab/space-separated column out of the line */
+static const char * next_column( const char ** s, const char * end, size_t * len )
+{
+    const char * res;
+    while ( *s < end && is_blank( **s ) )
+        ( *s )++;
+    res = *s;
+    while ( *s < end && !is_blank( **s ) )
+        ( *s )++;
+    *len = ( *s - res );
+    return res;
+}
+
+
+static bool parse_coord( const char * s, size_t len, uint64_t * value )
+{
+    char tmp[ 32 ];
+    char * endp;
+    if ( len == 0 || len >= sizeof tmp )
+        return false;
+    string_copy( tmp, sizeof tmp, s, len );
+    *value = strtou64( tmp, &endp, 10 );
+    return ( *endp == 0 );
+}
+
+
+static rc_t parse_region_line( const char * line, uint32_t line_nr, const char * filename,
+    rc_t ( CC * on_region ) ( const char * name, uint64_t start, uint64_t end, void * data ),
+    void * data )
+{
+    rc_t rc = 0;
+    size_t line_len = string_size( line );
+    const char * s = line;
+    const char * end = line + line_len;
+    size_t name_len, start_len, end_len;
+    const char * name = next_column( &s, end, &name_len );
+    const char * start_s = next_column( &s, end, &start_len );
+    const char * end_s = next_column( &s, end, &end_len );
+    uint64_t start, stop;
+
+    if ( name_len == 0 || name[ 0 ] == '#' ||
+         starts_with( name, name_len, "track" ) || starts_with( name, name_len, "browser" ) )
+        return 0;
+
+    if ( name_len >= 4096 || !parse_coord( start_s, start_len, &start ) || !parse_coord( end_s, end_len, &stop ) || stop < start )
+    {
+        rc = RC( rcApp, rcFile, rcParsing, rcFormat, rcInvalid );
+        (void)PLOGERR( klogErr, ( klogErr, rc, "invalid region in line #$(l) of '$(f)'", "l=%u,f=%s", line_nr, filename ) );
+    }
+    else if ( stop > start )
+    {
+        char ref_name[ 4096 ];
+        string_copy( ref_name, sizeof ref_name, name, name_len );
+        rc = on_region( ref_name, start, stop, data );
+    }
+    return rc;
+}
+
+
+rc_t foreach_region_in_file( const char * filename,
+    rc_t ( CC * on_region ) ( const char * name, uint64_t start, uint64_t end, void * data ),
+    void * data )
+{
+    KDirectory * dir;
+    rc_t rc = KDirectoryNativeDir ( &dir );
+    if ( rc != 0 )
+    {
+        (void)PLOGERR( klogErr, ( klogErr, rc, "cant created native directory for file '$(t)'", "t=%s", filename ) );
+    }
+    else
+    {
+        const struct KFile * f;
+        rc = KDirectoryOpenFileRead ( dir, &f, "%s", filename );
+        if ( rc != 0 )
+        {
+            (void)PLOGERR( klogErr, ( klogErr, rc, "cant open file '$(t)'", "t=%s", filename ) );
+        }
+        else
+        {
+            VNamelist * content;
+            rc = VNamelistMake ( &content, 1024 );
+            if ( rc != 0 )
+            {
+                (void)PLOGERR( klogErr, ( klogErr, rc, "cant create container for file '$(t)'", "t=%s", filename ) );
+            }
+            else
+            {
+                rc = LoadKFileToNameList( f, content );
+                if ( rc != 0 )
+                {
+                    (void)PLOGERR( klogErr, ( klogErr, rc, "cant load file '$(t)' into container", "t=%s", filename ) );
+                }
+                else
+                {
+                    uint32_t i, count;
+                    rc = VNameListCount ( content, &count );
+                    for ( i = 0; i < count && rc == 0; ++i )
+                    {
+                        const char * line;
+                        rc = VNameListGet ( content, i, &line );
+                        if ( rc == 0 && line != NULL )
+                            rc = parse_region_line( line, i + 1, filename, on_region, data );
+                    }
+                }
+                VNamelistRelease( content );
+            }
+            KFileRelease ( f );
+        }
+        KDirectoryRelease ( dir );
+    }
+    return rc;
+}
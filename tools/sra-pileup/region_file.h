@@ -0,0 +1,50 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_region_file_
+#define _h_region_file_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#if 0
+}
+#endif
+
+#include <klib/rc.h>
+
+/* reads a BED-style file of regions: "name <tab> start <tab> end [ <tab> ... ]"
+   start is 0-based, end is exclusive, columns after end are ignored,
+   empty lines, '#'-comments, 'track' and 'browser' lines are skipped */
+rc_t foreach_region_in_file( const char * filename,
+    rc_t ( CC * on_region ) ( const char * name, uint64_t start, uint64_t end, void * data ),
+    void * data );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
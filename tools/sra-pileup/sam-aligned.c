@@ -35,6 +35,9 @@
 #include "rna_splice_log.h"
 #include "sam-aligned.h"
 #include "md_flag.h"
+#include "bam_out.h"
+#include "bam_rec.h"
+#include "shard_sched.h"
 
 const char * PRIM_TABLE = "PRIMARY_ALIGNMENT";
 const char * SEC_TABLE = "SECONDARY_ALIGNMENT";
@@ -769,18 +772,21 @@ static void CC on_region( BSTNode *n, void *data )
                 if ( r != NULL )
                 {
                     INSDC_coord_len len;
-                    if ( r->start == 0 && r->end == 0 )
+                    if ( r->end == RANGE_OPEN_END )
                     {
-                        r->start = 1;
+                        /* up to the end of the reference, a given start can be behind it */
                         rctx->rc = ReferenceObj_SeqLength( ref_obj, &len );
                         if ( rctx->rc == 0 )
-                            r->end = ( r->start + len );
+                        {
+                            len = ( r->start < len ) ? len - ( INSDC_coord_len )r->start : 0;
+                            r->end = r->start + len - 1;
+                        }
                     }
                     else
                     {
                         len = ( r->end - r->start + 1 );
                     }
-                    if ( rctx->rc == 0 )
+                    if ( rctx->rc == 0 && len > 0 )
                     {
                         rctx->rc = add_pl_iters( rctx->opts, rctx->set_iter, ref_obj, rctx->idb,
                             r->start,           /* where the range starts on the reference */
@@ -976,12 +982,8 @@ static rc_t cg_cigar_treatments( enum cigar_treatment what_treatment,
 }
 
 
-static rc_t print_quality_or_star( const samdump_opts * const opts,
-                                   const char * const q,
-                                   uint32_t q_len,
-                                   uint32_t r_len )
+static bool is_star_quality( const char * const q, uint32_t q_len, uint32_t r_len )
 {
-    rc_t rc;
     bool star_qual = ( q_len == 0 || q_len != r_len );
     if ( !star_qual && q[ 0 ] == 255 )
     {
@@ -989,8 +991,17 @@ static rc_t print_quality_or_star( const samdump_opts * const opts,
         while ( i < q_len && q[ i ] == 255 ) i++;
         star_qual = ( i == q_len );
     }
-    
-    if ( star_qual )
+    return star_qual;
+}
+
+
+static rc_t print_quality_or_star( const samdump_opts * const opts,
+                                   const char * const q,
+                                   uint32_t q_len,
+                                   uint32_t r_len )
+{
+    rc_t rc;
+    if ( is_star_quality( q, q_len, r_len ) )
         rc = KOutMsg( "*" );
     else
         rc = dump_quality_33( opts, q, q_len, false ); /* sam-dump-opts.c */
@@ -1397,18 +1408,91 @@ static rc_t print_alignment_sam_ev( const samdump_opts * const opts,
 }
 
 
-static rc_t opt_field_spot_group( const VCursor * cursor, uint32_t col_id, int64_t row_id )
+/* a worker-thread collects the lines/records of its shard, otherwise they are printed */
+static rc_t flush_line( const samdump_opts * const opts, out_buf * line )
+{
+    rc_t rc;
+    if ( opts->out != NULL )
+        rc = out_buf_mem( opts->out, line->data, line->len );
+    else if ( opts->bam != NULL )
+        rc = bam_out_records( opts->bam, line->data, line->len ); /* bam_out.c */
+    else
+        return out_buf_flush( line );
+    line->len = 0;
+    return rc;
+}
+
+
+/* the optional fields, as SAM-text or appended to the BAM-record in line */
+static rc_t opt_field_Z( out_buf * line, bool bam, const char * tag, const char * value, size_t len )
+{
+    rc_t rc;
+    if ( bam )
+        return bam_tag_Z( line, tag, value, len ); /* bam_rec.c */
+    rc = out_buf_char( line, '\t' );
+    if ( rc == 0 )
+        rc = out_buf_mem( line, tag, 2 );
+    if ( rc == 0 )
+        rc = out_buf_mem( line, ":Z:", 3 );
+    if ( rc == 0 )
+        rc = out_buf_mem( line, value, len );
+    return rc;
+}
+
+
+static rc_t opt_field_i( out_buf * line, bool bam, const char * tag, uint64_t value )
+{
+    rc_t rc;
+    if ( bam )
+        return bam_tag_i( line, tag, ( int64_t )value ); /* bam_rec.c */
+    rc = out_buf_char( line, '\t' );
+    if ( rc == 0 )
+        rc = out_buf_mem( line, tag, 2 );
+    if ( rc == 0 )
+        rc = out_buf_mem( line, ":i:", 3 );
+    if ( rc == 0 )
+        rc = out_buf_u64( line, value );
+    return rc;
+}
+
+
+static rc_t opt_field_A( out_buf * line, bool bam, const char * tag, char value )
+{
+    rc_t rc;
+    if ( bam )
+        return bam_tag_A( line, tag, value ); /* bam_rec.c */
+    rc = out_buf_char( line, '\t' );
+    if ( rc == 0 )
+        rc = out_buf_mem( line, tag, 2 );
+    if ( rc == 0 )
+        rc = out_buf_mem( line, ":A:", 3 );
+    if ( rc == 0 )
+        rc = out_buf_char( line, value );
+    return rc;
+}
+
+
+/* optional fields that only exist as SAM-text are collected in tags and then appended to the BAM-record */
+static rc_t flush_tags( out_buf * line, out_buf * tags )
+{
+    rc_t rc = bam_tags_text( line, tags->data, tags->len ); /* bam_rec.c */
+    tags->len = 0;
+    return rc;
+}
+
+
+static rc_t opt_field_spot_group( out_buf * line, bool bam, const VCursor * cursor, uint32_t col_id, int64_t row_id )
 {
     const char * value = NULL;
     uint32_t len;    
     rc_t rc = read_char_ptr( row_id, cursor, col_id, &value, &len, "SPOT_GROUP" );
     if ( rc == 0 && len > 0 )
-        rc = KOutMsg( "\tRG:Z:%.*s", len, value );
+        rc = opt_field_Z( line, bam, "RG", value, len );
     return rc;
 }
 
 
-static rc_t opt_field_lnk_group( const VCursor * cursor, uint32_t col_id, int64_t row_id )
+static rc_t opt_field_lnk_group( out_buf * line, bool bam, const VCursor * cursor, uint32_t col_id, int64_t row_id )
 {
     const char * value = NULL;
     uint32_t len;    
@@ -1451,13 +1535,71 @@ static rc_t opt_field_lnk_group( const VCursor * cursor, uint32_t col_id, int64_
         }
         
         if ( CB.addr == NULL && UB.addr == NULL )
-            { rc = KOutMsg( "\tBX:Z:%.*s", len, value ); }
+            rc = opt_field_Z( line, bam, "BX", value, len );
         else
-            { rc = KOutMsg( "\tCB:Z:%S\tUB:Z:%S", &CB, &UB ); }
+        {
+            rc = opt_field_Z( line, bam, "CB", CB.addr, CB.size );
+            if ( rc == 0 )
+                rc = opt_field_Z( line, bam, "UB", UB.addr, UB.size );
+        }
     }
     return rc;
 }
 
+
+/* the mandatory fields of an aligned record, encoded directly into a BAM-record in line */
+static rc_t encode_alignment_bam( const samdump_opts * const opts, out_buf * line, const out_buf * name,
+                                  uint32_t sam_flags, const char * ref_name, INSDC_coord_zero pos,
+                                  int64_t mapq, const cg_cigar_output * cgc_output,
+                                  const char * mate_ref_name, uint32_t mate_ref_name_len,
+                                  INSDC_coord_zero mate_ref_pos, uint32_t mate_ref_pos_len,
+                                  INSDC_coord_len tlen )
+{
+    const bam_ref_dict * refs = bam_out_refs( opts->bam ); /* bam_out.c */
+    char qual_buffer[ 1024 ];
+    out_buf qual;
+    bam_rec_fields f;
+    bool missing = false;
+    rc_t rc = 0;
+
+    out_buf_init( &qual, qual_buffer, sizeof qual_buffer );
+    memset( &f, 0, sizeof f );
+    f.qname = name->data;
+    f.qname_len = name->len;
+    f.flag = sam_flags;
+    f.ref_id = bam_ref_id( refs, ref_name, string_size( ref_name ), &missing ); /* bam_rec.c */
+    f.pos = pos;
+    f.mapq = mapq;
+    f.cigar = cgc_output->p_cigar.ptr;
+    f.cigar_len = cgc_output->p_cigar.len;
+    f.seq = cgc_output->p_read.ptr;
+    f.seq_len = cgc_output->p_read.len;
+    if ( !is_star_quality( cgc_output->p_quality.ptr, cgc_output->p_quality.len, cgc_output->p_read.len ) )
+    {
+        rc = dump_quality_33_buf( &qual, opts, cgc_output->p_quality.ptr, cgc_output->p_quality.len, false ); /* sam-dump-opts.c */
+        f.qual = qual.data;
+        f.qual_len = qual.len;
+    }
+    if ( mate_ref_name_len == 1 && mate_ref_name[ 0 ] == '=' )
+        f.next_ref_id = f.ref_id;
+    else if ( mate_ref_name_len > 0 )
+        f.next_ref_id = bam_ref_id( refs, mate_ref_name, mate_ref_name_len, &missing );
+    else
+        f.next_ref_id = -1;
+    if ( mate_ref_name_len > 0 )
+        f.pnext = mate_ref_pos;
+    else
+        f.pnext = ( mate_ref_pos_len == 0 ? 0 : mate_ref_pos ) - 1;
+    f.tlen = ( int32_t )tlen;
+
+    if ( rc == 0 && missing )
+        rc = RC( rcExe, rcData, rcConverting, rcName, rcNotFound );
+    if ( rc == 0 )
+        rc = bam_rec_begin( line, &f ); /* bam_rec.c */
+    out_buf_release( &qual );
+    return rc;
+}
+
 static rc_t print_alignment_sam_ps( const samdump_opts * const opts,
                                     const char * ref_name,
                                     INSDC_coord_zero pos,
@@ -1476,6 +1618,12 @@ static rc_t print_alignment_sam_ps( const samdump_opts * const opts,
     cg_cigar_output cgc_output;
     rna_splice_candidates candidates; /* in cg_tools.h */
     bool rna_not_homogeneous_flag = false;
+    bool bam = ( opts->bam != NULL );
+    char * temp_cigar = NULL;
+    char line_buffer[ 4096 ], name_buffer[ 256 ], tags_buffer[ 512 ];
+    out_buf line;   /* the SAM-line or the BAM-record is assembled here and written at once */
+    out_buf name;   /* QNAME */
+    out_buf tags;   /* optional fields only available as SAM-text, on their way into the BAM-record */
 
     /* SAM-FIELD: NONE      SRA-column: MATE_ALIGN_ID ( int64 ) ... for cache lookup's */
     rc_t rc = read_int64( id, cursor, atx->mate_align_id_idx, &mate_align_id, 0, "MATE_ALIGN_ID" );
@@ -1587,6 +1735,10 @@ static rc_t print_alignment_sam_ps( const samdump_opts * const opts,
     if ( rc == 0 && opts->use_matepair_filter && !filter_by_matepair_dist( opts, tlen ) )
         return 0;
 
+    out_buf_init( &line, line_buffer, sizeof line_buffer );
+    out_buf_init( &name, name_buffer, sizeof name_buffer );
+    out_buf_init( &tags, tags_buffer, sizeof tags_buffer );
+
     /* SAM-FIELD: QNAME     SRA-column: SEQ_SPOT_ID ( int64 ) */
     if ( rc == 0 )
     {
@@ -1598,18 +1750,15 @@ static rc_t print_alignment_sam_ps( const samdump_opts * const opts,
                 uint32_t spot_group_len;
                 rc = read_char_ptr( id, cursor, atx->cmn.seq_spot_group_idx, &spot_group, &spot_group_len, "SPOT_GROUP" );
                 if ( rc == 0 )
-                    rc = dump_name( opts, *seq_spot_id, spot_group, spot_group_len ); /* sam-dump-opts.c */
+                    rc = dump_name_buf( &name, opts, *seq_spot_id, spot_group, spot_group_len ); /* sam-dump-opts.c */
             }
             else
-                rc = dump_name( opts, *seq_spot_id, NULL, 0 ); /* sam-dump-opts.c */
+                rc = dump_name_buf( &name, opts, *seq_spot_id, NULL, 0 ); /* sam-dump-opts.c */
         }
         else
-            rc = KOutMsg( "*" );
+            rc = out_buf_char( &name, '*' );
     }
 
-    if ( rc == 0 )
-        rc = KOutMsg( "\t" );
-
     /* massage the sam-flag if we are not dumping unaligned reads... */
     if ( !opts->dump_unaligned_reads    /** not going to dump unaligned **/
          && ( sam_flags & 0x1 )         /** but we have sequenced multiple fragments **/
@@ -1618,13 +1767,6 @@ static rc_t print_alignment_sam_ps( const samdump_opts * const opts,
         /* turn off 0x001 0x008 0x040 0x080 */
         sam_flags &= ~0xC9;
 
-    /* SAM-FIELD: FLAG      SRA-column: SAM_FLAGS ( uint32 ) */
-    /* SAM-FIELD: RNAME     SRA-column: REF_NAME / REF_SEQ_ID ( char * ) */
-    /* SAM-FIELD: POS       SRA-column: REF_POS + 1 */
-    /* SAM-FIELD: MAPQ      SRA-column: MAPQ */
-    if ( rc == 0 )
-        rc = KOutMsg( "%u\t%s\t%u\t%d\t", sam_flags, ref_name, pos + 1, rec->mapq );
-
     /* get READ, QUALITY and EIDT_DIST before cigar manipulation because we need/change these values */
     if ( rc == 0 )
         rc = get_READ_QUALITY_EDIT_DIST( &cgc_output, id, &atx->cmn );
@@ -1633,7 +1775,6 @@ static rc_t print_alignment_sam_ps( const samdump_opts * const opts,
     if ( rc == 0 )
     {
         cg_cigar_input cgc_input;
-        char * temp_cigar = NULL;
         static char const *bogus_quality = "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!";
 
         rc = read_char_ptr( id, cursor, atx->cmn.cigar_idx, &cgc_input.p_cigar.ptr, &cgc_input.p_cigar.len, "CIGAR" );
@@ -1670,7 +1811,7 @@ static rc_t print_alignment_sam_ps( const samdump_opts * const opts,
                     if ( candidates.fwd_matched > 0 && candidates.rev_matched > 0 )
                         rna_not_homogeneous_flag = true;
 
-                    temp_cigar = malloc( cgc_output.p_cigar.len + 1 ); /* temp_cigar will be released at the end of this block */
+                    temp_cigar = malloc( cgc_output.p_cigar.len + 1 ); /* temp_cigar will be released at the end of this function */
                     if ( temp_cigar != NULL )
                     {
                         /* create a new cigarstring by applying the candidates to the cigar-string */
@@ -1708,53 +1849,116 @@ static rc_t print_alignment_sam_ps( const samdump_opts * const opts,
             if ( candidates.cigops != NULL )
                 free( ( void * ) candidates.cigops );
         }
-        if ( rc == 0 )
-            rc = KOutMsg( "%.*s\t", cgc_output.p_cigar.len, cgc_output.p_cigar.ptr );
-
-        if ( temp_cigar != NULL )
-            free( temp_cigar );
     }
 
-    /* SAM-FIELD: RNEXT     SRA-column: MATE_REF_NAME ( !!! row_len can be zero !!! ) */
-    /* SAM-FIELD: PNEXT     SRA-column: MATE_REF_POS + 1 ( !!! row_len can be zero !!! ) */
-    /* SAM-FIELD: TLEN      SRA-column: TEMPLATE_LEN ( !!! row_len can be zero !!! ) */
-    if ( rc == 0 )
+    /* SAM-FIELD: QNAME, FLAG, RNAME, POS, MAPQ, CIGAR, RNEXT, PNEXT, TLEN, SEQ, QUAL */
+    if ( rc == 0 && bam )
+        rc = encode_alignment_bam( opts, &line, &name, sam_flags, ref_name, pos, rec->mapq, &cgc_output,
+                                   mate_ref_name, mate_ref_name_len, mate_ref_pos, mate_ref_pos_len, tlen );
+    else if ( rc == 0 )
     {
-        if ( mate_ref_name_len > 0 )
+        rc = out_buf_mem( &line, name.data, name.len );
+        if ( rc == 0 )
+            rc = out_buf_char( &line, '\t' );
+
+        /* SAM-FIELD: FLAG      SRA-column: SAM_FLAGS ( uint32 ) */
+        /* SAM-FIELD: RNAME     SRA-column: REF_NAME / REF_SEQ_ID ( char * ) */
+        /* SAM-FIELD: POS       SRA-column: REF_POS + 1 */
+        /* SAM-FIELD: MAPQ      SRA-column: MAPQ */
+        if ( rc == 0 )
+            rc = out_buf_u64( &line, sam_flags );
+        if ( rc == 0 )
+            rc = out_buf_char( &line, '\t' );
+        if ( rc == 0 )
+            rc = out_buf_str( &line, ref_name );
+        if ( rc == 0 )
+            rc = out_buf_char( &line, '\t' );
+        if ( rc == 0 )
+            rc = out_buf_u64( &line, ( uint32_t )( pos + 1 ) );
+        if ( rc == 0 )
+            rc = out_buf_char( &line, '\t' );
+        if ( rc == 0 )
+            rc = out_buf_i64( &line, rec->mapq );
+        if ( rc == 0 )
+            rc = out_buf_char( &line, '\t' );
+
+        /* SAM-FIELD: CIGAR */
+        if ( rc == 0 )
+            rc = out_buf_mem( &line, cgc_output.p_cigar.ptr, cgc_output.p_cigar.len );
+        if ( rc == 0 )
+            rc = out_buf_char( &line, '\t' );
+
+        /* SAM-FIELD: RNEXT     SRA-column: MATE_REF_NAME ( !!! row_len can be zero !!! ) */
+        /* SAM-FIELD: PNEXT     SRA-column: MATE_REF_POS + 1 ( !!! row_len can be zero !!! ) */
+        /* SAM-FIELD: TLEN      SRA-column: TEMPLATE_LEN ( !!! row_len can be zero !!! ) */
+        if ( rc == 0 )
         {
-            rc = KOutMsg( "%.*s\t%u\t%d\t", mate_ref_name_len, mate_ref_name, mate_ref_pos + 1, tlen );
+            if ( mate_ref_name_len > 0 )
+            {
+                rc = out_buf_mem( &line, mate_ref_name, mate_ref_name_len );
+                if ( rc == 0 )
+                    rc = out_buf_char( &line, '\t' );
+                if ( rc == 0 )
+                    rc = out_buf_u64( &line, ( uint32_t )( mate_ref_pos + 1 ) );
+            }
+            else
+            {
+                rc = out_buf_mem( &line, "*\t", 2 );
+                if ( rc == 0 )
+                {
+                    if ( mate_ref_pos_len == 0 )
+                        rc = out_buf_char( &line, '0' );
+                    else
+                        rc = out_buf_u64( &line, ( uint32_t )mate_ref_pos );
+                }
+            }
         }
-        else
+        if ( rc == 0 )
+            rc = out_buf_char( &line, '\t' );
+        if ( rc == 0 )
+            rc = out_buf_i64( &line, ( int32_t )tlen );
+        if ( rc == 0 )
+            rc = out_buf_char( &line, '\t' );
+
+        /* SAM-FIELD: SEQ       SRA-column: READ */
+        if ( rc == 0 )
+            rc = out_buf_mem( &line, cgc_output.p_read.ptr, cgc_output.p_read.len );
+        if ( rc == 0 )
+            rc = out_buf_char( &line, '\t' );
+
+        /* SAM-FIELD: QUAL      SRA-column: SAM_QUALITY */
+        if ( rc == 0 )
         {
-            if ( mate_ref_pos_len == 0 )
-                rc = KOutMsg( "*\t0\t%d\t", tlen );
+            if ( is_star_quality( cgc_output.p_quality.ptr, cgc_output.p_quality.len, cgc_output.p_read.len ) )
+                rc = out_buf_char( &line, '*' );
             else
-                rc = KOutMsg( "*\t%u\t%d\t", mate_ref_pos, tlen );
+                rc = dump_quality_33_buf( &line, opts, cgc_output.p_quality.ptr, cgc_output.p_quality.len, false ); /* sam-dump-opts.c */
         }
     }
 
-    /* SAM-FIELD: SEQ       SRA-column: READ */
-    if ( rc == 0 )
-        rc = KOutMsg( "%.*s\t", cgc_output.p_read.len, cgc_output.p_read.ptr );
-
-    /* SAM-FIELD: QUAL      SRA-column: SAM_QUALITY */
-    if ( rc == 0 )
-        rc = print_quality_or_star( opts, cgc_output.p_quality.ptr, cgc_output.p_quality.len, cgc_output.p_read.len ); /* above */    
-
     /* OPT SAM-FIELD: RG     SRA-column: SPOT_GROUP */
     if ( rc == 0 && ( atx->cmn.seq_spot_group_idx != COL_NOT_AVAILABLE ) )
-        rc = opt_field_spot_group( cursor, atx->cmn.seq_spot_group_idx, id );
+        rc = opt_field_spot_group( &line, bam, cursor, atx->cmn.seq_spot_group_idx, id );
 
     /* OPT SAM-FIELD: BZ     SRA-column: LINKAGE_GROUP */
     if ( rc == 0 && ( atx->lnk_group_idx != COL_NOT_AVAILABLE ) )
-        rc = opt_field_lnk_group( cursor, atx->lnk_group_idx, id );
+        rc = opt_field_lnk_group( &line, bam, cursor, atx->lnk_group_idx, id );
 
     if ( rc == 0 && cgc_output.p_tags.len > 0 )
-        rc = KOutMsg( "\t%.*s", cgc_output.p_tags.len, cgc_output.p_tags.ptr );
+    {
+        if ( bam )
+            rc = bam_tags_text( &line, cgc_output.p_tags.ptr, cgc_output.p_tags.len ); /* bam_rec.c */
+        else
+        {
+            rc = out_buf_char( &line, '\t' );
+            if ( rc == 0 )
+                rc = out_buf_mem( &line, cgc_output.p_tags.ptr, cgc_output.p_tags.len );
+        }
+    }
 
     /* OPT SAM-FIELD: XI     SRA-column: ALIGN_ID */
     if ( rc == 0 && opts->print_alignment_id_in_column_xi )
-        rc = KOutMsg( "\tXI:i:%u", id );
+        rc = opt_field_i( &line, bam, "XI", ( uint32_t )id );
 
     /* to match sam-tools output: in case we are dumping this in CG-mode.... */
     if ( rc == 0 && ( opts->cigar_treatment != ct_unchanged ) && ( atx->al_group_idx != COL_NOT_AVAILABLE ) )
@@ -1769,7 +1973,16 @@ static rc_t print_alignment_sam_ps( const samdump_opts * const opts,
             {
                 if ( align_grp[ i ] == '_' )
                 {
-                    rc = KOutMsg( "\tZI:i:%.*s\tZA:i:%.1s", i, align_grp, align_grp + i + 1 );
+                    out_buf * dst = bam ? &tags : &line;
+                    rc = out_buf_mem( dst, "\tZI:i:", 6 );
+                    if ( rc == 0 )
+                        rc = out_buf_mem( dst, align_grp, i );
+                    if ( rc == 0 )
+                        rc = out_buf_mem( dst, "\tZA:i:", 6 );
+                    if ( rc == 0 )
+                        rc = out_buf_char( dst, align_grp[ i + 1 ] );
+                    if ( rc == 0 && bam )
+                        rc = flush_tags( &line, &tags );
                     break;
                 }
             }
@@ -1783,12 +1996,12 @@ static rc_t print_alignment_sam_ps( const samdump_opts * const opts,
         uint32_t al_count_len;
         rc = read_uint8_ptr( id, cursor, atx->cmn.al_count_idx, &al_count, &al_count_len, "ALIGNMENT_COUNT" );
         if ( rc == 0 && al_count_len > 0 )
-            rc = KOutMsg( "\tNH:i:%u", *al_count );
+            rc = opt_field_i( &line, bam, "NH", *al_count );
     }
 
     /* OPT SAM-FIELD: NM     SRA-column: EDIT_DISTANCE */
     if ( rc == 0 )
-        rc = KOutMsg( "\tNM:i:%u", ( cgc_output.edit_dist - NM_adjustments ) );
+        rc = opt_field_i( &line, bam, "NM", ( uint32_t )( cgc_output.edit_dist - NM_adjustments ) );
 
     /* OPT SAM-FIELD: XS:A:+/-  SRA-column: RNA-SPLICING detected via computation, or from the RNA_ORIENTATION - column */
     if ( rc == 0 )
@@ -1799,9 +2012,9 @@ static rc_t print_alignment_sam_ps( const samdump_opts * const opts,
             if ( candidates.fwd_matched > 0 || candidates.rev_matched > 0 )
             {
                 if ( candidates.fwd_matched > 0 )
-                    rc = KOutMsg( "\tXS:A:+" );
+                    rc = opt_field_A( &line, bam, "XS", '+' );
                 else 
-                    rc = KOutMsg( "\tXS:A:-" );
+                    rc = opt_field_A( &line, bam, "XS", '-' );
             }
         }
         else
@@ -1814,9 +2027,7 @@ static rc_t print_alignment_sam_ps( const samdump_opts * const opts,
                 rc = read_char_ptr( id, cursor, atx->rna_orientation_idx,
                                     &rna_orientation, &rna_orientation_len, "RNA_ORIENTATION" );
                 if ( rc == 0 && rna_orientation_len > 0 )
-                {
-                    rc = KOutMsg( "\tXS:A:%c", rna_orientation[ 0 ] );
-                }
+                    rc = opt_field_A( &line, bam, "XS", rna_orientation[ 0 ] );
             }
         }
     }
@@ -1833,16 +2044,33 @@ static rc_t print_alignment_sam_ps( const samdump_opts * const opts,
             rc = ReferenceObj_Read( rec->ref, pos, rec->len, alig_ref, &ref_len );
             if ( rc == 0 )
             {
-                rc = kout_md_tag_from_cigar_string( cgc_output.p_cigar.ptr, cgc_output.p_cigar.len, /* cigar */
+                rc = md_tag_from_cigar_string( bam ? &tags : &line,
+                        cgc_output.p_cigar.ptr, cgc_output.p_cigar.len,                             /* cigar */
                         cgc_output.p_read.ptr, cgc_output.p_read.len,                               /* read */
                         alig_ref, ref_len );                                                        /* reference */
+                if ( rc == 0 && bam )
+                    rc = flush_tags( &line, &tags );
             }
             free( alig_ref );
         }
     }
     
     if ( rc == 0 )
-        rc = KOutMsg( "\n" );
+    {
+        if ( bam )
+        {
+            bam_rec_info info;
+            rc = bam_rec_end( &line, 0, &info ); /* bam_rec.c */
+        }
+        else
+            rc = out_buf_char( &line, '\n' );
+    }
+    if ( rc == 0 )
+        rc = flush_line( opts, &line );
+    out_buf_release( &line );
+    out_buf_release( &name );
+    out_buf_release( &tags );
+    free( temp_cigar );
 
     /* print a log-info if have to because RNA-splicing is requested and we have not homogeneous bits */
     if ( rna_not_homogeneous_flag )
@@ -1872,6 +2100,8 @@ static rc_t print_alignment_fastx( const samdump_opts * const opts,
     int64_t mate_align_id;
     const int64_t * seq_spot_id;
     uint32_t seq_spot_id_len;
+    char line_buffer[ 4096 ];
+    out_buf line;   /* the whole record is assembled here and written at once */
 
     rc_t rc = read_int64_ptr( rec->id, cursor, atx->cmn.seq_spot_id_idx, &seq_spot_id, &seq_spot_id_len, "SEQ_SPOT_ID" );
 
@@ -1885,10 +2115,11 @@ static rc_t print_alignment_fastx( const samdump_opts * const opts,
         }
     }
 
+    out_buf_init( &line, line_buffer, sizeof line_buffer );
     if ( opts->output_format == of_fastq )
-        rc = KOutMsg( "@" );
+        rc = out_buf_char( &line, '@' );
     else
-        rc = KOutMsg( ">" );
+        rc = out_buf_char( &line, '>' );
 
     /* SAM-FIELD: QNAME     1.row: name */
     if ( rc == 0 )
@@ -1901,20 +2132,22 @@ static rc_t print_alignment_fastx( const samdump_opts * const opts,
                 uint32_t spot_grp_len;
                 rc = read_char_ptr( rec->id, cursor, atx->cmn.seq_spot_group_idx, &spot_grp, &spot_grp_len, "SEQ_SPOT_GROUP" );
                 if ( rc == 0 )
-                    rc = dump_name( opts, *seq_spot_id, spot_grp, spot_grp_len ); /* sam-dump-opts.c */
+                    rc = dump_name_buf( &line, opts, *seq_spot_id, spot_grp, spot_grp_len ); /* sam-dump-opts.c */
             }
             else
-                rc = dump_name( opts, *seq_spot_id, NULL, 0 ); /* sam-dump-opts.c */
+                rc = dump_name_buf( &line, opts, *seq_spot_id, NULL, 0 ); /* sam-dump-opts.c */
         }
         else
-            rc = KOutMsg( "*" );
+            rc = out_buf_char( &line, '*' );
 
         if ( rc == 0 )
         {
             uint32_t seq_read_id;
             rc = read_uint32( rec->id, cursor, atx->cmn.seq_read_id_idx, &seq_read_id, 0, "SEQ_READ_ID" );
             if ( rc == 0 )
-                rc = KOutMsg( "/%u", seq_read_id );
+                rc = out_buf_char( &line, '/' );
+            if ( rc == 0 )
+                rc = out_buf_u64( &line, seq_read_id );
         }
     }
 
@@ -1927,15 +2160,27 @@ static rc_t print_alignment_fastx( const samdump_opts * const opts,
     {
         switch( atx->align_table_type )
         {
-        case att_primary    :   rc = KOutMsg( " primary" ); break;
-        case att_secondary  :   rc = KOutMsg( " secondary" ); break;
-        case att_evidence   :   rc = KOutMsg( " evidence" ); break;
+        case att_primary    :   rc = out_buf_str( &line, " primary" ); break;
+        case att_secondary  :   rc = out_buf_str( &line, " secondary" ); break;
+        case att_evidence   :   rc = out_buf_str( &line, " evidence" ); break;
         }
     }
 
     /* against what reference aligned, at what position, with what mapping-quality */
     if ( rc == 0 )
-        rc = KOutMsg( " ref=%s pos=%u mapq=%i\n", ref_name, pos + 1, rec->mapq );
+        rc = out_buf_mem( &line, " ref=", 5 );
+    if ( rc == 0 )
+        rc = out_buf_str( &line, ref_name );
+    if ( rc == 0 )
+        rc = out_buf_mem( &line, " pos=", 5 );
+    if ( rc == 0 )
+        rc = out_buf_u64( &line, ( uint32_t )( pos + 1 ) );
+    if ( rc == 0 )
+        rc = out_buf_mem( &line, " mapq=", 6 );
+    if ( rc == 0 )
+        rc = out_buf_i64( &line, rec->mapq );
+    if ( rc == 0 )
+        rc = out_buf_char( &line, '\n' );
 
     /* READ at a new line */
     if ( rc == 0 )
@@ -1946,16 +2191,18 @@ static rc_t print_alignment_fastx( const samdump_opts * const opts,
         if ( rc == 0 )
         {
             if ( read_size > 0 )
-                rc = KOutMsg( "%.*s\n", read_size, read );
+                rc = out_buf_mem( &line, read, read_size );
             else
-                rc = KOutMsg( "*\n" );
+                rc = out_buf_char( &line, '*' );
+            if ( rc == 0 )
+                rc = out_buf_char( &line, '\n' );
         }
     }
 
     /* QUALITY on a new line if in fastq-mode */
     if ( rc == 0 && opts->output_format == of_fastq )
     {
-        rc = KOutMsg( "+\n" );
+        rc = out_buf_mem( &line, "+\n", 2 );
         if ( rc == 0 )
         {
             const char * quality;
@@ -1964,15 +2211,18 @@ static rc_t print_alignment_fastx( const samdump_opts * const opts,
             if ( rc == 0 )
             {
                 if ( quality_size > 0 )
-                    rc = dump_quality_33( opts, quality, quality_size, orientation );  /* sam-dump-opts.c */
+                    rc = dump_quality_33_buf( &line, opts, quality, quality_size, orientation );  /* sam-dump-opts.c */
                 else
-                    rc = KOutMsg( "*" );
+                    rc = out_buf_char( &line, '*' );
             }
             if ( rc == 0 )
-                rc = KOutMsg( "\n" );
+                rc = out_buf_char( &line, '\n' );
         }
     }
 
+    if ( rc == 0 )
+        rc = flush_line( opts, &line );
+    out_buf_release( &line );
     return rc;
 }
 
@@ -2358,6 +2608,327 @@ static rc_t print_selected_aligned_spots( const samdump_opts * const opts,
 }
 
 
+/* =========================================================================================== */
+/* parallel dump of whole references: the references are cut into shards, worker-threads walk
+   one shard at a time with their own databases, reference-lists, cursors and mate-cache into
+   a buffer, the calling thread prints the buffers in the order of the shards ( shard_sched.c ) */
+
+typedef struct aligned_shard
+{
+    uint32_t db_idx;
+    uint32_t ref_idx;
+    INSDC_coord_zero start;
+    INSDC_coord_len len;
+    out_buf out;
+} aligned_shard;
+
+
+typedef struct aligned_shards
+{
+    aligned_shard * shard;
+    uint32_t count;
+    uint32_t allocated;
+
+    const input_files * ifs;
+    struct bam_out * bam;   /* the shards hold BAM-records instead of SAM-lines */
+} aligned_shards;
+
+
+typedef struct aligned_worker
+{
+    aligned_shards * shards;
+    samdump_opts opts;          /* a copy that collects the lines into the current shard */
+    const AlignMgr * a_mgr;
+    input_database * dbs;       /* own handles to the input-databases, opened when needed */
+    matecache * mc;             /* merged into the common mate-cache at the end */
+} aligned_worker;
+
+
+static rc_t add_aligned_shards( aligned_shards * self, uint32_t db_idx, uint32_t ref_idx,
+                                INSDC_coord_len ref_len, uint32_t size )
+{
+    rc_t rc = 0;
+    INSDC_coord_zero start = 0;
+    do
+    {
+        if ( self->count == self->allocated )
+        {
+            uint32_t new_allocated = self->allocated == 0 ? 64 : self->allocated * 2;
+            aligned_shard * tmp = realloc( self->shard, new_allocated * sizeof tmp[ 0 ] );
+            if ( tmp == NULL )
+                rc = RC( rcExe, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+            else
+            {
+                self->shard = tmp;
+                self->allocated = new_allocated;
+            }
+        }
+        if ( rc == 0 )
+        {
+            aligned_shard * shard = &self->shard[ self->count++ ];
+            shard->db_idx = db_idx;
+            shard->ref_idx = ref_idx;
+            shard->start = start;
+            shard->len = ( ref_len - start > size ) ? size : ref_len - start;
+            out_buf_init( &shard->out, NULL, 0 );
+            start += shard->len;
+        }
+    } while ( rc == 0 && ( INSDC_coord_len )start < ref_len );
+    return rc;
+}
+
+
+/* the references in the order print_all_aligned_spots_0() visits them */
+static rc_t make_aligned_shards( aligned_shards * self, uint32_t size )
+{
+    rc_t rc = 0;
+    uint32_t db_idx;
+    for ( db_idx = 0; db_idx < self->ifs->database_count && rc == 0; ++db_idx )
+    {
+        const input_database * ids = VectorGet( &self->ifs->dbs, db_idx );
+        if ( ids != NULL )
+        {
+            uint32_t ref_idx, refobj_count;
+            rc = ReferenceList_Count( ids->reflist, &refobj_count );
+            for ( ref_idx = 0; ref_idx < refobj_count && rc == 0; ++ref_idx )
+            {
+                const ReferenceObj * ref_obj;
+                rc = ReferenceList_Get( ids->reflist, &ref_obj, ref_idx );
+                if ( rc == 0 && ref_obj != NULL )
+                {
+                    INSDC_coord_len ref_len;
+                    rc = ReferenceObj_SeqLength( ref_obj, &ref_len );
+                    if ( rc == 0 )
+                        rc = add_aligned_shards( self, db_idx, ref_idx, ref_len, size );
+                    ReferenceObj_Release( ref_obj );
+                }
+            }
+        }
+    }
+    return rc;
+}
+
+
+/* the cursors of ReferenceList and placement-iterators cannot be shared between threads,
+   every worker opens the databases again */
+static rc_t worker_database( aligned_worker * self, uint32_t db_idx, const input_database ** idb )
+{
+    rc_t rc = 0;
+    input_database * own = &self->dbs[ db_idx ];
+    if ( own->db == NULL )
+    {
+        const input_database * src = VectorGet( &self->shards->ifs->dbs, db_idx );
+        const VDBManager * mgr;
+        rc = VDatabaseOpenManagerRead( src->db, &mgr );
+        if ( rc != 0 )
+        {
+            (void)LOGERR( klogInt, rc, "VDatabaseOpenManagerRead() failed" );
+        }
+        else
+        {
+            rc = VDBManagerOpenDBRead( mgr, &own->db, NULL, "%s", src->path );
+            if ( rc != 0 )
+            {
+                (void)PLOGERR( klogErr, ( klogErr, rc, "cannot open '$(t)'", "t=%s", src->path ) );
+            }
+            else
+            {
+                rc = ReferenceList_MakeDatabase( &own->reflist, own->db, self->shards->ifs->reflist_options, 0, NULL, 0 );
+                if ( rc != 0 )
+                {
+                    (void)PLOGERR( klogErr, ( klogErr, rc, "cannot create reflist for '$(t)'", "t=%s", src->path ) );
+                    VDatabaseRelease( own->db );
+                    own->db = NULL;
+                }
+            }
+            VDBManagerRelease( mgr );
+        }
+        own->db_idx = src->db_idx;
+        own->path = src->path;
+    }
+    *idb = own;
+    return rc;
+}
+
+
+static rc_t walk_aligned_shard( aligned_worker * self, aligned_shard * shard )
+{
+    const input_database * idb;
+    rc_t rc = worker_database( self, shard->db_idx, &idb );
+    if ( rc == 0 )
+    {
+        const ReferenceObj * ref_obj;
+        rc = ReferenceList_Get( idb->reflist, &ref_obj, shard->ref_idx );
+        if ( rc != 0 )
+        {
+            (void)LOGERR( klogInt, rc, "ReferenceList_Get() failed" );
+        }
+        else
+        {
+            PlacementSetIterator * set_iter;
+            rc = AlignMgrMakePlacementSetIterator( self->a_mgr, &set_iter );
+            if ( rc != 0 )
+            {
+                (void)LOGERR( klogErr, rc, "cannot create PlacementSetIterator" );
+            }
+            else
+            {
+                Vector context_list;
+                VectorInit ( &context_list, 0, 5 );
+
+                self->opts.out = &shard->out;
+                /* walk_position() prints only the alignments starting in the shard */
+                rc = add_pl_iters( &self->opts, set_iter, ref_obj, idb, shard->start, shard->len, NULL, &context_list );
+                if ( rc == 0 )
+                    rc = walk_placements( &self->opts, set_iter, self->mc );
+                self->opts.out = NULL;
+
+                VectorWhack ( &context_list, destroy_align_table_context, NULL );
+                PlacementSetIteratorRelease( set_iter );
+            }
+            ReferenceObj_Release( ref_obj );
+        }
+    }
+    return rc;
+}
+
+
+/* called by shard_sched.c on a worker-thread */
+static rc_t on_walk_aligned_shard( void * worker, uint32_t idx )
+{
+    aligned_worker * self = worker;
+    return walk_aligned_shard( self, &self->shards->shard[ idx ] );
+}
+
+
+/* called by shard_sched.c in the order of the shards */
+static rc_t on_write_aligned_shard( void * data, uint32_t idx )
+{
+    aligned_shards * self = data;
+    aligned_shard * shard = &self->shard[ idx ];
+    rc_t rc;
+    if ( self->bam != NULL )
+        rc = bam_out_records( self->bam, shard->out.data, shard->out.len ); /* bam_out.c */
+    else
+        rc = out_buf_flush( &shard->out );
+    out_buf_release( &shard->out );
+    return rc;
+}
+
+
+static rc_t make_aligned_worker( aligned_worker * self, aligned_shards * shards, const samdump_opts * const opts )
+{
+    rc_t rc;
+
+    self->shards = shards;
+    self->opts = *opts;
+    self->opts.out = NULL;
+    self->mc = NULL;
+    self->dbs = calloc( shards->ifs->database_count, sizeof self->dbs[ 0 ] );
+    if ( self->dbs == NULL )
+    {
+        self->a_mgr = NULL;
+        return RC( rcExe, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+    }
+
+    rc = AlignMgrMakeRead( &self->a_mgr );
+    if ( rc != 0 )
+    {
+        self->a_mgr = NULL;
+        (void)LOGERR( klogErr, rc, "cannot create alignment-manager" );
+    }
+    else if ( opts->use_mate_cache )
+        rc = make_matecache( &self->mc, shards->ifs->database_count,
+                             mate_cache_share( opts ), opts->mape_gap_cache_limit );
+    return rc;
+}
+
+
+static void release_aligned_worker( aligned_worker * self )
+{
+    if ( self->dbs != NULL )
+    {
+        uint32_t idx;
+        for ( idx = 0; idx < self->shards->ifs->database_count; ++idx )
+        {
+            if ( self->dbs[ idx ].reflist != NULL ) ReferenceList_Release( self->dbs[ idx ].reflist );
+            if ( self->dbs[ idx ].db != NULL ) VDatabaseRelease( self->dbs[ idx ].db );
+        }
+        free( self->dbs );
+    }
+    if ( self->mc != NULL ) release_matecache( self->mc );
+    if ( self->a_mgr != NULL ) AlignMgrRelease( self->a_mgr );
+}
+
+
+static rc_t print_all_aligned_spots_parallel( const samdump_opts * const opts,
+                                              const input_files * const ifs,
+                                              matecache * const mc )
+{
+    aligned_shards shards;
+    aligned_worker * workers = NULL;
+    uint32_t idx, made = 0;
+    rc_t rc;
+
+    memset( &shards, 0, sizeof shards );
+    shards.ifs = ifs;
+    shards.bam = opts->bam;
+
+    rc = make_aligned_shards( &shards, opts->shard_size );
+    if ( rc == 0 && shards.count > 0 )
+    {
+        workers = calloc( opts->threads, sizeof workers[ 0 ] );
+        if ( workers == NULL )
+            rc = RC( rcExe, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+        for ( idx = 0; rc == 0 && idx < opts->threads; ++idx )
+        {
+            rc = make_aligned_worker( &workers[ idx ], &shards, opts );
+            if ( rc != 0 )
+                release_aligned_worker( &workers[ idx ] );
+            else
+                made++;
+        }
+        if ( rc == 0 )
+            rc = run_shards( shards.count, workers, sizeof workers[ 0 ], opts->threads,
+                             on_walk_aligned_shard, on_write_aligned_shard, &shards ); /* shard_sched.c */
+        for ( idx = 0; idx < made; ++idx )
+        {
+            /* sam-unaligned.c looks up the half aligned mates in the common cache */
+            if ( rc == 0 && mc != NULL && workers[ idx ].mc != NULL )
+                rc = matecache_merge_unaligned( mc, workers[ idx ].mc );
+            release_aligned_worker( &workers[ idx ] );
+        }
+        free( workers );
+    }
+
+    for ( idx = 0; idx < shards.count; ++idx )
+        out_buf_release( &shards.shard[ idx ].out );
+    free( shards.shard );
+    return rc;
+}
+
+
+/* everything a shard prints has to go through out_buf, the evidence-printers write with KOutMsg(),
+   rna-splicing and the performance-log keep state across the whole reference */
+static bool can_walk_in_shards( const samdump_opts * const opts )
+{
+    return ( opts->threads > 1 &&
+             opts->region_count == 0 &&
+             opts->dump_mode == dm_one_ref_at_a_time &&
+             !opts->dump_cg_evidence && !opts->dump_cg_sam && !opts->dump_cg_ev_dnb &&
+             !opts->rna_splicing &&
+             opts->perf_log == NULL );
+}
+
+
+uint64_t mate_cache_share( const samdump_opts * const opts )
+{
+    if ( can_walk_in_shards( opts ) )
+        return opts->mate_cache_memory / ( opts->threads + 1 );
+    return opts->mate_cache_memory;
+}
+
+
 /*
    this is called from sam-dump3.c, it prepares the iterators and then walks them
    ---> only entry into this module <--- 
@@ -2374,8 +2945,15 @@ rc_t print_aligned_spots( const samdump_opts * const opts,
         perf_log_start_section( opts->perf_log, "aligned spots" );
 #endif
 
+    /* the workers look up the references of the BAM-header, it has to be complete before they start */
+    if ( opts->bam != NULL )
+        rc = bam_out_end_header( opts->bam ); /* bam_out.c */
+    else
+        rc = 0;
+
     /* first we make an alignment-manager */
-    rc = AlignMgrMakeRead( &a_mgr );
+    if ( rc == 0 )
+        rc = AlignMgrMakeRead( &a_mgr );
     if ( rc != 0 )
     {
         (void)LOGERR( klogErr, rc, "cannot create alignment-manager" );
@@ -2385,7 +2963,9 @@ rc_t print_aligned_spots( const samdump_opts * const opts,
         if ( opts->region_count == 0 )
         {
             /* the user did not specify regions to be printed ==> print all alignments */
-            switch( opts->dump_mode )
+            if ( can_walk_in_shards( opts ) )
+                rc = print_all_aligned_spots_parallel( opts, ifs, mc );
+            else switch( opts->dump_mode )
             {
                 case dm_one_ref_at_a_time : rc = print_all_aligned_spots_0( opts, ifs, mc, a_mgr ); break;
                 case dm_prepare_all_refs  : rc = print_all_aligned_spots_1( opts, ifs, mc, a_mgr ); break;
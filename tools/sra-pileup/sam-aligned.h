@@ -43,4 +43,8 @@ rc_t print_aligned_spots( const samdump_opts * const opts,
                           const input_files * const ifs,
                           matecache * const mc );
 
+/* the part of the mate-cache-memory one mate-cache gets: the main one,
+   and if the references are dumped in shards, one per worker-thread */
+uint64_t mate_cache_share( const samdump_opts * const opts );
+
 #endif
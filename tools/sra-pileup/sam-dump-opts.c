@@ -27,6 +27,7 @@
 
 #include "sam-dump-opts.h"
 #include "perf_log.h"
+#include "region_file.h"
 
 #include <klib/time.h>
 #include <align/quality-quantizer.h>
@@ -111,6 +112,11 @@ static int64_t CC cmp_range_wrapper( const void *item, const void *n )
 {   return cmp_range( item, n ); }
 
 
+static int64_t CC cmp_range_reorder( const void **item, const void **n, void *data )
+{   return cmp_range( *item, *n ); }
+
+
+/* appended unsorted, check_ref_region_ranges() sorts them once after all regions are given */
 static rc_t add_ref_region_range( reference_region * self, const uint64_t start, const uint64_t end )
 {
     rc_t rc = 0;
@@ -119,7 +125,7 @@ static rc_t add_ref_region_range( reference_region * self, const uint64_t start,
         rc = RC( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
     else
     {
-        rc = VectorInsert ( &self->ranges, r, NULL, cmp_range_wrapper );
+        rc = VectorAppend ( &self->ranges, NULL, r );
         if ( rc != 0 )
             free( r );
     }
@@ -235,33 +241,36 @@ static void free_reference_region( reference_region * self )
 }
 
 
+/* sort the ranges and merge the overlapping ones in one pass, the result is sorted and disjoint */
 static void check_ref_region_ranges( reference_region * self )
 {
     uint32_t n = VectorLength( &self->ranges );
-    uint32_t i = 0;
+    uint32_t i, dst = 0;
     range *a = NULL;
-    while ( i < n )
+
+    VectorReorder ( &self->ranges, cmp_range_reorder, NULL );
+    for ( i = 0; i < n; ++i )
     {
         range *b = VectorGet ( &self->ranges, i );
-        bool remove = false;
-        if ( a != NULL )
+        if ( a != NULL && range_overlapp( a, b ) )
         {
-            remove = range_overlapp( a, b );
-            if ( remove )
-            {
-                range *r;
+            if ( b->end > a->end )
                 a->end = b->end;
-                VectorRemove ( &self->ranges, i, (void**)&r );
-                free( r );
-                n--;
-            }
+            free( b );
         }
-        if ( !remove )
+        else
         {
+            void * prior;
+            VectorSwap ( &self->ranges, dst++, b, &prior );
             a = b;
-            ++i;
         }
     }
+    /* drop the merged ones from the end of the vector */
+    while ( n > dst )
+    {
+        void * r;
+        VectorRemove ( &self->ranges, --n, &r );
+    }
 }
 
 
@@ -346,7 +355,7 @@ static rc_t add_refrange( BSTree * regions, const char * name, const uint64_t st
 }
 
 
-static rc_t parse_and_add_region( BSTree * regions, const char * s )
+rc_t parse_and_add_region( BSTree * regions, const char * s )
 {
     rc_t rc = 0;
     uint64_t start, end;
@@ -357,8 +366,8 @@ static rc_t parse_and_add_region( BSTree * regions, const char * s )
     else
     {
         uint64_t start_0based = ( start > 0 ) ? start - 1 : 0;
-        uint64_t end_0based = ( end > 0 ) ? end - 1 : 0;
-        if ( end_0based != 0 && end_0based < start_0based )
+        uint64_t end_0based = ( end > 0 ) ? end - 1 : RANGE_OPEN_END;
+        if ( end_0based < start_0based )
         {
             uint64_t temp = end_0based;
             end_0based = start_0based;
@@ -370,13 +379,26 @@ static rc_t parse_and_add_region( BSTree * regions, const char * s )
 }
 
 
+static rc_t CC on_file_region( const char * name, uint64_t start, uint64_t end, void * data )
+{
+    /* BED: 0-based start, exclusive end ---> 0-based, inclusive */
+    return add_refrange( data, name, start, end - 1 );
+}
+
+
+rc_t add_regions_from_file( BSTree * regions, const char * filename )
+{
+    return foreach_region_in_file( filename, on_file_region, regions ); /* region_file.c */
+}
+
+
 static void CC check_refrange_wrapper( BSTNode *n, void *data )
 {
     check_ref_region_ranges( ( reference_region * ) n );
 }
 
 
-static void check_ref_regions( BSTree * regions )
+void check_ref_regions( BSTree * regions )
 {
     BSTreeForEach ( regions, false, check_refrange_wrapper, NULL );
 }
@@ -388,7 +410,7 @@ static void CC release_ref_region_wrapper( BSTNode *n, void * data )
 }
 
 
-static void free_ref_regions( BSTree * regions )
+void free_ref_regions( BSTree * regions )
 {    
     BSTreeWhack ( regions, release_ref_region_wrapper, NULL );
 }
@@ -402,7 +424,7 @@ static void CC count_ref_region_wrapper( BSTNode *n, void *data )
 }
 
 
-static uint32_t count_ref_regions( BSTree * regions )
+uint32_t count_ref_regions( BSTree * regions )
 {
     uint32_t res = 0;
     BSTreeForEach ( regions, false, count_ref_region_wrapper, &res );
@@ -554,14 +576,22 @@ static rc_t get_bool_option( Args * args, const char * name, bool *value )
 
 static rc_t gather_region_options( Args * args, samdump_opts * opts )
 {
-    uint32_t count;
+    uint32_t count, file_count = 0;
 
     rc_t rc = ArgsOptionCount( args, OPT_REGION, &count );
     if ( rc != 0 )
     {
         (void)PLOGERR( klogErr, ( klogErr, rc, "error counting comandline option '$(t)'", "t=%s", OPT_REGION ) );
     }
-    else if ( count > 0 )
+    else
+    {
+        rc = ArgsOptionCount( args, OPT_REGIONS_FILE, &file_count );
+        if ( rc != 0 )
+        {
+            (void)PLOGERR( klogErr, ( klogErr, rc, "error counting comandline option '$(t)'", "t=%s", OPT_REGIONS_FILE ) );
+        }
+    }
+    if ( rc == 0 && ( count > 0 || file_count > 0 ) )
     {
         uint32_t i;
 
@@ -577,6 +607,17 @@ static rc_t gather_region_options( Args * args, samdump_opts * opts )
             else
                 rc = parse_and_add_region( &opts->regions, s );
         }
+        for ( i = 0; i < file_count && rc == 0; ++i )
+        {
+            const char * s;
+            rc = ArgsOptionValue( args, OPT_REGIONS_FILE, i, (const void **)&s );
+            if ( rc != 0 )
+            {
+                (void)PLOGERR( klogErr, ( klogErr, rc, "error retrieving comandline option '$(t)'", "t=%s", OPT_REGIONS_FILE ) );
+            }
+            else
+                rc = add_regions_from_file( &opts->regions, s );
+        }
         if ( rc == 0 )
         {
             check_ref_regions( &opts->regions );
@@ -742,6 +783,25 @@ static rc_t gather_flag_options( Args * args, samdump_opts * opts )
             opts->output_compression = oc_bzip2;
     }
 
+    {
+        bool bam;
+
+        /* do we have to write BAM instead of SAM ? */
+        rc = get_bool_option( args, OPT_BAM, &bam );
+        if ( rc != 0 ) return rc;
+        if ( bam )
+        {
+            if ( opts->output_compression != oc_none )
+            {
+                rc = RC( rcExe, rcNoTarg, rcValidating, rcParam, rcInvalid );
+                (void)PLOGERR( klogErr, ( klogErr, rc, "the parameter '--$(p1)' excludes '--$(p2)' and '--$(p3)'",
+                              "p1=%s,p2=%s,p3=%s", OPT_BAM, OPT_GZIP, OPT_BZIP2 ) );
+                return rc;
+            }
+            opts->output_compression = oc_bam;
+        }
+    }
+
 
     {
         bool fasta, fastq;
@@ -916,7 +976,15 @@ static rc_t get_int64_option( Args * args, const char * name, uint64_t def, uint
 
 static rc_t gather_int_options( Args * args, samdump_opts * opts )
 {
-    rc_t rc = get_uint32_option( args, OPT_MATE_GAP, 10000, &opts->mape_gap_cache_limit, true );
+    /* 0 ... off, the memory-limit alone bounds the same-ref-cache */
+    rc_t rc = get_uint32_option( args, OPT_MATE_GAP, 0, &opts->mape_gap_cache_limit, true );
+    if ( rc == 0 )
+    {
+        uint32_t mb;
+        rc = get_uint32_option( args, OPT_MATE_MEM, 2048, &mb, true );
+        if ( rc == 0 )
+            opts->mate_cache_memory = ( uint64_t )mb << 20;
+    }
     if ( rc == 0 )
         rc = get_uint32_option( args, OPT_OUTBUFSIZE, 1024 * 32, &opts->output_buffer_size, false );
 
@@ -949,6 +1017,23 @@ static rc_t gather_int_options( Args * args, samdump_opts * opts )
     if ( rc == 0 )
         rc = get_uint32_option( args, OPT_RNA_SPLICEL, 0, &opts->rna_splice_level, true );
 
+    if ( rc == 0 )
+    {
+        rc = get_uint32_option( args, OPT_THREADS, 1, &opts->threads, true );
+        if ( rc == 0 && opts->no_mt )
+            opts->threads = 1;
+    }
+
+    if ( rc == 0 )
+        rc = get_uint32_option( args, OPT_SHARD, 1000000, &opts->shard_size, true );
+
+    if ( rc == 0 )
+    {
+        rc = get_uint32_option( args, OPT_BAM_THREADS, 4, &opts->bam_threads, false );
+        if ( rc == 0 && opts->no_mt )
+            opts->bam_threads = 0;
+    }
+
     return rc;
 }
 
@@ -1129,6 +1214,21 @@ static rc_t gather_string_options( Args * args, samdump_opts * opts )
             opts->rna_splice_log = make_rna_splice_log( opts->rna_splice_log_file, "sam-dump" );
     }
 
+    rc = get_str_option( args, OPT_BAM_INDEX, &s );
+    if ( rc == 0 && s != NULL )
+    {
+        if ( strcmp( s, "bai" ) == 0 )
+            opts->bam_index = bik_bai;
+        else if ( strcmp( s, "csi" ) == 0 )
+            opts->bam_index = bik_csi;
+        else
+        {
+            rc = RC( rcExe, rcArgv, rcProcessing, rcParam, rcInvalid );
+            (void)PLOGERR( klogErr, ( klogErr, rc, "invalid value '$(v)' for '--$(t)', expected 'bai' or 'csi'",
+                                      "v=%s,t=%s", s, OPT_BAM_INDEX ) );
+        }
+    }
+
     return rc;
 }
 
@@ -1170,6 +1270,44 @@ static void gather_unaligned_options( samdump_opts * opts )
     }
 }
 
+/* the BAM-encoder turns SAM-lines into records, everything else cannot be encoded */
+static rc_t check_bam_options( const samdump_opts * opts )
+{
+    rc_t rc = 0;
+    if ( opts->output_compression != oc_bam )
+    {
+        if ( opts->bam_index != bik_none )
+        {
+            rc = RC( rcExe, rcNoTarg, rcValidating, rcParam, rcInvalid );
+            (void)PLOGERR( klogErr, ( klogErr, rc, "the parameter '--$(p1)' requires '--$(p2)'",
+                                      "p1=%s,p2=%s", OPT_BAM_INDEX, OPT_BAM ) );
+        }
+    }
+    else if ( opts->bam_index != bik_none && opts->outputfile == NULL )
+    {
+        rc = RC( rcExe, rcNoTarg, rcValidating, rcParam, rcInvalid );
+        (void)PLOGERR( klogErr, ( klogErr, rc, "the parameter '--$(p1)' requires '--$(p2)'",
+                                  "p1=%s,p2=%s", OPT_BAM_INDEX, OPT_OUTPUTFILE ) );
+    }
+    else if ( opts->output_format != of_sam )
+    {
+        rc = RC( rcExe, rcNoTarg, rcValidating, rcParam, rcInvalid );
+        (void)LOGERR( klogErr, rc, "BAM-output cannot be combined with FASTA/FASTQ-output" );
+    }
+    else if ( opts->force_legacy || opts->report_cache )
+    {
+        /* dumping evidence-dnb forces the legacy code, which has no BAM-output */
+        rc = RC( rcExe, rcNoTarg, rcValidating, rcParam, rcInvalid );
+        (void)LOGERR( klogErr, rc, "BAM-output cannot be combined with legacy-mode, evidence-dnb-dump or cache-report" );
+    }
+    else if ( opts->header_mode == hm_none && !opts->dump_unaligned_only )
+    {
+        rc = RC( rcExe, rcNoTarg, rcValidating, rcParam, rcInvalid );
+        (void)LOGERR( klogErr, rc, "BAM-output needs the header to resolve references" );
+    }
+    return rc;
+}
+
 /* =========================================================================================== */
 
 
@@ -1185,7 +1323,7 @@ static rc_t CC report_reference_cb( const char * name, Vector * ranges, void *da
             for ( i = VectorStart( ranges ); i < count && rc == 0; ++i )
             {
                 range *r = VectorGet( ranges, i );
-                if ( r->end == 0 )
+                if ( r->end == RANGE_OPEN_END )
                 {
                     if ( r->start == 0 )
                         rc = KOutMsg( "\t[ start ... end ]\n" );
@@ -1247,9 +1385,17 @@ void report_options( const samdump_opts * opts )
         case oc_none  : KOutMsg( "output-compression    : none\n" ); break;
         case oc_gzip  : KOutMsg( "output-compression    : gzip\n" ); break;
         case oc_bzip2 : KOutMsg( "output-compression    : bzip2\n" ); break;
+        case oc_bam   : KOutMsg( "output-compression    : BAM ( %u threads )\n", opts->bam_threads ); break;
         default       : KOutMsg( "output-compression    : unknown\n" ); break;
     }
 
+    switch( opts->bam_index )
+    {
+        case bik_none : KOutMsg( "bam-index             : none\n" ); break;
+        case bik_bai  : KOutMsg( "bam-index             : BAI\n" ); break;
+        case bik_csi  : KOutMsg( "bam-index             : CSI\n" ); break;
+    }
+
     switch( opts->output_format )
     {
         case of_sam   : KOutMsg( "output-format         : SAM\n" ); break;
@@ -1330,6 +1476,7 @@ void report_options( const samdump_opts * opts )
     }
 
     KOutMsg( "mate-gap-cache-limit  : %u\n",  opts->mape_gap_cache_limit );
+    KOutMsg( "mate-cache-memory     : %lu MB\n", opts->mate_cache_memory >> 20 );
     KOutMsg( "outputfile            : %s\n",  opts->outputfile );
     KOutMsg( "outputbuffer-size     : %u\n",  opts->output_buffer_size );
     KOutMsg( "cursor-cache-size     : %u\n",  opts->cursor_cache_size );
@@ -1343,6 +1490,8 @@ void report_options( const samdump_opts * opts )
     KOutMsg( "rna-splice-log        : %s\n",  opts->rna_splice_log_file );
 
     KOutMsg( "multithreading        : %s\n",  opts->no_mt ? "NO" : "YES" );  
+    KOutMsg( "threads               : %u\n",  opts->threads );
+    KOutMsg( "shard-size            : %u\n",  opts->shard_size );
     KOutMsg( "with-MD-flag          : %s\n",  opts->with_md_flag ? "NO" : "YES" );
 	
 #if _DEBUGGING
@@ -1403,6 +1552,8 @@ rc_t gather_options( Args * args, samdump_opts * opts )
         rc = gather_matepair_distances( args, opts );
     if ( rc == 0 )
         gather_unaligned_options( opts );
+    if ( rc == 0 && !opts->report_options )
+        rc = check_bam_options( opts );
     return rc;
 }
 
@@ -1416,15 +1567,22 @@ bool is_this_alignment_requested( const samdump_opts * opts, const char *refname
         reference_region *rr = find_reference_region_len( ( BSTree * )&opts->regions, refname, refname_len );
         if ( rr != NULL )
         {
+            /* the ranges are sorted and disjoint: find the first one not ending before start */
             Vector *v = &(rr->ranges);
-            uint32_t i, count = VectorLength( v );
-            for ( i = 0; i < count && !res; ++i )
+            uint32_t lo = VectorStart( v ), hi = lo + VectorLength( v );
+            while ( lo < hi )
             {
-                range * r = VectorGet ( v, i );
-                if ( r != NULL )
-                {
-                    res = ( ( end >= r->start )&&( start <= r->end ) );
-                }
+                uint32_t mid = lo + ( hi - lo ) / 2;
+                const range * r = VectorGet ( v, mid );
+                if ( r->end < start )
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            if ( lo < VectorStart( v ) + VectorLength( v ) )
+            {
+                const range * r = VectorGet ( v, lo );
+                res = ( end >= r->start );
             }
         }
     }
@@ -1432,43 +1590,62 @@ bool is_this_alignment_requested( const samdump_opts * opts, const char *refname
 }
 
 
-rc_t dump_name( const samdump_opts * opts, int64_t seq_spot_id,
-                const char * spot_group, uint32_t spot_group_len )
+rc_t dump_name_buf( out_buf * buf, const samdump_opts * opts, int64_t seq_spot_id,
+                    const char * spot_group, uint32_t spot_group_len )
 {
-    rc_t rc;
+    rc_t rc = 0;
+    bool has_spot_group = ( spot_group != NULL && spot_group_len > 0 );
 
     if ( opts->print_cg_names )
     {
-        if ( spot_group != NULL && spot_group_len != 0 )
-            rc = KOutMsg( "%.*s-1:%lu", spot_group_len, spot_group, seq_spot_id );
-        else
-            rc = KOutMsg( "%lu", seq_spot_id );
+        /* "spotgroup-1:id" or "id" */
+        if ( has_spot_group )
+        {
+            rc = out_buf_mem( buf, spot_group, spot_group_len );
+            if ( rc == 0 )
+                rc = out_buf_mem( buf, "-1:", 3 );
+        }
+        if ( rc == 0 )
+            rc = out_buf_u64( buf, seq_spot_id );
     }
     else
     {
+        /* "prefix.id.spotgroup", prefix and spotgroup are optional */
         if ( opts->qname_prefix != NULL )
         {
-            /* we do have to print a prefix */
-            if ( opts->print_spot_group_in_name && spot_group != NULL && spot_group_len > 0 )
-                rc = KOutMsg( "%s.%lu.%.*s", opts->qname_prefix, seq_spot_id, spot_group_len, spot_group );
-            else
-            /* we do NOT have to append the spot-group */
-                rc = KOutMsg( "%s.%lu", opts->qname_prefix, seq_spot_id );
+            rc = out_buf_str( buf, opts->qname_prefix );
+            if ( rc == 0 )
+                rc = out_buf_char( buf, '.' );
         }
-        else
+        if ( rc == 0 )
+            rc = out_buf_u64( buf, seq_spot_id );
+        if ( rc == 0 && opts->print_spot_group_in_name && has_spot_group )
         {
-            /* we do NOT have to print a prefix */
-            if ( opts->print_spot_group_in_name && spot_group != NULL && spot_group_len > 0 )
-                rc = KOutMsg( "%lu.%.*s", seq_spot_id, spot_group_len, spot_group );
-            else
-            /* we do NOT have to append the spot-group */
-                rc = KOutMsg( "%lu", seq_spot_id );
+            rc = out_buf_char( buf, '.' );
+            if ( rc == 0 )
+                rc = out_buf_mem( buf, spot_group, spot_group_len );
         }
     }
     return rc;
 }
 
 
+rc_t dump_name( const samdump_opts * opts, int64_t seq_spot_id,
+                const char * spot_group, uint32_t spot_group_len )
+{
+    char buffer[ 256 ];
+    out_buf buf;
+    rc_t rc;
+
+    out_buf_init( &buf, buffer, sizeof buffer );
+    rc = dump_name_buf( &buf, opts, seq_spot_id, spot_group, spot_group_len );
+    if ( rc == 0 )
+        rc = out_buf_flush( &buf );
+    out_buf_release( &buf );
+    return rc;
+}
+
+
 rc_t dump_name_legacy( const samdump_opts * opts, const char * name, size_t name_len,
                        const char * spot_group, uint32_t spot_group_len )
 {
@@ -1674,3 +1851,47 @@ rc_t dump_quality_33( const samdump_opts * opts, char const *quality, uint32_t q
 
     return rc;
 }
+
+
+rc_t dump_quality_33_buf( out_buf * buf, const samdump_opts * opts, char const *quality, uint32_t qual_len, bool reverse )
+{
+    char * dst;
+    rc_t rc = out_buf_reserve( buf, qual_len, &dst );
+    if ( rc == 0 )
+    {
+        uint32_t i;
+        bool quantize = ( opts->qual_quant != NULL );
+
+        if ( reverse )
+        {
+            if ( quantize )
+            {
+                for ( i = 0; i < qual_len; ++i )
+                {
+                    uint32_t qual = quality[ qual_len - i - 1 ] - 33;
+                    dst[ i ] = ( opts->qual_quant_matrix[ qual ] + 33 );
+                }
+            }
+            else
+            {
+                for ( i = 0; i < qual_len; ++i )
+                    dst[ i ] = quality[ qual_len - i - 1 ];
+            }
+        }
+        else
+        {
+            if ( quantize )
+            {
+                for ( i = 0; i < qual_len; ++i )
+                {
+                    uint32_t qual = quality[ i ] - 33;
+                    dst[ i ] = opts->qual_quant_matrix[ qual ] + 33;
+                }
+            }
+            else
+                memmove( dst, quality, qual_len );
+        }
+        out_buf_commit( buf, qual_len );
+    }
+    return rc;
+}
@@ -45,6 +45,8 @@ extern "C" {
 #include <kapp/args.h>
 #include "perf_log.h"
 #include "rna_splice_log.h"
+#include "out_buf.h"
+#include "bam_index.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -61,6 +63,7 @@ extern "C" {
 #define OPT_CG_EV_DNB   "CG-ev-dnb"
 #define OPT_CG_MAPP     "CG-mappings"
 #define OPT_REGION      "aligned-region"
+#define OPT_REGIONS_FILE "regions-file"
 #define OPT_RECAL_HDR   "header"
 #define OPT_HDR_FILE    "header-file"
 #define OPT_NO_HDR      "no-header"
@@ -76,6 +79,9 @@ extern "C" {
 #define OPT_Q_QUANT     "qual-quant"
 #define OPT_GZIP        "gzip"
 #define OPT_BZIP2       "bzip2"
+#define OPT_BAM         "bam"
+#define OPT_BAM_INDEX   "bam-index"
+#define OPT_BAM_THREADS "bam-threads"
 #define OPT_FASTQ       "fastq"
 #define OPT_FASTA       "fasta"
 #define OPT_HDR_COMMENT "header-comment"
@@ -91,15 +97,21 @@ extern "C" {
 #define OPT_DUMP_MODE   "dump-mode"
 #define OPT_MIN_MAPQ    "min-mapq"
 #define OPT_NO_MATE_CACHE "no-mate-cache"
+#define OPT_MATE_MEM    "mate-cache-memory"
 #define OPT_LEGACY      "legacy"
 #define OPT_NEW         "new"
 #define OPT_RNA_SPLICE  "rna-splicing"
 #define OPT_RNA_SPLICEL "rna-splice-level"
 #define OPT_RNA_SPLICE_LOG "rna-splice-log"
 #define OPT_NO_MT       "disable-multithreading"
+#define OPT_THREADS     "threads"
+#define OPT_SHARD       "shard-size"
 #define OPT_TIMING      "timing"
 #define OPT_MD_FLAG     "with-md-flag"
 
+/* regions are 0-based and inclusive, a region without end reaches to the end of the reference */
+#define RANGE_OPEN_END ( ( uint64_t ) -1 )
+
 typedef struct range
 {
     uint64_t start;
@@ -134,7 +146,8 @@ enum output_compression
 {
     oc_none = 0,    /* do not compress output */
     oc_gzip,        /* compress output with gzip */
-    oc_bzip2        /* compress output with bzip2 */
+    oc_bzip2,       /* compress output with bzip2 */
+    oc_bam          /* encode output as BAM */
 };
 
 enum cigar_treatment
@@ -206,6 +219,9 @@ typedef struct samdump_opts
     /* mate's farther apart than this are not cached */
     uint32_t mape_gap_cache_limit;
 
+    /* how many bytes the mate-cache may keep in memory before it evicts/spills */
+    uint64_t mate_cache_memory;
+
     size_t cursor_cache_size;
 
     /* how the sam-headers are treated */
@@ -220,6 +236,22 @@ typedef struct samdump_opts
     /* should the output be compressed / in which format */
     enum output_compression output_compression;
 
+    /* which index to write next to a BAM-output */
+    enum bam_index_kind bam_index;
+
+    /* how many threads deflate the BAM-output */
+    uint32_t bam_threads;
+
+    /* > 1: dump the aligned reads of whole references in shards on this many threads */
+    uint32_t threads;
+    uint32_t shard_size;
+
+    /* if not NULL: a worker-thread collects the lines of its shard here instead of printing them */
+    out_buf * out;
+
+    /* if not NULL: the aligned reads are encoded as BAM-records and written here ( bam_out.h ) */
+    struct bam_out * bam;
+
     /* how to process in case of: aligned reads requested + no regions given */
     enum dump_mode dump_mode;
 
@@ -278,6 +310,14 @@ typedef struct foreach_reference_func
 } foreach_reference_func;
 
 
+/* the regions of --aligned-region ( name[:from-to], 1-based ) and of --regions-file ( BED ),
+   stored 0-based and inclusive, check_ref_regions() sorts and merges them per reference */
+rc_t parse_and_add_region( BSTree * regions, const char * s );
+rc_t add_regions_from_file( BSTree * regions, const char * filename );
+void check_ref_regions( BSTree * regions );
+void free_ref_regions( BSTree * regions );
+uint32_t count_ref_regions( BSTree * regions );
+
 rc_t foreach_reference( BSTree * regions,
     rc_t ( CC * on_reference ) ( const char * name, Vector *ranges, void *data ), 
     void *data );
@@ -296,6 +336,9 @@ bool is_this_alignment_requested( const samdump_opts * opts, const char *refname
 rc_t dump_name( const samdump_opts * opts, int64_t seq_spot_id,
                 const char * spot_group, uint32_t spot_group_len );
 
+rc_t dump_name_buf( out_buf * buf, const samdump_opts * opts, int64_t seq_spot_id,
+                    const char * spot_group, uint32_t spot_group_len );
+
 rc_t dump_name_legacy( const samdump_opts * opts, const char * name, size_t name_len,
                        const char * spot_group, uint32_t spot_group_len );
 
@@ -303,4 +346,10 @@ rc_t dump_quality( const samdump_opts * opts, char const *quality, uint32_t qual
 
 rc_t dump_quality_33( const samdump_opts * opts, char const *quality, uint32_t qual_len, bool reverse );
 
+rc_t dump_quality_33_buf( out_buf * buf, const samdump_opts * opts, char const *quality, uint32_t qual_len, bool reverse );
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -36,6 +36,7 @@
 #include "matecache.h"
 #include "cg_tools.h"
 #include "out_redir.h"
+#include "bam_redir.h"
 #include "sam-aligned.h"
 #include "sam-unaligned.h"
 
@@ -81,6 +82,10 @@ char const *sd_region_usage[]         = { "Filter by position on genome.",
                                        "\"from\" and \"to\" (inclusive) are 1-based coordinates",
                                        NULL };
 
+char const *sd_regions_file_usage[]   = { "Filter by the regions listed in this BED-file.",
+                                       "Each line: name, 0-based start, exclusive end",
+                                       NULL };
+
 char const *sd_distance_usage[]       = { "Filter by distance between matepairs.",
                                        "Use \"unknown\" to find matepairs split between the references.",
                                        "Use from-to (inclusive) to limit matepair distance on the same reference",
@@ -98,6 +103,16 @@ char const *sd_gzip_usage[]           = { "Compress output using gzip",
 char const *sd_bzip2_usage[]          = { "Compress output using bzip2",
                                        NULL };
 
+char const *sd_bam_usage[]            = { "Write BAM instead of SAM",
+                                       NULL };
+
+char const *sd_bam_index_usage[]      = { "Write a BAM-index next to the output-file,",
+                                       "'bai' or 'csi' ( only if output is sorted by position )",
+                                       NULL };
+
+char const *sd_bam_threads_usage[]    = { "number of threads compressing BAM (dflt:4)",
+                                       NULL };
+
 char const *sd_qname_usage[]          = { "Add .SPOT_GROUP to QNAME",
                                        NULL };
 
@@ -150,6 +165,9 @@ char const *sd_min_mapq_usage[]       = { "min. mapq an alignment has to have, t
 char const *sd_no_mate_cache_usage[]  = { "do not use a mate-cache, slower but less memory usage",
                                        NULL };
 
+char const *sd_mate_mem_usage[]       = { "memory for the mate-cache in MB, shared by all threads,",
+                                           "it evicts or spills into a temp-file beyond that (dflt:2048)", NULL };
+
 char const *rna_splice_usage[]        = { "modify cigar-string (replace .D. with .N.) and add output flags (XS:A:+/-) ",
                                            "when rna-splicing is detected by match to spliceosome recognition sites",
                                        NULL };
@@ -164,6 +182,11 @@ char const *rna_splice_log_usage[]    = { "file, into which rna-splice events ar
 
 char const *no_mt_usage[]             = { "disable multithreading", NULL };
 
+char const *threads_usage[]           = { "dump the aligned reads of whole references in shards",
+                                       "on this many threads, output stays in order (dflt:1)", NULL };
+
+char const *shard_usage[]             = { "size of the shards for --threads in bases (dflt:1000000)", NULL };
+
 char const *with_md_flag_usage[]      = { "print MD-flag", NULL };
                                       
 OptDef SamDumpArgs[] =
@@ -177,11 +200,15 @@ OptDef SamDumpArgs[] =
     { OPT_NO_HDR,        "n", NULL, sd_noheader_usage,       0, false, false },  /* do not print header */
     { OPT_HDR_COMMENT,  NULL, NULL, sd_comment_usage,        0, true,  false },  /* insert this comment into header */
     { OPT_REGION,       NULL, NULL, sd_region_usage,         0, true,  false },  /* filter by region */
+    { OPT_REGIONS_FILE, NULL, NULL, sd_regions_file_usage,   0, true,  false },  /* filter by regions from a BED-file */
     { OPT_MATE_DIST,    NULL, NULL, sd_distance_usage,       0, true,  false },  /* filter by a list of mate-pair-distances */
     { OPT_USE_SEQID,     "s", NULL, sd_seq_id_usage,         0, false, false },  /* print seq-id instead of seq-name*/
     { OPT_HIDE_IDENT,    "=", NULL, sd_identicalbases_usage, 0, false, false },  /* replace bases that match the reference with '=' */
     { OPT_GZIP,         NULL, NULL, sd_gzip_usage,           0, false, false },  /* compress the output with gzip */
     { OPT_BZIP2,        NULL, NULL, sd_bzip2_usage,          0, false, false },  /* compress the output with bzip2 */
+    { OPT_BAM,          NULL, NULL, sd_bam_usage,            0, false, false },  /* write BAM instead of SAM */
+    { OPT_BAM_INDEX,    NULL, NULL, sd_bam_index_usage,      0, true,  false },  /* write index next to BAM-output */
+    { OPT_BAM_THREADS,  NULL, NULL, sd_bam_threads_usage,    0, true,  false },  /* threads compressing BAM-output */
     { OPT_SPOTGRP,       "g", NULL, sd_qname_usage,          0, false, false },  /* add spotgroup to qname */
     { OPT_FASTQ,        NULL, NULL, sd_fastq_usage,          0, false, false },  /* output-format = fastq ( instead of SAM ) */
     { OPT_FASTA,        NULL, NULL, sd_fasta_usage,          0, false, false },  /* output-format = fasta ( instead of SAM ) */
@@ -204,10 +231,13 @@ OptDef SamDumpArgs[] =
     { OPT_CURSOR_CACHE, NULL, NULL, sd_cur_cache_usage,      0, true,  false },  /* size of cursor cache */
     { OPT_MIN_MAPQ,     NULL, NULL, sd_min_mapq_usage,       0, true,  false },  /* minimal mapping quality */
     { OPT_NO_MATE_CACHE,NULL, NULL, sd_no_mate_cache_usage,  0, false, false },  /* do not use mate-cache */
+    { OPT_MATE_MEM,     NULL, NULL, sd_mate_mem_usage,       0, true,  false },  /* memory-limit of mate-cache */
     { OPT_RNA_SPLICE,   NULL, NULL, rna_splice_usage,        0, false, false },  /* detect rna-splicing in sequence */
     { OPT_RNA_SPLICEL,  NULL, NULL, rna_splicel_usage,       0, true,  false },  /* level of rna-splicing detection */
     { OPT_RNA_SPLICE_LOG,  NULL, NULL, rna_splice_log_usage, 0, true,  false },  /* filename to log rna-splice events into */
     { OPT_NO_MT,        NULL, NULL, no_mt_usage,              0, false, false },   /* force new code-path */    
+    { OPT_THREADS,      NULL, NULL, threads_usage,           0, true,  false },  /* walk shards of the references in parallel */
+    { OPT_SHARD,        NULL, NULL, shard_usage,             0, true,  false },  /* size of these shards */
     { OPT_MD_FLAG,		NULL, NULL, with_md_flag_usage,       0, false, false },    /* print the MD-flag */	
     { OPT_DUMP_MODE,    NULL, NULL, NULL,                    0, true,  false },  /* how to produce aligned reads if no regions given */
     { OPT_CIGAR_TEST,   NULL, NULL, NULL,                    0, true,  false },  /* test cg-treatment of cigar string */
@@ -227,11 +257,15 @@ char const *sd_usage_params[] =
     NULL,                       /* no-header */
     "text",                     /* hdr-comment */
     "name[:from-to]",           /* region */
+    "filename",                 /* regions-file */
     "from-to|'unknown'",        /* mate distance filter*/
     NULL,                       /* seq-id */
     NULL,                       /* identical-bases */
     NULL,                       /* gzip */
     NULL,                       /* bzip2 */
+    NULL,                       /* bam */
+    "bai|csi",                  /* bam-index */
+    "count",                    /* bam-threads */
     NULL,                       /* qname */
     NULL,                       /* fasta */
     NULL,                       /* fastq */
@@ -254,10 +288,13 @@ char const *sd_usage_params[] =
     NULL,                       /* cursor cache */
     NULL,                       /* min_mapq */
     NULL,                       /* no mate-cache */
+    "MB",                       /* mate-cache-memory */
     NULL,                       /* detect rna-splicing in sequence */
     NULL,                       /* level of rna-splicing detection */
     NULL,                       /* file to log rna-splice-events into */
     NULL,                       /* no-mt */
+    "count",                    /* threads */
+    "bases",                    /* shard-size */
     NULL,                       /* with-md-flag */	
     NULL,                       /* dump_mode */
     NULL,                       /* cigar test */
@@ -384,7 +421,8 @@ static rc_t print_samdump( const samdump_opts * const opts )
                         matecache * mc = NULL;
 
                         if ( opts->use_mate_cache )
-                            rc = make_matecache( &mc, ifs->database_count );
+                            rc = make_matecache( &mc, ifs->database_count,
+                                                 mate_cache_share( opts ), opts->mape_gap_cache_limit ); /* sam-aligned.c */
 
                         if ( rc == 0 )
                         {
@@ -419,6 +457,7 @@ static rc_t print_samdump( const samdump_opts * const opts )
                             {
                                 if ( opts->report_cache )
                                     rc = matecache_report( mc ); /* matecache.c */
+                                matecache_perf_log( mc, opts->perf_log ); /* matecache.c */
                                 release_matecache( mc ); /* matecache.c */
                             }
                         }
@@ -461,6 +500,26 @@ static rc_t perform_cigar_test( const samdump_opts * const opts )
 
 /* =========================================================================================== */
 
+static rc_t samdump_bam_main( const samdump_opts * const opts )
+{
+    bam_redir redir; /* from bam_redir.h */
+    rc_t rc = init_bam_redir( &redir, opts->outputfile, opts->bam_index, opts->bam_threads );
+    if ( rc == 0 )
+    {
+        /* the header and the unaligned reads arrive as SAM-text, the aligned reads as BAM-records */
+        samdump_opts bam_opts = *opts;
+        bam_opts.bam = redir.bam;
+        /* ------------------------------------------------------ */
+        rc = print_samdump( &bam_opts );
+        /* ------------------------------------------------------ */
+        if ( rc == 0 )
+            rc = finish_bam_redir( &redir );
+    }
+    release_bam_redir( &redir );
+    return rc;
+}
+
+
 static rc_t samdump_main( Args * args, const samdump_opts * const opts )
 {
     rc_t rc = 0;
@@ -472,8 +531,13 @@ static rc_t samdump_main( Args * args, const samdump_opts * const opts )
         case oc_none  : mode = orm_uncompressed; break;
         case oc_gzip  : mode = orm_gzip; break;
         case oc_bzip2 : mode = orm_bzip2; break;
+        case oc_bam   : mode = orm_uncompressed; break; /* reports and tests stay text */
     }
 
+    if ( opts->output_compression == oc_bam && !opts->report_options &&
+         opts->cigar_test == NULL && opts->input_file_count > 0 )
+        return samdump_bam_main( opts );
+
     rc = init_out_redir( &redir, mode, opts->outputfile, opts->output_buffer_size ); /* from out_redir.c */
     if ( rc == 0 )
     {
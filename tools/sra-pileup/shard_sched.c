@@ -0,0 +1,221 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "shard_sched.h"
+
+#include <klib/log.h>
+#include <kapp/main.h>
+#include <kproc/thread.h>
+#include <kproc/lock.h>
+#include <kproc/cond.h>
+#include <sysalloc.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct shard_state
+{
+    rc_t rc;
+    bool done;
+} shard_state;
+
+
+typedef struct shard_sched
+{
+    shard_state * shard;
+    uint32_t count;
+    uint32_t next;          /* the next shard to be handed to a worker */
+    uint32_t written;       /* how many shards have been written */
+    uint32_t window;        /* the workers stay no more than this many shards ahead */
+    bool failed;
+    KLock * lock;
+    KCondition * cond;
+
+    shard_walk_fn walk;
+    shard_write_fn write;
+    void * data;
+} shard_sched;
+
+
+typedef struct shard_thread
+{
+    shard_sched * sched;
+    void * worker;
+    KThread * thread;
+} shard_thread;
+
+
+static rc_t CC shard_worker( const KThread *thread, void *data )
+{
+    shard_thread * self = data;
+    shard_sched * sched = self->sched;
+    rc_t rc = 0;
+
+    KLockAcquire( sched->lock );
+    while ( rc == 0 && !sched->failed && sched->next < sched->count )
+    {
+        uint32_t idx = sched->next;
+        if ( idx >= sched->written + sched->window )
+        {
+            KConditionWait( sched->cond, sched->lock );
+        }
+        else
+        {
+            sched->next++;
+            KLockUnlock( sched->lock );
+
+            rc = Quitting();
+            if ( rc == 0 )
+                rc = sched->walk( self->worker, idx );
+
+            KLockAcquire( sched->lock );
+            sched->shard[ idx ].rc = rc;
+            sched->shard[ idx ].done = true;
+            if ( rc != 0 )
+                sched->failed = true;
+            KConditionBroadcast( sched->cond );
+        }
+    }
+    KLockUnlock( sched->lock );
+    return rc;
+}
+
+
+/* write the shards in order as they are finished */
+static rc_t write_shards( shard_sched * self )
+{
+    rc_t rc = 0;
+    KLockAcquire( self->lock );
+    while ( rc == 0 && self->written < self->count )
+    {
+        shard_state * shard = &self->shard[ self->written ];
+        if ( !shard->done )
+        {
+            /* after a failure nobody picks up the shards not yet handed out */
+            if ( self->failed && self->written >= self->next )
+                break;
+            KConditionWait( self->cond, self->lock );
+        }
+        else
+        {
+            KLockUnlock( self->lock );
+
+            rc = shard->rc;
+            if ( rc == 0 )
+                rc = self->write( self->data, self->written );
+
+            KLockAcquire( self->lock );
+            if ( rc != 0 )
+                self->failed = true;
+            self->written++;
+            KConditionBroadcast( self->cond );
+        }
+    }
+    KLockUnlock( self->lock );
+    return rc;
+}
+
+
+/* let the workers stop taking new shards */
+static void fail_shards( shard_sched * self )
+{
+    KLockAcquire( self->lock );
+    self->failed = true;
+    KConditionBroadcast( self->cond );
+    KLockUnlock( self->lock );
+}
+
+
+rc_t run_shards( uint32_t count, void * workers, size_t worker_size, uint32_t threads,
+                 shard_walk_fn walk, shard_write_fn write, void * data )
+{
+    shard_sched sched;
+    shard_thread * thread = NULL;
+    uint32_t idx, started = 0;
+    rc_t rc = 0;
+
+    if ( count == 0 )
+        return 0;
+
+    memset( &sched, 0, sizeof sched );
+    sched.count = count;
+    sched.window = 2 * threads;
+    sched.walk = walk;
+    sched.write = write;
+    sched.data = data;
+
+    sched.shard = calloc( count, sizeof sched.shard[ 0 ] );
+    thread = calloc( threads, sizeof thread[ 0 ] );
+    if ( sched.shard == NULL || thread == NULL )
+        rc = RC ( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+    if ( rc == 0 )
+    {
+        rc = KLockMake( &sched.lock );
+        if ( rc != 0 )
+        {
+            LOGERR( klogInt, rc, "KLockMake() failed" );
+        }
+        else
+        {
+            rc = KConditionMake( &sched.cond );
+            if ( rc != 0 )
+            {
+                LOGERR( klogInt, rc, "KConditionMake() failed" );
+            }
+        }
+    }
+
+    for ( idx = 0; rc == 0 && idx < threads; ++idx )
+    {
+        thread[ idx ].sched = &sched;
+        thread[ idx ].worker = ( char * )workers + idx * worker_size;
+        rc = KThreadMake( &thread[ idx ].thread, shard_worker, &thread[ idx ] );
+        if ( rc != 0 )
+        {
+            LOGERR( klogInt, rc, "KThreadMake() failed" );
+        }
+        else
+            started++;
+    }
+    if ( rc == 0 )
+        rc = write_shards( &sched );
+    if ( rc != 0 && started > 0 )
+        fail_shards( &sched );
+    for ( idx = 0; idx < started; ++idx )
+    {
+        rc_t rc_thread = 0;
+        KThreadWait( thread[ idx ].thread, &rc_thread );
+        KThreadRelease( thread[ idx ].thread );
+        if ( rc == 0 )
+            rc = rc_thread;
+    }
+
+    free( thread );
+    free( sched.shard );
+    if ( sched.cond != NULL ) KConditionRelease( sched.cond );
+    if ( sched.lock != NULL ) KLockRelease( sched.lock );
+    return rc;
+}
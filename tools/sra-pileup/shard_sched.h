@@ -0,0 +1,57 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_shard_sched_
+#define _h_shard_sched_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <klib/rc.h>
+
+/* the ordered shard-scheduler of sra-pileup and sam-dump: worker-threads walk one shard
+   at a time into a buffer, the calling thread writes the buffers in the order of the shards.
+   the workers stay no more than 2 x threads shards ahead of the writer, after a failure
+   no more shards are handed out */
+
+/* called on a worker-thread: walk shard idx with the state of this worker */
+typedef rc_t ( * shard_walk_fn )( void * worker, uint32_t idx );
+
+/* called on the calling thread, in the order of the shards: write the buffer of shard idx,
+   only called for shards that were walked without an error */
+typedef rc_t ( * shard_write_fn )( void * data, uint32_t idx );
+
+/* workers points to an array of threads worker-states of worker_size bytes each,
+   returns after all threads are joined: with the first error of the writer or the workers */
+rc_t run_shards( uint32_t count, void * workers, size_t worker_size, uint32_t threads,
+                 shard_walk_fn walk, shard_write_fn write, void * data );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*  _h_shard_sched_ */
@@ -41,6 +41,7 @@
 #include "pileup_indels.h"
 #include "pileup_stat.h"
 #include "pileup_v2.h"
+#include "shard_sched.h"
 
 #include <kapp/main.h>
 
@@ -98,6 +99,8 @@
 
 #define OPTION_MIN_M   "minmismatch"
 #define OPTION_MERGE   "merge-dist"
+#define OPTION_THREADS "threads"
+#define OPTION_SHARD   "shard-size"
 
 #define OPTION_DEPTH_PER_SPOTGRP	"depth-per-spotgroup"
 
@@ -156,6 +159,12 @@ static const char * merge_usage[]           = { "If adjacent slices are closer t
                                                 "they are merged and a skiplist is created. ", 
                                                 "a value of zero disables the feature, default is 10000", NULL };
 
+static const char * threads_usage[]         = { "walk the references in shards on this many threads, ",
+                                                "output stays in reference order, ",
+                                                "only for the default pileup, default is 1", NULL };
+
+static const char * shard_usage[]           = { "size of the shards for --threads in bases, default is 1000000", NULL };
+
 static const char * no_qual_usage[]         = { "omit qualities", NULL };
 
 static const char * func_ref_usage[]        = { "list references", NULL };
@@ -189,6 +198,8 @@ OptDef MyOptions[] =
     { OPTION_SEQNAME,	ALIAS_SEQNAME,	NULL,	seqname_usage,	1,        false,       false },
     { OPTION_MIN_M,		NULL,			NULL,	min_m_usage,	1,        true,        false },
     { OPTION_MERGE,		NULL,			NULL,	merge_usage,	1,        true,        false },
+    { OPTION_THREADS,	NULL,			NULL,	threads_usage,	1,        true,        false },
+    { OPTION_SHARD,		NULL,			NULL,	shard_usage,	1,        true,        false },
     { OPTION_FUNC,		ALIAS_FUNC,		NULL,	func_usage,		1,        true,        false }
 };
 
@@ -284,6 +295,17 @@ static rc_t get_pileup_options( Args * args, pileup_options *opts )
 
     if ( rc == 0 )
         rc = get_uint32_option( args, OPTION_MERGE, &opts->merge_dist, 10000 );
+
+    if ( rc == 0 )
+        rc = get_uint32_option( args, OPTION_THREADS, &opts->threads, 1 );
+
+    if ( rc == 0 )
+    {
+        rc = get_uint32_option( args, OPTION_SHARD, &opts->shard_size, 1000000 );
+        if ( opts->shard_size == 0 )
+            opts->shard_size = 1000000;
+    }
+    opts->out = NULL;
         
     if ( rc == 0 )
         rc = get_bool_option( args, OPTION_DUPS, &opts->process_dups, false );
@@ -382,6 +404,8 @@ rc_t CC Usage ( const Args * args )
     HelpOptionLine ( ALIAS_SEQNAME, OPTION_SEQNAME, NULL, seqname_usage );
     HelpOptionLine ( NULL, OPTION_MIN_M, NULL, min_m_usage );
     HelpOptionLine ( NULL, OPTION_MERGE, NULL, merge_usage );
+    HelpOptionLine ( NULL, OPTION_THREADS, "count", threads_usage );
+    HelpOptionLine ( NULL, OPTION_SHARD, "bases", shard_usage );
     HelpOptionLine ( ALIAS_NOQUAL, OPTION_NOQUAL, NULL, no_qual_usage );
 
     HelpOptionLine ( NULL, "function ref",      NULL, func_ref_usage );
@@ -686,7 +710,9 @@ static rc_t walk_ref_position( ReferenceIterator *ref_iter,
         uint32_t i;
         uint32_t n = ReferenceIteratorBasesInserted ( ref_iter, &bases );
         
-        rc = print_2_dyn_string( line, "+%u", n );
+        rc = add_char_2_dyn_string( line, '+' );
+        if ( rc == 0 )
+            rc = add_uint_2_dyn_string( line, n );
         for ( i = 0; i < n && rc == 0; ++i )
         {
             rc = add_char_2_dyn_string( line, _4na_to_ascii( bases[ i ], reverse ) );
@@ -701,7 +727,9 @@ static rc_t walk_ref_position( ReferenceIterator *ref_iter,
         if ( bases != NULL )
         {
             uint32_t i;
-            rc = print_2_dyn_string( line, "-%u", n );
+            rc = add_char_2_dyn_string( line, '-' );
+            if ( rc == 0 )
+                rc = add_uint_2_dyn_string( line, n );
             for ( i = 0; i < n && rc == 0; ++i )
             {
                 rc = add_char_2_dyn_string( line, _4na_to_ascii( bases[ i ], reverse ) );
@@ -742,7 +770,10 @@ static rc_t walk_alignments( ReferenceIterator *ref_iter,
     } while ( rc == 0 );
 
 	if ( options->depth_per_spotgrp )
-		print_2_dyn_string( line, "%d\t", depth );
+	{
+		add_uint_2_dyn_string( line, depth );
+		add_char_2_dyn_string( line, '\t' );
+	}
 
 	add_dyn_string_2_dyn_string( line, events );
 	
@@ -821,10 +852,22 @@ static rc_t walk_position( ReferenceIterator *ref_iter,
 
 						reset_dyn_string( line );
 					
-						if ( options->depth_per_spotgrp )
-							rc = print_2_dyn_string( line, "%s\t%u\t%c", refname, pos + 1, c );
-						else
-							rc = print_2_dyn_string( line, "%s\t%u\t%c\t%u", refname, pos + 1, c, depth );
+						/* "refname pos base [depth]" */
+						rc = add_string_2_dyn_string( line, refname );
+						if ( rc == 0 )
+							rc = add_char_2_dyn_string( line, '\t' );
+						if ( rc == 0 )
+							rc = add_uint_2_dyn_string( line, ( uint32_t )( pos + 1 ) );
+						if ( rc == 0 )
+							rc = add_char_2_dyn_string( line, '\t' );
+						if ( rc == 0 )
+							rc = add_char_2_dyn_string( line, c );
+						if ( rc == 0 && !options->depth_per_spotgrp )
+						{
+							rc = add_char_2_dyn_string( line, '\t' );
+							if ( rc == 0 )
+								rc = add_uint_2_dyn_string( line, depth );
+						}
 							
 						if ( rc == 0 )
 						{
@@ -833,7 +876,12 @@ static rc_t walk_position( ReferenceIterator *ref_iter,
 
 							/* only one KOutMsg() per line... */
 							if ( rc == 0 )
-								rc = KOutMsg( "%s\n", dyn_string_char( line, 0 ) );
+							{
+								if ( options->out != NULL )
+									rc = add_line_2_dyn_string( options->out, line );
+								else
+									rc = KOutMsg( "%s\n", dyn_string_char( line, 0 ) );
+							}
 
 							if ( GetRCState( rc ) == rcDone )
 								rc = 0;
@@ -1366,12 +1414,452 @@ static void CC cur_id_vector_entry_whack( void *item, void *data )
 }
 
 
+/* =========================================================================================== */
+/* parallel pileup: the requested regions ( or the whole references ) are cut into shards,
+   worker-threads walk one shard at a time with their own reference-iterator, schema and
+   cursors into a buffer, the main-thread prints the buffers in the order of the shards ( shard_sched.c ) */
+
+typedef struct pileup_ref_len
+{
+    char * name;
+    uint64_t len;
+} pileup_ref_len;
+
+
+typedef struct pileup_shard
+{
+    const char * name;      /* owned by pileup_shards.refs */
+    uint64_t start;         /* 1-based, inclusive */
+    uint64_t end;
+    struct dyn_string * out;
+} pileup_shard;
+
+
+/* the order in which the shards are walked and printed is up to shard_sched.c */
+typedef struct pileup_shards
+{
+    Vector refs;            /* pileup_ref_len, in the order they were found */
+    pileup_shard * shard;
+    uint32_t count;
+    uint32_t allocated;
+
+    Args * args;
+    KDirectory * dir;
+    BSTree * regions;
+    const foreach_arg_ctx * arg_ctx;
+} pileup_shards;
+
+
+typedef struct pileup_worker
+{
+    pileup_shards * shards;
+    pileup_options options;     /* a copy with its own skiplist and output-buffer */
+    const AlignMgr * almgr;
+    VSchema * schema;
+} pileup_worker;
+
+
+static void CC ref_len_whack( void *item, void *data )
+{
+    pileup_ref_len * r = item;
+    free( r->name );
+    free( r );
+}
+
+
+static pileup_ref_len * find_ref_len( Vector * refs, const char * name )
+{
+    uint32_t idx, count = VectorLength( refs );
+    for ( idx = 0; idx < count; ++idx )
+    {
+        pileup_ref_len * r = VectorGet( refs, idx );
+        if ( strcmp( r->name, name ) == 0 )
+            return r;
+    }
+    return NULL;
+}
+
+
+/* the same reference can be found in more than one input, the longest wins */
+static rc_t add_ref_len( Vector * refs, const char * name, uint64_t len )
+{
+    rc_t rc = 0;
+    pileup_ref_len * r = find_ref_len( refs, name );
+    if ( r != NULL )
+    {
+        if ( r->len < len )
+            r->len = len;
+    }
+    else
+    {
+        r = malloc( sizeof * r );
+        if ( r == NULL )
+            rc = RC ( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+        else
+        {
+            r->name = string_dup_measure ( name, NULL );
+            r->len = len;
+            if ( r->name == NULL )
+                rc = RC ( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+            else
+                rc = VectorAppend ( refs, NULL, r );
+            if ( rc != 0 )
+                ref_len_whack( r, NULL );
+        }
+    }
+    return rc;
+}
+
+
+static rc_t collect_ref_len( Vector * refs, const ReferenceObj * obj, const char * name )
+{
+    INSDC_coord_len len;
+    rc_t rc = ReferenceObj_SeqLength( obj, &len );
+    if ( rc != 0 )
+    {
+        LOGERR( klogInt, rc, "ReferenceObj_SeqLength() failed" );
+    }
+    else if ( name == NULL )
+    {
+        rc = ReferenceObj_Name( obj, &name );
+        if ( rc != 0 )
+        {
+            LOGERR( klogInt, rc, "ReferenceObj_Name() failed" );
+        }
+    }
+    if ( rc == 0 )
+        rc = add_ref_len( refs, name, len );
+    return rc;
+}
+
+
+/* called for each source-file/accession: find the names and lengths of the references to walk */
+static rc_t CC collect_references( const char * path, const char * spot_group, void * data )
+{
+    pileup_shards * self = data;
+    const pileup_options * options = self->arg_ctx->options;
+    const VDatabase *db;
+    rc_t rc = VDBManagerOpenDBRead ( self->arg_ctx->vdb_mgr, &db, self->arg_ctx->vdb_schema, "%s", path );
+    if ( rc != 0 )
+    {
+        PLOGERR( klogErr, ( klogErr, rc, "failed to open '$(path)'", "path=%s", path ) );
+    }
+    else
+    {
+        const ReferenceList * reflist;
+        uint32_t reflist_options = ereferencelist_4na;
+
+        /* the same list prepare_ref_iter() walks */
+        if ( ( options->cmn.tab_select & primary_ats ) == primary_ats )
+            reflist_options |= ereferencelist_usePrimaryIds;
+        if ( ( options->cmn.tab_select & secondary_ats ) == secondary_ats )
+            reflist_options |= ereferencelist_useSecondaryIds;
+        if ( ( options->cmn.tab_select & evidence_ats ) == evidence_ats )
+            reflist_options |= ereferencelist_useEvidenceIds;
+
+        rc = ReferenceList_MakeDatabase( &reflist, db, reflist_options, 0, NULL, 0 );
+        if ( rc != 0 )
+        {
+            LOGERR( klogInt, rc, "ReferenceList_MakeDatabase() failed" );
+        }
+        else
+        {
+            const ReferenceObj * obj;
+            if ( count_ref_regions( self->regions ) == 0 )
+            {
+                uint32_t idx, count;
+                rc = ReferenceList_Count( reflist, &count );
+                for ( idx = 0; idx < count && rc == 0; ++idx )
+                {
+                    rc = ReferenceList_Get( reflist, &obj, idx );
+                    if ( rc != 0 )
+                    {
+                        LOGERR( klogInt, rc, "ReferenceList_Get() failed" );
+                    }
+                    else
+                    {
+                        rc = collect_ref_len( &self->refs, obj, NULL );
+                        ReferenceObj_Release( obj );
+                    }
+                }
+            }
+            else
+            {
+                const struct reference_region * node;
+                for ( node = get_first_ref_node( self->regions );
+                      node != NULL && rc == 0;
+                      node = get_next_ref_node( node ) )
+                {
+                    /* references not in this input are skipped, like in prepare_ref_iter() */
+                    const char * name = get_ref_node_name( node );
+                    if ( ReferenceList_Find( reflist, &obj, name, string_size( name ) ) == 0 )
+                    {
+                        rc = collect_ref_len( &self->refs, obj, name );
+                        ReferenceObj_Release( obj );
+                    }
+                }
+            }
+            ReferenceList_Release( reflist );
+        }
+        VDatabaseRelease( db );
+    }
+    return rc;
+}
+
+
+static rc_t add_shards( pileup_shards * self, const char * name, uint64_t start, uint64_t end, uint32_t size )
+{
+    rc_t rc = 0;
+    while ( rc == 0 && start <= end )
+    {
+        if ( self->count == self->allocated )
+        {
+            uint32_t new_allocated = self->allocated == 0 ? 64 : self->allocated * 2;
+            pileup_shard * tmp = realloc( self->shard, new_allocated * sizeof tmp[ 0 ] );
+            if ( tmp == NULL )
+                rc = RC ( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+            else
+            {
+                self->shard = tmp;
+                self->allocated = new_allocated;
+            }
+        }
+        if ( rc == 0 )
+        {
+            pileup_shard * shard = &self->shard[ self->count++ ];
+            shard->name = name;
+            shard->start = start;
+            shard->end = ( end - start >= size ) ? start + size - 1 : end;
+            shard->out = NULL;
+            start = shard->end + 1;
+        }
+    }
+    return rc;
+}
+
+
+/* cut the references in the order the sequential walk would visit them */
+static rc_t make_shards( pileup_shards * self, uint32_t size )
+{
+    rc_t rc = 0;
+    if ( count_ref_regions( self->regions ) == 0 )
+    {
+        uint32_t idx, count = VectorLength( &self->refs );
+        for ( idx = 0; idx < count && rc == 0; ++idx )
+        {
+            pileup_ref_len * r = VectorGet( &self->refs, idx );
+            rc = add_shards( self, r->name, 1, r->len, size );
+        }
+    }
+    else
+    {
+        const struct reference_region * node;
+        for ( node = get_first_ref_node( self->regions );
+              node != NULL && rc == 0;
+              node = get_next_ref_node( node ) )
+        {
+            pileup_ref_len * r = find_ref_len( &self->refs, get_ref_node_name( node ) );
+            if ( r != NULL )
+            {
+                uint32_t idx, count = get_ref_node_range_count( node );
+                for ( idx = 0; idx < count && rc == 0; ++idx )
+                {
+                    const struct reference_range * range = get_ref_range( node, idx );
+                    uint64_t start = get_ref_range_start( range );
+                    uint64_t end = get_ref_range_end( range );
+                    if ( start == 0 ) start = 1;
+                    if ( end == 0 || end > r->len ) end = r->len;
+                    rc = add_shards( self, r->name, start, end, size );
+                }
+            }
+        }
+    }
+    return rc;
+}
+
+
+/* load a fresh reference-iterator with the placements of one shard and walk it */
+static rc_t walk_shard( pileup_worker * self, pileup_shard * shard )
+{
+    foreach_arg_ctx arg_ctx;
+    pileup_callback_data cb_data;
+    PlacementRecordExtendFuncs cb_block;
+    Vector cur_ids_vector;
+    BSTree regions;
+    rc_t rc;
+
+    BSTreeInit( &regions );
+    VectorInit ( &cur_ids_vector, 0, 20 );
+    self->options.out = shard->out;
+
+    cb_data.almgr = self->almgr;
+    cb_data.options = &self->options;
+    arg_ctx.options = &self->options;
+    arg_ctx.vdb_mgr = self->shards->arg_ctx->vdb_mgr;
+    arg_ctx.vdb_schema = self->schema;
+    arg_ctx.ref_iter = NULL;
+    arg_ctx.ranges = &regions;
+    arg_ctx.cursor_ids = &cur_ids_vector;
+
+    cb_block.data = &cb_data;
+    cb_block.destroy = NULL;
+    cb_block.populate = populate_tooldata;
+    cb_block.alloc_size = alloc_size;
+    cb_block.fixed_size = 0;
+
+    rc = AlignMgrMakeReferenceIterator ( self->almgr, &arg_ctx.ref_iter, &cb_block, self->options.minmapq );
+    if ( rc != 0 )
+    {
+        LOGERR( klogInt, rc, "AlignMgrMakeReferenceIterator() failed" );
+    }
+    else
+    {
+        rc = add_region( &regions, shard->name, shard->start, shard->end );
+        if ( rc == 0 )
+            rc = foreach_argument( self->shards->args, self->shards->dir, self->options.div_by_spotgrp,
+                                   NULL, on_argument, &arg_ctx ); /* cmdline_cmn.c */
+        if ( rc == 0 )
+            rc = walk_ref_iter( arg_ctx.ref_iter, &self->options );
+        ReferenceIteratorRelease( arg_ctx.ref_iter );
+    }
+
+    VectorWhack ( &cur_ids_vector, cur_id_vector_entry_whack, NULL );
+    free_ref_regions( &regions );
+    return rc;
+}
+
+
+/* called by shard_sched.c on a worker-thread */
+static rc_t on_walk_shard( void * worker, uint32_t idx )
+{
+    pileup_worker * self = worker;
+    pileup_shard * shard = &self->shards->shard[ idx ];
+    rc_t rc = allocated_dyn_string( &shard->out, 64 * 1024 );
+    if ( rc == 0 )
+        rc = walk_shard( self, shard );
+    return rc;
+}
+
+
+/* called by shard_sched.c in the order of the shards */
+static rc_t on_write_shard( void * data, uint32_t idx )
+{
+    pileup_shards * self = data;
+    pileup_shard * shard = &self->shard[ idx ];
+    rc_t rc = 0;
+    if ( shard->out != NULL )
+    {
+        rc = print_dyn_string( shard->out );
+        free_dyn_string( shard->out );
+        shard->out = NULL;
+    }
+    return rc;
+}
+
+
+static rc_t make_worker( pileup_worker * self, pileup_shards * shards, const pileup_options * options )
+{
+    rc_t rc;
+
+    self->shards = shards;
+    self->options = *options;
+    self->options.skiplist = skiplist_make( shards->regions );
+    self->options.out = NULL;
+    self->schema = NULL;
+
+    rc = AlignMgrMakeRead ( &self->almgr );
+    if ( rc != 0 )
+    {
+        self->almgr = NULL;
+        LOGERR( klogInt, rc, "AlignMgrMake() failed" );
+    }
+    else
+    {
+        /* the schema is parsed into, so every worker gets its own */
+        rc = VDBManagerMakeSRASchema( shards->arg_ctx->vdb_mgr, &self->schema );
+        if ( rc != 0 )
+        {
+            LOGERR( klogInt, rc, "VDBManagerMakeSRASchema() failed" );
+        }
+        else if ( options->cmn.schema_file != NULL )
+        {
+            rc = VSchemaParseFile( self->schema, "%s", options->cmn.schema_file );
+            if ( rc != 0 )
+            {
+                LOGERR( klogInt, rc, "VSchemaParseFile() failed" );
+            }
+        }
+    }
+    return rc;
+}
+
+
+static void release_worker( pileup_worker * self )
+{
+    if ( self->options.skiplist != NULL ) skiplist_release( self->options.skiplist );
+    if ( self->schema != NULL ) VSchemaRelease( self->schema );
+    if ( self->almgr != NULL ) AlignMgrRelease ( self->almgr );
+}
+
+
+static rc_t walk_shards_parallel( Args * args, KDirectory * dir, BSTree * regions,
+                                  const foreach_arg_ctx * arg_ctx, pileup_options * options, bool * empty )
+{
+    pileup_shards shards;
+    pileup_worker * workers = NULL;
+    uint32_t idx, made = 0;
+    rc_t rc;
+
+    memset( &shards, 0, sizeof shards );
+    VectorInit ( &shards.refs, 0, 64 );
+    shards.args = args;
+    shards.dir = dir;
+    shards.regions = regions;
+    shards.arg_ctx = arg_ctx;
+
+    rc = foreach_argument( args, dir, options->div_by_spotgrp, empty, collect_references, &shards ); /* cmdline_cmn.c */
+    if ( rc == 0 && !*empty )
+        rc = make_shards( &shards, options->shard_size );
+    if ( rc == 0 && shards.count > 0 )
+    {
+        workers = calloc( options->threads, sizeof workers[ 0 ] );
+        if ( workers == NULL )
+            rc = RC ( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+        for ( idx = 0; rc == 0 && idx < options->threads; ++idx )
+        {
+            rc = make_worker( &workers[ idx ], &shards, options );
+            if ( rc != 0 )
+                release_worker( &workers[ idx ] );
+            else
+                made++;
+        }
+        if ( rc == 0 )
+            rc = run_shards( shards.count, workers, sizeof workers[ 0 ], options->threads,
+                             on_walk_shard, on_write_shard, &shards ); /* shard_sched.c */
+        for ( idx = 0; idx < made; ++idx )
+            release_worker( &workers[ idx ] );
+        free( workers );
+    }
+
+    for ( idx = 0; idx < shards.count; ++idx )
+    {
+        if ( shards.shard[ idx ].out != NULL )
+            free_dyn_string( shards.shard[ idx ].out );
+    }
+    free( shards.shard );
+    VectorWhack ( &shards.refs, ref_len_whack, NULL );
+    return rc;
+}
+
+
 static rc_t pileup_main( Args * args, pileup_options *options )
 {
     foreach_arg_ctx arg_ctx;
     pileup_callback_data cb_data;
     KDirectory * dir = NULL;
     Vector cur_ids_vector;
+    /* only the default pileup is cut into shards */
+    bool parallel = ( options->threads > 1 && options->function == sra_pileup_samtools );
 
     /* (1) make the align-manager ( necessary to make a ReferenceIterator... ) */
     rc_t rc = AlignMgrMakeRead ( &cb_data.almgr );
@@ -1499,10 +1987,18 @@ static rc_t pileup_main( Args * args, pileup_options *options )
             bool empty = false;
 
             check_ref_regions( &regions, options->merge_dist ); /* sanitize input, merge slices... */
-            options->skiplist = skiplist_make( &regions ); /* create skiplist for neighboring slices */
 
             arg_ctx.ranges = &regions;
-            rc = foreach_argument( args, dir, options->div_by_spotgrp, &empty, on_argument, &arg_ctx ); /* cmdline_cmn.c */
+            if ( parallel )
+            {
+                /* loads and walks its own ref-iterators, step (6) is done with it */
+                rc = walk_shards_parallel( args, dir, &regions, &arg_ctx, options, &empty );
+            }
+            else
+            {
+                options->skiplist = skiplist_make( &regions ); /* create skiplist for neighboring slices */
+                rc = foreach_argument( args, dir, options->div_by_spotgrp, &empty, on_argument, &arg_ctx ); /* cmdline_cmn.c */
+            }
             if ( empty )
             {
                 Usage ( args );
@@ -1513,7 +2009,7 @@ static rc_t pileup_main( Args * args, pileup_options *options )
     }
 
     /* (6) walk the "loaded" ref-iterator ===> perform the pileup */
-    if ( rc == 0 )
+    if ( rc == 0 && !parallel )
     {
         /* ============================================== */
         switch( options->function )
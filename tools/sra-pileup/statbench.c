@@ -0,0 +1,210 @@
+/* ===========================================================================
+ *
+ *                            PUBLIC DOMAIN NOTICE
+ *               National Center for Biotechnology Information
+ *
+ *  This software/database is a "United States Government Work" under the
+ *  terms of the United States Copyright Act.  It was written as part of
+ *  the author's official duties as a United States Government employee and
+ *  thus cannot be copyrighted.  This software/database is freely available
+ *  to the public for use. The National Library of Medicine and the U.S.
+ *  Government have not placed any restriction on its use or reproduction.
+ *
+ *  Although all reasonable efforts have been taken to ensure the accuracy
+ *  and reliability of the software and data, the NLM and the U.S.
+ *  Government do not and cannot warrant the performance or results that
+ *  may be obtained by using this software or data. The NLM and the U.S.
+ *  Government disclaim all warranties, express or implied, including
+ *  warranties of performance, merchantability or fitness for any particular
+ *  purpose.
+ *
+ *  Please cite the author in any work or product based on this material.
+ *
+ * ===========================================================================
+ *
+ * Measures the template-length percentiles of 'sra-pileup --function stat'
+ * on a simulated amplicon: every WINDOW positions a burst of <depth> fragments
+ * starts, the window ending at each position is evaluated once with a sort
+ * of the window and once with the tlen_hist of pileup_stat.c:
+ *   statbench [ <depth> [ <positions> ] ]
+ * without arguments the depths 10000, 30000 and 100000 are run on 2000 positions.
+ */
+
+#include <kapp/args.h>
+#include <kapp/main.h>
+#include <klib/log.h>
+#include <klib/time.h>
+#include <klib/sort.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tlen_hist.h"
+
+#include <klib/rc.h>
+
+#define WINDOW (150u)
+
+typedef struct sim
+{
+    uint32_t * values;      /* the fragments in the order they started */
+    uint32_t * starts;      /* first index into values for each position */
+    uint32_t * scratch;
+    uint32_t positions;
+    uint32_t count;
+} sim;
+
+/* mostly around 300 with a long tail, the odd chimera beyond TLEN_HIST_LIMIT */
+static uint32_t random_tlen( void )
+{
+    uint32_t r = rand() % 1000;
+    if ( r == 0 )
+        return TLEN_HIST_LIMIT + rand() % 1000000;
+    if ( r < 50 )
+        return 1 + rand() % 5000;
+    return 200 + rand() % 100 + rand() % 100;
+}
+
+static rc_t make_sim( sim * s, uint32_t depth, uint32_t positions )
+{
+    uint32_t p, i;
+    s->positions = positions;
+    s->count = ( ( positions + WINDOW - 1 ) / WINDOW ) * depth;
+    s->values = malloc( s->count * sizeof s->values[ 0 ] );
+    s->starts = malloc( ( positions + 1 ) * sizeof s->starts[ 0 ] );
+    s->scratch = malloc( ( depth + 1 ) * sizeof s->scratch[ 0 ] );
+    if ( s->values == NULL || s->starts == NULL || s->scratch == NULL )
+    {
+        rc_t rc = RC( rcExe, rcBuffer, rcAllocating, rcMemory, rcExhausted );
+        free( s->values ); free( s->starts ); free( s->scratch );
+        LOGERR( klogErr, rc, "out of memory" );
+        return rc;
+    }
+    srand( 1 );
+    for ( i = 0; i < s->count; ++i )
+        s->values[ i ] = random_tlen();
+    for ( p = 0, i = 0; p <= positions; ++p )
+    {
+        s->starts[ p ] = i;
+        if ( p % WINDOW == 0 && i < s->count )
+            i += depth;
+    }
+    return 0;
+}
+
+static void release_sim( sim * s )
+{
+    free( s->values );
+    free( s->starts );
+    free( s->scratch );
+}
+
+/* the window ending at position p are the fragments started at p - WINDOW + 1 ... p */
+static uint32_t window_from( const sim * s, uint32_t p )
+{
+    return s->starts[ ( p >= WINDOW ) ? p - WINDOW + 1 : 0 ];
+}
+
+static double run_sort( sim * s, uint64_t * check )
+{
+    KTimeMs_t const start = KTimeMsStamp();
+    uint64_t sum = 0;
+    uint32_t p;
+
+    for ( p = 0; p < s->positions; ++p )
+    {
+        uint32_t from = window_from( s, p );
+        uint32_t n = s->starts[ p + 1 ] - from;
+        if ( n > 0 )
+        {
+            memmove( s->scratch, &s->values[ from ], n * sizeof s->scratch[ 0 ] );
+            ksort_uint32_t( s->scratch, n );
+            sum += s->scratch[ ( n * 10 ) / 100 ] + s->scratch[ n >> 1 ] + s->scratch[ ( n * 90 ) / 100 ];
+        }
+    }
+    *check = sum;
+    {
+        KTimeMs_t const elapsed = KTimeMsStamp() - start;
+        return s->positions / ( ( elapsed ? elapsed : 1 ) / 1000.0 );
+    }
+}
+
+static double run_hist( sim * s, tlen_hist * h, uint64_t * check )
+{
+    KTimeMs_t const start = KTimeMsStamp();
+    uint64_t sum = 0;
+    uint32_t p, i, in = 0, out = 0;
+
+    tlen_hist_clear( h );
+    for ( p = 0; p < s->positions; ++p )
+    {
+        uint32_t n, from = window_from( s, p );
+        for ( ; out < from; ++out )
+            tlen_hist_remove( h, s->values[ out ] );
+        for ( i = s->starts[ p + 1 ]; in < i; ++in )
+            tlen_hist_insert( h, s->values[ in ] );
+        n = tlen_hist_count( h );
+        if ( n > 0 )
+            sum += tlen_hist_kth( h, ( n * 10 ) / 100 ) + tlen_hist_kth( h, n >> 1 ) + tlen_hist_kth( h, ( n * 90 ) / 100 );
+    }
+    *check = sum;
+    {
+        KTimeMs_t const elapsed = KTimeMsStamp() - start;
+        return s->positions / ( ( elapsed ? elapsed : 1 ) / 1000.0 );
+    }
+}
+
+static rc_t statbench( uint32_t depth, uint32_t positions )
+{
+    sim s;
+    tlen_hist h;
+    rc_t rc = make_sim( &s, depth, positions );
+    if ( rc == 0 )
+    {
+        rc = tlen_hist_init( &h );
+        if ( rc == 0 )
+        {
+            uint64_t check1 = 0;
+            uint64_t check2 = 0;
+            double const sorted = run_sort( &s, &check1 );
+            double const hist = run_hist( &s, &h, &check2 );
+
+            printf( "depth %7u sort: %10.1f hist: %10.1f positions/s x%.1f%s\n", depth,
+                    sorted, hist, hist / sorted, check1 == check2 ? "" : " MISMATCH" );
+            tlen_hist_finish( &h );
+        }
+        release_sim( &s );
+    }
+    return rc;
+}
+
+rc_t CC UsageSummary( char const * name )
+{
+    return 0;
+}
+
+rc_t CC Usage( Args const * args )
+{
+    return 0;
+}
+
+rc_t CC KMain( int argc, char * argv[] )
+{
+    uint32_t depth = argc > 1 ? strtoul( argv[ 1 ], NULL, 0 ) : 0;
+    uint32_t positions = argc > 2 ? strtoul( argv[ 2 ], NULL, 0 ) : 0;
+    rc_t rc = 0;
+
+    if ( positions == 0 )
+        positions = 2000;
+    if ( depth != 0 )
+        rc = statbench( depth, positions );
+    else
+    {
+        static uint32_t const depths[] = { 10000, 30000, 100000 };
+        uint32_t i;
+        for ( i = 0; rc == 0 && i < sizeof depths / sizeof depths[ 0 ]; ++i )
+            rc = statbench( depths[ i ], positions );
+    }
+    return rc;
+}
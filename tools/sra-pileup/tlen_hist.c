@@ -0,0 +1,187 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "tlen_hist.h"
+#include <sysalloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* level 0 counts values in steps of 4096, level 3 counts single values */
+static const uint32_t level_shift[ 4 ] = { 12, 8, 4, 0 };
+
+
+rc_t tlen_hist_init( tlen_hist * self )
+{
+    rc_t rc = 0;
+    uint32_t i;
+
+    memset( self, 0, sizeof *self );
+    for ( i = 0; i < 4 && rc == 0; ++i )
+    {
+        self->level[ i ] = calloc( ( TLEN_HIST_LIMIT >> level_shift[ i ] ), sizeof self->level[ i ][ 0 ] );
+        if ( self->level[ i ] == NULL )
+            rc = RC ( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+    }
+    if ( rc != 0 )
+        tlen_hist_finish( self );
+    return rc;
+}
+
+
+void tlen_hist_finish( tlen_hist * self )
+{
+    uint32_t i;
+    for ( i = 0; i < 4; ++i )
+    {
+        free( self->level[ i ] );
+        self->level[ i ] = NULL;
+    }
+    free( self->big );
+    self->big = NULL;
+    self->big_count = self->big_capacity = self->small_count = 0;
+}
+
+
+void tlen_hist_clear( tlen_hist * self )
+{
+    if ( self->small_count > 0 )
+    {
+        uint32_t i;
+        for ( i = 0; i < 4; ++i )
+            memset( self->level[ i ], 0, ( TLEN_HIST_LIMIT >> level_shift[ i ] ) * sizeof self->level[ i ][ 0 ] );
+        self->small_count = 0;
+    }
+    self->big_count = 0;
+}
+
+
+uint32_t tlen_hist_count( const tlen_hist * self )
+{
+    return self->small_count + self->big_count;
+}
+
+
+/* index of the first value in big that is not smaller than value */
+static uint32_t big_lower_bound( const tlen_hist * self, uint32_t value )
+{
+    uint32_t lo = 0, hi = self->big_count;
+    while ( lo < hi )
+    {
+        uint32_t mid = lo + ( ( hi - lo ) >> 1 );
+        if ( self->big[ mid ] < value )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+
+rc_t tlen_hist_insert( tlen_hist * self, uint32_t value )
+{
+    rc_t rc = 0;
+    if ( value < TLEN_HIST_LIMIT )
+    {
+        ++self->level[ 0 ][ value >> 12 ];
+        ++self->level[ 1 ][ value >> 8 ];
+        ++self->level[ 2 ][ value >> 4 ];
+        ++self->level[ 3 ][ value ];
+        ++self->small_count;
+    }
+    else
+    {
+        if ( self->big_count == self->big_capacity )
+        {
+            uint32_t new_capacity = ( self->big_capacity == 0 ) ? 64 : self->big_capacity * 2;
+            uint32_t * tmp = realloc( self->big, new_capacity * sizeof tmp[ 0 ] );
+            if ( tmp == NULL )
+                rc = RC ( rcApp, rcNoTarg, rcInserting, rcMemory, rcExhausted );
+            else
+            {
+                self->big = tmp;
+                self->big_capacity = new_capacity;
+            }
+        }
+        if ( rc == 0 )
+        {
+            uint32_t idx = big_lower_bound( self, value );
+            memmove( &self->big[ idx + 1 ], &self->big[ idx ], ( self->big_count - idx ) * sizeof self->big[ 0 ] );
+            self->big[ idx ] = value;
+            ++self->big_count;
+        }
+    }
+    return rc;
+}
+
+
+/* the value has to be in the set */
+void tlen_hist_remove( tlen_hist * self, uint32_t value )
+{
+    if ( value < TLEN_HIST_LIMIT )
+    {
+        --self->level[ 0 ][ value >> 12 ];
+        --self->level[ 1 ][ value >> 8 ];
+        --self->level[ 2 ][ value >> 4 ];
+        --self->level[ 3 ][ value ];
+        --self->small_count;
+    }
+    else
+    {
+        uint32_t idx = big_lower_bound( self, value );
+        if ( idx < self->big_count && self->big[ idx ] == value )
+        {
+            --self->big_count;
+            memmove( &self->big[ idx ], &self->big[ idx + 1 ], ( self->big_count - idx ) * sizeof self->big[ 0 ] );
+        }
+    }
+}
+
+
+uint32_t tlen_hist_kth( const tlen_hist * self, uint32_t k )
+{
+    if ( k >= self->small_count )
+    {
+        k -= self->small_count;
+        return ( k < self->big_count ) ? self->big[ k ] : 0;
+    }
+    else
+    {
+        /* descend: at every level skip whole buckets until the k-th value is inside one */
+        uint32_t lvl, bucket = 0;
+        for ( lvl = 0; lvl < 4; ++lvl )
+        {
+            const uint32_t * counts = self->level[ lvl ];
+            uint32_t idx = bucket << 4;
+            while ( k >= counts[ idx ] )
+            {
+                k -= counts[ idx ];
+                ++idx;
+            }
+            bucket = idx;
+        }
+        return bucket;
+    }
+}
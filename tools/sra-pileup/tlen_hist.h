@@ -0,0 +1,67 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_tlen_hist_
+#define _h_tlen_hist_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <klib/rc.h>
+
+/* an order-statistic multiset of template-lengths for the sliding window of pileup_stat.c:
+   insert and remove are O(1), the k-th smallest value takes at most 64 steps.
+   values below TLEN_HIST_LIMIT are counted in a 4-level histogram ( 16 buckets per level ),
+   the rare bigger ones are kept exact in a sorted array */
+
+#define TLEN_HIST_LIMIT 0x10000
+
+typedef struct tlen_hist
+{
+    uint32_t * level[ 4 ];  /* 16, 256, 4096 and 65536 counters */
+    uint32_t * big;         /* sorted values >= TLEN_HIST_LIMIT */
+    uint32_t big_count;
+    uint32_t big_capacity;
+    uint32_t small_count;
+} tlen_hist;
+
+rc_t tlen_hist_init( tlen_hist * self );
+void tlen_hist_finish( tlen_hist * self );
+void tlen_hist_clear( tlen_hist * self );
+
+uint32_t tlen_hist_count( const tlen_hist * self );
+rc_t tlen_hist_insert( tlen_hist * self, uint32_t value );
+void tlen_hist_remove( tlen_hist * self, uint32_t value );
+
+/* the value at index k if the values were sorted, k < tlen_hist_count() */
+uint32_t tlen_hist_kth( const tlen_hist * self, uint32_t k );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif